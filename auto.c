@@ -0,0 +1,536 @@
+/*_
+ * Copyright (c) 2015-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#define _AUTO_SAMPLES       65536   /* Rules sampled for the shape */
+#define _AUTO_KEYS          4096    /* Synthetic keys for the trials */
+#define _AUTO_ROUNDS        8       /* Timed passes over the keys */
+#define _AUTO_SL_MAX        64      /* Largest ruleset tried on the list */
+#define _AUTO_WILDCARD      0.5     /* Wildcard density for narrow strides */
+#define _AUTO_CANDIDATES    8
+#define _AUTO_REPORT_SIZE   4096
+
+#define _NWORDS     (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+
+/*
+ * Shape of the ruleset
+ */
+struct _shape {
+    size_t nr;
+    size_t nsample;
+    /* Number of the bits that are not constant over the sampled rules */
+    int keybits;
+    /* Ratio of the wildcard bits in the non-constant bit positions */
+    double wildcard;
+    /* Priority distribution of the sampled rules */
+    int pmin;
+    int pmax;
+    size_t distinct;
+};
+
+/*
+ * Configuration tried at commit
+ */
+struct _candidate {
+    enum palmtrie_type type;
+    int stride;
+    size_t memory;
+    double ns;
+    int status;
+#define _CAND_OK            0
+#define _CAND_FAILED        1
+#define _CAND_OVER_BUDGET   2
+};
+
+static volatile u64 _sink;
+
+/*
+ * xorshift64 for the synthetic keys
+ */
+static __inline__ u64
+_rand(u64 *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+
+    return *s;
+}
+
+/*
+ * Compare priorities for qsort
+ */
+static int
+_cmp_int(const void *a, const void *b)
+{
+    int x;
+    int y;
+
+    x = *(const int *)a;
+    y = *(const int *)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*
+ * Append a formatted line to the report
+ */
+static void
+_report(char *buf, size_t *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if ( *len >= _AUTO_REPORT_SIZE ) {
+        return;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, _AUTO_REPORT_SIZE - *len, fmt, ap);
+    va_end(ap);
+    if ( n > 0 ) {
+        *len += n;
+    }
+}
+
+/*
+ * Name of the engine
+ */
+static const char *
+_name(enum palmtrie_type type)
+{
+    switch ( type ) {
+    case PALMTRIE_SORTED_LIST:
+        return "sl";
+    case PALMTRIE_BASIC:
+        return "tpt";
+    case PALMTRIE_DEFAULT:
+        return "mtpt";
+    case PALMTRIE_PLUS:
+        return "popmtpt";
+    case PALMTRIE_PARTITION:
+        return "part";
+    default:
+        return "unknown";
+    }
+}
+
+/*
+ * Label of the candidate with the stride of the multiway tries
+ */
+static const char *
+_label(const struct _candidate *c, char *buf, size_t size)
+{
+    if ( PALMTRIE_STRIDE_VARIABLE == c->stride ) {
+        snprintf(buf, size, "%s/var", _name(c->type));
+    } else if ( PALMTRIE_SORTED_LIST != c->type
+                && PALMTRIE_BASIC != c->type ) {
+        snprintf(buf, size, "%s/%d", _name(c->type), c->stride);
+    } else {
+        snprintf(buf, size, "%s", _name(c->type));
+    }
+
+    return buf;
+}
+
+/*
+ * Sample the wildcard density per bit position and the priority distribution
+ * of the ruleset
+ */
+static int
+_sample(struct palmtrie_auto *au, struct _shape *shape)
+{
+    size_t wild[_NWORDS * 64];
+    size_t ones[_NWORDS * 64];
+    size_t step;
+    size_t i;
+    size_t n;
+    size_t sum;
+    int *prio;
+    int b;
+
+    memset(shape, 0, sizeof(struct _shape));
+    shape->nr = au->nr;
+    if ( 0 == au->nr ) {
+        return 0;
+    }
+    step = (au->nr + _AUTO_SAMPLES - 1) / _AUTO_SAMPLES;
+    prio = malloc(sizeof(int) * (au->nr / step + 1));
+    if ( NULL == prio ) {
+        return -1;
+    }
+
+    memset(wild, 0, sizeof(wild));
+    memset(ones, 0, sizeof(ones));
+    n = 0;
+    for ( i = 0; i < au->nr; i += step ) {
+        for ( b = 0; b < _NWORDS * 64; b++ ) {
+            if ( EXTRACT(au->rules[i].mask, b) ) {
+                wild[b]++;
+            } else {
+                ones[b] += EXTRACT(au->rules[i].addr, b);
+            }
+        }
+        prio[n++] = au->rules[i].priority;
+    }
+    shape->nsample = n;
+
+    /* Wildcard density in the bits that are neither wildcard nor the same
+       value in all the rules, e.g., excluding the padding of short keys */
+    sum = 0;
+    for ( b = 0; b < _NWORDS * 64; b++ ) {
+        if ( wild[b] == n
+             || (0 == wild[b] && (0 == ones[b] || n == ones[b])) ) {
+            continue;
+        }
+        shape->keybits++;
+        sum += wild[b];
+    }
+    if ( shape->keybits > 0 ) {
+        shape->wildcard = (double)sum / ((double)shape->keybits * n);
+    }
+
+    /* Priority distribution */
+    qsort(prio, n, sizeof(int), _cmp_int);
+    shape->pmin = prio[0];
+    shape->pmax = prio[n - 1];
+    shape->distinct = 1;
+    for ( i = 1; i < n; i++ ) {
+        if ( prio[i] != prio[i - 1] ) {
+            shape->distinct++;
+        }
+    }
+    free(prio);
+
+    return 0;
+}
+
+/*
+ * Generate the synthetic keys by filling the wildcard bits of random rules
+ */
+static addr_t *
+_keys(struct palmtrie_auto *au, size_t n)
+{
+    addr_t *keys;
+    struct palmtrie_rule *r;
+    u64 s;
+    size_t i;
+    int j;
+
+    keys = calloc(n, sizeof(addr_t));
+    if ( NULL == keys ) {
+        return NULL;
+    }
+    if ( 0 == au->nr ) {
+        return keys;
+    }
+    s = 88172645463325252ULL;
+    for ( i = 0; i < n; i++ ) {
+        r = &au->rules[_rand(&s) % au->nr];
+        for ( j = 0; j < _NWORDS; j++ ) {
+            keys[i].a[j] = (r->addr.a[j] & ~r->mask.a[j])
+                | (_rand(&s) & r->mask.a[j]);
+        }
+    }
+
+    return keys;
+}
+
+/*
+ * Build a candidate from the rules
+ */
+static struct palmtrie *
+_build(struct palmtrie_auto *au, struct _candidate *c)
+{
+    struct palmtrie *palmtrie;
+    size_t i;
+    int ret;
+
+    palmtrie = palmtrie_init(NULL, c->type, c->stride);
+    if ( NULL == palmtrie ) {
+        return NULL;
+    }
+    for ( i = 0; i < au->nr; i++ ) {
+        ret = palmtrie_add_data(palmtrie, au->rules[i].addr,
+                                au->rules[i].mask, au->rules[i].priority,
+                                au->rules[i].data);
+        if ( ret < 0 ) {
+            palmtrie_release(palmtrie);
+            return NULL;
+        }
+    }
+    if ( palmtrie_commit(palmtrie) < 0 ) {
+        palmtrie_release(palmtrie);
+        return NULL;
+    }
+    c->memory = palmtrie_memory(palmtrie);
+
+    return palmtrie;
+}
+
+/*
+ * Measure the lookup time in nanoseconds per lookup; the best of the rounds
+ */
+static double
+_measure(struct palmtrie *palmtrie, const addr_t *keys, size_t n)
+{
+    struct timespec t0;
+    struct timespec t1;
+    double best;
+    double t;
+    u64 x;
+    size_t i;
+    int r;
+
+    /* Warm up the caches */
+    x = 0;
+    for ( i = 0; i < n; i++ ) {
+        x ^= palmtrie_lookup(palmtrie, keys[i]);
+    }
+
+    best = -1;
+    for ( r = 0; r < _AUTO_ROUNDS; r++ ) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for ( i = 0; i < n; i++ ) {
+            x ^= palmtrie_lookup(palmtrie, keys[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        t = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / n;
+        if ( best < 0 || t < best ) {
+            best = t;
+        }
+    }
+    _sink = x;
+
+    return best;
+}
+
+/*
+ * Set the memory budget in bytes of the engine selected at commit; 0 for
+ * unlimited
+ */
+int
+palmtrie_auto_set_budget(struct palmtrie *palmtrie, size_t budget)
+{
+    if ( PALMTRIE_AUTO != palmtrie->type ) {
+        return -1;
+    }
+    palmtrie->u.au.budget = budget;
+
+    return 0;
+}
+
+/*
+ * Report of the last selection, or NULL if not committed
+ */
+const char *
+palmtrie_auto_report(struct palmtrie *palmtrie)
+{
+    if ( PALMTRIE_AUTO != palmtrie->type ) {
+        return NULL;
+    }
+
+    return palmtrie->u.au.report;
+}
+
+/*
+ * Add an entry; the engine is built at commit
+ */
+int
+palmtrie_auto_add(struct palmtrie_auto *au, addr_t addr, addr_t mask,
+                  int priority, u64 data)
+{
+    struct palmtrie_rule *rules;
+    size_t size;
+
+    if ( au->nr >= au->size ) {
+        size = au->size ? au->size * 2 : 1024;
+        rules = realloc(au->rules, sizeof(struct palmtrie_rule) * size);
+        if ( NULL == rules ) {
+            return -1;
+        }
+        au->rules = rules;
+        au->size = size;
+    }
+    au->rules[au->nr].addr = addr;
+    au->rules[au->nr].mask = mask;
+    au->rules[au->nr].priority = priority;
+    au->rules[au->nr].data = data;
+    au->nr++;
+
+    return 0;
+}
+
+/*
+ * Select the engine by trial compilation of the candidates chosen from the
+ * shape of the ruleset, and keep the fastest one within the memory budget
+ */
+int
+palmtrie_auto_commit(struct palmtrie_auto *au)
+{
+    struct _shape shape;
+    struct _candidate cands[_AUTO_CANDIDATES];
+    struct palmtrie *best;
+    struct palmtrie *palmtrie;
+    addr_t *keys;
+    char *report;
+    char label[32];
+    size_t len;
+    int narrow;
+    int nc;
+    int bi;
+    int i;
+
+    if ( _sample(au, &shape) < 0 ) {
+        return -1;
+    }
+    keys = _keys(au, _AUTO_KEYS);
+    if ( NULL == keys ) {
+        return -1;
+    }
+    report = malloc(_AUTO_REPORT_SIZE);
+    if ( NULL == report ) {
+        free(keys);
+        return -1;
+    }
+    len = 0;
+    report[0] = '\0';
+    _report(report, &len, "rules %zu (sampled %zu), key bits %d, "
+            "wildcard density %.2f, priorities %zu distinct in [%d, %d]\n",
+            shape.nr, shape.nsample, shape.keybits, shape.wildcard,
+            shape.distinct, shape.pmin, shape.pmax);
+
+    /* Candidates: narrow strides for wildcard-heavy keys since the ternary
+       slots of wide strides blow up, and wide strides for dense keys */
+    narrow = shape.wildcard >= _AUTO_WILDCARD;
+    nc = 0;
+    if ( shape.nr <= _AUTO_SL_MAX ) {
+        cands[nc].type = PALMTRIE_SORTED_LIST;
+        cands[nc++].stride = 0;
+    }
+    cands[nc].type = PALMTRIE_BASIC;
+    cands[nc++].stride = 0;
+    cands[nc].type = PALMTRIE_PLUS;
+    cands[nc++].stride = narrow ? 4 : 7;
+    cands[nc].type = PALMTRIE_PLUS;
+    cands[nc++].stride = narrow ? 6 : 8;
+    cands[nc].type = PALMTRIE_PLUS;
+    cands[nc++].stride = PALMTRIE_STRIDE_VARIABLE;
+    cands[nc].type = PALMTRIE_PARTITION;
+    cands[nc++].stride = narrow ? 6 : 8;
+    cands[nc].type = PALMTRIE_DEFAULT;
+    cands[nc++].stride = narrow ? 4 : 8;
+    _report(report, &len, "%s keys: trying %s strides\n",
+            narrow ? "wildcard-heavy" : "dense", narrow ? "narrow" : "wide");
+
+    /* Trial compilation */
+    best = NULL;
+    bi = -1;
+    for ( i = 0; i < nc; i++ ) {
+        cands[i].memory = 0;
+        cands[i].ns = 0;
+        palmtrie = _build(au, &cands[i]);
+        if ( NULL == palmtrie ) {
+            cands[i].status = _CAND_FAILED;
+            _report(report, &len, "candidate %s: build failed\n",
+                    _label(&cands[i], label, sizeof(label)));
+            continue;
+        }
+        if ( au->budget && cands[i].memory > au->budget ) {
+            cands[i].status = _CAND_OVER_BUDGET;
+            palmtrie_release(palmtrie);
+            _report(report, &len, "candidate %s: %zu bytes, over budget\n",
+                    _label(&cands[i], label, sizeof(label)), cands[i].memory);
+            continue;
+        }
+        cands[i].status = _CAND_OK;
+        cands[i].ns = _measure(palmtrie, keys, _AUTO_KEYS);
+        _report(report, &len, "candidate %s: %zu bytes, %.1f ns/lookup\n",
+                _label(&cands[i], label, sizeof(label)), cands[i].memory,
+                cands[i].ns);
+        if ( NULL == best || cands[i].ns < cands[bi].ns ) {
+            if ( NULL != best ) {
+                palmtrie_release(best);
+            }
+            best = palmtrie;
+            bi = i;
+        } else {
+            palmtrie_release(palmtrie);
+        }
+    }
+    free(keys);
+
+    if ( NULL != best ) {
+        _report(report, &len, "chose %s: fastest within the budget",
+                _label(&cands[bi], label, sizeof(label)));
+        if ( au->budget ) {
+            _report(report, &len, " of %zu bytes\n", au->budget);
+        } else {
+            _report(report, &len, " (unlimited)\n");
+        }
+    } else {
+        /* Nothing fits in the budget; fall back to the smallest one */
+        for ( i = 0; i < nc; i++ ) {
+            if ( _CAND_OVER_BUDGET == cands[i].status
+                 && (bi < 0 || cands[i].memory < cands[bi].memory) ) {
+                bi = i;
+            }
+        }
+        if ( bi >= 0 ) {
+            best = _build(au, &cands[bi]);
+        }
+        if ( NULL == best ) {
+            free(report);
+            return -1;
+        }
+        _report(report, &len, "chose %s: smallest, no candidate within "
+                "the budget of %zu bytes\n",
+                _label(&cands[bi], label, sizeof(label)), au->budget);
+    }
+
+    /* Replace the engine */
+    if ( NULL != au->engine ) {
+        palmtrie_release(au->engine);
+    }
+    au->engine = best;
+    free(au->report);
+    au->report = report;
+
+    return 0;
+}
+
+/*
+ * Release the instance
+ */
+int
+palmtrie_auto_release(struct palmtrie_auto *au)
+{
+    if ( NULL != au->engine ) {
+        palmtrie_release(au->engine);
+        au->engine = NULL;
+    }
+    free(au->rules);
+    au->rules = NULL;
+    au->nr = 0;
+    au->size = 0;
+    free(au->report);
+    au->report = NULL;
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,169 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+#define _MAX_WAYS       16
+#define _INVALID        (~0ULL)
+
+/*
+ * Hash of the key
+ */
+static __inline__ size_t
+_hash(const addr_t *addr)
+{
+    u64 h;
+    int i;
+
+    h = 0;
+    for ( i = 0; i < _NWORDS; i++ ) {
+        h = (h ^ addr->a[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (size_t)h;
+}
+
+/*
+ * Choose the way to be replaced in the set
+ */
+static __inline__ int
+_victim(struct palmtrie_cache *c, struct palmtrie_cache_entry *set, u64 gen)
+{
+    int victim;
+    int i;
+
+    /* A stale or empty entry first */
+    for ( i = 0; i < c->ways; i++ ) {
+        if ( set[i].generation != gen ) {
+            return i;
+        }
+    }
+
+    switch ( c->victim ) {
+    case PALMTRIE_CACHE_RANDOM:
+        /* xorshift64 */
+        c->rng ^= c->rng << 13;
+        c->rng ^= c->rng >> 7;
+        c->rng ^= c->rng << 17;
+        return c->rng % c->ways;
+    default:
+        /* The oldest stamp; the access time for LRU and the insertion time
+           for FIFO */
+        victim = 0;
+        for ( i = 1; i < c->ways; i++ ) {
+            if ( (int32_t)(set[i].stamp - set[victim].stamp) < 0 ) {
+                victim = i;
+            }
+        }
+        return victim;
+    }
+}
+
+/*
+ * Initialize a cache of the palmtrie with the number of entries rounded up to
+ * a power of two sets of the ways.  The cache is used by a single thread.
+ */
+int
+palmtrie_cache_init(struct palmtrie_cache *c, struct palmtrie *palmtrie,
+                    size_t entries, int ways, enum palmtrie_cache_victim victim)
+{
+    size_t nsets;
+    size_t i;
+
+    if ( ways <= 0 || ways > _MAX_WAYS ) {
+        return -1;
+    }
+    switch ( victim ) {
+    case PALMTRIE_CACHE_LRU:
+    case PALMTRIE_CACHE_FIFO:
+    case PALMTRIE_CACHE_RANDOM:
+        break;
+    default:
+        return -1;
+    }
+    nsets = 1;
+    while ( nsets * ways < entries ) {
+        nsets <<= 1;
+    }
+
+    memset(c, 0, sizeof(struct palmtrie_cache));
+    c->entries = aligned_alloc(64, ((sizeof(struct palmtrie_cache_entry)
+                                     * nsets * ways + 63) & ~63ULL));
+    if ( NULL == c->entries ) {
+        return -1;
+    }
+    for ( i = 0; i < nsets * ways; i++ ) {
+        c->entries[i].generation = _INVALID;
+        c->entries[i].stamp = 0;
+    }
+    c->palmtrie = palmtrie;
+    c->nsets = nsets;
+    c->ways = ways;
+    c->victim = victim;
+    c->rng = 88172645463325252ULL;
+
+    return 0;
+}
+
+/*
+ * Lookup the address through the cache
+ */
+u64
+palmtrie_cache_lookup(struct palmtrie_cache *c, addr_t addr)
+{
+    struct palmtrie_cache_entry *set;
+    u64 data;
+    u64 gen;
+    int i;
+
+    gen = __atomic_load_n(&c->palmtrie->generation, __ATOMIC_ACQUIRE);
+    set = &c->entries[(_hash(&addr) & (c->nsets - 1)) * c->ways];
+    for ( i = 0; i < c->ways; i++ ) {
+        if ( set[i].generation == gen && ADDR_CMP(set[i].addr, addr) ) {
+            c->hits++;
+            if ( PALMTRIE_CACHE_LRU == c->victim ) {
+                set[i].stamp = ++c->clock;
+            }
+            return set[i].data;
+        }
+    }
+
+    /* Miss */
+    c->misses++;
+    data = palmtrie_lookup(c->palmtrie, addr);
+    i = _victim(c, set, gen);
+    set[i].addr = addr;
+    set[i].data = data;
+    set[i].generation = gen;
+    set[i].stamp = ++c->clock;
+
+    return data;
+}
+
+/*
+ * Release the cache
+ */
+void
+palmtrie_cache_release(struct palmtrie_cache *c)
+{
+    free(c->entries);
+    c->entries = NULL;
+    c->nsets = 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,355 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+
+/*
+ * Rule in the order of the lookup, with the number of the wildcard bits and
+ * the highest key word to filter the rules compared
+ */
+struct _order {
+    int priority;
+    int wildcards;
+    int shared;                 /* Whether another rule has the same data */
+    size_t rule;
+    u64 data;
+    u64 addr;
+    u64 mask;
+};
+
+/*
+ * Compare the rules by the data for qsort
+ */
+static int
+_cmp_data(const void *a, const void *b)
+{
+    const struct _order *x;
+    const struct _order *y;
+
+    x = (const struct _order *)a;
+    y = (const struct _order *)b;
+
+    return x->data < y->data ? -1 : (x->data > y->data ? 1 : 0);
+}
+
+/*
+ * Compare the rules in the descending order of the priority, and then in the
+ * order of the addition for qsort
+ */
+static int
+_cmp_priority(const void *a, const void *b)
+{
+    const struct _order *x;
+    const struct _order *y;
+
+    x = (const struct _order *)a;
+    y = (const struct _order *)b;
+
+    if ( x->priority != y->priority ) {
+        return x->priority > y->priority ? -1 : 1;
+    }
+
+    return x->rule < y->rule ? -1 : (x->rule > y->rule ? 1 : 0);
+}
+
+/*
+ * Whether every key matching the rule x matches the rule y
+ */
+static __inline__ int
+_covers(const struct palmtrie_rule *y, const struct palmtrie_rule *x, int nw)
+{
+    int i;
+
+    for ( i = 0; i < nw; i++ ) {
+        if ( (x->mask.a[i] & ~y->mask.a[i])
+             || ((x->addr.a[i] ^ y->addr.a[i]) & ~y->mask.a[i]) ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Whether a key matches both the rules
+ */
+static __inline__ int
+_overlaps(const addr_t *addr0, const addr_t *mask0, const addr_t *addr1,
+          const addr_t *mask1, int nw)
+{
+    int i;
+
+    for ( i = 0; i < nw; i++ ) {
+        if ( (addr0->a[i] ^ addr1->a[i]) & ~mask0->a[i] & ~mask1->a[i] ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Whether a range rule of the priority from lo to hi and a different data
+ * overlaps the rule, taking the key of its group for the ranges
+ */
+static int
+_range_conflict(const struct palmtrie_ranges *rt,
+                const struct palmtrie_rule *x, int lo, int hi)
+{
+    const struct palmtrie_range_group *g;
+    const struct palmtrie_range_rule *r;
+    size_t i;
+    size_t j;
+
+    for ( i = 0; i < rt->nr; i++ ) {
+        g = rt->groups[i];
+        if ( g->max_priority < lo
+             || !_overlaps(&g->addr, &g->mask, &x->addr, &x->mask,
+                           _NWORDS) ) {
+            continue;
+        }
+        for ( j = 0; j < g->nr; j++ ) {
+            r = &g->rules[j];
+            if ( r->priority >= lo && r->priority <= hi
+                 && (u64)r->data != x->data ) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Enable or disable the redundancy elimination of Palmtrie+ before adding
+ * any entry
+ */
+int
+palmtrie_set_eliminate(struct palmtrie *palmtrie, int enabled)
+{
+    if ( PALMTRIE_PLUS != palmtrie->type ) {
+        return -1;
+    }
+    if ( palmtrie->eliminate.nr || palmtrie->exact.rules.nr
+         || palmtrie->exact.others ) {
+        /* Entries have been added */
+        return -1;
+    }
+    palmtrie->eliminate.enabled = enabled ? 1 : 0;
+
+    return 0;
+}
+
+/*
+ * Rules left out of the trie at the last commit
+ */
+const struct palmtrie_eliminated *
+palmtrie_eliminated(struct palmtrie *palmtrie, size_t *nr)
+{
+    if ( PALMTRIE_PLUS != palmtrie->type ) {
+        *nr = 0;
+        return NULL;
+    }
+    *nr = palmtrie->eliminate.nreport;
+
+    return palmtrie->eliminate.report;
+}
+
+/*
+ * Add an entry; the entry is added to the trie at commit unless eliminated
+ */
+int
+palmtrie_eliminate_add(struct palmtrie_eliminate *el, addr_t addr,
+                       addr_t mask, int priority, u64 data)
+{
+    struct palmtrie_rule *rules;
+    uint8_t *states;
+    size_t size;
+
+    if ( el->nr >= el->size ) {
+        size = el->size ? el->size * 2 : 1024;
+        rules = realloc(el->rules, sizeof(struct palmtrie_rule) * size);
+        if ( NULL == rules ) {
+            return -1;
+        }
+        el->rules = rules;
+        states = realloc(el->states, sizeof(uint8_t) * size);
+        if ( NULL == states ) {
+            return -1;
+        }
+        el->states = states;
+        el->size = size;
+    }
+    el->rules[el->nr].addr = addr;
+    el->rules[el->nr].mask = mask;
+    el->rules[el->nr].priority = priority;
+    el->rules[el->nr].data = data;
+    el->states[el->nr] = PALMTRIE_ELIMINATE_KEPT;
+    el->nr++;
+
+    return 0;
+}
+
+/*
+ * Decide the rules to be left out of the trie.  The rules are examined in
+ * the order of the lookup against the rules kept so far, hence each rule
+ * left out does not change the result of any lookup, even when the covering
+ * rule is also a candidate.  A rule already in the trie is always kept.  The
+ * examination is quadratic in the number of the rules.
+ */
+int
+palmtrie_eliminate_commit(struct palmtrie_eliminate *el,
+                          const struct palmtrie_ranges *rt)
+{
+    struct palmtrie_eliminated *report;
+    struct palmtrie_rule *x;
+    struct palmtrie_rule *y;
+    struct _order *order;
+    size_t i;
+    size_t j;
+    size_t k;
+    int nw;
+    int w;
+
+    free(el->report);
+    el->report = NULL;
+    el->nreport = 0;
+    if ( 0 == el->nr ) {
+        return 0;
+    }
+    order = malloc(sizeof(struct _order) * el->nr);
+    if ( NULL == order ) {
+        return -1;
+    }
+    report = malloc(sizeof(struct palmtrie_eliminated) * el->nr);
+    if ( NULL == report ) {
+        free(order);
+        return -1;
+    }
+
+    /* The words beyond the highest one set in the rules are equal */
+    nw = 1;
+    for ( i = 0; i < el->nr; i++ ) {
+        for ( w = _NWORDS - 1; w >= nw; w-- ) {
+            if ( el->rules[i].addr.a[w] | el->rules[i].mask.a[w] ) {
+                nw = w + 1;
+                break;
+            }
+        }
+        if ( PALMTRIE_ELIMINATE_ADDED != el->states[i] ) {
+            el->states[i] = PALMTRIE_ELIMINATE_KEPT;
+        }
+    }
+    for ( i = 0; i < el->nr; i++ ) {
+        x = &el->rules[i];
+        order[i].priority = x->priority;
+        order[i].wildcards = 0;
+        for ( w = 0; w < nw; w++ ) {
+            order[i].wildcards += __builtin_popcountll(x->mask.a[w]);
+        }
+        order[i].rule = i;
+        order[i].data = x->data;
+        order[i].addr = x->addr.a[nw - 1];
+        order[i].mask = x->mask.a[nw - 1];
+    }
+    /* A rule of a unique data cannot be redundant */
+    qsort(order, el->nr, sizeof(struct _order), _cmp_data);
+    for ( i = 0; i < el->nr; i++ ) {
+        order[i].shared = (i > 0 && order[i - 1].data == order[i].data)
+            || (i + 1 < el->nr && order[i + 1].data == order[i].data);
+    }
+    qsort(order, el->nr, sizeof(struct _order), _cmp_priority);
+
+    for ( i = 0; i < el->nr; i++ ) {
+        x = &el->rules[order[i].rule];
+        if ( PALMTRIE_ELIMINATE_ADDED == el->states[order[i].rule] ) {
+            continue;
+        }
+
+        /* Shadowed by a rule of a higher priority */
+        for ( j = 0; j < i && order[j].priority > x->priority; j++ ) {
+            if ( order[j].wildcards < order[i].wildcards
+                 || (order[i].mask & ~order[j].mask)
+                 || ((order[i].addr ^ order[j].addr) & ~order[j].mask) ) {
+                continue;
+            }
+            y = &el->rules[order[j].rule];
+            if ( PALMTRIE_ELIMINATE_OUT != el->states[order[j].rule]
+                 && _covers(y, x, nw) ) {
+                break;
+            }
+        }
+        if ( j < i && order[j].priority > x->priority ) {
+            el->states[order[i].rule] = PALMTRIE_ELIMINATE_OUT;
+            report[el->nreport].rule = order[i].rule;
+            report[el->nreport].by = order[j].rule;
+            report[el->nreport].reason = PALMTRIE_SHADOWED;
+            el->nreport++;
+            continue;
+        }
+
+        /* Covered by a rule of a lower priority and the same data before any
+           overlapping rule of a different data */
+        if ( !order[i].shared ) {
+            continue;
+        }
+        for ( j = i + 1; j < el->nr; j++ ) {
+            if ( (order[i].addr ^ order[j].addr)
+                 & ~order[i].mask & ~order[j].mask ) {
+                continue;
+            }
+            k = order[j].rule;
+            y = &el->rules[k];
+            if ( PALMTRIE_ELIMINATE_OUT == el->states[k]
+                 || !_overlaps(&x->addr, &x->mask, &y->addr, &y->mask,
+                               nw) ) {
+                continue;
+            }
+            if ( y->data != x->data ) {
+                /* Conflict */
+                break;
+            }
+            if ( y->priority < x->priority && _covers(y, x, nw) ) {
+                if ( !_range_conflict(rt, x, y->priority, x->priority) ) {
+                    el->states[order[i].rule] = PALMTRIE_ELIMINATE_OUT;
+                    report[el->nreport].rule = order[i].rule;
+                    report[el->nreport].by = k;
+                    report[el->nreport].reason = PALMTRIE_REDUNDANT;
+                    el->nreport++;
+                }
+                break;
+            }
+        }
+    }
+    free(order);
+    el->report = report;
+
+    return 0;
+}
+
+/*
+ * Release the rules
+ */
+void
+palmtrie_eliminate_release(struct palmtrie_eliminate *el)
+{
+    free(el->rules);
+    free(el->states);
+    free(el->report);
+    memset(el, 0, sizeof(struct palmtrie_eliminate));
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,319 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+#define _MAX_WILDCARDS  16
+
+/*
+ * Hash of the key words under the wildcard up to the highest word set in the
+ * entries
+ */
+static __inline__ size_t
+_hash(const struct palmtrie_exact *e, const addr_t *addr)
+{
+    u64 h;
+    int i;
+
+    h = 0;
+    for ( i = 0; i < e->nwords; i++ ) {
+        h = (h ^ (addr->a[i] & ~e->wildcard.a[i])) * 0x9e3779b97f4a7c15ULL;
+    }
+    /* Finalize to spread the high bits to the low bits of the index, as the
+       low bits of the keys are often zero under the wildcard */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (size_t)h;
+}
+
+/*
+ * Insert an entry to the table, keeping the highest priority for the same key
+ */
+static void
+_insert(struct palmtrie_exact *e, const struct palmtrie_rule *r)
+{
+    struct palmtrie_exact_entry *ent;
+    addr_t key;
+    size_t i;
+
+    key = r->addr;
+    ADDR_MASK(key, e->wildcard);
+    i = _hash(e, &key) & (e->size - 1);
+    for ( ;; ) {
+        ent = &e->table[i];
+        if ( ent->priority < 0 ) {
+            ent->addr = key;
+            ent->priority = r->priority;
+            ent->data = (void *)r->data;
+            e->nr++;
+            return;
+        }
+        if ( ADDR_CMP(ent->addr, key) ) {
+            if ( r->priority > ent->priority ) {
+                ent->priority = r->priority;
+                ent->data = (void *)r->data;
+            }
+            return;
+        }
+        i = (i + 1) & (e->size - 1);
+    }
+}
+
+/*
+ * Whether an entry of the mask can be split into the table.  The mask must
+ * be the wildcard of the table once chosen, and otherwise have the wildcard
+ * bits only in a contiguous run, i.e., the padding of the key.
+ */
+int
+palmtrie_exact_candidate(struct palmtrie_exact *e, addr_t mask)
+{
+    u64 w;
+    int run;
+    int i;
+
+    if ( e->fixed < 0 ) {
+        return 0;
+    } else if ( e->fixed ) {
+        return ADDR_CMP(mask, e->wildcard);
+    }
+    /* 0: below the run, 1: in the run, 2: above the run */
+    run = 0;
+    for ( i = 0; i < _NWORDS; i++ ) {
+        w = mask.a[i];
+        if ( 0 == run ) {
+            if ( 0 == w ) {
+                continue;
+            }
+            w >>= __builtin_ctzll(w);
+            if ( w & (w + 1) ) {
+                return 0;
+            }
+            run = (mask.a[i] >> 63) ? 1 : 2;
+        } else if ( 1 == run ) {
+            if ( ~0ULL == w ) {
+                continue;
+            }
+            if ( w & (w + 1) ) {
+                return 0;
+            }
+            run = 2;
+        } else if ( 0 != w ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Add a fully specified entry; the table is compiled at commit
+ */
+int
+palmtrie_exact_add(struct palmtrie_exact *e, addr_t addr, addr_t mask,
+                   int priority, void *data)
+{
+    struct palmtrie_rule *ptr;
+    size_t size;
+
+    if ( e->rules.nr >= e->rules.size ) {
+        size = e->rules.size ? e->rules.size * 2 : 1024;
+        ptr = realloc(e->rules.ptr, sizeof(struct palmtrie_rule) * size);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        e->rules.ptr = ptr;
+        e->rules.size = size;
+    }
+    e->rules.ptr[e->rules.nr].addr = addr;
+    e->rules.ptr[e->rules.nr].mask = mask;
+    e->rules.ptr[e->rules.nr].priority = priority;
+    e->rules.ptr[e->rules.nr].data = (u64)data;
+    e->rules.nr++;
+
+    return 0;
+}
+
+/*
+ * Choose the most common wildcard of the entries at the first call, and move
+ * the entries of the other wildcards to the end of the rules.  All the
+ * entries are moved if the most common one is not the majority of all the
+ * entries.  Returns the number of the moved entries, which are to be added
+ * to the trie.
+ */
+size_t
+palmtrie_exact_split(struct palmtrie_exact *e)
+{
+    struct palmtrie_rule tmp;
+    addr_t wildcards[_MAX_WILDCARDS];
+    size_t cnt[_MAX_WILDCARDS];
+    size_t i;
+    size_t n;
+    int nw;
+    int best;
+    int j;
+
+    if ( 0 == e->rules.nr ) {
+        return 0;
+    }
+    if ( !e->fixed ) {
+        nw = 0;
+        for ( i = 0; i < e->rules.nr; i++ ) {
+            for ( j = 0; j < nw; j++ ) {
+                if ( ADDR_CMP(wildcards[j], e->rules.ptr[i].mask) ) {
+                    cnt[j]++;
+                    break;
+                }
+            }
+            if ( j == nw && nw < _MAX_WILDCARDS ) {
+                wildcards[nw] = e->rules.ptr[i].mask;
+                cnt[nw++] = 1;
+            }
+        }
+        best = 0;
+        for ( j = 1; j < nw; j++ ) {
+            if ( cnt[j] > cnt[best] ) {
+                best = j;
+            }
+        }
+        e->wildcard = wildcards[best];
+        e->fixed = 1;
+        if ( cnt[best] * 2 < e->rules.nr + e->others ) {
+            /* Not worth probing */
+            e->fixed = -1;
+        }
+    }
+
+    /* Partition */
+    n = 0;
+    for ( i = 0; i < e->rules.nr; i++ ) {
+        if ( e->fixed > 0
+             && ADDR_CMP(e->rules.ptr[i].mask, e->wildcard) ) {
+            tmp = e->rules.ptr[n];
+            e->rules.ptr[n] = e->rules.ptr[i];
+            e->rules.ptr[i] = tmp;
+            n++;
+        }
+    }
+    i = e->rules.nr - n;
+    e->rules.nr = n;
+    e->others += i;
+
+    return i;
+}
+
+/*
+ * Lookup the entry of the address.  The priority is set to the one of the
+ * entry, or -1 if not found.
+ */
+void *
+palmtrie_exact_lookup(struct palmtrie_exact *e, const addr_t *addr,
+                      int *priority)
+{
+    struct palmtrie_exact_entry *ent;
+    size_t i;
+
+    *priority = -1;
+    if ( 0 == e->nr ) {
+        return NULL;
+    }
+    i = _hash(e, addr) & (e->size - 1);
+    for ( ;; ) {
+        ent = &e->table[i];
+        if ( ent->priority < 0 ) {
+            return NULL;
+        }
+        if ( ADDR_MASK_CMP2(*addr, e->wildcard, ent->addr) ) {
+            *priority = ent->priority;
+            return ent->data;
+        }
+        i = (i + 1) & (e->size - 1);
+    }
+}
+
+/*
+ * Compile the table at the load factor of 1/2 or less
+ */
+int
+palmtrie_exact_commit(struct palmtrie_exact *e)
+{
+    struct palmtrie_exact_entry *table;
+    size_t size;
+    size_t i;
+    int j;
+
+    free(e->table);
+    e->table = NULL;
+    e->size = 0;
+    e->nr = 0;
+    e->nwords = 0;
+    if ( 0 == e->rules.nr ) {
+        return 0;
+    }
+
+    /* The words above are zero in all the keys of the table, which are
+       still compared but not hashed */
+    for ( i = 0; i < e->rules.nr; i++ ) {
+        for ( j = _NWORDS - 1; j >= e->nwords; j-- ) {
+            if ( e->rules.ptr[i].addr.a[j] & ~e->wildcard.a[j] ) {
+                e->nwords = j + 1;
+                break;
+            }
+        }
+    }
+
+    size = 16;
+    while ( size < e->rules.nr * 2 ) {
+        size <<= 1;
+    }
+    table = malloc(sizeof(struct palmtrie_exact_entry) * size);
+    if ( NULL == table ) {
+        return -1;
+    }
+    for ( i = 0; i < size; i++ ) {
+        table[i].priority = -1;
+    }
+    e->table = table;
+    e->size = size;
+    for ( i = 0; i < e->rules.nr; i++ ) {
+        _insert(e, &e->rules.ptr[i]);
+    }
+
+    return 0;
+}
+
+/*
+ * Release the table and the entries
+ */
+void
+palmtrie_exact_release(struct palmtrie_exact *e)
+{
+    free(e->table);
+    free(e->rules.ptr);
+    memset(e, 0, sizeof(struct palmtrie_exact));
+}
+
+/*
+ * Memory size of the table and the entries in bytes
+ */
+size_t
+palmtrie_exact_memory(struct palmtrie_exact *e)
+{
+    return sizeof(struct palmtrie_rule) * e->rules.nr
+        + sizeof(struct palmtrie_exact_entry) * e->size;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,147 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Compare the fields by the position in the key for qsort
+ */
+static int
+_cmp_pos(const void *a, const void *b)
+{
+    const struct palmtrie_field *x;
+    const struct palmtrie_field *y;
+
+    x = (const struct palmtrie_field *)a;
+    y = (const struct palmtrie_field *)b;
+
+    return x->pos - y->pos;
+}
+
+/*
+ * Compile the fields of the packet header into the descriptor; the fields
+ * contiguous both in the header and the key are merged into a run of bytes
+ * copied at once
+ */
+int
+palmtrie_fields_compile(struct palmtrie_fields *desc,
+                        const struct palmtrie_field *fields, int n)
+{
+    struct palmtrie_field sorted[PALMTRIE_FIELDS_MAX];
+    struct palmtrie_field *f;
+    int i;
+    int nr;
+
+    if ( n < 0 || n > PALMTRIE_FIELDS_MAX ) {
+        return -1;
+    }
+    memcpy(sorted, fields, sizeof(struct palmtrie_field) * n);
+    qsort(sorted, n, sizeof(struct palmtrie_field), _cmp_pos);
+
+    desc->len = 0;
+    nr = 0;
+    for ( i = 0; i < n; i++ ) {
+        f = &sorted[i];
+        if ( f->offset < 0 || f->len <= 0 || f->pos < 0
+             || f->pos + f->len > (int)sizeof(((addr_t *)0)->a) ) {
+            return -1;
+        }
+        if ( i > 0 && f->pos < sorted[i - 1].pos + sorted[i - 1].len ) {
+            /* Overlapping in the key */
+            return -1;
+        }
+        if ( (size_t)(f->offset + f->len) > desc->len ) {
+            desc->len = f->offset + f->len;
+        }
+        if ( nr > 0 && !(f->flags & PALMTRIE_FIELD_REVERSE)
+             && !desc->runs[nr - 1].reverse
+             && desc->runs[nr - 1].pos + desc->runs[nr - 1].len == f->pos
+             && desc->runs[nr - 1].offset + desc->runs[nr - 1].len
+             == f->offset ) {
+            /* Contiguous */
+            desc->runs[nr - 1].len += f->len;
+            continue;
+        }
+        desc->runs[nr].offset = f->offset;
+        desc->runs[nr].pos = f->pos;
+        desc->runs[nr].len = f->len;
+        desc->runs[nr].reverse = (f->flags & PALMTRIE_FIELD_REVERSE) ? 1 : 0;
+        nr++;
+    }
+    desc->nr = nr;
+
+    return 0;
+}
+
+/*
+ * Build the key from the packet header of at least desc->len bytes; the bytes
+ * of the key not in any field are zero
+ */
+void
+palmtrie_fields_key(const struct palmtrie_fields *desc, const uint8_t *hdr,
+                    addr_t *key)
+{
+    const uint8_t *s;
+    uint8_t *k;
+    int i;
+    int j;
+
+    memset(key, 0, sizeof(addr_t));
+    k = (uint8_t *)key->a;
+    for ( i = 0; i < desc->nr; i++ ) {
+        s = hdr + desc->runs[i].offset;
+        if ( __builtin_expect(!!desc->runs[i].reverse, 0) ) {
+            for ( j = 0; j < desc->runs[i].len; j++ ) {
+                k[desc->runs[i].pos + j] = s[desc->runs[i].len - 1 - j];
+            }
+            continue;
+        }
+        /* Constant sizes for the common fields to be inlined */
+        switch ( desc->runs[i].len ) {
+        case 1:
+            k[desc->runs[i].pos] = s[0];
+            break;
+        case 2:
+            memcpy(k + desc->runs[i].pos, s, 2);
+            break;
+        case 4:
+            memcpy(k + desc->runs[i].pos, s, 4);
+            break;
+        case 8:
+            memcpy(k + desc->runs[i].pos, s, 8);
+            break;
+        case 16:
+            memcpy(k + desc->runs[i].pos, s, 16);
+            break;
+        default:
+            memcpy(k + desc->runs[i].pos, s, desc->runs[i].len);
+        }
+    }
+}
+
+/*
+ * Lookup the packet header by the key built with the descriptor
+ */
+u64
+palmtrie_lookup_pkt(struct palmtrie *palmtrie,
+                    const struct palmtrie_fields *desc, const uint8_t *hdr)
+{
+    addr_t key;
+
+    palmtrie_fields_key(desc, hdr, &key);
+
+    return palmtrie_lookup_ref(palmtrie, &key);
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
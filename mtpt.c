@@ -3,6 +3,11 @@
  * All rights reserved.
  */
 
+/* Built once for each stride; see Makefile.am */
+#ifndef PALMTRIE_MTPT_STRIDE
+#error "PALMTRIE_MTPT_STRIDE must be defined."
+#endif
+
 #include "palmtrie.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,25 +53,126 @@ _delete_node(struct palmtrie_mtpt_node_data *n)
  * Release the instance
  */
 int
-palmtrie_mtpt_release(struct palmtrie *palmtrie)
+palmtrie_mtpt_release(struct palmtrie_mtpt *mtpt)
 {
-    /* Check the type */
-    if ( PALMTRIE_DEFAULT != palmtrie->type ) {
-        /* Type error */
-        return -1;
-    }
     /* Recursively delete nodes from the root */
-    _delete_node(palmtrie->u.mtpt.root);
+    _delete_node(mtpt->root);
+    mtpt->root = NULL;
 
     return 0;
 }
 
 /*
- * Add a leaf
+ * Recursively count the memory size of the node in a tree
+ */
+static size_t
+_node_memory(struct palmtrie_mtpt_node_data *n)
+{
+    size_t sz;
+    int i;
+
+    if ( NULL == n ) {
+        return 0;
+    }
+
+    sz = sizeof(struct palmtrie_mtpt_node_data);
+    for ( i = 0; i < (1 << PALMTRIE_MTPT_STRIDE); i++ ) {
+        if ( NULL != n->children[i] && n->bit > n->children[i]->bit ) {
+            sz += _node_memory(n->children[i]);
+        }
+    }
+    for ( i = 0; i < (1 << PALMTRIE_MTPT_STRIDE) - 1; i++ ) {
+        if ( NULL != n->ternaries[i] && n->bit > n->ternaries[i]->bit ) {
+            sz += _node_memory(n->ternaries[i]);
+        }
+    }
+
+    return sz;
+}
+
+/*
+ * Memory size of the instance in bytes
+ */
+size_t
+palmtrie_mtpt_memory(struct palmtrie_mtpt *mtpt)
+{
+    return _node_memory(mtpt->root);
+}
+
+/*
+ * Recursively collect the statistics of the node at the depth; a slot of a
+ * higher bit than the node is a reference to a leaf
+ */
+static void
+_node_stats(struct palmtrie_mtpt_node_data *n, int depth,
+            struct palmtrie_stats *stats)
+{
+    struct palmtrie_mtpt_node_data *c;
+    int nodes;
+    int slots;
+    int i;
+
+    stats->rules++;
+    stats->inodes++;
+    nodes = 0;
+    slots = 0;
+    for ( i = 0; i < (2 << PALMTRIE_MTPT_STRIDE) - 1; i++ ) {
+        if ( i < (1 << PALMTRIE_MTPT_STRIDE) ) {
+            c = n->children[i];
+        } else {
+            c = n->ternaries[i - (1 << PALMTRIE_MTPT_STRIDE)];
+        }
+        if ( NULL == c ) {
+            continue;
+        }
+        if ( i < (1 << PALMTRIE_MTPT_STRIDE) ) {
+            stats->children++;
+        } else {
+            stats->ternaries++;
+        }
+        slots++;
+        if ( n->bit > c->bit ) {
+            nodes++;
+            _node_stats(c, depth + 1, stats);
+        } else {
+            stats->leaves++;
+            stats->avg_depth += depth;
+            if ( depth > stats->max_depth ) {
+                stats->max_depth = depth;
+            }
+        }
+    }
+    if ( 0 == nodes && 1 == slots ) {
+        stats->compressible++;
+    }
+}
+
+/*
+ * Statistics of the instance
+ */
+void
+palmtrie_mtpt_stats(struct palmtrie_mtpt *mtpt, struct palmtrie_stats *stats)
+{
+    if ( NULL == mtpt->root ) {
+        return;
+    }
+    _node_stats(mtpt->root, 1, stats);
+    stats->inode_bytes = palmtrie_mtpt_memory(mtpt);
+    if ( stats->leaves > stats->rules ) {
+        stats->duplicates = stats->leaves - stats->rules;
+    }
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
+/*
+ * Add a leaf, or find the entry of the same key if same is not NULL
  */
 static int
 _add_leaf(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
-          int priority, void *data, int cbit)
+          int priority, void *data, int cbit,
+          struct palmtrie_mtpt_node_data **same)
 {
     struct palmtrie_mtpt_node_data *n;
     int i;
@@ -100,6 +206,7 @@ _add_leaf(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
     }
 #endif
     n->data = data;
+    n->rule = 0;
     for ( i = 0; i < (1 << PALMTRIE_MTPT_STRIDE); i++ ) {
         n->children[i] = NULL;
     }
@@ -175,6 +282,10 @@ _add_leaf(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
         if ( bit < -PALMTRIE_MTPT_STRIDE ) {
             /* Same node */
             free(n);
+            if ( NULL != same ) {
+                *same = *node;
+                return 1;
+            }
             printf("xxx %llx %llx/%llx %llx , %llx %llx/%llx %llx %d xxx",
                    (*node)->addr.a[0], (*node)->addr.a[1],
                    (*node)->mask.a[0], (*node)->mask.a[1],
@@ -261,6 +372,7 @@ _add_internal(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
         ? (*node)->max_priority : priority;
 #endif
     n->data = data;
+    n->rule = 0;
     for ( i = 0; i < (1 << PALMTRIE_MTPT_STRIDE); i++ ) {
         n->children[i] = NULL;
     }
@@ -315,7 +427,8 @@ _add_internal(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
  */
 static int
 _add(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
-     int priority, void *data, int cbit)
+     int priority, void *data, int cbit,
+     struct palmtrie_mtpt_node_data **same)
 {
     int bit;
     int b;
@@ -330,7 +443,7 @@ _add(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
     if ( NULL == *node ) {
         /* Reaches at a null node */
         return _add_leaf(node, addr, mask, priority, data,
-                         PALMTRIE_ADDR_BITS - PALMTRIE_MTPT_STRIDE);
+                         PALMTRIE_ADDR_BITS - PALMTRIE_MTPT_STRIDE, same);
     } else {
 #if PALMTRIE_PRIORITY_SKIP
         if ( priority > (*node)->max_priority ) {
@@ -404,13 +517,15 @@ _add(struct palmtrie_mtpt_node_data **node, addr_t addr, addr_t mask,
         }
         if ( NULL == *next ) {
             /* Leaf */
-            return _add_leaf(next, addr, mask, priority, data, nbit);
+            return _add_leaf(next, addr, mask, priority, data, nbit,
+                             same);
         } else if ( (*node)->bit <= (*next)->bit ) {
             /* Backtrack */
-            return _add_leaf(next, addr, mask, priority, data, nbit);
+            return _add_leaf(next, addr, mask, priority, data, nbit,
+                             same);
         } else {
             /* Traverse to a descendent node */
-            return _add(next, addr, mask, priority, data, nbit);
+            return _add(next, addr, mask, priority, data, nbit, same);
         }
     }
 
@@ -421,7 +536,37 @@ palmtrie_mtpt_add(struct palmtrie_mtpt *mtpt, addr_t addr, addr_t mask,
                int priority, void *data)
 {
     return _add(&mtpt->root, addr, mask, priority, data,
-                PALMTRIE_ADDR_BITS - PALMTRIE_MTPT_STRIDE);
+                PALMTRIE_ADDR_BITS - PALMTRIE_MTPT_STRIDE, NULL);
+}
+
+/*
+ * Add an entry, or replace the priority and the data of the entry of the same
+ * key, whose ones are set to the opriority and the odata.  Returns 1 if
+ * replaced, 0 if added, or -1 on failure.
+ */
+int
+palmtrie_mtpt_replace(struct palmtrie_mtpt *mtpt, addr_t addr, addr_t mask,
+                      int priority, void *data, int *opriority, void **odata)
+{
+    struct palmtrie_mtpt_node_data *n;
+    int ret;
+
+    ret = _add(&mtpt->root, addr, mask, priority, data,
+               PALMTRIE_ADDR_BITS - PALMTRIE_MTPT_STRIDE, &n);
+    if ( 1 == ret ) {
+        /* The priorities of the ancestors are raised on the way */
+        *opriority = n->priority;
+        *odata = n->data;
+        n->priority = priority;
+        n->data = data;
+#if PALMTRIE_PRIORITY_SKIP
+        if ( priority > n->max_priority ) {
+            n->max_priority = priority;
+        }
+#endif
+    }
+
+    return ret;
 }
 
 struct cache {
@@ -10,11 +10,37 @@
 #include <string.h>
 
 /*
- * Initialize an instance
+ * Call the function of the multiway trie instance for the stride, which has
+ * been validated in palmtrie_init()
+ */
+#define STRIDE_CALL(stride, func, ...)                  \
+    (4 == (stride) ? func##_s4(__VA_ARGS__)             \
+     : 6 == (stride) ? func##_s6(__VA_ARGS__)           \
+     : 7 == (stride) ? func##_s7(__VA_ARGS__)           \
+     : func##_s8(__VA_ARGS__))
+
+/*
+ * Initialize an instance.  The stride is used by the multiway tries
+ * (PALMTRIE_DEFAULT and PALMTRIE_PLUS), and 0 selects
+ * PALMTRIE_DEFAULT_STRIDE.  PALMTRIE_PLUS also takes PALMTRIE_STRIDE_VARIABLE
+ * to choose the stride of each node at commit.
  */
 struct palmtrie *
-palmtrie_init(struct palmtrie *palmtrie, enum palmtrie_type type)
+palmtrie_init(struct palmtrie *palmtrie, enum palmtrie_type type, int stride)
 {
+    if ( 0 == stride ) {
+        stride = PALMTRIE_DEFAULT_STRIDE;
+    }
+    if ( PALMTRIE_STRIDE_VARIABLE == stride ) {
+        if ( PALMTRIE_PLUS != type && PALMTRIE_PARTITION != type ) {
+            /* Supported only by Palmtrie+ */
+            return NULL;
+        }
+    } else if ( !PALMTRIE_STRIDE_SUPPORTED(stride) ) {
+        /* Unsupported stride */
+        return NULL;
+    }
+
     /* Allocate for the data structure when the argument is not NULL, and then
        clear all the variables */
     if ( NULL == palmtrie ) {
@@ -49,7 +75,30 @@ palmtrie_init(struct palmtrie *palmtrie, enum palmtrie_type type)
         palmtrie->u.popmtpt.nodes.nr = 0;
         palmtrie->u.popmtpt.nodes.used = 0;
         palmtrie->u.popmtpt.nodes.ptr = NULL;
+        memset(&palmtrie->u.popmtpt.rules, 0,
+               sizeof(palmtrie->u.popmtpt.rules));
+        memset(&palmtrie->u.popmtpt.direct, 0,
+               sizeof(palmtrie->u.popmtpt.direct));
         palmtrie->u.popmtpt.mtpt.root = NULL;
+        palmtrie->u.popmtpt.ranges = &palmtrie->ranges;
+        if ( PALMTRIE_STRIDE_VARIABLE == stride ) {
+            /* Compiled from the rules at commit */
+            (void)memset(&palmtrie->u.vpopmtpt, 0,
+                         sizeof(struct palmtrie_vpopmtpt));
+        }
+        break;
+    case PALMTRIE_AUTO:
+        /* Selected at commit */
+        palmtrie->u.au.rules = NULL;
+        palmtrie->u.au.nr = 0;
+        palmtrie->u.au.size = 0;
+        palmtrie->u.au.budget = 0;
+        palmtrie->u.au.engine = NULL;
+        palmtrie->u.au.report = NULL;
+        break;
+    case PALMTRIE_PARTITION:
+        /* Partitioned at commit */
+        (void)memset(&palmtrie->u.pt, 0, sizeof(struct palmtrie_partition));
         break;
     default:
         /* Unsupported type */
@@ -59,6 +108,7 @@ palmtrie_init(struct palmtrie *palmtrie, enum palmtrie_type type)
         return NULL;
     }
     palmtrie->type = type;
+    palmtrie->stride = stride;
 
     return palmtrie;
 }
@@ -80,11 +130,26 @@ palmtrie_release(struct palmtrie *palmtrie)
         ret = palmtrie_tpt_release(palmtrie);
         break;
     case PALMTRIE_DEFAULT:
-        ret = palmtrie_mtpt_release(palmtrie);
+        ret = STRIDE_CALL(palmtrie->stride, palmtrie_mtpt_release,
+                          &palmtrie->u.mtpt);
         break;
     case PALMTRIE_PLUS:
-        //ret = palmtrie_mtpt_release(palmtrie);
-        ret = 0;
+        palmtrie_exact_release(&palmtrie->exact);
+        palmtrie_range_release(&palmtrie->ranges);
+        palmtrie_prefix_release(&palmtrie->prefix);
+        palmtrie_eliminate_release(&palmtrie->eliminate);
+        if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+            ret = palmtrie_vpopmtpt_release(&palmtrie->u.vpopmtpt);
+            break;
+        }
+        ret = STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_release,
+                          &palmtrie->u.popmtpt);
+        break;
+    case PALMTRIE_AUTO:
+        ret = palmtrie_auto_release(&palmtrie->u.au);
+        break;
+    case PALMTRIE_PARTITION:
+        ret = palmtrie_partition_release(&palmtrie->u.pt);
         break;
     default:
         return;
@@ -98,6 +163,63 @@ palmtrie_release(struct palmtrie *palmtrie)
     }
 }
 
+/*
+ * Add an entry to the trie of Palmtrie+.  An entry of the same key as a group
+ * of the range rules is added to the group as a rule of the full ranges,
+ * since the key of the group is in the trie.
+ */
+static int
+_plus_add(struct palmtrie *palmtrie, addr_t addr, addr_t mask, int priority,
+          u64 data)
+{
+    addr_t key;
+
+    if ( palmtrie->ranges.nr ) {
+        key = addr;
+        ADDR_MASK(key, mask);
+        if ( NULL != palmtrie_range_find(&palmtrie->ranges, &key, &mask) ) {
+            return palmtrie_range_add(&palmtrie->ranges, addr, mask, NULL, 0,
+                                      priority, (void *)data);
+        }
+    }
+    if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+        if ( palmtrie_vpopmtpt_add(&palmtrie->u.vpopmtpt, addr, mask,
+                                   priority, (void *)data) < 0 ) {
+            return -1;
+        }
+    } else if ( STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_add,
+                            &palmtrie->u.popmtpt, addr, mask, priority,
+                            (void *)data) < 0 ) {
+        return -1;
+    }
+    /* Also kept for the prefix-only compilation */
+    if ( PALMTRIE_PREFIX_ONLY
+         && palmtrie_prefix_add(&palmtrie->prefix, addr, mask, priority,
+                                (void *)data) < 0 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Add an entry to Palmtrie+, either to the exact-match table or to the trie
+ */
+static int
+_plus_add_data(struct palmtrie *palmtrie, addr_t addr, addr_t mask,
+               int priority, u64 data)
+{
+    if ( PALMTRIE_EXACT_HASH
+         && palmtrie_exact_candidate(&palmtrie->exact, mask) ) {
+        /* Fully specified; split into the hash table at commit */
+        return palmtrie_exact_add(&palmtrie->exact, addr, mask, priority,
+                                  (void *)data);
+    }
+    palmtrie->exact.others++;
+
+    return _plus_add(palmtrie, addr, mask, priority, data);
+}
+
 /*
  * palmtrie_add_data -- add an entry with data for a specified address to the
  * trie
@@ -106,21 +228,195 @@ int
 palmtrie_add_data(struct palmtrie *palmtrie, addr_t addr, addr_t mask,
                   int priority, u64 data)
 {
+    int ret;
+
     switch ( palmtrie->type ) {
     case PALMTRIE_SORTED_LIST:
-        return palmtrie_sl_add(palmtrie, addr, mask, priority, (void *)data);
+        ret = palmtrie_sl_add(palmtrie, addr, mask, priority, (void *)data);
+        break;
     case PALMTRIE_BASIC:
-        return palmtrie_tpt_add(palmtrie, addr, mask, priority, (void *)data);
+        ret = palmtrie_tpt_add(palmtrie, addr, mask, priority, (void *)data);
+        break;
     case PALMTRIE_DEFAULT:
-        return palmtrie_mtpt_add(&palmtrie->u.mtpt, addr, mask, priority,
-                                 (void *)data);
+        ret = STRIDE_CALL(palmtrie->stride, palmtrie_mtpt_add,
+                          &palmtrie->u.mtpt, addr, mask, priority,
+                          (void *)data);
+        break;
     case PALMTRIE_PLUS:
-        return palmtrie_popmtpt_add(&palmtrie->u.popmtpt, addr, mask, priority,
-                                    (void *)data);
+        if ( palmtrie->eliminate.enabled ) {
+            /* Added at commit unless redundant */
+            ret = palmtrie_eliminate_add(&palmtrie->eliminate, addr, mask,
+                                         priority, data);
+            break;
+        }
+        ret = _plus_add_data(palmtrie, addr, mask, priority, data);
+        break;
+    case PALMTRIE_AUTO:
+        ret = palmtrie_auto_add(&palmtrie->u.au, addr, mask, priority, data);
+        break;
+    case PALMTRIE_PARTITION:
+        ret = palmtrie_partition_add(&palmtrie->u.pt, addr, mask, priority,
+                                     data);
+        break;
     default:
         /* Not supported type */
         return -1;
     }
+    if ( 0 == ret ) {
+        /* Invalidate the flow caches */
+        __atomic_add_fetch(&palmtrie->generation, 1, __ATOMIC_RELEASE);
+    }
+
+    return ret;
+}
+
+/*
+ * palmtrie_add_data_ref -- add an entry by the references to the address and
+ * the mask
+ */
+int
+palmtrie_add_data_ref(struct palmtrie *palmtrie, const addr_t *addr,
+                      const addr_t *mask, int priority, u64 data)
+{
+    return palmtrie_add_data(palmtrie, *addr, *mask, priority, data);
+}
+
+/*
+ * Add the entries of the prefixes expanded from the ranges
+ */
+static int
+_add_expanded(struct palmtrie *palmtrie, addr_t addr, addr_t mask,
+              const struct palmtrie_range *ranges, int n, int priority,
+              u64 data)
+{
+    u32 values[PALMTRIE_RANGE_BITS * 2];
+    u32 wildcards[PALMTRIE_RANGE_BITS * 2];
+    int np;
+    int i;
+
+    if ( 0 == n ) {
+        return palmtrie_add_data(palmtrie, addr, mask, priority, data);
+    }
+    np = palmtrie_range_prefixes(&ranges[0], values, wildcards);
+    for ( i = 0; i < np; i++ ) {
+        palmtrie_range_set(&addr, &mask, &ranges[0], values[i], wildcards[i]);
+        if ( _add_expanded(palmtrie, addr, mask, ranges + 1, n - 1, priority,
+                           data) < 0 ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * palmtrie_add_range -- add an entry with data whose fields of the ranges
+ * are in the ranges; the bits of the fields in the address and the mask are
+ * ignored
+ */
+int
+palmtrie_add_range(struct palmtrie *palmtrie, addr_t addr, addr_t mask,
+                   const struct palmtrie_range *ranges, int n, int priority,
+                   u64 data)
+{
+    if ( !palmtrie_range_valid(ranges, n) ) {
+        return -1;
+    }
+    if ( PALMTRIE_RANGE_LEAF && PALMTRIE_PLUS == palmtrie->type
+         && PALMTRIE_STRIDE_VARIABLE != palmtrie->stride ) {
+        /* Checked at the leaf of the group added to the trie at commit */
+        if ( palmtrie_range_add(&palmtrie->ranges, addr, mask, ranges, n,
+                                priority, (void *)data) < 0 ) {
+            return -1;
+        }
+        __atomic_add_fetch(&palmtrie->generation, 1, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    /* The other types search the prefixes */
+    return _add_expanded(palmtrie, addr, mask, ranges, n, priority, data);
+}
+
+/*
+ * Lookup an entry of Palmtrie+ of a higher priority than the specified
+ * priority, and return the specified data if there is no such entry.  The
+ * priority is updated to the one of the returned data.
+ */
+void *
+palmtrie_plus_lookup_above(struct palmtrie *palmtrie, addr_t addr,
+                           int *priority, void *data)
+{
+    return palmtrie_plus_lookup_above_ref(palmtrie, &addr, priority, data,
+                                          NULL);
+}
+
+/*
+ * Lookup an entry of Palmtrie+ by the reference to the address, with the
+ * traversal stack of the context or NULL
+ */
+void *
+palmtrie_plus_lookup_above_ref(struct palmtrie *palmtrie, const addr_t *addr,
+                               int *priority, void *data, void **stack)
+{
+    void *edata;
+    int epriority;
+
+    /* The exact match first to skip the entries of lower priorities in the
+       trie */
+    if ( palmtrie->exact.nr ) {
+        edata = palmtrie_exact_lookup(&palmtrie->exact, addr, &epriority);
+        if ( epriority > *priority ) {
+            *priority = epriority;
+            data = edata;
+        }
+    }
+    if ( PALMTRIE_PREFIX_ONLY && NULL != palmtrie->prefix.direct.ptr ) {
+        return palmtrie_prefix_lookup_above(&palmtrie->prefix, addr,
+                                            priority, data);
+    }
+    if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+        return palmtrie_vpopmtpt_lookup_above_ref(&palmtrie->u.vpopmtpt, addr,
+                                                  priority, data, stack);
+    }
+    return STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_lookup_above_ref,
+                       &palmtrie->u.popmtpt, addr, priority, data, stack);
+}
+
+/*
+ * Lookup by the reference to the address with the traversal stack or NULL;
+ * the types other than Palmtrie+ take the address by value
+ */
+static u64
+_lookup_ref(struct palmtrie *palmtrie, const addr_t *addr, void **stack)
+{
+    int priority;
+
+    switch ( palmtrie->type ) {
+    case PALMTRIE_SORTED_LIST:
+        return (u64)palmtrie_sl_lookup(palmtrie, *addr);
+    case PALMTRIE_BASIC:
+        return (u64)palmtrie_tpt_lookup(palmtrie, *addr);
+    case PALMTRIE_DEFAULT:
+        return (u64)STRIDE_CALL(palmtrie->stride, palmtrie_mtpt_lookup,
+                                palmtrie, *addr);
+    case PALMTRIE_PLUS:
+        priority = -1;
+        return (u64)palmtrie_plus_lookup_above_ref(palmtrie, addr, &priority,
+                                                   NULL, stack);
+    case PALMTRIE_AUTO:
+        if ( NULL == palmtrie->u.au.engine ) {
+            /* Not committed yet */
+            return 0;
+        }
+        return _lookup_ref(palmtrie->u.au.engine, addr, stack);
+    case PALMTRIE_PARTITION:
+        return (u64)palmtrie_partition_lookup_ref(&palmtrie->u.pt, addr,
+                                                  stack);
+    default:
+        return 0;
+    }
+
+    return 0;
 }
 
 /*
@@ -130,17 +426,261 @@ palmtrie_add_data(struct palmtrie *palmtrie, addr_t addr, addr_t mask,
 u64
 palmtrie_lookup(struct palmtrie *palmtrie, addr_t addr)
 {
+    return _lookup_ref(palmtrie, &addr, NULL);
+}
+
+/*
+ * palmtrie_lookup_ref -- lookup an entry by the reference to the address
+ */
+u64
+palmtrie_lookup_ref(struct palmtrie *palmtrie, const addr_t *addr)
+{
+    return _lookup_ref(palmtrie, addr, NULL);
+}
+
+/*
+ * palmtrie_ctx_init -- initialize a lookup context of the palmtrie used by a
+ * thread
+ */
+void
+palmtrie_ctx_init(struct palmtrie_ctx *ctx, struct palmtrie *palmtrie)
+{
+    ctx->palmtrie = palmtrie;
+}
+
+/*
+ * palmtrie_ctx_lookup -- lookup an entry with the traversal stack of the
+ * context
+ */
+u64
+palmtrie_ctx_lookup(struct palmtrie_ctx *ctx, const addr_t *addr)
+{
+    return _lookup_ref(ctx->palmtrie, addr, ctx->stack);
+}
+
+/*
+ * palmtrie_lookup_batch -- lookup the entries corresponding to an array of
+ * addresses from the trie
+ */
+void
+palmtrie_lookup_batch(struct palmtrie *palmtrie, const addr_t *addrs,
+                      u64 *results, size_t n)
+{
+    void *stack[PALMTRIE_STACK_DEPTH];
+    void *data;
+    size_t i;
+    int priority;
+
+    /* Dispatch once for the batch */
     switch ( palmtrie->type ) {
     case PALMTRIE_SORTED_LIST:
-        return (u64)palmtrie_sl_lookup(palmtrie, addr);
+        for ( i = 0; i < n; i++ ) {
+            results[i] = (u64)palmtrie_sl_lookup(palmtrie, addrs[i]);
+        }
+        break;
     case PALMTRIE_BASIC:
-        return (u64)palmtrie_tpt_lookup(palmtrie, addr);
+        for ( i = 0; i < n; i++ ) {
+            results[i] = (u64)palmtrie_tpt_lookup(palmtrie, addrs[i]);
+        }
+        break;
     case PALMTRIE_DEFAULT:
-        return (u64)palmtrie_mtpt_lookup(palmtrie, addr);
+        switch ( palmtrie->stride ) {
+        case 4:
+            for ( i = 0; i < n; i++ ) {
+                results[i] = (u64)palmtrie_mtpt_lookup_s4(palmtrie, addrs[i]);
+            }
+            break;
+        case 6:
+            for ( i = 0; i < n; i++ ) {
+                results[i] = (u64)palmtrie_mtpt_lookup_s6(palmtrie, addrs[i]);
+            }
+            break;
+        case 7:
+            for ( i = 0; i < n; i++ ) {
+                results[i] = (u64)palmtrie_mtpt_lookup_s7(palmtrie, addrs[i]);
+            }
+            break;
+        default:
+            for ( i = 0; i < n; i++ ) {
+                results[i] = (u64)palmtrie_mtpt_lookup_s8(palmtrie, addrs[i]);
+            }
+        }
+        break;
     case PALMTRIE_PLUS:
-        return (u64)palmtrie_popmtpt_lookup(&palmtrie->u.popmtpt, addr);
+        if ( PALMTRIE_PREFIX_ONLY && NULL != palmtrie->prefix.direct.ptr ) {
+            for ( i = 0; i < n; i++ ) {
+                data = palmtrie_exact_lookup(&palmtrie->exact, &addrs[i],
+                                             &priority);
+                results[i] = (u64)palmtrie_prefix_lookup_above(
+                    &palmtrie->prefix, &addrs[i], &priority, data);
+            }
+            break;
+        }
+        switch ( palmtrie->stride ) {
+        case PALMTRIE_STRIDE_VARIABLE:
+            for ( i = 0; i < n; i++ ) {
+                data = palmtrie_exact_lookup(&palmtrie->exact, &addrs[i],
+                                             &priority);
+                results[i] = (u64)palmtrie_vpopmtpt_lookup_above_ref(
+                    &palmtrie->u.vpopmtpt, &addrs[i], &priority, data,
+                    stack);
+            }
+            break;
+        case 4:
+            for ( i = 0; i < n; i++ ) {
+                data = palmtrie_exact_lookup(&palmtrie->exact, &addrs[i],
+                                             &priority);
+                results[i] = (u64)palmtrie_popmtpt_lookup_above_ref_s4(
+                    &palmtrie->u.popmtpt, &addrs[i], &priority, data,
+                    stack);
+            }
+            break;
+        case 6:
+            for ( i = 0; i < n; i++ ) {
+                data = palmtrie_exact_lookup(&palmtrie->exact, &addrs[i],
+                                             &priority);
+                results[i] = (u64)palmtrie_popmtpt_lookup_above_ref_s6(
+                    &palmtrie->u.popmtpt, &addrs[i], &priority, data,
+                    stack);
+            }
+            break;
+        case 7:
+            for ( i = 0; i < n; i++ ) {
+                data = palmtrie_exact_lookup(&palmtrie->exact, &addrs[i],
+                                             &priority);
+                results[i] = (u64)palmtrie_popmtpt_lookup_above_ref_s7(
+                    &palmtrie->u.popmtpt, &addrs[i], &priority, data,
+                    stack);
+            }
+            break;
+        default:
+            for ( i = 0; i < n; i++ ) {
+                data = palmtrie_exact_lookup(&palmtrie->exact, &addrs[i],
+                                             &priority);
+                results[i] = (u64)palmtrie_popmtpt_lookup_above_ref_s8(
+                    &palmtrie->u.popmtpt, &addrs[i], &priority, data,
+                    stack);
+            }
+        }
+        break;
+    case PALMTRIE_AUTO:
+        if ( NULL == palmtrie->u.au.engine ) {
+            /* Not committed yet */
+            memset(results, 0, sizeof(u64) * n);
+            break;
+        }
+        palmtrie_lookup_batch(palmtrie->u.au.engine, addrs, results, n);
+        break;
+    case PALMTRIE_PARTITION:
+        for ( i = 0; i < n; i++ ) {
+            results[i] = (u64)palmtrie_partition_lookup(&palmtrie->u.pt,
+                                                        addrs[i]);
+        }
+        break;
     default:
-        return 0;
+        memset(results, 0, sizeof(u64) * n);
+    }
+}
+
+/*
+ * Compile the data structure of the type
+ */
+static int
+_commit(struct palmtrie *palmtrie)
+{
+    struct palmtrie_range_group *g;
+    struct palmtrie_rule *r;
+    void *odata;
+    size_t n;
+    size_t i;
+    int opriority;
+    int ret;
+
+    if ( PALMTRIE_PLUS == palmtrie->type ) {
+        if ( palmtrie->eliminate.enabled ) {
+            /* Add the entries that are not redundant */
+            if ( palmtrie_eliminate_commit(&palmtrie->eliminate,
+                                           &palmtrie->ranges) < 0 ) {
+                return -1;
+            }
+            for ( i = 0; i < palmtrie->eliminate.nr; i++ ) {
+                if ( PALMTRIE_ELIMINATE_KEPT
+                     != palmtrie->eliminate.states[i] ) {
+                    continue;
+                }
+                r = &palmtrie->eliminate.rules[i];
+                if ( _plus_add_data(palmtrie, r->addr, r->mask, r->priority,
+                                    r->data) < 0 ) {
+                    return -1;
+                }
+                palmtrie->eliminate.states[i] = PALMTRIE_ELIMINATE_ADDED;
+            }
+        }
+        /* Move the entries of the other wildcards than the chosen one from
+           the exact-match table to the trie */
+        n = palmtrie_exact_split(&palmtrie->exact);
+        for ( i = 0; i < n; i++ ) {
+            r = &palmtrie->exact.rules.ptr[palmtrie->exact.rules.nr + i];
+            if ( _plus_add(palmtrie, r->addr, r->mask, r->priority,
+                           r->data) < 0 ) {
+                return -1;
+            }
+        }
+        /* The groups of the range rules of higher priorities than the
+           entries in the trie; the leaves of the groups check the ranges,
+           hence the keys are not added to the prefix-only compilation */
+        if ( palmtrie->ranges.nr ) {
+            palmtrie_prefix_ternary(&palmtrie->prefix);
+        }
+        for ( i = 0; i < palmtrie->ranges.nr; i++ ) {
+            g = palmtrie->ranges.groups[i];
+            if ( g->max_priority <= g->added ) {
+                continue;
+            }
+            ret = STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_replace,
+                              &palmtrie->u.popmtpt, g->addr, g->mask,
+                              g->max_priority, (void *)g, &opriority, &odata);
+            if ( ret < 0 ) {
+                return -1;
+            }
+            if ( 1 == ret && (void *)g != odata ) {
+                /* The entry of the same key added before the group is
+                   merged into the group */
+                if ( palmtrie_range_add(&palmtrie->ranges, g->addr, g->mask,
+                                        NULL, 0, opriority, odata) < 0 ) {
+                    return -1;
+                }
+                ret = STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_replace,
+                                  &palmtrie->u.popmtpt, g->addr, g->mask,
+                                  g->max_priority, (void *)g, &opriority,
+                                  &odata);
+                if ( ret < 0 ) {
+                    return -1;
+                }
+            } else if ( 0 == ret ) {
+                palmtrie->exact.others++;
+            }
+            g->added = g->max_priority;
+        }
+        palmtrie_range_commit(&palmtrie->ranges);
+        if ( palmtrie_exact_commit(&palmtrie->exact) < 0 ) {
+            return -1;
+        }
+        if ( PALMTRIE_PREFIX_ONLY && !palmtrie->prefix.ternary ) {
+            /* Every mask of the entries in the trie is a prefix; the
+               multiway ternary trie is not compiled */
+            return palmtrie_prefix_commit(&palmtrie->prefix);
+        }
+        palmtrie_prefix_release(&palmtrie->prefix);
+        if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+            return palmtrie_vpopmtpt_commit(&palmtrie->u.vpopmtpt);
+        }
+        return STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_commit,
+                           &palmtrie->u.popmtpt);
+    } else if ( PALMTRIE_AUTO == palmtrie->type ) {
+        return palmtrie_auto_commit(&palmtrie->u.au);
+    } else if ( PALMTRIE_PARTITION == palmtrie->type ) {
+        return palmtrie_partition_commit(&palmtrie->u.pt, palmtrie->stride);
     }
 
     return 0;
@@ -152,11 +692,113 @@ palmtrie_lookup(struct palmtrie *palmtrie, addr_t addr)
 int
 palmtrie_commit(struct palmtrie *palmtrie)
 {
-    if ( PALMTRIE_PLUS == palmtrie->type ) {
-        return palmtrie_popmtpt_commit(&palmtrie->u.popmtpt);
+    int ret;
+
+    ret = _commit(palmtrie);
+    if ( 0 == ret ) {
+        /* Invalidate the flow caches */
+        __atomic_add_fetch(&palmtrie->generation, 1, __ATOMIC_RELEASE);
     }
 
-    return 0;
+    return ret;
+}
+
+/*
+ * palmtrie_memory -- return the memory size of the data structure in bytes,
+ * excluding the control data structure
+ */
+size_t
+palmtrie_memory(struct palmtrie *palmtrie)
+{
+    switch ( palmtrie->type ) {
+    case PALMTRIE_SORTED_LIST:
+        return palmtrie_sl_memory(palmtrie);
+    case PALMTRIE_BASIC:
+        return palmtrie_tpt_memory(palmtrie);
+    case PALMTRIE_DEFAULT:
+        return STRIDE_CALL(palmtrie->stride, palmtrie_mtpt_memory,
+                           &palmtrie->u.mtpt);
+    case PALMTRIE_PLUS:
+        if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+            return palmtrie_vpopmtpt_memory(&palmtrie->u.vpopmtpt)
+                + palmtrie_exact_memory(&palmtrie->exact)
+                + palmtrie_prefix_memory(&palmtrie->prefix);
+        }
+        return STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_memory,
+                           &palmtrie->u.popmtpt)
+            + palmtrie_exact_memory(&palmtrie->exact)
+            + palmtrie_range_memory(&palmtrie->ranges)
+            + palmtrie_prefix_memory(&palmtrie->prefix);
+    case PALMTRIE_AUTO:
+        if ( NULL == palmtrie->u.au.engine ) {
+            return 0;
+        }
+        return palmtrie_memory(palmtrie->u.au.engine);
+    case PALMTRIE_PARTITION:
+        return palmtrie_partition_memory(&palmtrie->u.pt);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * palmtrie_get_stats -- get the statistics of the data structure, whose bytes
+ * sum up to palmtrie_memory()
+ */
+void
+palmtrie_get_stats(struct palmtrie *palmtrie, struct palmtrie_stats *stats)
+{
+    size_t sz;
+
+    memset(stats, 0, sizeof(struct palmtrie_stats));
+    switch ( palmtrie->type ) {
+    case PALMTRIE_SORTED_LIST:
+        palmtrie_sl_stats(palmtrie, stats);
+        break;
+    case PALMTRIE_BASIC:
+        palmtrie_tpt_stats(palmtrie, stats);
+        break;
+    case PALMTRIE_DEFAULT:
+        STRIDE_CALL(palmtrie->stride, palmtrie_mtpt_stats, &palmtrie->u.mtpt,
+                    stats);
+        break;
+    case PALMTRIE_PLUS:
+        if ( PALMTRIE_PREFIX_ONLY && NULL != palmtrie->prefix.direct.ptr ) {
+            /* The ternary trie is kept for the updates */
+            palmtrie_prefix_stats(&palmtrie->prefix, stats);
+            if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+                stats->build_bytes
+                    += palmtrie_vpopmtpt_memory(&palmtrie->u.vpopmtpt);
+            } else {
+                stats->build_bytes
+                    += STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_memory,
+                                   &palmtrie->u.popmtpt);
+            }
+        } else if ( PALMTRIE_STRIDE_VARIABLE == palmtrie->stride ) {
+            palmtrie_vpopmtpt_stats(&palmtrie->u.vpopmtpt, stats);
+        } else {
+            STRIDE_CALL(palmtrie->stride, palmtrie_popmtpt_stats,
+                        &palmtrie->u.popmtpt, stats);
+        }
+        /* The entries in the exact hash */
+        stats->rules += palmtrie->exact.rules.nr;
+        break;
+    case PALMTRIE_AUTO:
+        if ( NULL != palmtrie->u.au.engine ) {
+            palmtrie_get_stats(palmtrie->u.au.engine, stats);
+        }
+        break;
+    case PALMTRIE_PARTITION:
+        palmtrie_partition_stats(&palmtrie->u.pt, stats);
+        break;
+    default:
+        break;
+    }
+
+    /* The others, e.g., the exact hash, the ranges, and the partitions */
+    stats->bytes = palmtrie_memory(palmtrie);
+    sz = stats->build_bytes + stats->inode_bytes + stats->leaf_bytes;
+    stats->other_bytes = stats->bytes > sz ? stats->bytes - sz : 0;
 }
 
 /*
@@ -7,6 +7,7 @@
 #define _PALMTRIE_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -14,11 +15,12 @@ typedef uint64_t u64;
 
 /* Typical TCAM key-width: 40, 80, 160, 320, 480, 640 bits */
 
-/* 512-bit addressing */
+/* 512-bit addressing; the key is naturally aligned and takes a cache line
+   in the arrays aligned to 64 bytes */
 #if defined(PALMTRIE_SHORT) && PALMTRIE_SHORT
-typedef struct { u32 g; u64 a[2]; } __attribute__ ((packed)) addr_t;
+typedef struct { u64 a[2]; } addr_t;
 #define PALMTRIE_ADDR_BITS     480
-#define PALMTRIE_ADDR_ZERO     {0, {0, 0}}
+#define PALMTRIE_ADDR_ZERO     {{0, 0}}
 
 #define ADDR_MASK(addr, mask) do {              \
         (addr).a[0] &= ~(mask).a[0];            \
@@ -38,9 +40,9 @@ typedef struct { u32 g; u64 a[2]; } __attribute__ ((packed)) addr_t;
 
 #else
 
-typedef struct { u32 g; u64 a[8]; } __attribute__ ((packed)) addr_t;
+typedef struct { u64 a[8]; } addr_t;
 #define PALMTRIE_ADDR_BITS     480
-#define PALMTRIE_ADDR_ZERO     {0, {0, 0, 0, 0, 0, 0, 0, 0}}
+#define PALMTRIE_ADDR_ZERO     {{0, 0, 0, 0, 0, 0, 0, 0}}
 
 #define ADDR_MASK(addr, mask) do {              \
         (addr).a[0] &= ~(mask).a[0];            \
@@ -81,9 +83,27 @@ typedef struct { u32 g; u64 a[8]; } __attribute__ ((packed)) addr_t;
 #endif
 
 
-#ifndef PALMTRIE_MTPT_STRIDE
-#define PALMTRIE_MTPT_STRIDE  8
+/*
+ * Stride of the multiway tries.  mtpt.c and popmtpt.c are compiled once for
+ * each of the supported strides with PALMTRIE_MTPT_STRIDE defined, and the
+ * instance is selected at runtime by the stride argument of palmtrie_init().
+ */
+#ifndef PALMTRIE_DEFAULT_STRIDE
+#define PALMTRIE_DEFAULT_STRIDE 8
 #endif
+#define PALMTRIE_STRIDE_SUPPORTED(s)                            \
+    (4 == (s) || 6 == (s) || 7 == (s) || 8 == (s))
+
+/*
+ * Stride chosen per node at commit (PALMTRIE_PLUS only) in the range from
+ * PALMTRIE_VSTRIDE_MIN to PALMTRIE_VSTRIDE_MAX bits
+ */
+#define PALMTRIE_STRIDE_VARIABLE    (-1)
+#define PALMTRIE_VSTRIDE_MIN        4
+#define PALMTRIE_VSTRIDE_MAX        10
+
+/* Entries of the traversal stack of the lookup of Palmtrie+ */
+#define PALMTRIE_STACK_DEPTH        256
 
 #ifndef PALMTRIE_PRIORITY_SKIP
 #define PALMTRIE_PRIORITY_SKIP 1
@@ -93,6 +113,51 @@ typedef struct { u32 g; u64 a[8]; } __attribute__ ((packed)) addr_t;
 #define PALMTRIE_EXACTMATCH_FIRST 0
 #endif
 
+/* Split the fully specified entries of Palmtrie+ into a hash table */
+#ifndef PALMTRIE_EXACT_HASH
+#define PALMTRIE_EXACT_HASH 1
+#endif
+
+/* Share the identical subtrees of the compiled Palmtrie+ */
+#ifndef PALMTRIE_PLUS_SHARE
+#define PALMTRIE_PLUS_SHARE 1
+#endif
+
+/* Bits of the direct table in front of the root of Palmtrie+ (e.g., 16 or
+   24); 0 disables the table */
+#ifndef PALMTRIE_PLUS_DIRECT
+#define PALMTRIE_PLUS_DIRECT 16
+#endif
+
+/* Check the ranges of the fields at the leaves of Palmtrie+ instead of
+   expanding them to prefixes */
+#ifndef PALMTRIE_RANGE_LEAF
+#define PALMTRIE_RANGE_LEAF 1
+#endif
+#define PALMTRIE_RANGES_MAX     2       /* Ranges per rule */
+
+/* Compile Palmtrie+ into the multiway trie of the leaf-pushed prefixes when
+   every mask of the entries in the trie is a prefix */
+#ifndef PALMTRIE_PREFIX_ONLY
+#define PALMTRIE_PREFIX_ONLY 1
+#endif
+#define PALMTRIE_PREFIX_STRIDE  6
+/* Bits of the direct table of the prefix-only compilation */
+#ifndef PALMTRIE_PREFIX_DIRECT
+#define PALMTRIE_PREFIX_DIRECT  16
+#endif
+#define PALMTRIE_PREFIX_LEAF    0x80000000U
+#define PALMTRIE_RANGE_BITS     24      /* Maximum width of a range field */
+
+/* Maximum number of the partitions of PALMTRIE_PARTITION, and the minimum
+   size of a partition as the reciprocal of the fraction of the rules */
+#ifndef PALMTRIE_PARTITION_MAX
+#define PALMTRIE_PARTITION_MAX 4
+#endif
+#ifndef PALMTRIE_PARTITION_MIN
+#define PALMTRIE_PARTITION_MIN 32
+#endif
+
 
 static __inline__ int
 ADDR_PREFIX_CMP(addr_t a0, addr_t m0, addr_t a1, addr_t m1, int plen, int msb)
@@ -115,11 +180,38 @@ ADDR_PREFIX_CMP(addr_t a0, addr_t m0, addr_t a1, addr_t m1, int plen, int msb)
     return 1;
 }
 
-#define EXTRACT(addr, bit)      (((addr).a[(bit) >> 6] >> ((bit) & 0x3f)) & 1)
+/* Extract the bit at the bit position; the bits below the key (i.e., the
+   negative positions of the trie nodes at the bottom) are zero */
+#define EXTRACT(addr, bit)                                              \
+    ((bit) < 0 ? 0 : (((addr).a[(bit) >> 6] >> ((bit) & 0x3f)) & 1))
 
-#define EXTRACTN(addr, bit, n)                                      \
-    ((*(uint32_t *)((void *)&(addr).g + (((bit) + 32) >> 3))        \
-      >> (((bit) + 0) & 0x7)) & ((1 << (n)) - 1))
+/*
+ * Extract the n bits from the bit position, where n is at most 32; the bits
+ * below the key (i.e., the negative positions of the trie nodes at the
+ * bottom) are zero, and a field across two words is shifted in from the next
+ * word
+ */
+static __inline__ uint32_t
+ADDR_EXTRACTN(const addr_t *addr, int bit, int n)
+{
+    u64 v;
+    int i;
+    int s;
+
+    if ( __builtin_expect(!!(bit < 0), 0) ) {
+        return (uint32_t)(addr->a[0] << -bit) & (uint32_t)((1ULL << n) - 1);
+    }
+    i = bit >> 6;
+    s = bit & 0x3f;
+    v = addr->a[i] >> s;
+    if ( s + n > 64
+         && i + 1 < (int)(sizeof(addr->a) / sizeof(addr->a[0])) ) {
+        v |= addr->a[i + 1] << (64 - s);
+    }
+
+    return (uint32_t)v & (uint32_t)((1ULL << n) - 1);
+}
+#define EXTRACTN(addr, bit, n)  ADDR_EXTRACTN(&(addr), (bit), (n))
 
 
 #define BTS(addr, bit) do {                                 \
@@ -153,6 +245,8 @@ enum palmtrie_type {
     PALMTRIE_BASIC,
     PALMTRIE_DEFAULT,
     PALMTRIE_PLUS,
+    PALMTRIE_AUTO,
+    PALMTRIE_PARTITION,
 };
 
 /*
@@ -199,6 +293,7 @@ struct palmtrie_tpt {
     struct palmtrie_tpt_node *root;
 };
 
+#ifdef PALMTRIE_MTPT_STRIDE
 /*
  * Node of multiway ternary PATRICIA trie
  * Types in the least significant 3 bits:
@@ -218,12 +313,15 @@ struct palmtrie_mtpt_node_data {
     int max_priority;
 #endif
     void *data;
+    /* Index of the rule in the rule table of Palmtrie+ at the last commit */
+    uint32_t rule;
 
     /* Descendent nodes */
     struct palmtrie_mtpt_node_data *children[1 << PALMTRIE_MTPT_STRIDE];
     /* Searchback nodes */
     struct palmtrie_mtpt_node_data *ternaries[(1 << PALMTRIE_MTPT_STRIDE) - 1];
 };
+#endif /* PALMTRIE_MTPT_STRIDE */
 
 /*
  * Multiway ternary PATRICIA trie
@@ -240,6 +338,22 @@ struct palmtrie_popmtpt_leaf
     void *data;
 };
 #define PALMTRIE_STRIDE_OPT 1
+/*
+ * Key word checked at a leaf of Palmtrie+: the key word masked by the care
+ * bits must be equal to the addr
+ */
+struct palmtrie_popmtpt_word {
+    uint64_t care;
+    uint64_t addr;
+};
+#ifdef PALMTRIE_MTPT_STRIDE
+/* Key words stored in a leaf; four words fit in the size of an internal
+   node of the stride 8 */
+#if PALMTRIE_MTPT_STRIDE == 8
+#define PALMTRIE_LEAF_WORDS     4
+#else
+#define PALMTRIE_LEAF_WORDS     2
+#endif
 struct palmtrie_popmtpt_node {
     int16_t bit;
     union {
@@ -268,12 +382,20 @@ struct palmtrie_popmtpt_node {
         } inode;
         struct {
             int32_t priority;
-            addr_t addr;
-            addr_t mask;
-            void *data;
+            /* Index of the rule in the rule table */
+            uint32_t rule;
+            /* The data is the group of the range rules of the key */
+            uint8_t ranges;
+            /* Bitmap of the key words to be checked; the words are in the
+               leaf, or only in the rule table if they do not fit */
+            uint8_t bitmap;
+            /* Bitmap of the key words to be zero */
+            uint8_t zeros;
+            struct palmtrie_popmtpt_word words[PALMTRIE_LEAF_WORDS];
         } leaf;
     } u;
 };
+#endif /* PALMTRIE_MTPT_STRIDE */
 struct palmtrie_popmtpt {
     uint32_t root;
     struct {
@@ -281,7 +403,361 @@ struct palmtrie_popmtpt {
         int used;
         struct palmtrie_popmtpt_node *ptr;
     } nodes;
+    /* Rules referred to by the leaves, in a structure of arrays */
+    struct {
+        uint32_t nr;
+        uint32_t size;
+        int32_t *priority;
+        void **data;
+        addr_t *addr;
+        addr_t *mask;
+    } rules;
+    /* Direct table from the top bits of the root to the candidate nodes;
+       each entry is the index of a list in the pool, and a list is the
+       number of the nodes followed by the nodes in the order pushed onto
+       the traversal stack */
+    struct {
+        int bits;
+        int bit;
+        uint32_t *ptr;
+        struct {
+            uint32_t nr;
+            uint32_t size;
+            uint32_t *ptr;
+        } pool;
+    } direct;
     struct palmtrie_mtpt mtpt;
+    /* Groups of the range rules of the instance */
+    const struct palmtrie_ranges *ranges;
+};
+
+/*
+ * Rule of a ternary matching table
+ */
+struct palmtrie_rule {
+    addr_t addr;
+    addr_t mask;
+    int priority;
+    u64 data;
+};
+
+/*
+ * Node of Palmtrie+ with the variable stride.  The bitmaps of the children
+ * and the ternaries of an internal node are stored in the word pool, each
+ * word with the index of the node corresponding to its least significant
+ * set bit.
+ */
+struct palmtrie_vpopmtpt_node {
+    int16_t bit;
+    uint8_t stride;             /* 0 for a leaf */
+    union {
+        struct {
+            int32_t max_priority;
+            uint32_t words;     /* Children, then ternaries */
+        } inode;
+        struct {
+            int32_t priority;
+            addr_t addr;
+            addr_t mask;
+            void *data;
+        } leaf;
+    } u;
+};
+struct palmtrie_vpopmtpt_word {
+    uint64_t bitmap;
+    uint32_t base;
+};
+struct palmtrie_vpopmtpt {
+    struct {
+        size_t nr;
+        size_t size;
+        struct palmtrie_rule *ptr;
+    } rules;
+    struct {
+        uint32_t nr;
+        uint32_t used;
+        struct palmtrie_vpopmtpt_node *ptr;
+    } nodes;
+    struct {
+        uint32_t nr;
+        uint32_t used;
+        struct palmtrie_vpopmtpt_word *ptr;
+    } words;
+    /* Number of the internal nodes by the stride */
+    uint32_t strides[PALMTRIE_VSTRIDE_MAX + 1];
+};
+
+/*
+ * Open addressing hash table of the fully specified entries, which is looked
+ * up before the trie to start the search from the matched priority.  The
+ * entries share the wildcard of the padding bits above the key, which is
+ * chosen at the first commit as the most common one, and an empty slot has
+ * the priority -1.  The table is not used unless the fully specified entries
+ * are the majority, since the probe only pays off then.
+ */
+struct palmtrie_exact_entry {
+    addr_t addr;
+    int priority;
+    void *data;
+};
+struct palmtrie_exact {
+    /* Entries to be compiled into the table */
+    struct {
+        size_t nr;
+        size_t size;
+        struct palmtrie_rule *ptr;
+    } rules;
+    addr_t wildcard;
+    int fixed;                  /* 1: wildcard chosen, -1: not used */
+    size_t others;              /* Entries added to the trie */
+    /* Compiled table of a power-of-two size */
+    struct palmtrie_exact_entry *table;
+    size_t size;
+    size_t nr;
+    int nwords;
+};
+
+/*
+ * Prefix-only compilation of Palmtrie+.  The entries whose masks are
+ * contiguous from the least significant bit are compiled at commit into a
+ * multiway trie of the leaf-pushed prefixes of PALMTRIE_PREFIX_STRIDE bits
+ * (Poptrie), whose internal node has the bitmaps of the children and of the
+ * runs of the same leaf, below a direct table of the top bits.  The trie
+ * covers the bits of the keys below the width, and the keys set above it are
+ * matched against the wide entries whose wildcard bits exceed the width.  An
+ * entry of another mask falls back to the ternary trie for good.
+ */
+struct palmtrie_prefix_rule {
+    addr_t addr;
+    int wildcards;
+    int priority;
+    void *data;
+    uint32_t result;
+};
+struct palmtrie_prefix_result {
+    int priority;
+    void *data;
+};
+struct palmtrie_prefix_node {
+    u64 vector;                 /* Children of the internal nodes */
+    u64 leafvec;                /* Starts of the runs of the same leaf */
+    uint32_t base0;             /* Index of the first leaf */
+    uint32_t base1;             /* Index of the first child */
+};
+struct palmtrie_prefix {
+    int ternary;
+    /* Entries in the order of the prefixes after commit */
+    struct {
+        size_t nr;
+        size_t size;
+        struct palmtrie_prefix_rule *ptr;
+    } rules;
+    /* Compiled trie; the leaves are the indices of the distinct pairs of
+       the priority and the data, the first one for no entry */
+    int width;
+    addr_t outside;             /* Bits above the width */
+    /* Entries of the top bits, the index of the node or the result with
+       PALMTRIE_PREFIX_LEAF */
+    struct {
+        int bits;
+        int bit;
+        uint32_t *ptr;
+    } direct;
+    struct {
+        uint32_t nr;
+        uint32_t used;
+        struct palmtrie_prefix_node *ptr;
+    } nodes;
+    struct {
+        uint32_t nr;
+        uint32_t used;
+        uint32_t *ptr;
+    } leaves;
+    struct {
+        uint32_t nr;
+        struct palmtrie_prefix_result *ptr;
+    } results;
+    struct {
+        uint32_t nr;
+        uint32_t *ptr;
+    } wide;
+};
+
+/*
+ * Range of the field of the width bits from the bit position of the key
+ */
+struct palmtrie_range {
+    int bit;
+    int width;
+    u32 lo;
+    u32 hi;
+};
+
+/*
+ * Rules of the ranges sharing the same key of the ternary part, which is
+ * added to the trie of Palmtrie+ as a leaf checking the ranges of the rules
+ */
+struct palmtrie_range_rule {
+    int priority;
+    int nranges;
+    struct palmtrie_range ranges[PALMTRIE_RANGES_MAX];
+    void *data;
+};
+struct palmtrie_range_group {
+    addr_t addr;
+    addr_t mask;
+    int max_priority;
+    int added;                  /* Priority of the entry in the trie */
+    /* Rules in the descending order of the priority after commit */
+    size_t nr;
+    size_t size;
+    struct palmtrie_range_rule *rules;
+};
+struct palmtrie_ranges {
+    struct palmtrie_range_group **groups;
+    size_t nr;
+    size_t size;
+    size_t rules;
+    /* Open addressing index of the groups by the key */
+    struct palmtrie_range_group **index;
+    size_t isize;
+};
+
+/*
+ * Find the rule of the group of a higher priority than the specified
+ * priority whose ranges contain the fields of the address
+ */
+static __inline__ const struct palmtrie_range_rule *
+palmtrie_range_lookup(const struct palmtrie_range_group *g, const addr_t *addr,
+                      int priority)
+{
+    const struct palmtrie_range_rule *r;
+    u32 v;
+    size_t i;
+    int j;
+
+    for ( i = 0; i < g->nr; i++ ) {
+        r = &g->rules[i];
+        if ( r->priority <= priority ) {
+            break;
+        }
+        for ( j = 0; j < r->nranges; j++ ) {
+            v = EXTRACTN(*addr, r->ranges[j].bit, r->ranges[j].width);
+            if ( v < r->ranges[j].lo || v > r->ranges[j].hi ) {
+                break;
+            }
+        }
+        if ( j == r->nranges ) {
+            return r;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Ruleset loaded from a ternary matching table file
+ */
+struct palmtrie_ruleset {
+    struct palmtrie_rule *rules;
+    size_t nr;
+    int keybits;
+};
+
+/* Flags for the ternary matching table loader */
+#define PALMTRIE_TCAM_REVERSE   0x1     /* Keys from the most significant
+                                           nibble */
+#define PALMTRIE_TCAM_THREADS   0x2     /* Parse in multiple threads */
+#define PALMTRIE_TCAM_BINARY    0x4     /* Save in the binary format */
+#define PALMTRIE_TCAM_COMPACT   0x8     /* Save in the binary format without
+                                           wildcard words */
+
+/*
+ * Header of the binary ruleset format, followed by the records of a 32-bit
+ * priority, a 32-bit bitmap of the stored words (compact format only), a
+ * 64-bit data, and the pairs of the 64-bit addr and mask words.  All the
+ * fields are little endian.
+ */
+#define PALMTRIE_TCAM_MAGIC         "PALMTRIE"
+#define PALMTRIE_TCAM_VERSION       1
+#define PALMTRIE_TCAM_HDR_COMPACT   0x1
+struct palmtrie_tcam_header {
+    char magic[8];
+    u32 version;
+    u32 flags;
+    u32 keybits;
+    u32 nwords;
+    u64 nr;
+} __attribute__ ((packed));
+
+/*
+ * Engine selected by trial compilation at commit (PALMTRIE_AUTO)
+ */
+struct palmtrie_auto {
+    /* Rules added since the initialization */
+    struct palmtrie_rule *rules;
+    size_t nr;
+    size_t size;
+    /* Memory budget in bytes of the selected engine (0: unlimited) */
+    size_t budget;
+    /* Selected engine and the report of the selection */
+    struct palmtrie *engine;
+    char *report;
+};
+
+/*
+ * Palmtrie+ sub-tries over the partitions of the rules by the wildcard shape
+ * (PALMTRIE_PARTITION), searched in the descending order of their maximum
+ * priorities
+ */
+struct palmtrie_partition_part {
+    struct palmtrie *palmtrie;
+    int max_priority;
+    size_t nr;
+};
+struct palmtrie_partition {
+    /* Rules added since the initialization */
+    struct palmtrie_rule *rules;
+    size_t nr;
+    size_t size;
+    /* Sub-tries built at commit */
+    struct palmtrie_partition_part *parts;
+    int nparts;
+};
+
+/*
+ * Reason of a rule left out of the compiled trie of Palmtrie+
+ */
+enum palmtrie_elimination {
+    /* Covered by a rule of a higher priority */
+    PALMTRIE_SHADOWED,
+    /* Covered by a rule of a lower priority and the same data, and no rule
+       of a different data overlaps in between */
+    PALMTRIE_REDUNDANT,
+};
+struct palmtrie_eliminated {
+    /* Indices of the rule and the covering rule in the order of addition */
+    size_t rule;
+    size_t by;
+    enum palmtrie_elimination reason;
+};
+
+/*
+ * Rules of Palmtrie+ buffered for the redundancy elimination at commit
+ */
+#define PALMTRIE_ELIMINATE_OUT      0   /* Left out */
+#define PALMTRIE_ELIMINATE_KEPT     1   /* To be added to the trie */
+#define PALMTRIE_ELIMINATE_ADDED    2   /* In the trie */
+struct palmtrie_eliminate {
+    int enabled;
+    /* Rules in the order of the addition, and their states */
+    struct palmtrie_rule *rules;
+    uint8_t *states;
+    size_t nr;
+    size_t size;
+    /* Rules left out at the last commit */
+    struct palmtrie_eliminated *report;
+    size_t nreport;
 };
 
 /*
@@ -293,37 +769,339 @@ struct palmtrie {
         struct palmtrie_tpt tpt;
         struct palmtrie_mtpt mtpt;
         struct palmtrie_popmtpt popmtpt;
+        struct palmtrie_vpopmtpt vpopmtpt;
+        struct palmtrie_auto au;
+        struct palmtrie_partition pt;
     } u;
+    /* Fully specified entries of PALMTRIE_PLUS */
+    struct palmtrie_exact exact;
+    /* Range rules of PALMTRIE_PLUS */
+    struct palmtrie_ranges ranges;
+    /* Redundancy elimination of PALMTRIE_PLUS */
+    struct palmtrie_eliminate eliminate;
+    /* Prefix-only compilation of PALMTRIE_PLUS */
+    struct palmtrie_prefix prefix;
     enum palmtrie_type type;
+    int stride;
     int allocated;
+    /* Bumped at every update to invalidate the flow caches */
+    u64 generation;
+};
+
+/*
+ * Victim policy of the flow cache
+ */
+enum palmtrie_cache_victim {
+    PALMTRIE_CACHE_LRU,
+    PALMTRIE_CACHE_FIFO,
+    PALMTRIE_CACHE_RANDOM,
+};
+
+/*
+ * Per-thread set-associative cache of the lookup results.  An entry is valid
+ * only if its generation is the current one of the palmtrie, hence the
+ * updates invalidate the entries lazily.
+ */
+struct palmtrie_cache_entry {
+    addr_t addr;
+    u32 stamp;                  /* Last access (LRU) or insertion (FIFO) */
+    u64 generation;
+    u64 data;
+};
+struct palmtrie_cache {
+    struct palmtrie *palmtrie;
+    struct palmtrie_cache_entry *entries;
+    size_t nsets;
+    int ways;
+    enum palmtrie_cache_victim victim;
+    u32 clock;
+    u64 rng;
+    /* Statistics */
+    u64 hits;
+    u64 misses;
+};
+
+/*
+ * Field of the packet header copied to the key: the len bytes from the offset
+ * of the header to the bytes from the pos of the key in the memory order, or
+ * in the reverse order with PALMTRIE_FIELD_REVERSE to hold a field of the
+ * network byte order as a number (e.g., a port for the range fields)
+ */
+#define PALMTRIE_FIELD_REVERSE  0x1
+struct palmtrie_field {
+    int offset;
+    int len;
+    int pos;
+    int flags;
+};
+
+/*
+ * Compiled descriptor of the fields to build the key from a packet header
+ */
+#define PALMTRIE_FIELDS_MAX     16
+struct palmtrie_fields {
+    int nr;
+    size_t len;                 /* Bytes of the header read */
+    struct {
+        u16 offset;
+        u16 pos;
+        u16 len;
+        u16 reverse;
+    } runs[PALMTRIE_FIELDS_MAX];
+};
+
+/*
+ * Lookup context reused across the lookups by a thread, holding the traversal
+ * stack of the lookup
+ */
+struct palmtrie_ctx {
+    struct palmtrie *palmtrie;
+    void *stack[PALMTRIE_STACK_DEPTH];
+};
+
+/*
+ * Statistics of the data structure.  The bytes of palmtrie_memory() are split
+ * into the trie kept for the updates, the internal nodes and the leaves (with
+ * the rule table) of the structure looked up, and the others such as the
+ * exact hash and the ranges.  The nodes and the depths are of the structure
+ * looked up, where the depth of a leaf is the number of the internal nodes on
+ * the way from the root.
+ */
+struct palmtrie_stats {
+    size_t bytes;
+    size_t build_bytes;
+    size_t inode_bytes;
+    size_t leaf_bytes;
+    size_t other_bytes;
+    size_t rules;
+    size_t inodes;
+    size_t leaves;
+    size_t children;            /* Slots of the children used */
+    size_t ternaries;           /* Slots of the ternaries used */
+    size_t duplicates;          /* Leaves beyond the first one of a rule */
+    size_t compressible;        /* Internal nodes with a single leaf only */
+    int max_depth;
+    double avg_depth;
 };
 
 /* Prototype declarations */
-struct palmtrie * palmtrie_init(struct palmtrie *, enum palmtrie_type);
+struct palmtrie * palmtrie_init(struct palmtrie *, enum palmtrie_type, int);
+void palmtrie_release(struct palmtrie *);
 int palmtrie_add_data(struct palmtrie *, addr_t, addr_t, int, u64);
+int palmtrie_add_range(struct palmtrie *, addr_t, addr_t,
+                       const struct palmtrie_range *, int, int, u64);
 u64 palmtrie_lookup(struct palmtrie *, addr_t);
+void palmtrie_lookup_batch(struct palmtrie *, const addr_t *, u64 *, size_t);
 int palmtrie_commit(struct palmtrie *);
+size_t palmtrie_memory(struct palmtrie *);
+void palmtrie_get_stats(struct palmtrie *, struct palmtrie_stats *);
+void * palmtrie_plus_lookup_above(struct palmtrie *, addr_t, int *, void *);
+int palmtrie_add_data_ref(struct palmtrie *, const addr_t *, const addr_t *,
+                          int, u64);
+u64 palmtrie_lookup_ref(struct palmtrie *, const addr_t *);
+void * palmtrie_plus_lookup_above_ref(struct palmtrie *, const addr_t *,
+                                      int *, void *, void **);
+void palmtrie_ctx_init(struct palmtrie_ctx *, struct palmtrie *);
+u64 palmtrie_ctx_lookup(struct palmtrie_ctx *, const addr_t *);
+
+/* in tcam.c */
+int palmtrie_ruleset_load(struct palmtrie_ruleset *, const char *, int);
+int palmtrie_ruleset_save(const struct palmtrie_ruleset *, const char *, int);
+void palmtrie_ruleset_release(struct palmtrie_ruleset *);
+int palmtrie_add_ruleset(struct palmtrie *, const struct palmtrie_ruleset *);
+int palmtrie_load_tcam(struct palmtrie *, const char *, int);
+addr_t * palmtrie_load_keys(const char *, int, size_t *);
+
+/* in field.c */
+int palmtrie_fields_compile(struct palmtrie_fields *,
+                            const struct palmtrie_field *, int);
+void palmtrie_fields_key(const struct palmtrie_fields *, const uint8_t *,
+                         addr_t *);
+u64 palmtrie_lookup_pkt(struct palmtrie *, const struct palmtrie_fields *,
+                        const uint8_t *);
+
+/* in auto.c */
+int palmtrie_auto_set_budget(struct palmtrie *, size_t);
+const char * palmtrie_auto_report(struct palmtrie *);
+int palmtrie_auto_add(struct palmtrie_auto *, addr_t, addr_t, int, u64);
+int palmtrie_auto_commit(struct palmtrie_auto *);
+int palmtrie_auto_release(struct palmtrie_auto *);
+
+/* in eliminate.c */
+int palmtrie_set_eliminate(struct palmtrie *, int);
+const struct palmtrie_eliminated * palmtrie_eliminated(struct palmtrie *,
+                                                       size_t *);
+int palmtrie_eliminate_add(struct palmtrie_eliminate *, addr_t, addr_t, int,
+                           u64);
+int palmtrie_eliminate_commit(struct palmtrie_eliminate *,
+                              const struct palmtrie_ranges *);
+void palmtrie_eliminate_release(struct palmtrie_eliminate *);
+
+/* in prefix.c */
+int palmtrie_prefix_add(struct palmtrie_prefix *, addr_t, addr_t, int,
+                        void *);
+void palmtrie_prefix_ternary(struct palmtrie_prefix *);
+int palmtrie_prefix_commit(struct palmtrie_prefix *);
+void * palmtrie_prefix_lookup_above(const struct palmtrie_prefix *,
+                                    const addr_t *, int *, void *);
+void palmtrie_prefix_release(struct palmtrie_prefix *);
+size_t palmtrie_prefix_memory(struct palmtrie_prefix *);
+void palmtrie_prefix_stats(struct palmtrie_prefix *, struct palmtrie_stats *);
+
+/* in range.c */
+int palmtrie_range_valid(const struct palmtrie_range *, int);
+void palmtrie_range_set(addr_t *, addr_t *, const struct palmtrie_range *,
+                        u32, u32);
+int palmtrie_range_prefixes(const struct palmtrie_range *, u32 *, u32 *);
+int palmtrie_range_add(struct palmtrie_ranges *, addr_t, addr_t,
+                       const struct palmtrie_range *, int, int, void *);
+struct palmtrie_range_group *
+palmtrie_range_find(const struct palmtrie_ranges *, const addr_t *,
+                    const addr_t *);
+void palmtrie_range_commit(struct palmtrie_ranges *);
+void palmtrie_range_release(struct palmtrie_ranges *);
+size_t palmtrie_range_memory(struct palmtrie_ranges *);
+
+/* in partition.c */
+int palmtrie_partition_add(struct palmtrie_partition *, addr_t, addr_t, int,
+                           u64);
+int palmtrie_partition_commit(struct palmtrie_partition *, int);
+void * palmtrie_partition_lookup(struct palmtrie_partition *, addr_t);
+void * palmtrie_partition_lookup_ref(struct palmtrie_partition *,
+                                     const addr_t *, void **);
+int palmtrie_partition_release(struct palmtrie_partition *);
+size_t palmtrie_partition_memory(struct palmtrie_partition *);
+void palmtrie_partition_stats(struct palmtrie_partition *,
+                              struct palmtrie_stats *);
+
+/* in cache.c */
+int palmtrie_cache_init(struct palmtrie_cache *, struct palmtrie *, size_t,
+                        int, enum palmtrie_cache_victim);
+u64 palmtrie_cache_lookup(struct palmtrie_cache *, addr_t);
+void palmtrie_cache_release(struct palmtrie_cache *);
+
+/* in exact.c */
+int palmtrie_exact_candidate(struct palmtrie_exact *, addr_t);
+int palmtrie_exact_add(struct palmtrie_exact *, addr_t, addr_t, int, void *);
+size_t palmtrie_exact_split(struct palmtrie_exact *);
+void * palmtrie_exact_lookup(struct palmtrie_exact *, const addr_t *, int *);
+int palmtrie_exact_commit(struct palmtrie_exact *);
+void palmtrie_exact_release(struct palmtrie_exact *);
+size_t palmtrie_exact_memory(struct palmtrie_exact *);
+
+/* in vpopmtpt.c */
+int palmtrie_vpopmtpt_add(struct palmtrie_vpopmtpt *, addr_t, addr_t, int,
+                          void *);
+void * palmtrie_vpopmtpt_lookup(struct palmtrie_vpopmtpt *, addr_t);
+void * palmtrie_vpopmtpt_lookup_above(struct palmtrie_vpopmtpt *, addr_t,
+                                      int *, void *);
+void * palmtrie_vpopmtpt_lookup_above_ref(struct palmtrie_vpopmtpt *,
+                                          const addr_t *, int *, void *,
+                                          void **);
+int palmtrie_vpopmtpt_commit(struct palmtrie_vpopmtpt *);
+int palmtrie_vpopmtpt_release(struct palmtrie_vpopmtpt *);
+size_t palmtrie_vpopmtpt_memory(struct palmtrie_vpopmtpt *);
+void palmtrie_vpopmtpt_stats(struct palmtrie_vpopmtpt *,
+                             struct palmtrie_stats *);
 
 /* in sl.c */
 int palmtrie_sl_add(struct palmtrie *, addr_t, addr_t, int, void *);
 void * palmtrie_sl_lookup(struct palmtrie *, addr_t);
 int palmtrie_sl_release(struct palmtrie *);
+size_t palmtrie_sl_memory(struct palmtrie *);
+void palmtrie_sl_stats(struct palmtrie *, struct palmtrie_stats *);
 
 /* in tpt.c */
 int palmtrie_tpt_add(struct palmtrie *, addr_t, addr_t, int, void *);
 void * palmtrie_tpt_lookup(struct palmtrie *, addr_t);
 int palmtrie_tpt_release(struct palmtrie *);
+size_t palmtrie_tpt_memory(struct palmtrie *);
+void palmtrie_tpt_stats(struct palmtrie *, struct palmtrie_stats *);
+
+/* in mtpt.c and popmtpt.c, suffixed with the stride (e.g., _s8) */
+#define PALMTRIE_STRIDE_PROTOTYPES(s)                                   \
+    int palmtrie_mtpt_add_s##s(struct palmtrie_mtpt *, addr_t, addr_t, int, \
+                               void *);                                 \
+    void * palmtrie_mtpt_lookup_s##s(struct palmtrie *, addr_t);        \
+    int palmtrie_mtpt_replace_s##s(struct palmtrie_mtpt *, addr_t, addr_t, \
+                                   int, void *, int *, void **);        \
+    int palmtrie_mtpt_release_s##s(struct palmtrie_mtpt *);             \
+    size_t palmtrie_mtpt_memory_s##s(struct palmtrie_mtpt *);           \
+    void palmtrie_mtpt_stats_s##s(struct palmtrie_mtpt *,               \
+                                  struct palmtrie_stats *);             \
+    void * palmtrie_popmtpt_lookup_s##s(struct palmtrie_popmtpt *, addr_t); \
+    void * palmtrie_popmtpt_lookup_above_s##s(struct palmtrie_popmtpt *,  \
+                                              addr_t, int *, void *);   \
+    void * palmtrie_popmtpt_lookup_above_ref_s##s(struct palmtrie_popmtpt *, \
+                                                  const addr_t *, int *, \
+                                                  void *, void **);     \
+    int palmtrie_popmtpt_add_s##s(struct palmtrie_popmtpt *, addr_t, addr_t, \
+                                  int, void *);                         \
+    int palmtrie_popmtpt_replace_s##s(struct palmtrie_popmtpt *, addr_t, \
+                                      addr_t, int, void *, int *, void **); \
+    int palmtrie_popmtpt_commit_s##s(struct palmtrie_popmtpt *);        \
+    int palmtrie_popmtpt_release_s##s(struct palmtrie_popmtpt *);       \
+    size_t palmtrie_popmtpt_memory_s##s(struct palmtrie_popmtpt *);     \
+    void palmtrie_popmtpt_stats_s##s(struct palmtrie_popmtpt *,         \
+                                     struct palmtrie_stats *);
+PALMTRIE_STRIDE_PROTOTYPES(4)
+PALMTRIE_STRIDE_PROTOTYPES(6)
+PALMTRIE_STRIDE_PROTOTYPES(7)
+PALMTRIE_STRIDE_PROTOTYPES(8)
 
-/* in mtpt.c */
-int palmtrie_mtpt_add(struct palmtrie_mtpt *, addr_t, addr_t, int, void *);
-void * palmtrie_mtpt_lookup(struct palmtrie *, addr_t);
-int palmtrie_mtpt_release(struct palmtrie *);
+/*
+ * Lookup of Palmtrie+ of a fixed stride (e.g., palmtrie_plus_lookup_s8) for
+ * the callers knowing the type and the stride of the palmtrie of the context,
+ * without the dispatch in palmtrie_ctx_lookup()
+ */
+#define PALMTRIE_PLUS_LOOKUP_INLINE(s)                                  \
+    static __inline__ u64                                               \
+    palmtrie_plus_lookup_s##s(struct palmtrie_ctx *ctx, const addr_t *addr) \
+    {                                                                   \
+        void *data;                                                     \
+        int priority;                                                   \
+                                                                        \
+        data = palmtrie_exact_lookup(&ctx->palmtrie->exact, addr,       \
+                                     &priority);                        \
+        if ( PALMTRIE_PREFIX_ONLY                                       \
+             && NULL != ctx->palmtrie->prefix.direct.ptr ) {            \
+            return (u64)palmtrie_prefix_lookup_above(                   \
+                &ctx->palmtrie->prefix, addr, &priority, data);         \
+        }                                                               \
+        return (u64)palmtrie_popmtpt_lookup_above_ref_s##s(             \
+            &ctx->palmtrie->u.popmtpt, addr, &priority, data, ctx->stack); \
+    }
+PALMTRIE_PLUS_LOOKUP_INLINE(4)
+PALMTRIE_PLUS_LOOKUP_INLINE(6)
+PALMTRIE_PLUS_LOOKUP_INLINE(7)
+PALMTRIE_PLUS_LOOKUP_INLINE(8)
 
-/* in popmtpt.c */
-void * palmtrie_popmtpt_lookup(struct palmtrie_popmtpt *, addr_t);
-int
-palmtrie_popmtpt_add(struct palmtrie_popmtpt *, addr_t, addr_t, int, void *);
-int palmtrie_popmtpt_commit(struct palmtrie_popmtpt *);
+#ifdef PALMTRIE_MTPT_STRIDE
+/* Map the unsuffixed names to the instance being compiled */
+#define _PALMTRIE_SYM2(name, s)     name##_s##s
+#define _PALMTRIE_SYM(name, s)      _PALMTRIE_SYM2(name, s)
+#define PALMTRIE_STRIDE_SYM(name)   _PALMTRIE_SYM(name, PALMTRIE_MTPT_STRIDE)
+#define palmtrie_mtpt_add       PALMTRIE_STRIDE_SYM(palmtrie_mtpt_add)
+#define palmtrie_mtpt_lookup    PALMTRIE_STRIDE_SYM(palmtrie_mtpt_lookup)
+#define palmtrie_mtpt_replace   PALMTRIE_STRIDE_SYM(palmtrie_mtpt_replace)
+#define palmtrie_mtpt_release   PALMTRIE_STRIDE_SYM(palmtrie_mtpt_release)
+#define palmtrie_mtpt_delete    PALMTRIE_STRIDE_SYM(palmtrie_mtpt_delete)
+#define palmtrie_mtpt_memory    PALMTRIE_STRIDE_SYM(palmtrie_mtpt_memory)
+#define palmtrie_mtpt_stats     PALMTRIE_STRIDE_SYM(palmtrie_mtpt_stats)
+#define palmtrie_popmtpt_lookup PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_lookup)
+#define palmtrie_popmtpt_lookup_above                           \
+    PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_lookup_above)
+#define palmtrie_popmtpt_lookup_above_ref                       \
+    PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_lookup_above_ref)
+#define palmtrie_popmtpt_add    PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_add)
+#define palmtrie_popmtpt_replace                                \
+    PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_replace)
+#define palmtrie_popmtpt_commit PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_commit)
+#define palmtrie_popmtpt_release                                \
+    PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_release)
+#define palmtrie_popmtpt_memory PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_memory)
+#define palmtrie_popmtpt_stats  PALMTRIE_STRIDE_SYM(palmtrie_popmtpt_stats)
+#endif
 
 #endif
 
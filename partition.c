@@ -0,0 +1,414 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _NBYTES     (int)sizeof(((addr_t *)0)->a)
+
+/*
+ * Group of the rules of the same shape
+ */
+struct _group {
+    u64 shape;
+    size_t nr;
+    int part;
+};
+
+/*
+ * Wildcard shape of the mask: the bitmap of the bytes all of whose bits are
+ * wildcard, e.g., the fields of the 5-tuple that are wildcarded
+ */
+static __inline__ u64
+_shape(const addr_t *mask)
+{
+    const uint8_t *b;
+    u64 shape;
+    int i;
+
+    b = (const uint8_t *)mask->a;
+    shape = 0;
+    for ( i = 0; i < _NBYTES; i++ ) {
+        if ( 0xff == b[i] ) {
+            shape |= 1ULL << i;
+        }
+    }
+
+    return shape;
+}
+
+/*
+ * Compare the groups by the shape for qsort
+ */
+static int
+_cmp_shape(const void *a, const void *b)
+{
+    const struct _group *x;
+    const struct _group *y;
+
+    x = (const struct _group *)a;
+    y = (const struct _group *)b;
+
+    return x->shape < y->shape ? -1 : (x->shape > y->shape ? 1 : 0);
+}
+
+/*
+ * Compare the groups in the descending order of the number of the rules for
+ * qsort
+ */
+static int
+_cmp_nr(const void *a, const void *b)
+{
+    const struct _group *x;
+    const struct _group *y;
+
+    x = (const struct _group *)a;
+    y = (const struct _group *)b;
+
+    return x->nr > y->nr ? -1 : (x->nr < y->nr ? 1 : 0);
+}
+
+/*
+ * Compare the partitions in the descending order of the maximum priority for
+ * qsort
+ */
+static int
+_cmp_priority(const void *a, const void *b)
+{
+    const struct palmtrie_partition_part *x;
+    const struct palmtrie_partition_part *y;
+
+    x = (const struct palmtrie_partition_part *)a;
+    y = (const struct palmtrie_partition_part *)b;
+
+    return x->max_priority > y->max_priority ? -1
+        : (x->max_priority < y->max_priority ? 1 : 0);
+}
+
+/*
+ * Find the group of the shape in the groups sorted by the shape
+ */
+static struct _group *
+_find(struct _group *groups, size_t n, u64 shape)
+{
+    size_t lo;
+    size_t hi;
+    size_t mid;
+
+    lo = 0;
+    hi = n;
+    while ( lo < hi ) {
+        mid = (lo + hi) / 2;
+        if ( groups[mid].shape < shape ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return &groups[lo];
+}
+
+/*
+ * Release the sub-tries
+ */
+static void
+_release_parts(struct palmtrie_partition *pt)
+{
+    int i;
+
+    for ( i = 0; i < pt->nparts; i++ ) {
+        palmtrie_release(pt->parts[i].palmtrie);
+    }
+    free(pt->parts);
+    pt->parts = NULL;
+    pt->nparts = 0;
+}
+
+/*
+ * Group the rules by the shape, and assign the groups to at most
+ * PALMTRIE_PARTITION_MAX partitions; the largest groups have their own
+ * partitions, and the other groups are merged into the partition of the
+ * nearest shape.  Returns the number of the partitions.
+ */
+static int
+_assign(struct palmtrie_partition *pt, struct _group **groupsp, size_t *ngp)
+{
+    struct _group *groups;
+    struct _group *g;
+    size_t ng;
+    size_t i;
+    size_t j;
+    int best;
+    int d;
+    int bd;
+    int np;
+
+    groups = malloc(sizeof(struct _group) * pt->nr);
+    if ( NULL == groups ) {
+        return -1;
+    }
+    for ( i = 0; i < pt->nr; i++ ) {
+        groups[i].shape = _shape(&pt->rules[i].mask);
+        groups[i].nr = 1;
+    }
+    qsort(groups, pt->nr, sizeof(struct _group), _cmp_shape);
+    ng = 0;
+    for ( i = 0; i < pt->nr; i = j ) {
+        for ( j = i + 1; j < pt->nr && groups[j].shape == groups[i].shape;
+              j++ ) {
+        }
+        groups[ng].shape = groups[i].shape;
+        groups[ng].nr = j - i;
+        ng++;
+    }
+
+    /* The partitions of the largest groups; a small group is not worth a
+       sub-trie visited by the lookups */
+    qsort(groups, ng, sizeof(struct _group), _cmp_nr);
+    np = 0;
+    for ( i = 0; i < ng; i++ ) {
+        if ( np < PALMTRIE_PARTITION_MAX
+             && (0 == np
+                 || groups[i].nr * PALMTRIE_PARTITION_MIN >= pt->nr) ) {
+            groups[i].part = np++;
+        } else {
+            groups[i].part = -1;
+        }
+    }
+    for ( i = 0; i < ng; i++ ) {
+        if ( groups[i].part >= 0 ) {
+            continue;
+        }
+        /* The partition of the shape of the least different bytes */
+        best = 0;
+        bd = _NBYTES + 1;
+        for ( j = 0; j < (size_t)np; j++ ) {
+            g = &groups[j];
+            d = __builtin_popcountll(g->shape ^ groups[i].shape);
+            if ( d < bd ) {
+                bd = d;
+                best = g->part;
+            }
+        }
+        groups[i].part = best;
+    }
+    qsort(groups, ng, sizeof(struct _group), _cmp_shape);
+
+    *groupsp = groups;
+    *ngp = ng;
+
+    return np;
+}
+
+/*
+ * Add an entry; the sub-tries are built at commit
+ */
+int
+palmtrie_partition_add(struct palmtrie_partition *pt, addr_t addr,
+                       addr_t mask, int priority, u64 data)
+{
+    struct palmtrie_rule *rules;
+    size_t size;
+
+    if ( pt->nr >= pt->size ) {
+        size = pt->size ? pt->size * 2 : 1024;
+        rules = realloc(pt->rules, sizeof(struct palmtrie_rule) * size);
+        if ( NULL == rules ) {
+            return -1;
+        }
+        pt->rules = rules;
+        pt->size = size;
+    }
+    pt->rules[pt->nr].addr = addr;
+    pt->rules[pt->nr].mask = mask;
+    pt->rules[pt->nr].priority = priority;
+    pt->rules[pt->nr].data = data;
+    pt->nr++;
+
+    return 0;
+}
+
+/*
+ * Partition the rules by the shape, and build the Palmtrie+ sub-trie of the
+ * stride for each partition
+ */
+int
+palmtrie_partition_commit(struct palmtrie_partition *pt, int stride)
+{
+    struct palmtrie_partition_part *parts;
+    struct palmtrie_rule *r;
+    struct _group *groups;
+    struct _group *g;
+    size_t ng;
+    size_t i;
+    int np;
+    int p;
+
+    _release_parts(pt);
+    if ( 0 == pt->nr ) {
+        return 0;
+    }
+    np = _assign(pt, &groups, &ng);
+    if ( np < 0 ) {
+        return -1;
+    }
+    parts = calloc(np, sizeof(struct palmtrie_partition_part));
+    if ( NULL == parts ) {
+        free(groups);
+        return -1;
+    }
+    pt->parts = parts;
+    for ( i = 0; i < ng; i++ ) {
+        parts[groups[i].part].nr += groups[i].nr;
+    }
+    for ( p = 0; p < np; p++ ) {
+        parts[p].max_priority = -1;
+        parts[p].palmtrie = palmtrie_init(NULL, PALMTRIE_PLUS, stride);
+        if ( NULL == parts[p].palmtrie ) {
+            free(groups);
+            _release_parts(pt);
+            return -1;
+        }
+        pt->nparts++;
+    }
+
+    for ( i = 0; i < pt->nr; i++ ) {
+        r = &pt->rules[i];
+        g = _find(groups, ng, _shape(&r->mask));
+        p = g->part;
+        if ( palmtrie_add_data(parts[p].palmtrie, r->addr, r->mask,
+                               r->priority, r->data) < 0 ) {
+            free(groups);
+            _release_parts(pt);
+            return -1;
+        }
+        if ( r->priority > parts[p].max_priority ) {
+            parts[p].max_priority = r->priority;
+        }
+    }
+    free(groups);
+    for ( p = 0; p < np; p++ ) {
+        if ( palmtrie_commit(parts[p].palmtrie) < 0 ) {
+            _release_parts(pt);
+            return -1;
+        }
+    }
+
+    /* The lookup visits the partitions in the descending order of the
+       maximum priority */
+    qsort(parts, np, sizeof(struct palmtrie_partition_part), _cmp_priority);
+
+    return 0;
+}
+
+/*
+ * Lookup the partitions until the best match found beats the maximum
+ * priority of the next partition
+ */
+void *
+palmtrie_partition_lookup(struct palmtrie_partition *pt, addr_t addr)
+{
+    return palmtrie_partition_lookup_ref(pt, &addr, NULL);
+}
+
+/*
+ * Lookup the partitions by the reference to the address with the traversal
+ * stack or NULL
+ */
+void *
+palmtrie_partition_lookup_ref(struct palmtrie_partition *pt,
+                              const addr_t *addr, void **stack)
+{
+    void *data;
+    int priority;
+    int i;
+
+    data = NULL;
+    priority = -1;
+    for ( i = 0; i < pt->nparts; i++ ) {
+        if ( pt->parts[i].max_priority <= priority ) {
+            break;
+        }
+        data = palmtrie_plus_lookup_above_ref(pt->parts[i].palmtrie, addr,
+                                              &priority, data, stack);
+    }
+
+    return data;
+}
+
+/*
+ * Release the instance
+ */
+int
+palmtrie_partition_release(struct palmtrie_partition *pt)
+{
+    _release_parts(pt);
+    free(pt->rules);
+    pt->rules = NULL;
+    pt->nr = 0;
+    pt->size = 0;
+
+    return 0;
+}
+
+/*
+ * Memory size of the sub-tries in bytes
+ */
+size_t
+palmtrie_partition_memory(struct palmtrie_partition *pt)
+{
+    size_t sz;
+    int i;
+
+    sz = sizeof(struct palmtrie_partition_part) * pt->nparts;
+    for ( i = 0; i < pt->nparts; i++ ) {
+        sz += palmtrie_memory(pt->parts[i].palmtrie);
+    }
+
+    return sz;
+}
+
+/*
+ * Statistics summed up over the sub-tries
+ */
+void
+palmtrie_partition_stats(struct palmtrie_partition *pt,
+                         struct palmtrie_stats *stats)
+{
+    struct palmtrie_stats ps;
+    int i;
+
+    for ( i = 0; i < pt->nparts; i++ ) {
+        palmtrie_get_stats(pt->parts[i].palmtrie, &ps);
+        stats->build_bytes += ps.build_bytes;
+        stats->inode_bytes += ps.inode_bytes;
+        stats->leaf_bytes += ps.leaf_bytes;
+        stats->rules += ps.rules;
+        stats->inodes += ps.inodes;
+        stats->leaves += ps.leaves;
+        stats->children += ps.children;
+        stats->ternaries += ps.ternaries;
+        stats->duplicates += ps.duplicates;
+        stats->compressible += ps.compressible;
+        stats->avg_depth += ps.avg_depth * ps.leaves;
+        if ( ps.max_depth > stats->max_depth ) {
+            stats->max_depth = ps.max_depth;
+        }
+    }
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -3,6 +3,11 @@
  * All rights reserved.
  */
 
+/* Built once for each stride; see Makefile.am */
+#ifndef PALMTRIE_MTPT_STRIDE
+#error "PALMTRIE_MTPT_STRIDE must be defined."
+#endif
+
 #include "palmtrie.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,7 +20,180 @@
 
 #define PALMTRIE_POPMTPT_NR_NODES      (1 << 23)
 
-#define _STACK_DEPTH    64
+#define _STACK_DEPTH    PALMTRIE_STACK_DEPTH
+#define _NBITMAPS       (((1 << PALMTRIE_MTPT_STRIDE) + 63) >> 6)
+/* Candidate nodes of an entry of the direct table at most */
+#define _DIRECT_LIST    (PALMTRIE_STACK_DEPTH / 4)
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+
+/*
+ * Set the bits from the bit position in the key, ignoring the guard bits
+ */
+static __inline__ void
+_prove(addr_t *proven, int bit, int n)
+{
+    int b;
+
+    for ( b = bit < 0 ? 0 : bit; b < bit + n; b++ ) {
+        BTS(*proven, b);
+    }
+}
+
+/*
+ * Get the index of the rule of a node in the rule table, adding the rule if
+ * it is not in the table yet.  A rule is at the same index for all the leaves
+ * referring to it, since the key is unique in the multiway trie.
+ */
+static int64_t
+_rule(struct palmtrie_popmtpt *t, struct palmtrie_mtpt_node_data *n)
+{
+    uint32_t size;
+    void *ptr;
+
+    if ( n->rule < t->rules.nr
+         && 0 == memcmp(&t->rules.addr[n->rule], &n->addr, sizeof(addr_t))
+         && 0 == memcmp(&t->rules.mask[n->rule], &n->mask, sizeof(addr_t)) ) {
+        return n->rule;
+    }
+    if ( t->rules.nr >= t->rules.size ) {
+        size = t->rules.size ? t->rules.size * 2 : 1024;
+        ptr = realloc(t->rules.priority, sizeof(int32_t) * size);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->rules.priority = ptr;
+        ptr = realloc(t->rules.data, sizeof(void *) * size);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->rules.data = ptr;
+        ptr = realloc(t->rules.addr, sizeof(addr_t) * size);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->rules.addr = ptr;
+        ptr = realloc(t->rules.mask, sizeof(addr_t) * size);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->rules.mask = ptr;
+        t->rules.size = size;
+    }
+    t->rules.priority[t->rules.nr] = n->priority;
+    t->rules.data[t->rules.nr] = n->data;
+    t->rules.addr[t->rules.nr] = n->addr;
+    t->rules.mask[t->rules.nr] = n->mask;
+    n->rule = t->rules.nr;
+
+    return t->rules.nr++;
+}
+
+/*
+ * Release the rule table
+ */
+static void
+_rules_release(struct palmtrie_popmtpt *t)
+{
+    free(t->rules.priority);
+    free(t->rules.data);
+    free(t->rules.addr);
+    free(t->rules.mask);
+    memset(&t->rules, 0, sizeof(t->rules));
+}
+
+/*
+ * Copy a leaf referring to the rule with the key words to be checked; the
+ * bits proven by the path from the root and the wildcard bits are not
+ * checked, and the words to be zero are only in the bitmap.  The ranges of
+ * the rules are checked at the leaf whose data is the group of the range
+ * rules of the key.
+ */
+static int
+_leaf(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *c,
+      struct palmtrie_mtpt_node_data *n, const addr_t *proven)
+{
+    struct palmtrie_range_group *g;
+    uint64_t care;
+    int64_t rule;
+    int nw;
+    int i;
+
+    rule = _rule(t, n);
+    if ( rule < 0 ) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    c->bit = -PALMTRIE_MTPT_STRIDE - 1;
+    c->u.leaf.rule = rule;
+    c->u.leaf.priority = n->priority;
+    c->u.leaf.ranges = 0;
+    if ( NULL != t->ranges ) {
+        g = palmtrie_range_find(t->ranges, &n->addr, &n->mask);
+        c->u.leaf.ranges = NULL != g && (void *)g == n->data;
+    }
+
+    c->u.leaf.bitmap = 0;
+    c->u.leaf.zeros = 0;
+    nw = 0;
+    for ( i = 0; i < _NWORDS; i++ ) {
+        care = ~n->mask.a[i] & ~proven->a[i];
+        if ( 0 == care ) {
+            continue;
+        } else if ( ~0ULL == care && 0 == n->addr.a[i] ) {
+            c->u.leaf.zeros |= 1 << i;
+            continue;
+        }
+        if ( nw < PALMTRIE_LEAF_WORDS ) {
+            c->u.leaf.words[nw].care = care;
+            c->u.leaf.words[nw].addr = n->addr.a[i] & care;
+        }
+        c->u.leaf.bitmap |= 1 << i;
+        nw++;
+    }
+
+    return 0;
+}
+
+/*
+ * Check the key words of a leaf; the words that do not fit in the leaf are
+ * checked against the key of the rule
+ */
+static __inline__ int
+_match(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *n,
+       const addr_t *addr)
+{
+    const struct palmtrie_popmtpt_word *w;
+    const addr_t *raddr;
+    const addr_t *rmask;
+    unsigned int b;
+    int i;
+
+    b = n->u.leaf.bitmap;
+    if ( __builtin_expect(!!(popcnt(b) <= PALMTRIE_LEAF_WORDS), 1) ) {
+        w = n->u.leaf.words;
+        for ( ; b; b &= b - 1, w++ ) {
+            if ( (addr->a[__builtin_ctz(b)] & w->care) != w->addr ) {
+                return 0;
+            }
+        }
+    } else {
+        raddr = &t->rules.addr[n->u.leaf.rule];
+        rmask = &t->rules.mask[n->u.leaf.rule];
+        for ( ; b; b &= b - 1 ) {
+            i = __builtin_ctz(b);
+            if ( (addr->a[i] ^ raddr->a[i]) & ~rmask->a[i] ) {
+                return 0;
+            }
+        }
+    }
+    for ( b = n->u.leaf.zeros; b; b &= b - 1 ) {
+        if ( addr->a[__builtin_ctz(b)] ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
 
 /*
  * Check if the  node is compressible or not
@@ -79,13 +257,15 @@ _compressible_leaf(struct palmtrie_mtpt_node_data *n)
  */
 static int
 _traverse_node(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *pn,
-               struct palmtrie_mtpt_node_data *n)
+               struct palmtrie_mtpt_node_data *n, const addr_t *proven)
 {
     int i;
     int pos;
-    uint64_t bitmap[(1 << PALMTRIE_MTPT_STRIDE) >> 6];
+    int ret;
+    uint64_t bitmap[((1 << PALMTRIE_MTPT_STRIDE) + 63) >> 6];
     struct palmtrie_popmtpt_node *c;
     struct palmtrie_mtpt_node_data *cl;
+    addr_t p;
 
     if ( NULL == n ) {
         return -1;
@@ -149,30 +329,28 @@ _traverse_node(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *pn,
     pos = 0;
     for ( i = 0; i < (1 << PALMTRIE_MTPT_STRIDE); i++ ) {
         if ( NULL != n->children[i] ) {
+            /* All the bits of the stride are proven by the child */
+            p = *proven;
+            _prove(&p, n->bit, PALMTRIE_MTPT_STRIDE);
             if ( n->bit > n->children[i]->bit ) {
                 cl = _compressible_leaf(n->children[i]);
                 if ( cl ) {
                     /* Leaf */
-                    c[pos].bit = -PALMTRIE_MTPT_STRIDE - 1;
-                    c[pos].u.leaf.addr = cl->addr;
-                    c[pos].u.leaf.mask = cl->mask;
-                    c[pos].u.leaf.data = cl->data;
-                    c[pos].u.leaf.priority = cl->priority;
+                    ret = _leaf(t, &c[pos], cl, &p);
                     pos++;
                 } else {
                     /* Traverse */
-                    _traverse_node(t, &c[pos], n->children[i]);
+                    ret = _traverse_node(t, &c[pos], n->children[i], &p);
                     pos++;
                 }
             } else {
                 /* Leaf */
-                c[pos].bit = -PALMTRIE_MTPT_STRIDE - 1;
-                c[pos].u.leaf.addr = n->children[i]->addr;
-                c[pos].u.leaf.mask = n->children[i]->mask;
-                c[pos].u.leaf.data = n->children[i]->data;
-                c[pos].u.leaf.priority = n->children[i]->priority;
+                ret = _leaf(t, &c[pos], n->children[i], &p);
                 pos++;
             }
+            if ( ret < 0 ) {
+                return -1;
+            }
         }
     }
 
@@ -228,29 +406,29 @@ _traverse_node(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *pn,
     pos = 0;
     for ( i = 0; i < (1 << PALMTRIE_MTPT_STRIDE) - 1; i++ ) {
         if ( NULL != n->ternaries[i] ) {
+            /* The most significant bits of the stride above the wildcard
+               suffix are proven by the ternary */
+            p = *proven;
+            _prove(&p, n->bit + PALMTRIE_MTPT_STRIDE
+                   - (31 - __builtin_clz(i + 1)), 31 - __builtin_clz(i + 1));
             if ( n->bit > n->ternaries[i]->bit ) {
                 cl = _compressible_leaf(n->ternaries[i]);
                 if ( cl ) {
-                    c[pos].bit = -PALMTRIE_MTPT_STRIDE - 1;
-                    c[pos].u.leaf.addr = cl->addr;
-                    c[pos].u.leaf.mask = cl->mask;
-                    c[pos].u.leaf.data = cl->data;
-                    c[pos].u.leaf.priority = cl->priority;
+                    ret = _leaf(t, &c[pos], cl, &p);
                     pos++;
                 } else {
                     /* Traverse */
-                    _traverse_node(t, &c[pos], n->ternaries[i]);
+                    ret = _traverse_node(t, &c[pos], n->ternaries[i], &p);
                     pos++;
                 }
             } else {
                 /* Terminate */
-                c[pos].bit = -PALMTRIE_MTPT_STRIDE - 1;
-                c[pos].u.leaf.addr = n->ternaries[i]->addr;
-                c[pos].u.leaf.mask = n->ternaries[i]->mask;
-                c[pos].u.leaf.data = n->ternaries[i]->data;
-                c[pos].u.leaf.priority = n->ternaries[i]->priority;
+                ret = _leaf(t, &c[pos], n->ternaries[i], &p);
                 pos++;
             }
+            if ( ret < 0 ) {
+                return -1;
+            }
         }
     }
 
@@ -264,6 +442,7 @@ static int
 _convert(struct palmtrie_popmtpt *popmtpt)
 {
     struct palmtrie_popmtpt_node *c;
+    addr_t proven = PALMTRIE_ADDR_ZERO;
     int ret;
 
     popmtpt->nodes.nr = PALMTRIE_POPMTPT_NR_NODES;
@@ -278,7 +457,7 @@ _convert(struct palmtrie_popmtpt *popmtpt)
     c = &popmtpt->nodes.ptr[popmtpt->nodes.used];
     popmtpt->root = popmtpt->nodes.used;
     popmtpt->nodes.used++;
-    ret = _traverse_node(popmtpt, c, popmtpt->mtpt.root);
+    ret = _traverse_node(popmtpt, c, popmtpt->mtpt.root, &proven);
     if ( ret < 0 ) {
         return -1;
     }
@@ -287,12 +466,461 @@ _convert(struct palmtrie_popmtpt *popmtpt)
 }
 
 /*
- * Lookup an entry corresponding to the specified address
+ * Get the index of the first child (or ternary) of an internal node
+ */
+static __inline__ uint32_t
+_block_start(const struct palmtrie_popmtpt_node *n, int ternary)
+{
+#if PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT
+    return ternary ? n->u.inode.tbase : n->u.inode.cbase;
+#else
+    return ternary ? n->u.inode.ternaries[0] : n->u.inode.children[0];
+#endif
+}
+
+/*
+ * Get the number of the children (or the ternaries) of an internal node
+ */
+static __inline__ uint32_t
+_block_len(const struct palmtrie_popmtpt_node *n, int ternary)
+{
+    const uint64_t *bitmap;
+    uint32_t len;
+    int i;
+
+    bitmap = ternary ? n->u.inode.bitmap_t : n->u.inode.bitmap_c;
+    len = 0;
+    for ( i = 0; i < _NBITMAPS; i++ ) {
+        len += popcnt(bitmap[i]);
+    }
+
+    return len;
+}
+
+/*
+ * Move the children (or the ternaries) of an internal node to the block
+ * starting at the specified index
+ */
+static __inline__ void
+_block_move(struct palmtrie_popmtpt_node *n, int ternary, uint32_t start)
+{
+#if PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT
+    if ( ternary ) {
+        n->u.inode.tbase = start;
+    } else {
+        n->u.inode.cbase = start;
+    }
+#else
+    uint32_t *base;
+    uint32_t old;
+    int i;
+
+    base = ternary ? n->u.inode.ternaries : n->u.inode.children;
+    old = base[0];
+    for ( i = 0; i < _NBITMAPS; i++ ) {
+        base[i] = base[i] - old + start;
+    }
+#endif
+}
+
+/*
+ * Hash of a node whose children and ternaries are already shared
+ */
+static u64
+_node_hash(const struct palmtrie_popmtpt *t,
+           const struct palmtrie_popmtpt_node *n)
+{
+    u64 h;
+    int i;
+
+    h = (u64)(uint16_t)n->bit * 0x9e3779b97f4a7c15ULL;
+    if ( n->bit < -PALMTRIE_MTPT_STRIDE ) {
+        h = (h ^ (uint32_t)n->u.leaf.priority) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ (uintptr_t)t->rules.data[n->u.leaf.rule])
+            * 0x9e3779b97f4a7c15ULL;
+        if ( popcnt(n->u.leaf.bitmap) > PALMTRIE_LEAF_WORDS ) {
+            return (h ^ n->u.leaf.rule) * 0x9e3779b97f4a7c15ULL;
+        }
+        for ( i = 0; i < popcnt(n->u.leaf.bitmap); i++ ) {
+            h = (h ^ n->u.leaf.words[i].addr) * 0x9e3779b97f4a7c15ULL;
+        }
+        return h ^ n->u.leaf.bitmap;
+    }
+    for ( i = 0; i < _NBITMAPS; i++ ) {
+        h = (h ^ n->u.inode.bitmap_c[i]) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ n->u.inode.bitmap_t[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+    h = (h ^ _block_start(n, 0)) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ _block_start(n, 1)) * 0x9e3779b97f4a7c15ULL;
+
+    return h;
+}
+
+/*
+ * Check if two nodes whose children and ternaries are already shared are
+ * interchangeable; a leaf refers to the rule only for the data unless the key
+ * words do not fit in the leaf
+ */
+static int
+_same_node(const struct palmtrie_popmtpt *t,
+           const struct palmtrie_popmtpt_node *a,
+           const struct palmtrie_popmtpt_node *b)
+{
+    int nw;
+    int i;
+
+    if ( a->bit != b->bit ) {
+        return 0;
+    }
+    if ( a->bit < -PALMTRIE_MTPT_STRIDE ) {
+        if ( a->u.leaf.priority != b->u.leaf.priority
+             || a->u.leaf.ranges != b->u.leaf.ranges
+             || a->u.leaf.bitmap != b->u.leaf.bitmap
+             || a->u.leaf.zeros != b->u.leaf.zeros
+             || t->rules.data[a->u.leaf.rule]
+             != t->rules.data[b->u.leaf.rule] ) {
+            return 0;
+        }
+        nw = popcnt(a->u.leaf.bitmap);
+        if ( nw > PALMTRIE_LEAF_WORDS ) {
+            return a->u.leaf.rule == b->u.leaf.rule;
+        }
+        for ( i = 0; i < nw; i++ ) {
+            if ( a->u.leaf.words[i].care != b->u.leaf.words[i].care
+                 || a->u.leaf.words[i].addr != b->u.leaf.words[i].addr ) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+#if PALMTRIE_PRIORITY_SKIP
+    if ( a->u.inode.max_priority != b->u.inode.max_priority ) {
+        return 0;
+    }
+#endif
+#if PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT
+    if ( a->u.inode.cbase != b->u.inode.cbase
+         || a->u.inode.tbase != b->u.inode.tbase ) {
+        return 0;
+    }
+#endif
+
+    return 0 == memcmp(a->u.inode.bitmap_c, b->u.inode.bitmap_c,
+                       sizeof(a->u.inode.bitmap_c))
+        && 0 == memcmp(a->u.inode.bitmap_t, b->u.inode.bitmap_t,
+                       sizeof(a->u.inode.bitmap_t))
+        && 0 == memcmp(a->u.inode.children, b->u.inode.children,
+                       sizeof(a->u.inode.children))
+        && 0 == memcmp(a->u.inode.ternaries, b->u.inode.ternaries,
+                       sizeof(a->u.inode.ternaries));
+}
+
+/*
+ * Share the identical blocks of the children and the ternaries in the
+ * compiled trie, and renumber the nodes reachable from the root.  The blocks
+ * of a node are after the node, so the nodes are visited from the last one
+ * to share the blocks bottom-up; a table entry is the length of a block in
+ * the upper 32 bits and its first node in the lower 32 bits.
+ */
+static int
+_share(struct palmtrie_popmtpt *t)
+{
+    struct palmtrie_popmtpt_node *n;
+    struct palmtrie_popmtpt_node c;
+    uint32_t *idx;
+    u64 *table;
+    size_t size;
+    size_t j;
+    uint32_t start;
+    uint32_t len;
+    uint32_t k;
+    int64_t i;
+    int ternary;
+    u64 h;
+
+    for ( size = 1024; size < (size_t)t->nodes.used * 2; size <<= 1 ) {
+    }
+    table = calloc(size, sizeof(u64));
+    if ( NULL == table ) {
+        return -1;
+    }
+    for ( i = t->nodes.used - 1; i >= 0; i-- ) {
+        n = &t->nodes.ptr[i];
+        if ( n->bit < -PALMTRIE_MTPT_STRIDE ) {
+            continue;
+        }
+        for ( ternary = 0; ternary < 2; ternary++ ) {
+            len = _block_len(n, ternary);
+            if ( 0 == len ) {
+                _block_move(n, ternary, 0);
+                continue;
+            }
+            start = _block_start(n, ternary);
+            h = len;
+            for ( k = 0; k < len; k++ ) {
+                h = (h ^ _node_hash(t, &t->nodes.ptr[start + k]))
+                    * 0x9e3779b97f4a7c15ULL;
+            }
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            for ( j = h & (size - 1); ; j = (j + 1) & (size - 1) ) {
+                if ( 0 == table[j] ) {
+                    table[j] = ((u64)len << 32) | start;
+                    break;
+                }
+                if ( (table[j] >> 32) != len ) {
+                    continue;
+                }
+                for ( k = 0; k < len; k++ ) {
+                    if ( !_same_node(t, &t->nodes.ptr[(uint32_t)table[j] + k],
+                                     &t->nodes.ptr[start + k]) ) {
+                        break;
+                    }
+                }
+                if ( k == len ) {
+                    _block_move(n, ternary, (uint32_t)table[j]);
+                    break;
+                }
+            }
+        }
+    }
+    free(table);
+
+    /* Mark the reachable nodes, and then renumber them in the same order */
+    idx = calloc(t->nodes.used, sizeof(uint32_t));
+    if ( NULL == idx ) {
+        return -1;
+    }
+    idx[t->root] = 1;
+    for ( i = 0; i < t->nodes.used; i++ ) {
+        n = &t->nodes.ptr[i];
+        if ( !idx[i] || n->bit < -PALMTRIE_MTPT_STRIDE ) {
+            continue;
+        }
+        for ( ternary = 0; ternary < 2; ternary++ ) {
+            start = _block_start(n, ternary);
+            len = _block_len(n, ternary);
+            for ( k = 0; k < len; k++ ) {
+                idx[start + k] = 1;
+            }
+        }
+    }
+    k = 0;
+    for ( i = 0; i < t->nodes.used; i++ ) {
+        if ( idx[i] ) {
+            idx[i] = k++;
+        } else {
+            idx[i] = UINT32_MAX;
+        }
+    }
+    for ( i = 0; i < t->nodes.used; i++ ) {
+        if ( UINT32_MAX == idx[i] ) {
+            continue;
+        }
+        c = t->nodes.ptr[i];
+        if ( c.bit >= -PALMTRIE_MTPT_STRIDE ) {
+            for ( ternary = 0; ternary < 2; ternary++ ) {
+                if ( _block_len(&c, ternary) ) {
+                    _block_move(&c, ternary, idx[_block_start(&c, ternary)]);
+                }
+            }
+        }
+        t->nodes.ptr[idx[i]] = c;
+    }
+    t->root = idx[t->root];
+    t->nodes.used = k;
+    free(idx);
+
+    /* Return the pages of the unreachable nodes */
+    n = realloc(t->nodes.ptr, sizeof(struct palmtrie_popmtpt_node) * k);
+    if ( NULL != n ) {
+        t->nodes.ptr = n;
+        t->nodes.nr = k;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the index of the child (or the ternary) of the slot of an internal node
+ * in the node array, or -1 if there is no such node
  */
-static struct palmtrie_popmtpt_node *
-_lookup(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *node,
-        addr_t addr, struct palmtrie_popmtpt_node *res)
+static int64_t
+_slot(const struct palmtrie_popmtpt_node *n, int ternary, int idx)
 {
+    const uint64_t *bitmap;
+    uint32_t base;
+
+    bitmap = ternary ? n->u.inode.bitmap_t : n->u.inode.bitmap_c;
+    if ( !((1ULL << (idx & 0x3f)) & bitmap[idx >> 6]) ) {
+        return -1;
+    }
+#if PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT
+    base = ternary ? n->u.inode.tbase + n->u.inode.ternaries[idx >> 6]
+        : n->u.inode.cbase + n->u.inode.children[idx >> 6];
+#else
+    base = ternary ? n->u.inode.ternaries[idx >> 6]
+        : n->u.inode.children[idx >> 6];
+#endif
+
+    return base + popcnt(((1ULL << (idx & 0x3f)) - 1) & bitmap[idx >> 6]);
+}
+
+/*
+ * Append the candidate nodes of a node to the list for the keys whose bits
+ * from lo to hi are the ones of the specified key.  An internal node whose
+ * stride is in these bits is replaced with the nodes pushed by the lookup in
+ * the same order, unless the list grows beyond _DIRECT_LIST nodes with the
+ * reserve of the entries for the siblings appended after the node.
+ */
+static int
+_direct_expand(struct palmtrie_popmtpt *t, uint32_t index, const addr_t *key,
+               int lo, int hi, uint32_t *list, int n, int reserve)
+{
+    struct palmtrie_popmtpt_node *node;
+    int64_t next[PALMTRIE_MTPT_STRIDE + 1];
+    int sidx;
+    int idx;
+    int nr;
+    int c;
+    int i;
+
+    node = &t->nodes.ptr[index];
+    if ( node->bit < -PALMTRIE_MTPT_STRIDE || node->bit < lo
+         || node->bit + PALMTRIE_MTPT_STRIDE - 1 > hi ) {
+        /* Leaf, or not resolved by the bits */
+        list[n++] = index;
+        return n;
+    }
+
+    sidx = EXTRACTN(*key, node->bit, PALMTRIE_MTPT_STRIDE);
+    nr = 0;
+#if PALMTRIE_EXACTMATCH_FIRST \
+    && !(PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT)
+    next[nr++] = _slot(node, 0, sidx);
+#endif
+    idx = (sidx >> 1) | (1 << (PALMTRIE_MTPT_STRIDE - 1));
+    for ( i = PALMTRIE_MTPT_STRIDE - 1; i >= 0; i-- ) {
+        next[nr++] = _slot(node, 1, (idx >> i) - 1);
+    }
+#if !PALMTRIE_EXACTMATCH_FIRST \
+    || (PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT)
+    next[nr++] = _slot(node, 0, sidx);
+#endif
+
+    c = 0;
+    for ( i = 0; i < nr; i++ ) {
+        c += next[i] >= 0;
+    }
+    if ( n + c + reserve > _DIRECT_LIST ) {
+        list[n++] = index;
+        return n;
+    }
+    for ( i = 0; i < nr; i++ ) {
+        if ( next[i] >= 0 ) {
+            /* Each of the following siblings takes an entry at least */
+            c--;
+            n = _direct_expand(t, next[i], key, lo, hi, list, n,
+                               reserve + c);
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Build the direct table from the PALMTRIE_PLUS_DIRECT bits at the top of the
+ * stride of the root to the candidate nodes, only if the table is not larger
+ * than the compiled nodes; the same lists of the consecutive entries are
+ * shared
+ */
+static int
+_direct(struct palmtrie_popmtpt *t)
+{
+    uint32_t list[_DIRECT_LIST];
+    uint32_t prev;
+    uint32_t size;
+    uint32_t v;
+    addr_t key;
+    void *ptr;
+    int bits;
+    int hi;
+    int lo;
+    int n;
+    int b;
+
+    bits = PALMTRIE_PLUS_DIRECT;
+    hi = t->nodes.ptr[t->root].bit + PALMTRIE_MTPT_STRIDE - 1;
+    lo = hi - bits + 1;
+    if ( bits <= 0 || t->nodes.ptr[t->root].bit < -PALMTRIE_MTPT_STRIDE
+         || lo < 0 || (sizeof(uint32_t) << bits)
+         > sizeof(struct palmtrie_popmtpt_node) * t->nodes.used ) {
+        return 0;
+    }
+
+    t->direct.ptr = malloc(sizeof(uint32_t) << bits);
+    if ( NULL == t->direct.ptr ) {
+        return -1;
+    }
+    prev = 0;
+    for ( v = 0; v < (1U << bits); v++ ) {
+        memset(&key, 0, sizeof(addr_t));
+        for ( b = 0; b < bits; b++ ) {
+            if ( (v >> b) & 1 ) {
+                BTS(key, lo + b);
+            }
+        }
+        n = _direct_expand(t, t->root, &key, lo, hi, list, 0, 0);
+        if ( v > 0 && t->direct.pool.ptr[prev] == (uint32_t)n
+             && 0 == memcmp(&t->direct.pool.ptr[prev + 1], list,
+                            sizeof(uint32_t) * n) ) {
+            t->direct.ptr[v] = prev;
+            continue;
+        }
+        if ( t->direct.pool.nr + n + 1 > t->direct.pool.size ) {
+            size = t->direct.pool.size ? t->direct.pool.size * 2 : 4096;
+            ptr = realloc(t->direct.pool.ptr, sizeof(uint32_t) * size);
+            if ( NULL == ptr ) {
+                return -1;
+            }
+            t->direct.pool.ptr = ptr;
+            t->direct.pool.size = size;
+        }
+        prev = t->direct.pool.nr;
+        t->direct.pool.ptr[prev] = n;
+        memcpy(&t->direct.pool.ptr[prev + 1], list, sizeof(uint32_t) * n);
+        t->direct.pool.nr += n + 1;
+        t->direct.ptr[v] = prev;
+    }
+    t->direct.bits = bits;
+    t->direct.bit = lo;
+
+    return 0;
+}
+
+/*
+ * Release the direct table
+ */
+static void
+_direct_release(struct palmtrie_popmtpt *t)
+{
+    free(t->direct.ptr);
+    free(t->direct.pool.ptr);
+    memset(&t->direct, 0, sizeof(t->direct));
+}
+
+/*
+ * Lookup an entry corresponding to the specified address of a higher
+ * priority than the specified one from the specified nodes; the data of the
+ * rule is taken from the rule table only for the result
+ */
+static void *
+_lookup(struct palmtrie_popmtpt *t, const uint32_t *roots, int n,
+        const addr_t *addr, int *priority, void *data, void **ptrs)
+{
+    struct palmtrie_popmtpt_node *node;
     int sidx;
     int idx;
     int i;
@@ -300,38 +928,49 @@ _lookup(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *node,
     int nr;
     int tmp;
     int pidx;
-    struct palmtrie_popmtpt_node **ptrs;
+    const struct palmtrie_range_rule *r;
+    int64_t rule;
+    int prio;
 
-    ptrs = alloca(sizeof(struct palmtrie_popmtpt_node *) * _STACK_DEPTH);
+    /* The match of the range rules has the data itself */
+    rule = -1;
+    prio = *priority;
 
-    if ( __builtin_expect(!!(NULL == node), 0) ) {
-        return res;
+    for ( nr = 0; nr < n; nr++ ) {
+        ptrs[nr] = &t->nodes.ptr[roots[nr]];
     }
-
-    nr = 0;
-    ptrs[nr++] = node;
     while ( nr > 0 ) {
         nr--;
         node = ptrs[nr];
 
         if ( node->bit < -PALMTRIE_MTPT_STRIDE ) {
             /* Leaf */
-            if ( node->u.leaf.priority > res->u.leaf.priority &&
-                 ADDR_MASK_CMP2(addr, node->u.leaf.mask, node->u.leaf.addr) ) {
-                res = node;
+            if ( node->u.leaf.priority > prio && _match(t, node, addr) ) {
+                if ( __builtin_expect(!!node->u.leaf.ranges, 0) ) {
+                    r = palmtrie_range_lookup(
+                        t->rules.data[node->u.leaf.rule], addr, prio);
+                    if ( NULL != r ) {
+                        prio = r->priority;
+                        data = r->data;
+                        rule = -1;
+                    }
+                    continue;
+                }
+                prio = node->u.leaf.priority;
+                rule = node->u.leaf.rule;
             }
             continue;
         }
 
 #if PALMTRIE_PRIORITY_SKIP
-        if ( res->u.leaf.priority >= node->u.inode.max_priority ) {
+        if ( prio >= node->u.inode.max_priority ) {
             continue;
         }
 #endif
 
 #if PALMTRIE_MTPT_STRIDE == 8 && PALMTRIE_STRIDE_OPT
         uint32_t base;
-        sidx = EXTRACTN(addr, node->bit, PALMTRIE_MTPT_STRIDE);
+        sidx = EXTRACTN(*addr, node->bit, PALMTRIE_MTPT_STRIDE);
         idx = (sidx >> 1) | (1 << (PALMTRIE_MTPT_STRIDE - 1));
 
         if ( node->u.inode.bitmap_t[0] ) {
@@ -387,7 +1026,7 @@ _lookup(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *node,
 #else
 
         /* Sort by priority (roughly) */
-        sidx = EXTRACTN(addr, node->bit, PALMTRIE_MTPT_STRIDE);
+        sidx = EXTRACTN(*addr, node->bit, PALMTRIE_MTPT_STRIDE);
 #if PALMTRIE_EXACTMATCH_FIRST
         idx = sidx;
         if ( (1ULL << (idx & 0x3f)) & node->u.inode.bitmap_c[idx >> 6] ) {
@@ -486,19 +1125,56 @@ _lookup(struct palmtrie_popmtpt *t, struct palmtrie_popmtpt_node *node,
             fprintf(stderr, "Fatal error: Stack overflow\n");
         }
     }
+    *priority = prio;
 
-    return res;
+    return rule < 0 ? data : t->rules.data[rule];
 }
 void *
 palmtrie_popmtpt_lookup(struct palmtrie_popmtpt *t, addr_t addr)
 {
-    struct palmtrie_popmtpt_node *n;
-    struct palmtrie_popmtpt_node sentinel;
+    int priority;
+
+    priority = -1;
+    return palmtrie_popmtpt_lookup_above(t, addr, &priority, NULL);
+}
+
+/*
+ * Lookup an entry of a higher priority than the specified priority, and
+ * return the specified data if there is no such entry.  The priority is
+ * updated to the one of the returned data.
+ */
+void *
+palmtrie_popmtpt_lookup_above(struct palmtrie_popmtpt *t, addr_t addr,
+                              int *priority, void *data)
+{
+    return palmtrie_popmtpt_lookup_above_ref(t, &addr, priority, data, NULL);
+}
+
+/*
+ * Lookup an entry of a higher priority than the specified priority by the
+ * reference to the address, with the traversal stack of PALMTRIE_STACK_DEPTH
+ * entries preallocated by the caller, or on the stack if it is NULL
+ */
+void *
+palmtrie_popmtpt_lookup_above_ref(struct palmtrie_popmtpt *t,
+                                  const addr_t *addr, int *priority,
+                                  void *data, void **stack)
+{
+    void *ptrs[_STACK_DEPTH];
+    const uint32_t *c;
+
+    if ( NULL == t->nodes.ptr ) {
+        return data;
+    }
+    if ( NULL != t->direct.ptr ) {
+        c = &t->direct.pool.ptr[t->direct.ptr[
+                ADDR_EXTRACTN(addr, t->direct.bit, t->direct.bits)]];
+        return _lookup(t, c + 1, c[0], addr, priority, data,
+                       NULL != stack ? stack : ptrs);
+    }
 
-    sentinel.u.leaf.data = NULL;
-    sentinel.u.leaf.priority = -1;
-    n = &t->nodes.ptr[t->root];
-    return _lookup(t, n, addr, &sentinel)->u.leaf.data;
+    return _lookup(t, &t->root, 1, addr, priority, data,
+                   NULL != stack ? stack : ptrs);
 }
 
 /*
@@ -518,6 +1194,19 @@ palmtrie_popmtpt_add(struct palmtrie_popmtpt *mtpt, addr_t addr, addr_t mask,
     return 0;
 }
 
+/*
+ * Add an entry, or replace the priority and the data of the entry of the same
+ * key; the entry is compiled at the next commit
+ */
+int
+palmtrie_popmtpt_replace(struct palmtrie_popmtpt *mtpt, addr_t addr,
+                         addr_t mask, int priority, void *data,
+                         int *opriority, void **odata)
+{
+    return palmtrie_mtpt_replace(&mtpt->mtpt, addr, mask, priority, data,
+                                 opriority, odata);
+}
+
 /*
  * Compile the optimized trie
  */
@@ -528,18 +1217,159 @@ palmtrie_popmtpt_commit(struct palmtrie_popmtpt *mtpt)
 
     if ( NULL != mtpt->nodes.ptr ) {
         free(mtpt->nodes.ptr);
+        mtpt->nodes.ptr = NULL;
         mtpt->nodes.used = 0;
         mtpt->nodes.nr = 0;
         mtpt->root = 0;
     }
+    _rules_release(mtpt);
+    _direct_release(mtpt);
+    if ( NULL == mtpt->mtpt.root ) {
+        /* Empty; e.g., all the entries are in the exact-match table */
+        return 0;
+    }
     ret = _convert(mtpt);
     if ( ret < 0 ) {
         return -1;
     }
+    if ( PALMTRIE_PLUS_SHARE && _share(mtpt) < 0 ) {
+        fprintf(stderr, "Memory allocation error\n");
+        return -1;
+    }
+    ret = _direct(mtpt);
+    if ( ret < 0 ) {
+        fprintf(stderr, "Memory allocation error\n");
+        _direct_release(mtpt);
+        return -1;
+    }
 
     return 0;
 }
 
+/*
+ * Release the instance
+ */
+int
+palmtrie_popmtpt_release(struct palmtrie_popmtpt *mtpt)
+{
+    free(mtpt->nodes.ptr);
+    mtpt->nodes.ptr = NULL;
+    mtpt->nodes.used = 0;
+    mtpt->nodes.nr = 0;
+    mtpt->root = 0;
+    _rules_release(mtpt);
+    _direct_release(mtpt);
+
+    return palmtrie_mtpt_release(&mtpt->mtpt);
+}
+
+/*
+ * Memory size of the instance in bytes; the compiled nodes and the lists of
+ * the direct table are counted up to the used ones, and the multiway trie for
+ * updates is included
+ */
+size_t
+palmtrie_popmtpt_memory(struct palmtrie_popmtpt *mtpt)
+{
+    return sizeof(struct palmtrie_popmtpt_node) * mtpt->nodes.used
+        + (sizeof(int32_t) + sizeof(void *) + sizeof(addr_t) * 2)
+        * mtpt->rules.nr
+        + (NULL != mtpt->direct.ptr ? sizeof(uint32_t) << mtpt->direct.bits
+           : 0)
+        + sizeof(uint32_t) * mtpt->direct.pool.nr
+        + palmtrie_mtpt_memory(&mtpt->mtpt);
+}
+
+/*
+ * Statistics of the instance; the nodes are of the compiled trie, where the
+ * depth of a node shared by the parents of different depths is the deepest
+ * one, and the children follow their parent in the node array
+ */
+void
+palmtrie_popmtpt_stats(struct palmtrie_popmtpt *mtpt,
+                       struct palmtrie_stats *stats)
+{
+    struct palmtrie_popmtpt_node *n;
+    uint8_t *seen;
+    int *depth;
+    uint32_t start;
+    uint32_t len;
+    uint32_t k;
+    int ternary;
+    int i;
+
+    if ( 0 == mtpt->nodes.used ) {
+        /* Not compiled yet */
+        palmtrie_mtpt_stats(&mtpt->mtpt, stats);
+        stats->build_bytes = stats->inode_bytes;
+        stats->inode_bytes = 0;
+        return;
+    }
+
+    depth = calloc(mtpt->nodes.used, sizeof(int));
+    seen = calloc(mtpt->rules.nr + 1, sizeof(uint8_t));
+    if ( NULL == depth || NULL == seen ) {
+        free(depth);
+        free(seen);
+        return;
+    }
+    stats->build_bytes = palmtrie_mtpt_memory(&mtpt->mtpt);
+    stats->rules = mtpt->rules.nr;
+    depth[mtpt->root] = 1;
+    for ( i = 0; i < mtpt->nodes.used; i++ ) {
+        n = &mtpt->nodes.ptr[i];
+        if ( n->bit < -PALMTRIE_MTPT_STRIDE ) {
+            /* The depth of a leaf is of its parent */
+            stats->leaves++;
+            stats->avg_depth += depth[i] - 1;
+            if ( depth[i] - 1 > stats->max_depth ) {
+                stats->max_depth = depth[i] - 1;
+            }
+            if ( n->u.leaf.rule < mtpt->rules.nr ) {
+                if ( seen[n->u.leaf.rule] ) {
+                    stats->duplicates++;
+                }
+                seen[n->u.leaf.rule] = 1;
+            }
+            continue;
+        }
+        stats->inodes++;
+        for ( ternary = 0; ternary < 2; ternary++ ) {
+            len = _block_len(n, ternary);
+            if ( ternary ) {
+                stats->ternaries += len;
+            } else {
+                stats->children += len;
+            }
+            start = _block_start(n, ternary);
+            for ( k = 0; k < len; k++ ) {
+                if ( depth[start + k] < depth[i] + 1 ) {
+                    depth[start + k] = depth[i] + 1;
+                }
+            }
+        }
+        if ( 1 == _block_len(n, 0) + _block_len(n, 1) ) {
+            start = _block_start(n, _block_len(n, 0) ? 0 : 1);
+            if ( mtpt->nodes.ptr[start].bit < -PALMTRIE_MTPT_STRIDE ) {
+                stats->compressible++;
+            }
+        }
+    }
+    free(depth);
+    free(seen);
+
+    stats->inode_bytes = sizeof(struct palmtrie_popmtpt_node) * stats->inodes
+        + (NULL != mtpt->direct.ptr ? sizeof(uint32_t) << mtpt->direct.bits
+           : 0)
+        + sizeof(uint32_t) * mtpt->direct.pool.nr;
+    stats->leaf_bytes = sizeof(struct palmtrie_popmtpt_node) * stats->leaves
+        + (sizeof(int32_t) + sizeof(void *) + sizeof(addr_t) * 2)
+        * mtpt->rules.nr;
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
 /*
  * Local variables:
  * tab-width: 4
@@ -0,0 +1,708 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* 64-bit popcnt intrinsic.  To use popcnt instruction in x86-64, the "-mpopcnt"
+   option must be specified in CFLAGS. */
+#define popcnt(v)               __builtin_popcountll(v)
+
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+#define _STRIDE         PALMTRIE_PREFIX_STRIDE
+#define _SLOTS          (1 << _STRIDE)
+#define _NONE           ((uint32_t)-1)
+
+/*
+ * Number of the wildcard bits of the mask, or -1 if the wildcard bits are not
+ * contiguous from the least significant bit
+ */
+static int
+_wildcards(const addr_t *mask)
+{
+    int k;
+    int i;
+
+    k = 0;
+    for ( i = 0; i < _NWORDS; i++ ) {
+        if ( ~mask->a[i] == 0 ) {
+            k += 64;
+            continue;
+        }
+        if ( mask->a[i] & (mask->a[i] + 1) ) {
+            return -1;
+        }
+        k += popcnt(mask->a[i]);
+        for ( i++; i < _NWORDS; i++ ) {
+            if ( mask->a[i] ) {
+                return -1;
+            }
+        }
+        break;
+    }
+
+    return k;
+}
+
+/*
+ * Compare the entries in the order of the prefixes, the covering one first,
+ * for qsort
+ */
+static int
+_cmp_prefix(const void *a, const void *b)
+{
+    const struct palmtrie_prefix_rule *x;
+    const struct palmtrie_prefix_rule *y;
+    int i;
+
+    x = (const struct palmtrie_prefix_rule *)a;
+    y = (const struct palmtrie_prefix_rule *)b;
+
+    for ( i = _NWORDS - 1; i >= 0; i-- ) {
+        if ( x->addr.a[i] != y->addr.a[i] ) {
+            return x->addr.a[i] < y->addr.a[i] ? -1 : 1;
+        }
+    }
+
+    return y->wildcards - x->wildcards;
+}
+
+/*
+ * Whether the entry takes over the current leaf.  The entries are applied in
+ * the order of the prefixes, hence the longest prefix wins a tie.
+ */
+static __inline__ int
+_better(const struct palmtrie_prefix *p, uint32_t rule, uint32_t cur)
+{
+    return _NONE == cur
+        || p->rules.ptr[rule].priority >= p->rules.ptr[cur].priority;
+}
+
+/*
+ * Reserve the nodes and return the index of the first one
+ */
+static int64_t
+_alloc_nodes(struct palmtrie_prefix *p, uint32_t n)
+{
+    struct palmtrie_prefix_node *ptr;
+    uint32_t nr;
+
+    if ( p->nodes.used + n > p->nodes.nr ) {
+        nr = p->nodes.nr ? p->nodes.nr : 1024;
+        while ( p->nodes.used + n > nr ) {
+            nr *= 2;
+        }
+        ptr = realloc(p->nodes.ptr, sizeof(struct palmtrie_prefix_node) * nr);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        p->nodes.ptr = ptr;
+        p->nodes.nr = nr;
+    }
+    p->nodes.used += n;
+
+    return p->nodes.used - n;
+}
+
+/*
+ * Append a leaf
+ */
+static int
+_append_leaf(struct palmtrie_prefix *p, uint32_t result)
+{
+    uint32_t *ptr;
+    uint32_t nr;
+
+    if ( p->leaves.used >= p->leaves.nr ) {
+        nr = p->leaves.nr ? p->leaves.nr * 2 : 1024;
+        ptr = realloc(p->leaves.ptr, sizeof(uint32_t) * nr);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        p->leaves.ptr = ptr;
+        p->leaves.nr = nr;
+    }
+    p->leaves.ptr[p->leaves.used++] = result;
+
+    return 0;
+}
+
+/*
+ * Compare the results by the priority and the data for qsort
+ */
+static int
+_cmp_result(const void *a, const void *b)
+{
+    const struct palmtrie_prefix_rule *x;
+    const struct palmtrie_prefix_rule *y;
+
+    x = *(const struct palmtrie_prefix_rule **)a;
+    y = *(const struct palmtrie_prefix_rule **)b;
+
+    if ( x->priority != y->priority ) {
+        return x->priority < y->priority ? -1 : 1;
+    }
+
+    return x->data < y->data ? -1 : (x->data > y->data ? 1 : 0);
+}
+
+/*
+ * Number the distinct pairs of the priority and the data of the entries from
+ * one, as the leaves of the same result are compressed to a run regardless
+ * of the entries
+ */
+static int
+_results(struct palmtrie_prefix *p)
+{
+    struct palmtrie_prefix_rule **sorted;
+    struct palmtrie_prefix_result *results;
+    uint32_t nr;
+    size_t i;
+
+    sorted = malloc(sizeof(struct palmtrie_prefix_rule *) * p->rules.nr);
+    if ( NULL == sorted ) {
+        return -1;
+    }
+    results = malloc(sizeof(struct palmtrie_prefix_result)
+                     * (p->rules.nr + 1));
+    if ( NULL == results ) {
+        free(sorted);
+        return -1;
+    }
+    for ( i = 0; i < p->rules.nr; i++ ) {
+        sorted[i] = &p->rules.ptr[i];
+    }
+    qsort(sorted, p->rules.nr, sizeof(struct palmtrie_prefix_rule *),
+          _cmp_result);
+    results[0].priority = INT32_MIN;
+    results[0].data = NULL;
+    nr = 1;
+    for ( i = 0; i < p->rules.nr; i++ ) {
+        if ( 1 == nr || results[nr - 1].priority != sorted[i]->priority
+             || results[nr - 1].data != sorted[i]->data ) {
+            results[nr].priority = sorted[i]->priority;
+            results[nr].data = sorted[i]->data;
+            nr++;
+        }
+        sorted[i]->result = nr - 1;
+    }
+    free(sorted);
+    p->results.ptr = results;
+    p->results.nr = nr;
+
+    return 0;
+}
+
+/*
+ * Release the compiled trie
+ */
+static void
+_release_trie(struct palmtrie_prefix *p)
+{
+    free(p->direct.ptr);
+    free(p->nodes.ptr);
+    free(p->leaves.ptr);
+    free(p->results.ptr);
+    free(p->wide.ptr);
+    memset(&p->direct, 0, sizeof(p->direct));
+    memset(&p->nodes, 0, sizeof(p->nodes));
+    memset(&p->leaves, 0, sizeof(p->leaves));
+    memset(&p->results, 0, sizeof(p->results));
+    memset(&p->wide, 0, sizeof(p->wide));
+}
+
+/*
+ * Build the node of the stride from the bit position with the entries from
+ * lo to hi in its subtree, pushing the leaf of the prefixes above the node
+ * down to its slots
+ */
+static int
+_build(struct palmtrie_prefix *p, uint32_t index, int bit, size_t lo,
+       size_t hi, uint32_t leaf)
+{
+    struct palmtrie_prefix_rule *r;
+    uint32_t slots[_SLOTS];
+    uint32_t result;
+    uint32_t prev;
+    int64_t base1;
+    u64 vector;
+    u64 leafvec;
+    uint32_t base0;
+    uint32_t n;
+    size_t i;
+    size_t j;
+    int span;
+    int s;
+    int t;
+
+    /* The prefixes ending in the node cover the slots, and the others are
+       in the children */
+    for ( s = 0; s < _SLOTS; s++ ) {
+        slots[s] = leaf;
+    }
+    vector = 0;
+    for ( i = lo; i < hi; i++ ) {
+        r = &p->rules.ptr[i];
+        s = ADDR_EXTRACTN(&r->addr, bit, _STRIDE);
+        if ( r->wildcards <= bit ) {
+            vector |= 1ULL << s;
+            continue;
+        }
+        span = r->wildcards - bit >= _STRIDE
+            ? _SLOTS : 1 << (r->wildcards - bit);
+        s &= ~(span - 1);
+        for ( t = s; t < s + span; t++ ) {
+            if ( _better(p, i, slots[t]) ) {
+                slots[t] = i;
+            }
+        }
+    }
+
+    /* The runs of the same result are compressed */
+    base0 = p->leaves.used;
+    leafvec = 0;
+    prev = 0;
+    for ( s = 0; s < _SLOTS; s++ ) {
+        if ( vector & (1ULL << s) ) {
+            continue;
+        }
+        result = _NONE == slots[s] ? 0 : p->rules.ptr[slots[s]].result;
+        if ( 0 == leafvec || result != prev ) {
+            leafvec |= 1ULL << s;
+            if ( _append_leaf(p, result) < 0 ) {
+                return -1;
+            }
+            prev = result;
+        }
+    }
+    base1 = _alloc_nodes(p, popcnt(vector));
+    if ( base1 < 0 ) {
+        return -1;
+    }
+    p->nodes.ptr[index].vector = vector;
+    p->nodes.ptr[index].leafvec = leafvec;
+    p->nodes.ptr[index].base0 = base0;
+    p->nodes.ptr[index].base1 = base1;
+
+    /* The entries of a child are contiguous after the prefixes covering
+       it */
+    i = lo;
+    n = 0;
+    for ( s = 0; s < _SLOTS; s++ ) {
+        if ( !(vector & (1ULL << s)) ) {
+            continue;
+        }
+        while ( p->rules.ptr[i].wildcards > bit
+                || (int)ADDR_EXTRACTN(&p->rules.ptr[i].addr, bit, _STRIDE)
+                != s ) {
+            i++;
+        }
+        for ( j = i + 1; j < hi; j++ ) {
+            if ( (int)ADDR_EXTRACTN(&p->rules.ptr[j].addr, bit, _STRIDE)
+                 != s ) {
+                break;
+            }
+        }
+        if ( _build(p, base1 + n, bit - _STRIDE, i, j, slots[s]) < 0 ) {
+            return -1;
+        }
+        n++;
+        i = j;
+    }
+
+    return 0;
+}
+
+/*
+ * Build the direct table of the top bits and the nodes below it, in the same
+ * way as a node of the stride of the bits
+ */
+static int
+_build_direct(struct palmtrie_prefix *p)
+{
+    struct palmtrie_prefix_rule *r;
+    uint32_t *slots;
+    uint8_t *internal;
+    int64_t index;
+    size_t nslots;
+    size_t span;
+    size_t s;
+    size_t t;
+    size_t i;
+    size_t j;
+    int bit;
+
+    /* Not for the entries fitting in the cache without it */
+    p->direct.bits = p->rules.nr >= (1U << PALMTRIE_PREFIX_DIRECT) >> 4
+        ? PALMTRIE_PREFIX_DIRECT : 0;
+    p->direct.bit = p->direct.bits ? p->width - p->direct.bits : 0;
+    bit = p->width - p->direct.bits;
+    nslots = (size_t)1 << p->direct.bits;
+    slots = malloc(sizeof(uint32_t) * nslots);
+    if ( NULL == slots ) {
+        return -1;
+    }
+    p->direct.ptr = slots;
+    internal = calloc(nslots, sizeof(uint8_t));
+    if ( NULL == internal ) {
+        return -1;
+    }
+
+    for ( s = 0; s < nslots; s++ ) {
+        slots[s] = _NONE;
+    }
+    for ( i = 0; i < p->rules.nr; i++ ) {
+        r = &p->rules.ptr[i];
+        s = ADDR_EXTRACTN(&r->addr, p->direct.bit, p->direct.bits);
+        if ( r->wildcards <= bit ) {
+            internal[s] = 1;
+            continue;
+        }
+        span = r->wildcards - bit >= p->direct.bits
+            ? nslots : (size_t)1 << (r->wildcards - bit);
+        s &= ~(span - 1);
+        for ( t = s; t < s + span; t++ ) {
+            if ( _better(p, i, slots[t]) ) {
+                slots[t] = i;
+            }
+        }
+    }
+
+    i = 0;
+    for ( s = 0; s < nslots; s++ ) {
+        if ( !internal[s] ) {
+            slots[s] = PALMTRIE_PREFIX_LEAF
+                | (_NONE == slots[s] ? 0 : p->rules.ptr[slots[s]].result);
+            continue;
+        }
+        while ( p->rules.ptr[i].wildcards > bit
+                || ADDR_EXTRACTN(&p->rules.ptr[i].addr, p->direct.bit,
+                                 p->direct.bits) != s ) {
+            i++;
+        }
+        for ( j = i + 1; j < p->rules.nr; j++ ) {
+            if ( ADDR_EXTRACTN(&p->rules.ptr[j].addr, p->direct.bit,
+                               p->direct.bits) != s ) {
+                break;
+            }
+        }
+        index = _alloc_nodes(p, 1);
+        if ( index < 0
+             || _build(p, index, bit - _STRIDE, i, j, slots[s]) < 0 ) {
+            free(internal);
+            return -1;
+        }
+        slots[s] = index;
+        i = j;
+    }
+    free(internal);
+
+    return 0;
+}
+
+/*
+ * Add an entry, or fall back to the ternary trie if the mask is not a prefix
+ */
+int
+palmtrie_prefix_add(struct palmtrie_prefix *p, addr_t addr, addr_t mask,
+                    int priority, void *data)
+{
+    struct palmtrie_prefix_rule *rules;
+    size_t size;
+    int k;
+
+    if ( p->ternary ) {
+        return 0;
+    }
+    k = _wildcards(&mask);
+    if ( k < 0 ) {
+        palmtrie_prefix_ternary(p);
+        return 0;
+    }
+    if ( p->rules.nr >= p->rules.size ) {
+        size = p->rules.size ? p->rules.size * 2 : 1024;
+        rules = realloc(p->rules.ptr,
+                        sizeof(struct palmtrie_prefix_rule) * size);
+        if ( NULL == rules ) {
+            return -1;
+        }
+        p->rules.ptr = rules;
+        p->rules.size = size;
+    }
+    ADDR_MASK(addr, mask);
+    p->rules.ptr[p->rules.nr].addr = addr;
+    p->rules.ptr[p->rules.nr].wildcards = k;
+    p->rules.ptr[p->rules.nr].priority = priority;
+    p->rules.ptr[p->rules.nr].data = data;
+    p->rules.nr++;
+
+    return 0;
+}
+
+/*
+ * Fall back to the ternary trie; the compiled trie serves the lookups until
+ * it is released at the next commit
+ */
+void
+palmtrie_prefix_ternary(struct palmtrie_prefix *p)
+{
+    p->ternary = 1;
+}
+
+/*
+ * Compile the trie of the entries
+ */
+int
+palmtrie_prefix_commit(struct palmtrie_prefix *p)
+{
+    struct palmtrie_prefix_rule *r;
+    uint32_t *wide;
+    size_t i;
+    int width;
+    int w;
+
+    _release_trie(p);
+    if ( 0 == p->rules.nr ) {
+        return 0;
+    }
+    qsort(p->rules.ptr, p->rules.nr, sizeof(struct palmtrie_prefix_rule),
+          _cmp_prefix);
+    if ( _results(p) < 0 ) {
+        return -1;
+    }
+
+    /* The width is up to the highest bit set in the prefixes */
+    width = 0;
+    for ( i = 0; i < p->rules.nr; i++ ) {
+        r = &p->rules.ptr[i];
+        for ( w = _NWORDS - 1; w >= 0 && w * 64 + 64 > width; w-- ) {
+            if ( r->addr.a[w] ) {
+                if ( w * 64 + 64 - __builtin_clzll(r->addr.a[w]) > width ) {
+                    width = w * 64 + 64 - __builtin_clzll(r->addr.a[w]);
+                }
+                break;
+            }
+        }
+    }
+    p->width = width;
+    for ( w = 0; w < _NWORDS; w++ ) {
+        p->outside.a[w] = width >= w * 64 + 64 ? 0
+            : (width <= w * 64 ? ~0ULL : ~0ULL << (width - w * 64));
+    }
+    wide = malloc(sizeof(uint32_t) * p->rules.nr);
+    if ( NULL == wide ) {
+        _release_trie(p);
+        return -1;
+    }
+    p->wide.ptr = wide;
+    for ( i = 0; i < p->rules.nr; i++ ) {
+        if ( p->rules.ptr[i].wildcards > width ) {
+            p->wide.ptr[p->wide.nr++] = i;
+        }
+    }
+
+    if ( _build_direct(p) < 0 ) {
+        _release_trie(p);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Result of the key set above the width, matching the wide entries whose
+ * wildcard bits cover the highest bit set
+ */
+static uint32_t
+_lookup_wide(const struct palmtrie_prefix *p, const addr_t *addr)
+{
+    const struct palmtrie_prefix_rule *r;
+    const struct palmtrie_prefix_rule *best;
+    uint32_t i;
+    int h;
+    int w;
+
+    h = 0;
+    for ( w = _NWORDS - 1; w >= 0; w-- ) {
+        if ( addr->a[w] ) {
+            h = w * 64 + 63 - __builtin_clzll(addr->a[w]);
+            break;
+        }
+    }
+    best = NULL;
+    for ( i = 0; i < p->wide.nr; i++ ) {
+        r = &p->rules.ptr[p->wide.ptr[i]];
+        if ( r->wildcards <= h ) {
+            continue;
+        }
+        if ( NULL == best || r->priority > best->priority
+             || (r->priority == best->priority
+                 && r->wildcards < best->wildcards) ) {
+            best = r;
+        }
+    }
+
+    return NULL != best ? best->result : 0;
+}
+
+/*
+ * Lookup an entry of a higher priority than the specified priority, and
+ * return the specified data if there is no such entry.  The priority is
+ * updated to the one of the returned data.
+ */
+void *
+palmtrie_prefix_lookup_above(const struct palmtrie_prefix *p,
+                             const addr_t *addr, int *priority, void *data)
+{
+    const struct palmtrie_prefix_node *n;
+    const struct palmtrie_prefix_result *r;
+    uint32_t result;
+    uint32_t e;
+    u64 outside;
+    u64 m;
+    int bit;
+    int s;
+    int i;
+
+    outside = 0;
+    for ( i = 0; i < _NWORDS; i++ ) {
+        outside |= addr->a[i] & p->outside.a[i];
+    }
+    e = p->direct.ptr[ADDR_EXTRACTN(addr, p->direct.bit, p->direct.bits)];
+    if ( __builtin_expect(!!outside, 0) ) {
+        result = _lookup_wide(p, addr);
+    } else if ( e & PALMTRIE_PREFIX_LEAF ) {
+        result = e & ~PALMTRIE_PREFIX_LEAF;
+    } else {
+        /* One node for each stride */
+        n = &p->nodes.ptr[e];
+        bit = p->width - p->direct.bits - _STRIDE;
+        for ( ;; ) {
+            s = ADDR_EXTRACTN(addr, bit, _STRIDE);
+            m = (2ULL << s) - 1;
+            if ( !(n->vector & (1ULL << s)) ) {
+                break;
+            }
+            n = &p->nodes.ptr[n->base1 + popcnt(n->vector & m) - 1];
+            bit -= _STRIDE;
+        }
+        result = p->leaves.ptr[n->base0 + popcnt(n->leafvec & m) - 1];
+    }
+    r = &p->results.ptr[result];
+    if ( r->priority > *priority ) {
+        *priority = r->priority;
+        return r->data;
+    }
+
+    return data;
+}
+
+/*
+ * Release the entries and the compiled trie; the fallback to the ternary
+ * trie is kept
+ */
+void
+palmtrie_prefix_release(struct palmtrie_prefix *p)
+{
+    int ternary;
+
+    ternary = p->ternary;
+    _release_trie(p);
+    free(p->rules.ptr);
+    memset(p, 0, sizeof(struct palmtrie_prefix));
+    p->ternary = ternary;
+}
+
+/*
+ * Memory size of the compiled trie and the entries in bytes
+ */
+size_t
+palmtrie_prefix_memory(struct palmtrie_prefix *p)
+{
+    if ( NULL == p->direct.ptr ) {
+        return 0;
+    }
+
+    return (sizeof(uint32_t) << p->direct.bits)
+        + sizeof(struct palmtrie_prefix_node) * p->nodes.used
+        + sizeof(uint32_t) * (p->leaves.used + p->wide.nr)
+        + sizeof(struct palmtrie_prefix_result) * p->results.nr
+        + sizeof(struct palmtrie_prefix_rule) * p->rules.nr;
+}
+
+/*
+ * Statistics of the compiled trie; a node is allocated before its children,
+ * and a node not referred to by another one is referred to by the direct
+ * table, whose entries are not counted as the leaves
+ */
+void
+palmtrie_prefix_stats(struct palmtrie_prefix *p, struct palmtrie_stats *stats)
+{
+    struct palmtrie_prefix_node *n;
+    uint8_t *seen;
+    int *depth;
+    uint32_t i;
+    uint32_t k;
+
+    if ( NULL == p->direct.ptr ) {
+        return;
+    }
+    stats->rules = p->rules.nr;
+    stats->build_bytes = sizeof(struct palmtrie_prefix_rule) * p->rules.nr;
+    stats->inode_bytes = (sizeof(uint32_t) << p->direct.bits)
+        + sizeof(struct palmtrie_prefix_node) * p->nodes.used;
+    stats->leaf_bytes = sizeof(uint32_t) * (p->leaves.used + p->wide.nr)
+        + sizeof(struct palmtrie_prefix_result) * p->results.nr;
+    stats->inodes = p->nodes.used;
+    stats->leaves = p->leaves.used;
+
+    depth = calloc(p->nodes.used + 1, sizeof(int));
+    seen = calloc(p->results.nr + 1, sizeof(uint8_t));
+    if ( NULL == depth || NULL == seen ) {
+        free(depth);
+        free(seen);
+        return;
+    }
+    for ( i = 0; i < p->nodes.used; i++ ) {
+        n = &p->nodes.ptr[i];
+        if ( 0 == depth[i] ) {
+            depth[i] = 1;
+        }
+        for ( k = 0; k < popcnt(n->vector); k++ ) {
+            depth[n->base1 + k] = depth[i] + 1;
+        }
+        for ( k = 0; k < popcnt(n->leafvec); k++ ) {
+            if ( p->leaves.ptr[n->base0 + k] < p->results.nr ) {
+                if ( seen[p->leaves.ptr[n->base0 + k]] ) {
+                    stats->duplicates++;
+                }
+                seen[p->leaves.ptr[n->base0 + k]] = 1;
+            }
+        }
+        stats->children += popcnt(n->vector);
+        stats->avg_depth += (double)depth[i] * popcnt(n->leafvec);
+        if ( n->leafvec && depth[i] > stats->max_depth ) {
+            stats->max_depth = depth[i];
+        }
+        if ( 0 == n->vector && 1 == popcnt(n->leafvec) ) {
+            stats->compressible++;
+        }
+    }
+    free(depth);
+    free(seen);
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,346 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+
+/*
+ * Hash of the key of a group
+ */
+static __inline__ size_t
+_hash(const addr_t *addr, const addr_t *mask)
+{
+    u64 h;
+    int i;
+
+    h = 0;
+    for ( i = 0; i < _NWORDS; i++ ) {
+        h = (h ^ addr->a[i]) * 0x9e3779b97f4a7c15ULL;
+        h = (h ^ mask->a[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (size_t)h;
+}
+
+/*
+ * Compare the rules in the descending order of the priority for qsort
+ */
+static int
+_cmp_priority(const void *a, const void *b)
+{
+    const struct palmtrie_range_rule *x;
+    const struct palmtrie_range_rule *y;
+
+    x = (const struct palmtrie_range_rule *)a;
+    y = (const struct palmtrie_range_rule *)b;
+
+    return x->priority > y->priority ? -1
+        : (x->priority < y->priority ? 1 : 0);
+}
+
+/*
+ * Rebuild the index of the groups at the load factor of 1/2 or less
+ */
+static int
+_reindex(struct palmtrie_ranges *rt, size_t size)
+{
+    struct palmtrie_range_group **index;
+    struct palmtrie_range_group *g;
+    size_t i;
+    size_t j;
+
+    index = calloc(size, sizeof(struct palmtrie_range_group *));
+    if ( NULL == index ) {
+        return -1;
+    }
+    for ( i = 0; i < rt->nr; i++ ) {
+        g = rt->groups[i];
+        j = _hash(&g->addr, &g->mask) & (size - 1);
+        while ( NULL != index[j] ) {
+            j = (j + 1) & (size - 1);
+        }
+        index[j] = g;
+    }
+    free(rt->index);
+    rt->index = index;
+    rt->isize = size;
+
+    return 0;
+}
+
+/*
+ * Whether the ranges are valid
+ */
+int
+palmtrie_range_valid(const struct palmtrie_range *ranges, int n)
+{
+    int i;
+
+    if ( n < 0 || n > PALMTRIE_RANGES_MAX ) {
+        return 0;
+    }
+    for ( i = 0; i < n; i++ ) {
+        if ( ranges[i].width <= 0 || ranges[i].width > PALMTRIE_RANGE_BITS
+             || ranges[i].bit < 0
+             || ranges[i].bit + ranges[i].width > PALMTRIE_ADDR_BITS
+             || ranges[i].lo > ranges[i].hi
+             || ranges[i].hi >> (ranges[i].width - 1) > 1 ) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Set the field of the range to the value with the wildcard bits
+ */
+void
+palmtrie_range_set(addr_t *addr, addr_t *mask, const struct palmtrie_range *r,
+                   u32 value, u32 wildcard)
+{
+    int b;
+    int i;
+
+    for ( i = 0; i < r->width; i++ ) {
+        b = r->bit + i;
+        if ( (wildcard >> i) & 1 ) {
+            BTC(*addr, b);
+            BTS(*mask, b);
+        } else {
+            BTC(*mask, b);
+            if ( (value >> i) & 1 ) {
+                BTS(*addr, b);
+            } else {
+                BTC(*addr, b);
+            }
+        }
+    }
+}
+
+/*
+ * Split the range into the prefixes; the values and the wildcards must have
+ * the room for 2 * width entries.  Returns the number of the prefixes.
+ */
+int
+palmtrie_range_prefixes(const struct palmtrie_range *r, u32 *values,
+                        u32 *wildcards)
+{
+    u64 lo;
+    u64 hi;
+    u64 size;
+    int n;
+
+    n = 0;
+    lo = r->lo;
+    hi = (u64)r->hi + 1;
+    while ( lo < hi ) {
+        /* The largest aligned block from lo within the range */
+        size = lo ? (lo & -lo) : (1ULL << r->width);
+        while ( lo + size > hi ) {
+            size >>= 1;
+        }
+        values[n] = lo;
+        wildcards[n] = size - 1;
+        n++;
+        lo += size;
+    }
+
+    return n;
+}
+
+/*
+ * Add a rule of the ranges to the group of its key, which has the ternary
+ * part of the rule and the common prefix of each range.  A range of a prefix
+ * is only in the key.
+ */
+int
+palmtrie_range_add(struct palmtrie_ranges *rt, addr_t addr, addr_t mask,
+                   const struct palmtrie_range *ranges, int n, int priority,
+                   void *data)
+{
+    struct palmtrie_range_group **groups;
+    struct palmtrie_range_group *g;
+    struct palmtrie_range_rule *rule;
+    struct palmtrie_range_rule *rules;
+    u32 wildcard;
+    u32 d;
+    size_t size;
+    size_t i;
+    int nr;
+    int k;
+
+    nr = 0;
+    rule = NULL;
+    for ( k = 0; k < n; k++ ) {
+        d = ranges[k].lo ^ ranges[k].hi;
+        wildcard = d ? (u32)((1ULL << (32 - __builtin_clz(d))) - 1) : 0;
+        palmtrie_range_set(&addr, &mask, &ranges[k], ranges[k].lo, wildcard);
+        if ( (ranges[k].lo & wildcard) || (~ranges[k].hi & wildcard) ) {
+            /* Not a prefix; checked at the leaf */
+            nr++;
+        }
+    }
+    ADDR_MASK(addr, mask);
+
+    /* Find the group of the key */
+    if ( rt->nr * 2 >= rt->isize ) {
+        if ( _reindex(rt, rt->isize ? rt->isize * 2 : 1024) < 0 ) {
+            return -1;
+        }
+    }
+    i = _hash(&addr, &mask) & (rt->isize - 1);
+    for ( ;; ) {
+        g = rt->index[i];
+        if ( NULL == g ) {
+            break;
+        }
+        if ( ADDR_CMP(g->addr, addr) && ADDR_CMP(g->mask, mask) ) {
+            break;
+        }
+        i = (i + 1) & (rt->isize - 1);
+    }
+    if ( NULL == g ) {
+        if ( rt->nr >= rt->size ) {
+            size = rt->size ? rt->size * 2 : 1024;
+            groups = realloc(rt->groups,
+                             sizeof(struct palmtrie_range_group *) * size);
+            if ( NULL == groups ) {
+                return -1;
+            }
+            rt->groups = groups;
+            rt->size = size;
+        }
+        g = calloc(1, sizeof(struct palmtrie_range_group));
+        if ( NULL == g ) {
+            return -1;
+        }
+        g->addr = addr;
+        g->mask = mask;
+        g->max_priority = -1;
+        g->added = -1;
+        rt->groups[rt->nr++] = g;
+        rt->index[i] = g;
+    }
+
+    /* Append the rule */
+    if ( g->nr >= g->size ) {
+        size = g->size ? g->size * 2 : 4;
+        rules = realloc(g->rules, sizeof(struct palmtrie_range_rule) * size);
+        if ( NULL == rules ) {
+            return -1;
+        }
+        g->rules = rules;
+        g->size = size;
+    }
+    rule = &g->rules[g->nr++];
+    rule->priority = priority;
+    rule->data = data;
+    rule->nranges = 0;
+    for ( k = 0; k < n; k++ ) {
+        d = ranges[k].lo ^ ranges[k].hi;
+        wildcard = d ? (u32)((1ULL << (32 - __builtin_clz(d))) - 1) : 0;
+        if ( (ranges[k].lo & wildcard) || (~ranges[k].hi & wildcard) ) {
+            rule->ranges[rule->nranges++] = ranges[k];
+        }
+    }
+    if ( priority > g->max_priority ) {
+        g->max_priority = priority;
+    }
+    rt->rules++;
+
+    return 0;
+}
+
+/*
+ * Find the group of the key
+ */
+struct palmtrie_range_group *
+palmtrie_range_find(const struct palmtrie_ranges *rt, const addr_t *addr,
+                    const addr_t *mask)
+{
+    struct palmtrie_range_group *g;
+    size_t i;
+
+    if ( 0 == rt->nr ) {
+        return NULL;
+    }
+    i = _hash(addr, mask) & (rt->isize - 1);
+    for ( ;; ) {
+        g = rt->index[i];
+        if ( NULL == g ) {
+            return NULL;
+        }
+        if ( ADDR_CMP(g->addr, *addr) && ADDR_CMP(g->mask, *mask) ) {
+            return g;
+        }
+        i = (i + 1) & (rt->isize - 1);
+    }
+}
+
+/*
+ * Sort the rules of each group in the descending order of the priority for
+ * the lookup
+ */
+void
+palmtrie_range_commit(struct palmtrie_ranges *rt)
+{
+    size_t i;
+
+    for ( i = 0; i < rt->nr; i++ ) {
+        qsort(rt->groups[i]->rules, rt->groups[i]->nr,
+              sizeof(struct palmtrie_range_rule), _cmp_priority);
+    }
+}
+
+/*
+ * Release the groups
+ */
+void
+palmtrie_range_release(struct palmtrie_ranges *rt)
+{
+    size_t i;
+
+    for ( i = 0; i < rt->nr; i++ ) {
+        free(rt->groups[i]->rules);
+        free(rt->groups[i]);
+    }
+    free(rt->groups);
+    free(rt->index);
+    memset(rt, 0, sizeof(struct palmtrie_ranges));
+}
+
+/*
+ * Memory size of the groups in bytes
+ */
+size_t
+palmtrie_range_memory(struct palmtrie_ranges *rt)
+{
+    size_t sz;
+    size_t i;
+
+    sz = sizeof(struct palmtrie_range_group *) * (rt->nr + rt->isize);
+    for ( i = 0; i < rt->nr; i++ ) {
+        sz += sizeof(struct palmtrie_range_group)
+            + sizeof(struct palmtrie_range_rule) * rt->groups[i]->nr;
+    }
+
+    return sz;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -1,8 +1,10 @@
 #!/bin/sh
 
+SYNTHETIC=0
 if [ ! -d "datasets" ]; then
     echo "Missing datasets.  Download and extract https://pix.jar.jp/palmtrie/datasets.tar.gz"
-    exit 1
+    echo "Falling back to the synthetic ClassBench-like datasets generated by palmtrie_gen."
+    SYNTHETIC=1
 fi
 
 ./configure
@@ -28,26 +30,50 @@ echo "Evaluation Directiory: $DIR"
 
 cd $DIR
 
+DATASETS=$CWD/datasets
+if [ $SYNTHETIC -eq 1 ]; then
+    ## Generate the ClassBench-like rulesets and traces
+    DATASETS=$DIR/datasets
+    mkdir -p $DATASETS/tcam $DATASETS/traffic
+    seed=0
+    for d in "acl1" "fw2" "ipc2"; do for n in "1k" "10k" "50k" "100k" "200k" "500k"; do
+        echo "Generating ${d}_seed_${n}..."
+        nr=`echo $n | sed -e 's/k$/000/'`
+        seed=`expr $seed + 1`
+        $CWD/palmtrie_gen -r -t ${d%?} -n $nr -S $seed -m 1000000 \
+            $DATASETS/tcam/classbench-wo-flags.${d}_seed_${n}.tcam \
+            $DATASETS/traffic/${d}_seed_${n}_trace.txt
+        if [ $? -ne 0 ]; then
+            echo "Failed to generate ${d}_seed_${n}" >& 2
+            exit 1
+        fi
+    done; done
+fi
+
 mkdir tests
-cp $CWD/tests/traffic.sfl2 tests/
-cp $CWD/tests/acl-1000.ross tests/
-
-## Campus network policy
-mkdir campus
-mkdir campus/scanning
-mkdir campus/random
-for i in `seq 0 1 16`; do
-     echo "Evaluating acl-D${i} performance..."
-     $CWD/palmtrie_eval_acl $CWD/datasets/tcam/acl-D${i}.tcam popmtpt-ross > campus/scanning/result.acl-D${i}.txt
-     $CWD/palmtrie_eval_acl $CWD/datasets/tcam/acl-D${i}.tcam popmtpt-sfl > campus/random/result.acl-D${i}.txt
-done
+if [ -f $CWD/tests/traffic.sfl2 -a -f $CWD/tests/acl-1000.ross -a -f $DATASETS/tcam/acl-D0.tcam ]; then
+    cp $CWD/tests/traffic.sfl2 tests/
+    cp $CWD/tests/acl-1000.ross tests/
+
+    ## Campus network policy
+    mkdir campus
+    mkdir campus/scanning
+    mkdir campus/random
+    for i in `seq 0 1 16`; do
+         echo "Evaluating acl-D${i} performance..."
+         $CWD/palmtrie_eval_acl $DATASETS/tcam/acl-D${i}.tcam popmtpt-ross > campus/scanning/result.acl-D${i}.txt
+         $CWD/palmtrie_eval_acl $DATASETS/tcam/acl-D${i}.tcam popmtpt-sfl > campus/random/result.acl-D${i}.txt
+    done
+else
+    echo "Skipping the campus network policy (no dataset available)"
+fi
 
 ## ClassBench
 mkdir classbench
 for d in "acl1" "fw2" "ipc2"; do for n in "1k" "10k" "50k" "100k" "200k" "500k"; do
      echo "Evaluating ClassBench ${d}_seed_${n} performance..."
-    cp $CWD/datasets/traffic/${d}_seed_${n}_trace.txt tests/traffic.tmp
-    $CWD/palmtrie_eval_acl $CWD/datasets/tcam/classbench-wo-flags.${d}_seed_${n}.tcam popmtpt-traffic > classbench/result.${d}_seed_${n}.txt
+    cp $DATASETS/traffic/${d}_seed_${n}_trace.txt tests/traffic.tmp
+    $CWD/palmtrie_eval_acl $DATASETS/tcam/classbench-wo-flags.${d}_seed_${n}.tcam popmtpt-traffic > classbench/result.${d}_seed_${n}.txt
 done; done
 
 echo "All done!  The evaluation results are saved at $DIR"
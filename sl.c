@@ -46,6 +46,45 @@ palmtrie_sl_release(struct palmtrie *palmtrie)
     return 0;
 }
 
+/*
+ * Memory size of the instance in bytes
+ */
+size_t
+palmtrie_sl_memory(struct palmtrie *palmtrie)
+{
+    struct palmtrie_sorted_list_entry *e;
+    size_t sz;
+
+    sz = 0;
+    for ( e = palmtrie->u.sl.head; NULL != e; e = e->next ) {
+        sz += sizeof(struct palmtrie_sorted_list_entry);
+    }
+
+    return sz;
+}
+
+/*
+ * Statistics of the instance; the entries are the leaves scanned in order,
+ * hence the depth of an entry is its position in the list
+ */
+void
+palmtrie_sl_stats(struct palmtrie *palmtrie, struct palmtrie_stats *stats)
+{
+    struct palmtrie_sorted_list_entry *e;
+
+    for ( e = palmtrie->u.sl.head; NULL != e; e = e->next ) {
+        stats->rules++;
+        stats->leaves++;
+        stats->avg_depth += stats->leaves;
+    }
+    stats->leaf_bytes = sizeof(struct palmtrie_sorted_list_entry)
+        * stats->leaves;
+    stats->max_depth = stats->leaves;
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
 /*
  * Add an entry to the sorted list
  */
@@ -0,0 +1,770 @@
+/*_
+ * Copyright (c) 2015-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define _MAX_THREADS    64
+#define _MIN_CHUNK      (1 << 20)
+
+/*
+ * Value of hexadecimal digits; -1 for the other characters
+ */
+static const int8_t _hexval[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6,
+    ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+#define HEXVAL(c)       (_hexval[(uint8_t)(c)] - 1)
+
+#define IS_SPACE(c)     ((c) == ' ' || (c) == '\t' || (c) == '\r')
+
+/*
+ * Parser state of a chunk of the mapped file
+ */
+struct tcam_chunk {
+    pthread_t th;
+    int threaded;
+    const char *p;
+    const char *end;
+    int flags;
+    int keyonly;
+    /* Length of the longest key in hexadecimal characters */
+    size_t keylen;
+    /* Parsed entries */
+    void *ents;
+    size_t nr;
+    size_t size;
+    int ret;
+};
+
+#if defined(__SSE2__)
+/*
+ * Decode 16 hexadecimal characters into 8 bytes
+ */
+static __inline__ int
+_hex16(const char *s, uint8_t *out)
+{
+    __m128i v;
+    __m128i lc;
+    __m128i isdig;
+    __m128i isalpha;
+    __m128i nib;
+    __m128i lane;
+
+    v = _mm_loadu_si128((const __m128i *)s);
+    isdig = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                          _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    lc = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    isalpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                            _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+    if ( 0xffff != _mm_movemask_epi8(_mm_or_si128(isdig, isalpha)) ) {
+        /* Invalid character */
+        return -1;
+    }
+    nib = _mm_or_si128(
+        _mm_and_si128(isdig, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+        _mm_andnot_si128(isdig, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+
+    /* The first character of each pair is the upper nibble */
+    lane = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(nib, 4),
+                                      _mm_set1_epi16(0x00f0)),
+                        _mm_srli_epi16(nib, 8));
+    _mm_storel_epi64((__m128i *)out, _mm_packus_epi16(lane, lane));
+
+    return 0;
+}
+#endif
+
+/*
+ * Decode a hexadecimal string of len characters to a key.  The string
+ * represents the bytes of the key in the memory order, or a big number
+ * from the most significant nibble if PALMTRIE_TCAM_REVERSE is set.
+ */
+static int
+_decode(const char *s, size_t len, addr_t *addr, int flags)
+{
+    uint8_t *b;
+    size_t i;
+    int hi;
+    int lo;
+    uint8_t t;
+
+    if ( (len & 1) || len > sizeof(addr->a) * 2 ) {
+        /* Length mismatch */
+        return -1;
+    }
+    memset(addr, 0, sizeof(addr_t));
+    b = (uint8_t *)addr->a;
+
+    i = 0;
+#if defined(__SSE2__)
+    for ( ; i + 16 <= len; i += 16 ) {
+        if ( _hex16(s + i, b + (i >> 1)) < 0 ) {
+            return -1;
+        }
+    }
+#endif
+    for ( ; i < len; i += 2 ) {
+        hi = HEXVAL(s[i]);
+        lo = HEXVAL(s[i + 1]);
+        if ( hi < 0 || lo < 0 ) {
+            return -1;
+        }
+        b[i >> 1] = (hi << 4) | lo;
+    }
+
+    if ( flags & PALMTRIE_TCAM_REVERSE ) {
+        len >>= 1;
+        for ( i = 0; i < len / 2; i++ ) {
+            t = b[i];
+            b[i] = b[len - i - 1];
+            b[len - i - 1] = t;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Get the next whitespace-separated token in the line
+ */
+static __inline__ const char *
+_token(const char **p, const char *end, size_t *len)
+{
+    const char *s;
+
+    while ( *p < end && IS_SPACE(**p) ) {
+        (*p)++;
+    }
+    s = *p;
+    while ( *p < end && !IS_SPACE(**p) && '\n' != **p ) {
+        (*p)++;
+    }
+    *len = *p - s;
+
+    return s;
+}
+
+/*
+ * Parse a decimal number
+ */
+static __inline__ int
+_number(const char **p, const char *end, long long *v)
+{
+    const char *s;
+    size_t len;
+    size_t i;
+    int neg;
+
+    s = _token(p, end, &len);
+    if ( 0 == len ) {
+        return -1;
+    }
+    neg = 0;
+    i = 0;
+    if ( '-' == s[0] ) {
+        neg = 1;
+        i++;
+    }
+    if ( i >= len ) {
+        return -1;
+    }
+    *v = 0;
+    for ( ; i < len; i++ ) {
+        if ( s[i] < '0' || s[i] > '9' ) {
+            return -1;
+        }
+        *v = *v * 10 + (s[i] - '0');
+    }
+    if ( neg ) {
+        *v = -*v;
+    }
+
+    return 0;
+}
+
+/*
+ * Append an entry to the chunk
+ */
+static void *
+_append(struct tcam_chunk *c, size_t sz)
+{
+    void *ents;
+    size_t nsize;
+
+    if ( c->nr >= c->size ) {
+        nsize = c->size ? c->size * 2 : 1024;
+        ents = realloc(c->ents, sz * nsize);
+        if ( NULL == ents ) {
+            return NULL;
+        }
+        c->ents = ents;
+        c->size = nsize;
+    }
+
+    return (uint8_t *)c->ents + sz * c->nr++;
+}
+
+/*
+ * Allocate the array of the entries; the keys are aligned to the cache line
+ * so that a key does not straddle two lines
+ */
+static void *
+_alloc(size_t size, int keyonly)
+{
+    if ( !keyonly ) {
+        return malloc(size);
+    }
+
+    return aligned_alloc(64, (size + 63) & ~(size_t)63);
+}
+
+/*
+ * Parse all the lines in the chunk
+ */
+static void *
+_parse_chunk(void *arg)
+{
+    struct tcam_chunk *c;
+    struct palmtrie_rule *r;
+    const char *p;
+    const char *s;
+    size_t len;
+    long long v;
+    addr_t *key;
+
+    c = (struct tcam_chunk *)arg;
+    c->ret = -1;
+    p = c->p;
+    while ( p < c->end ) {
+        s = _token(&p, c->end, &len);
+        if ( 0 == len || '#' == s[0] ) {
+            /* Empty or comment line */
+            while ( p < c->end && '\n' != *p ) {
+                p++;
+            }
+            p++;
+            continue;
+        }
+        if ( c->keyonly ) {
+            /* Traffic pattern: the first column */
+            key = _append(c, sizeof(addr_t));
+            if ( NULL == key || _decode(s, len, key, c->flags) < 0 ) {
+                return NULL;
+            }
+        } else {
+            /* Ternary matching table: addr, mask, priority, and action */
+            r = _append(c, sizeof(struct palmtrie_rule));
+            if ( NULL == r || _decode(s, len, &r->addr, c->flags) < 0 ) {
+                return NULL;
+            }
+            if ( len > c->keylen ) {
+                c->keylen = len;
+            }
+            s = _token(&p, c->end, &len);
+            if ( _decode(s, len, &r->mask, c->flags) < 0 ) {
+                return NULL;
+            }
+            if ( _number(&p, c->end, &v) < 0 ) {
+                return NULL;
+            }
+            r->priority = v;
+            if ( _number(&p, c->end, &v) < 0 ) {
+                return NULL;
+            }
+            r->data = v;
+        }
+        /* Skip the rest of the line */
+        while ( p < c->end && '\n' != *p ) {
+            p++;
+        }
+        p++;
+    }
+    c->ret = 0;
+
+    return NULL;
+}
+
+/*
+ * Parse the mapped file, optionally in parallel
+ */
+static void *
+_parse(const char *buf, size_t size, int flags, int keyonly, size_t sz,
+       size_t *nr, int *keybits)
+{
+    struct tcam_chunk chunks[_MAX_THREADS];
+    const char *p;
+    uint8_t *ents;
+    size_t total;
+    long ncpu;
+    int nth;
+    int i;
+    int err;
+
+    nth = 1;
+    if ( flags & PALMTRIE_TCAM_THREADS ) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nth = ncpu > 0 ? ncpu : 1;
+        if ( nth > _MAX_THREADS ) {
+            nth = _MAX_THREADS;
+        }
+        if ( (size_t)nth > size / _MIN_CHUNK + 1 ) {
+            nth = size / _MIN_CHUNK + 1;
+        }
+    }
+
+    /* Split the file at line boundaries */
+    memset(chunks, 0, sizeof(chunks));
+    p = buf;
+    for ( i = 0; i < nth; i++ ) {
+        chunks[i].p = p;
+        if ( i == nth - 1 ) {
+            p = buf + size;
+        } else {
+            p = buf + size * (i + 1) / nth;
+            if ( p < chunks[i].p ) {
+                p = chunks[i].p;
+            }
+            while ( p < buf + size && '\n' != *p ) {
+                p++;
+            }
+            if ( p < buf + size ) {
+                p++;
+            }
+        }
+        chunks[i].end = p;
+        chunks[i].flags = flags;
+        chunks[i].keyonly = keyonly;
+    }
+
+    /* Parse */
+    err = 0;
+    for ( i = 1; i < nth; i++ ) {
+        if ( 0 == pthread_create(&chunks[i].th, NULL, _parse_chunk,
+                                 &chunks[i]) ) {
+            chunks[i].threaded = 1;
+        } else {
+            /* Parse in this thread instead */
+            _parse_chunk(&chunks[i]);
+        }
+    }
+    _parse_chunk(&chunks[0]);
+    for ( i = 1; i < nth; i++ ) {
+        if ( chunks[i].threaded ) {
+            pthread_join(chunks[i].th, NULL);
+        }
+    }
+
+    /* Concatenate the chunks */
+    total = 0;
+    *keybits = 0;
+    for ( i = 0; i < nth; i++ ) {
+        if ( chunks[i].ret < 0 ) {
+            err = 1;
+        }
+        total += chunks[i].nr;
+        if ( (int)chunks[i].keylen * 4 > *keybits ) {
+            *keybits = chunks[i].keylen * 4;
+        }
+    }
+    ents = NULL;
+    if ( !err ) {
+        if ( 1 == nth && !keyonly ) {
+            ents = chunks[0].ents;
+            chunks[0].ents = NULL;
+        } else {
+            ents = _alloc(sz * (total ? total : 1), keyonly);
+            if ( NULL != ents ) {
+                total = 0;
+                for ( i = 0; i < nth; i++ ) {
+                    if ( chunks[i].nr ) {
+                        memcpy(ents + sz * total, chunks[i].ents,
+                               sz * chunks[i].nr);
+                    }
+                    total += chunks[i].nr;
+                }
+            }
+        }
+    }
+    for ( i = 0; i < nth; i++ ) {
+        free(chunks[i].ents);
+    }
+    if ( NULL == ents && !err && 0 == total ) {
+        /* Empty file */
+        ents = malloc(sz);
+    }
+    if ( NULL == ents ) {
+        return NULL;
+    }
+    *nr = total;
+
+    return ents;
+}
+
+/*
+ * Parse a binary ruleset.  All the words are little endian.
+ */
+static struct palmtrie_rule *
+_parse_binary(const uint8_t *buf, size_t size, size_t *nr, int *keybits)
+{
+    const struct palmtrie_tcam_header *hdr;
+    const uint8_t *p;
+    const uint8_t *end;
+    struct palmtrie_rule *rules;
+    u32 flags;
+    u32 nwords;
+    u32 wmap;
+    u64 n;
+    u64 i;
+    u32 j;
+
+    if ( size < sizeof(struct palmtrie_tcam_header) ) {
+        return NULL;
+    }
+    hdr = (const struct palmtrie_tcam_header *)buf;
+    flags = le32toh(hdr->flags);
+    nwords = le32toh(hdr->nwords);
+    n = le64toh(hdr->nr);
+    if ( PALMTRIE_TCAM_VERSION != le32toh(hdr->version)
+         || nwords > sizeof(((addr_t *)0)->a) / sizeof(u64)
+         || n > size ) {
+        /* Unsupported version or key width */
+        return NULL;
+    }
+    *keybits = le32toh(hdr->keybits);
+
+    rules = malloc(sizeof(struct palmtrie_rule) * (n ? n : 1));
+    if ( NULL == rules ) {
+        return NULL;
+    }
+    memset(rules, 0, sizeof(struct palmtrie_rule) * (n ? n : 1));
+
+    p = buf + sizeof(struct palmtrie_tcam_header);
+    end = buf + size;
+    for ( i = 0; i < n; i++ ) {
+        if ( p + 16 > end ) {
+            goto error;
+        }
+        rules[i].priority = (int32_t)le32toh(*(const u32 *)p);
+        wmap = le32toh(*(const u32 *)(p + 4));
+        rules[i].data = le64toh(*(const u64 *)(p + 8));
+        p += 16;
+        if ( !(flags & PALMTRIE_TCAM_HDR_COMPACT) ) {
+            /* All the words are stored */
+            wmap = (1U << nwords) - 1;
+        }
+        for ( j = 0; j < nwords; j++ ) {
+            if ( wmap & (1U << j) ) {
+                if ( p + 16 > end ) {
+                    goto error;
+                }
+                rules[i].addr.a[j] = le64toh(*(const u64 *)p);
+                rules[i].mask.a[j] = le64toh(*(const u64 *)(p + 8));
+                p += 16;
+            } else {
+                /* Omitted wildcard word */
+                rules[i].mask.a[j] = ~0ULL;
+            }
+        }
+    }
+    *nr = n;
+
+    return rules;
+
+error:
+    free(rules);
+    return NULL;
+}
+
+/*
+ * Map the file and parse it
+ */
+static void *
+_load(const char *path, int flags, int keyonly, size_t sz, size_t *nr,
+      int *keybits)
+{
+    struct stat st;
+    void *buf;
+    void *ents;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( fstat(fd, &st) < 0 ) {
+        close(fd);
+        return NULL;
+    }
+    if ( 0 == st.st_size ) {
+        close(fd);
+        *nr = 0;
+        *keybits = 0;
+        return malloc(sz);
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( MAP_FAILED == buf ) {
+        return NULL;
+    }
+    (void)madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+    if ( !keyonly && (size_t)st.st_size >= sizeof(PALMTRIE_TCAM_MAGIC) - 1
+         && 0 == memcmp(buf, PALMTRIE_TCAM_MAGIC,
+                        sizeof(PALMTRIE_TCAM_MAGIC) - 1) ) {
+        /* Binary ruleset */
+        ents = _parse_binary(buf, st.st_size, nr, keybits);
+    } else {
+        ents = _parse(buf, st.st_size, flags, keyonly, sz, nr, keybits);
+    }
+
+    munmap(buf, st.st_size);
+
+    return ents;
+}
+
+/*
+ * Number of 64-bit words to store keys of the ruleset
+ */
+static __inline__ int
+_nwords(const struct palmtrie_ruleset *rs)
+{
+    int maxw;
+    int w;
+
+    maxw = sizeof(((addr_t *)0)->a) / sizeof(u64);
+    w = (rs->keybits + 63) / 64;
+    if ( w <= 0 || w > maxw ) {
+        w = maxw;
+    }
+
+    return w;
+}
+
+/*
+ * Write the ruleset in the binary format
+ */
+static int
+_save_binary(const struct palmtrie_ruleset *rs, FILE *fp, int flags)
+{
+    struct palmtrie_tcam_header hdr;
+    u64 buf[2 + 2 * 8];
+    u32 wmap;
+    size_t i;
+    int nwords;
+    int n;
+    int j;
+
+    nwords = _nwords(rs);
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PALMTRIE_TCAM_MAGIC, sizeof(hdr.magic));
+    hdr.version = htole32(PALMTRIE_TCAM_VERSION);
+    hdr.flags = htole32((flags & PALMTRIE_TCAM_COMPACT)
+                        ? PALMTRIE_TCAM_HDR_COMPACT : 0);
+    hdr.keybits = htole32(rs->keybits ? rs->keybits : nwords * 64);
+    hdr.nwords = htole32(nwords);
+    hdr.nr = htole64(rs->nr);
+    if ( 1 != fwrite(&hdr, sizeof(hdr), 1, fp) ) {
+        return -1;
+    }
+
+    for ( i = 0; i < rs->nr; i++ ) {
+        wmap = 0;
+        n = 2;
+        for ( j = 0; j < nwords; j++ ) {
+            if ( (flags & PALMTRIE_TCAM_COMPACT)
+                 && 0 == rs->rules[i].addr.a[j]
+                 && ~0ULL == rs->rules[i].mask.a[j] ) {
+                /* Omit the wildcard word */
+                continue;
+            }
+            wmap |= 1U << j;
+            buf[n++] = htole64(rs->rules[i].addr.a[j]);
+            buf[n++] = htole64(rs->rules[i].mask.a[j]);
+        }
+        if ( !(flags & PALMTRIE_TCAM_COMPACT) ) {
+            wmap = 0;
+        }
+        buf[0] = htole64((u64)(u32)rs->rules[i].priority
+                         | ((u64)wmap << 32));
+        buf[1] = htole64(rs->rules[i].data);
+        if ( 1 != fwrite(buf, sizeof(u64) * n, 1, fp) ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write a key in hexadecimal
+ */
+static __inline__ void
+_hexkey(char *s, const addr_t *addr, int nbytes, int flags)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *b;
+    int i;
+    int k;
+
+    b = (const uint8_t *)addr->a;
+    for ( i = 0; i < nbytes; i++ ) {
+        k = (flags & PALMTRIE_TCAM_REVERSE) ? nbytes - i - 1 : i;
+        s[2 * i] = hex[b[k] >> 4];
+        s[2 * i + 1] = hex[b[k] & 0xf];
+    }
+    s[2 * nbytes] = '\0';
+}
+
+/*
+ * Write the ruleset in the text format
+ */
+static int
+_save_text(const struct palmtrie_ruleset *rs, FILE *fp, int flags)
+{
+    char addr[sizeof(((addr_t *)0)->a) * 2 + 1];
+    char mask[sizeof(((addr_t *)0)->a) * 2 + 1];
+    size_t i;
+    int nbytes;
+
+    nbytes = rs->keybits ? (rs->keybits + 7) / 8 : _nwords(rs) * 8;
+    for ( i = 0; i < rs->nr; i++ ) {
+        _hexkey(addr, &rs->rules[i].addr, nbytes, flags);
+        _hexkey(mask, &rs->rules[i].mask, nbytes, flags);
+        if ( fprintf(fp, "%s %s %d %llu\n", addr, mask, rs->rules[i].priority,
+                     (unsigned long long)rs->rules[i].data) < 0 ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * palmtrie_ruleset_load -- load a ternary matching table file
+ */
+int
+palmtrie_ruleset_load(struct palmtrie_ruleset *rs, const char *path, int flags)
+{
+    rs->rules = _load(path, flags, 0, sizeof(struct palmtrie_rule), &rs->nr,
+                      &rs->keybits);
+    if ( NULL == rs->rules ) {
+        rs->nr = 0;
+        rs->keybits = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * palmtrie_ruleset_save -- save the ruleset to a ternary matching table file
+ */
+int
+palmtrie_ruleset_save(const struct palmtrie_ruleset *rs, const char *path,
+                      int flags)
+{
+    FILE *fp;
+    int ret;
+
+    fp = fopen(path, "w");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    if ( flags & (PALMTRIE_TCAM_BINARY | PALMTRIE_TCAM_COMPACT) ) {
+        ret = _save_binary(rs, fp, flags);
+    } else {
+        ret = _save_text(rs, fp, flags);
+    }
+    if ( 0 != fclose(fp) ) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/*
+ * palmtrie_ruleset_release -- release the rules in the ruleset
+ */
+void
+palmtrie_ruleset_release(struct palmtrie_ruleset *rs)
+{
+    free(rs->rules);
+    rs->rules = NULL;
+    rs->nr = 0;
+}
+
+/*
+ * palmtrie_add_ruleset -- add all the rules in the ruleset
+ */
+int
+palmtrie_add_ruleset(struct palmtrie *palmtrie,
+                     const struct palmtrie_ruleset *rs)
+{
+    size_t i;
+    int ret;
+
+    for ( i = 0; i < rs->nr; i++ ) {
+        ret = palmtrie_add_data(palmtrie, rs->rules[i].addr, rs->rules[i].mask,
+                                rs->rules[i].priority, rs->rules[i].data);
+        if ( ret < 0 ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * palmtrie_load_tcam -- load a ternary matching table file to the palmtrie
+ */
+int
+palmtrie_load_tcam(struct palmtrie *palmtrie, const char *path, int flags)
+{
+    struct palmtrie_ruleset rs;
+    int ret;
+
+    ret = palmtrie_ruleset_load(&rs, path, flags);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_ruleset(palmtrie, &rs);
+    palmtrie_ruleset_release(&rs);
+
+    return ret;
+}
+
+/*
+ * palmtrie_load_keys -- load the keys from a traffic pattern file
+ */
+addr_t *
+palmtrie_load_keys(const char *path, int flags, size_t *nr)
+{
+    int keybits;
+
+    return _load(path, flags, 1, sizeof(addr_t), nr, &keybits);
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -3,28 +3,10 @@
  * All rights reserved.
  */
 
-#include "../palmtrie.h"
+#include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-
-#include <alloca.h>
-void
-reverse(char *s)
-{
-    char *t;
-    int l;
-    int i;
-    l = strlen(s);
-    t = alloca(l + 1);
-    for ( i = 0; i < l; i++ ) {
-        t[i] = s[l - i - 1];
-    }
-    t[l] = 0;
-
-    strcpy(s, t);
-}
 
 /* Macro for testing */
 #define TEST_FUNC(str, func, ret)                \
@@ -45,57 +27,6 @@ reverse(char *s)
         fflush(stdout);                              \
     } while ( 0 )
 
-/*
- * Get current time at the microsecond granularity
- */
-double
-getmicrotime(void)
-{
-    struct timeval tv;
-    double microsec;
-
-    if ( 0 != gettimeofday(&tv, NULL) ) {
-        return 0.0;
-    }
-
-    microsec = (double)tv.tv_sec + (1.0 * tv.tv_usec / 1000000);
-
-    return microsec;
-}
-
-/*
- * Xorshift
- */
-static __inline__ u32
-xor128(void)
-{
-    static u32 x = 123456789;
-    static u32 y = 362436069;
-    static u32 z = 521288629;
-    static u32 w = 88675123;
-    u32 t;
-
-    t = x ^ (x<<11);
-    x = y;
-    y = z;
-    z = w;
-    return w = (w ^ (w>>19)) ^ (t ^ (t >> 8));
-}
-
-static __inline__ int
-hex2bin(char c)
-{
-    if ( c >= '0' && c <= '9' ) {
-        return c - '0';
-    } else if ( c >= 'a' && c <= 'f' ) {
-        return c - 'a' + 10;
-    } else if ( c >= 'A' && c <= 'F' ) {
-        return c - 'A' + 10;
-    } else {
-        return 0;
-    }
-}
-
 /*
  * Performance test
  */
@@ -103,75 +34,28 @@ static int
 test_microperf(enum palmtrie_type type, const char *fname, long long nr)
 {
     struct palmtrie palmtrie;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
     int ret;
-    addr_t addr = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    u64 d;
     long long i;
-    ssize_t k;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t tmp = {{0, 0, 0, 0, 0, 0, 0, 0}};
     double t0;
     double t1;
     double delta;
     u64 x;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
+    palmtrie_init(&palmtrie, type, 0);
 
-    /* Load from the linx file */
-    fp = fopen(fname, "r");
-    if ( NULL == fp ) {
+    /* Load from the TCAM file */
+    ret = palmtrie_load_tcam(&palmtrie, fname, PALMTRIE_TCAM_REVERSE);
+    if ( ret < 0 ) {
         return -1;
     }
-
-    /* Load the full route */
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        reverse(data0);
-        reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            d = hex2bin(data1[k]);
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-        }
-        ret = palmtrie_add_data(&palmtrie, addr, mask, priority, action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( 0 == i % 100000 ) {
-            TEST_PROGRESS();
-        }
-        i++;
-    }
+    TEST_PROGRESS();
     ret = palmtrie_commit(&palmtrie);
     if ( ret < 0 ) {
         return -1;
     }
 
-    /* Close */
-    fclose(fp);
-
     /* Benchmark */
     x = 0;
     t0 = getmicrotime();
@@ -223,118 +107,36 @@ test_rossperf(enum palmtrie_type type, const char *fname, const char *tfname,
               long long nr)
 {
     struct palmtrie palmtrie;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
     int ret;
-    addr_t addr = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    u64 d;
     long long i;
-    ssize_t k;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
     double t0;
     double t1;
     double delta;
     u64 x;
     addr_t *pattern;
-    int npkt;
-    long long j;
+    size_t npkt;
+    size_t j;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
+    palmtrie_init(&palmtrie, type, 0);
 
     /* Load TCAM file */
-    fp = fopen(fname, "r");
-    if ( NULL == fp ) {
+    ret = palmtrie_load_tcam(&palmtrie, fname, PALMTRIE_TCAM_REVERSE);
+    if ( ret < 0 ) {
         return -1;
     }
-
-    /* Load the full route */
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        reverse(data0);
-        reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            d = hex2bin(data1[k]);
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-        }
-        ret = palmtrie_add_data(&palmtrie, addr, mask, priority, action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( 0 == i % 100000 ) {
-            TEST_PROGRESS();
-        }
-        i++;
-    }
+    TEST_PROGRESS();
     ret = palmtrie_commit(&palmtrie);
     if ( ret < 0 ) {
         return -1;
     }
 
-    /* Close */
-    fclose(fp);
-
     /* Traffic pattern */
-    fp = fopen(tfname, "r");
-    if ( NULL == fp ) {
+    pattern = palmtrie_load_keys(tfname, PALMTRIE_TCAM_REVERSE, &npkt);
+    if ( NULL == pattern || 0 == npkt ) {
         return -1;
     }
-
-    /* Load the full route */
-    i = 0;
-    pattern = malloc(sizeof(addr_t) * 65536 * 256);
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s", data0);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        reverse(data0);
-        if ( strlen(data0) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        memset(&tmp, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            tmp.a[k >> 4] |= d << ((k & 0xf) << 2);
-        }
-        (void)memcpy(&pattern[i], &tmp, sizeof(addr_t));
-        if ( 0 == i % 1000000 ) {
-            TEST_PROGRESS();
-        }
-        i++;
-        if ( i >= 65536 * 256 ) {
-            break;
-        }
-    }
-    npkt = i;
-
-    /* Close */
-    fclose(fp);
+    TEST_PROGRESS();
 
     /* Benchmark */
     x = 0;
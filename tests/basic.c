@@ -3,28 +3,11 @@
  * All rights reserved.
  */
 
-#include "../palmtrie.h"
+#include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
-
-#include <alloca.h>
-void
-reverse(char *s)
-{
-    char *t;
-    int l;
-    int i;
-    l = strlen(s);
-    t = alloca(l + 1);
-    for ( i = 0; i < l; i++ ) {
-        t[i] = s[l - i - 1];
-    }
-    t[l] = 0;
-
-    strcpy(s, t);
-}
+#include <unistd.h>
 
 /* Macro for testing */
 #define TEST_FUNC(str, func, ret)                \
@@ -40,217 +23,1291 @@ reverse(char *s)
         printf("\n");                            \
     } while ( 0 )
 
+#define TEST_STRIDES(str, func, strides, ret)     \
+    do {                                          \
+        printf("%s: ", str);                      \
+        fflush(stdout);                           \
+        if ( 0 == test_strides(func, strides) ) { \
+            printf("passed");                     \
+        } else {                                  \
+            printf("failed");                     \
+            ret = -1;                             \
+        }                                         \
+        printf("\n");                             \
+    } while ( 0 )
+
 #define TEST_PROGRESS()                              \
     do {                                             \
         printf(".");                                 \
         fflush(stdout);                              \
     } while ( 0 )
 
+/* Strides of the tests of Palmtrie+, terminated by 0 */
+static const int strides_4_8[] = { 4, 8, 0 };
+static const int strides_8_var[] = { 8, PALMTRIE_STRIDE_VARIABLE, 0 };
+static const int strides_4_8_var[] = { 4, 8, PALMTRIE_STRIDE_VARIABLE, 0 };
+
 /*
- * Get current time at the microsecond granularity
+ * Run a test of a stride for each of the strides
  */
-double
-getmicrotime(void)
+static int
+test_strides(int (*test)(int), const int *strides)
 {
-    struct timeval tv;
-    double microsec;
+    int i;
 
-    if ( 0 != gettimeofday(&tv, NULL) ) {
-        return 0.0;
+    for ( i = 0; 0 != strides[i]; i++ ) {
+        if ( test(strides[i]) < 0 ) {
+            return -1;
+        }
     }
 
-    microsec = (double)tv.tv_sec + (1.0 * tv.tv_usec / 1000000);
+    return 0;
+}
+
+/*
+ * Test
+ */
+static int
+test_true(enum palmtrie_type type, int stride)
+{
+    struct palmtrie palmtrie;
+    int ret;
+    addr_t addrs[] = {
+        {{0x5, 0, 0, 0, 0, 0, 0, 0}}, {{0, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x3, 0, 0, 0, 0, 0, 0, 0}}, {{0, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x0, 0, 0, 0, 0, 0, 0, 0}}, {{1, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x0, 0, 0, 0, 0, 0, 0, 0}}, {{0xffffffffULL, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb20c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb22100ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb22400ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0x3ff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb22c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb24000ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0x3fff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb24e00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb25600ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb25b00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb25c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb27c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb27f00ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0xff, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb28000ULL, 0, 0, 0, 0, 0, 0, 0}}, {{0x7fff, 0, 0, 0, 0, 0, 0, 0}},
+    };
+    addr_t tests[] = {
+        {{0xcbb24001ULL, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb26001ULL, 0, 0, 0, 0, 0, 0, 0}},
+        {{0xcbb28701ULL, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x3, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x5, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x2, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x1, 0, 0, 0, 0, 0, 0, 0}},
+        {{0x0, 0, 0, 0, 0, 0, 0, 0}},
+    };
+
+    if ( NULL == palmtrie_init(&palmtrie, type, stride) ) {
+        return -1;
+    }
 
-    return microsec;
+    ret = palmtrie_add_data(&palmtrie, addrs[0], addrs[1], 2, 5);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[2], addrs[3], 2, 3);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[4], addrs[5], 1, 2);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[6], addrs[7], 0, 9);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[8], addrs[9], 24, 11);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[10], addrs[11], 24, 12);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[12], addrs[13], 22, 13);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[14], addrs[15], 24, 14);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[16], addrs[17], 18, 15);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[18], addrs[19], 24, 16);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[20], addrs[21], 24, 17);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[22], addrs[23], 24, 18);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[24], addrs[25], 24, 19);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[26], addrs[27], 24, 20);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[28], addrs[29], 24, 21);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_add_data(&palmtrie, addrs[30], addrs[31], 17, 22);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    ret = palmtrie_commit(&palmtrie);
+    if ( ret < 0 ) {
+        return -1;
+    }
+
+    if ( 15 != palmtrie_lookup(&palmtrie, tests[0]) ) {
+        return -1;
+    }
+    if ( 15 != palmtrie_lookup(&palmtrie, tests[1]) ) {
+        return -1;
+    }
+    if ( 22 != palmtrie_lookup(&palmtrie, tests[2]) ) {
+        return -1;
+    }
+    if ( 3 != palmtrie_lookup(&palmtrie, tests[3]) ) {
+        return -1;
+    }
+    if ( 5 != palmtrie_lookup(&palmtrie, tests[4]) ) {
+        return -1;
+    }
+    if ( 9 != palmtrie_lookup(&palmtrie, tests[5]) ) {
+        return -1;
+    }
+    if ( 2 != palmtrie_lookup(&palmtrie, tests[6]) ) {
+        return -1;
+    }
+    if ( 2 != palmtrie_lookup(&palmtrie, tests[7]) ) {
+        return -1;
+    }
+
+    return 0;
+}
+static int
+test_true_sl(void)
+{
+    return test_true(PALMTRIE_SORTED_LIST, 0);
+}
+static int
+test_true_tpt(void)
+{
+    return test_true(PALMTRIE_BASIC, 0);
+}
+static int
+test_true_mtpt(void)
+{
+    return test_true(PALMTRIE_DEFAULT, 0);
+}
+static int
+test_true_popmtpt(void)
+{
+    return test_true(PALMTRIE_PLUS, 0);
+}
+static int
+test_true_auto(void)
+{
+    return test_true(PALMTRIE_AUTO, 0);
+}
+static int
+test_true_partition(void)
+{
+    if ( test_true(PALMTRIE_PARTITION, 8) < 0 ) {
+        return -1;
+    }
+
+    return test_true(PALMTRIE_PARTITION, PALMTRIE_STRIDE_VARIABLE);
+}
+static int
+test_true_strides(void)
+{
+    static const int strides[] = { 4, 6, 7, 8 };
+    int i;
+
+    for ( i = 0; i < (int)(sizeof(strides) / sizeof(strides[0])); i++ ) {
+        if ( test_true(PALMTRIE_DEFAULT, strides[i]) < 0 ) {
+            return -1;
+        }
+        if ( test_true(PALMTRIE_PLUS, strides[i]) < 0 ) {
+            return -1;
+        }
+    }
+    if ( test_true(PALMTRIE_PLUS, PALMTRIE_STRIDE_VARIABLE) < 0 ) {
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
- * Xorshift
+ * Test of the fully specified entries split into the hash table, mixed with
+ * the wildcard entries of lower and higher priorities
  */
-static __inline__ u32
-xor128(void)
-{
-    static u32 x = 123456789;
-    static u32 y = 362436069;
-    static u32 z = 521288629;
-    static u32 w = 88675123;
-    u32 t;
-
-    t = x ^ (x<<11);
-    x = y;
-    y = z;
-    z = w;
-    return w = (w ^ (w>>19)) ^ (t ^ (t >> 8));
-}
-
-static __inline__ int
-hex2bin(char c)
-{
-    if ( c >= '0' && c <= '9' ) {
-        return c - '0';
-    } else if ( c >= 'a' && c <= 'f' ) {
-        return c - 'a' + 10;
-    } else if ( c >= 'A' && c <= 'F' ) {
-        return c - 'A' + 10;
-    } else {
+static int
+test_exact(int stride)
+{
+    struct palmtrie palmtrie;
+    addr_t zero = PALMTRIE_ADDR_ZERO;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    static const struct {
+        u64 addr;
+        u64 mask;
+        int priority;
+        u64 data;
+    } rules[] = {
+        { 0x1234, 0, 10, 1 },
+        { 0x1234, 0, 8, 4 },
+        { 0x1200, 0xff, 5, 2 },
+        { 0x1250, 0xf, 20, 3 },
+        { 0x1255, 0, 15, 5 },
+    };
+    static const u64 tests[][2] = {
+        { 0x1234, 1 }, { 0x1235, 2 }, { 0x1255, 3 }, { 0x1256, 3 },
+        { 0x1300, 0 },
+    };
+    int i;
+
+    if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    for ( i = 0; i < (int)(sizeof(rules) / sizeof(rules[0])); i++ ) {
+        addr.a[0] = rules[i].addr;
+        mask.a[0] = rules[i].mask;
+        if ( palmtrie_add_data(&palmtrie, addr, mask, rules[i].priority,
+                               rules[i].data) < 0 ) {
+            return -1;
+        }
+    }
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++ ) {
+        addr.a[0] = tests[i][0];
+        if ( palmtrie_lookup(&palmtrie, addr) != tests[i][1] ) {
+            return -1;
+        }
+    }
+    palmtrie_release(&palmtrie);
+
+    /* Only the fully specified entries */
+    if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    addr.a[0] = 0x1234;
+    if ( palmtrie_add_data(&palmtrie, addr, zero, 1, 7) < 0 ) {
+        return -1;
+    }
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
+        return -1;
+    }
+    if ( palmtrie_lookup(&palmtrie, addr) != 7
+         || palmtrie_lookup(&palmtrie, zero) != 0 ) {
+        return -1;
+    }
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+/*
+ * Range test; the rules have a 16-bit field from the bit 16 and a 16-bit
+ * range field from the bit 0
+ */
+static int
+test_range(enum palmtrie_type type, int stride)
+{
+    struct palmtrie palmtrie;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    struct palmtrie_range range = { 0, 16, 0, 0 };
+    static const struct {
+        u64 addr;
+        u64 mask;
+        u32 lo;
+        u32 hi;
+        int priority;
+    } rules[] = {
+        { 0x0a000000, 0x00ff0000, 1024, 65535, 10 },
+        { 0x0a000000, 0x00ff0000, 0, 1023, 5 },
+        { 0x0a000000, 0x00ff0000, 80, 80, 20 },
+        { 0x00000000, 0xffff0000, 1000, 2000, 1 },
+        { 0x0a000000, 0x00ff0000, 500, 3000, 15 },
+        { 0x0a000000, 0x00ff0000, 2048, 65535, 12 },
+        { 0x0a000000, 0x00ff0000, 1500, 1600, 30 },
+    };
+    static const u32 ports[] = {
+        0, 79, 80, 81, 499, 500, 1000, 1023, 1024, 1500, 1600, 1601, 2000,
+        2047, 2048, 3000, 3001, 65535
+    };
+    u64 expected;
+    int best;
+    int nr;
+    int i;
+    int j;
+    int k;
+
+    if ( NULL == palmtrie_init(&palmtrie, type, stride) ) {
+        return -1;
+    }
+    /* The last rule is added after the first commit */
+    for ( nr = 6; nr <= 7; nr++ ) {
+        for ( i = nr == 6 ? 0 : 6; i < nr; i++ ) {
+            addr.a[0] = rules[i].addr;
+            mask.a[0] = rules[i].mask;
+            range.lo = rules[i].lo;
+            range.hi = rules[i].hi;
+            if ( palmtrie_add_range(&palmtrie, addr, mask, &range, 1,
+                                    rules[i].priority, i + 1) < 0 ) {
+                return -1;
+            }
+        }
+        if ( palmtrie_commit(&palmtrie) < 0 ) {
+            return -1;
+        }
+        for ( j = 0; j < 2; j++ ) {
+            for ( k = 0; k < (int)(sizeof(ports) / sizeof(ports[0])); k++ ) {
+                addr.a[0] = (j ? 0x0b050000 : 0x0a050000) | ports[k];
+                expected = 0;
+                best = -1;
+                for ( i = 0; i < nr; i++ ) {
+                    if ( (addr.a[0] & ~rules[i].mask & ~0xffffULL)
+                         == rules[i].addr && ports[k] >= rules[i].lo
+                         && ports[k] <= rules[i].hi
+                         && rules[i].priority > best ) {
+                        best = rules[i].priority;
+                        expected = i + 1;
+                    }
+                }
+                if ( palmtrie_lookup(&palmtrie, addr) != expected ) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    /* Invalid ranges */
+    range.lo = 2;
+    range.hi = 1;
+    if ( palmtrie_add_range(&palmtrie, addr, mask, &range, 1, 1, 1) >= 0 ) {
+        return -1;
+    }
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+static int
+test_range_types(void)
+{
+    if ( test_range(PALMTRIE_PLUS, 8) < 0 || test_range(PALMTRIE_PLUS, 4) < 0
+         || test_range(PALMTRIE_PLUS, PALMTRIE_STRIDE_VARIABLE) < 0 ) {
+        return -1;
+    }
+
+    return test_range(PALMTRIE_SORTED_LIST, 0);
+}
+
+/*
+ * Range rules added after the commit, cross-checked with the sorted list at
+ * each of the phases of random range and plain rules on the keys of an 8-bit
+ * field from the bit 16 and a 16-bit range field from the bit 0; the wildcard
+ * of the bits from 24 keeps the plain rules off the exact-match table
+ */
+static int
+test_range_update(int stride)
+{
+    struct palmtrie palmtrie0;
+    struct palmtrie palmtrie1;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    struct palmtrie_range range = { 0, 16, 0, 0 };
+    static const u32 bounds[][2] = {
+        { 1024, 65535 }, { 2000, 60000 }, { 0, 1023 }, { 80, 80 },
+        { 500, 3000 }, { 0, 65535 },
+    };
+    static const u32 ports[] = {
+        0, 80, 81, 500, 1023, 1024, 1500, 2000, 3000, 3001, 60000, 65535
+    };
+    int phase;
+    int i;
+    int j;
+    int k;
+
+    if ( NULL == palmtrie_init(&palmtrie0, PALMTRIE_SORTED_LIST, 0)
+         || NULL == palmtrie_init(&palmtrie1, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+
+    /* A higher priority of the same group after the commit */
+    addr.a[0] = 0x000a0000;
+    mask.a[0] = 0xff000000;
+    range.lo = 1024;
+    range.hi = 65535;
+    if ( palmtrie_add_range(&palmtrie1, addr, mask, &range, 1, 5, 1) < 0
+         || palmtrie_commit(&palmtrie1) < 0 ) {
+        return -1;
+    }
+    range.lo = 2000;
+    range.hi = 60000;
+    if ( palmtrie_add_range(&palmtrie1, addr, mask, &range, 1, 10, 2) < 0
+         || palmtrie_commit(&palmtrie1) < 0 ) {
+        return -1;
+    }
+    for ( k = 0; k < (int)(sizeof(ports) / sizeof(ports[0])); k++ ) {
+        addr.a[0] = 0x050a0000 | ports[k];
+        if ( palmtrie_lookup(&palmtrie1, addr)
+             != (ports[k] < 1024 ? 0
+                 : (ports[k] >= 2000 && ports[k] <= 60000 ? 2 : 1)) ) {
+            return -1;
+        }
+    }
+    palmtrie_release(&palmtrie1);
+
+    /* Random rules in the phases */
+    if ( NULL == palmtrie_init(&palmtrie1, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    for ( phase = 0; phase < 3; phase++ ) {
+        for ( i = phase * 32; i < (phase + 1) * 32; i++ ) {
+            addr.a[0] = (u64)(0x0a + xor128() % 2) << 16;
+            mask.a[0] = xor128() % 2 ? 0xff000000 : 0;
+            j = xor128() % (sizeof(bounds) / sizeof(bounds[0]));
+            range.lo = bounds[j][0];
+            range.hi = bounds[j][1];
+            if ( 0 == xor128() % 4 ) {
+                /* Plain rule of any port */
+                mask.a[0] |= 0xffff;
+                if ( palmtrie_add_data(&palmtrie0, addr, mask, i, i + 1) < 0
+                     || palmtrie_add_data(&palmtrie1, addr, mask, i,
+                                          i + 1) < 0 ) {
+                    return -1;
+                }
+                continue;
+            }
+            if ( palmtrie_add_range(&palmtrie0, addr, mask, &range, 1, i,
+                                    i + 1) < 0
+                 || palmtrie_add_range(&palmtrie1, addr, mask, &range, 1, i,
+                                       i + 1) < 0 ) {
+                return -1;
+            }
+        }
+        if ( palmtrie_commit(&palmtrie0) < 0
+             || palmtrie_commit(&palmtrie1) < 0 ) {
+            return -1;
+        }
+        for ( j = 0x0a; j <= 0x0c; j++ ) {
+            for ( k = 0; k < (int)(sizeof(ports) / sizeof(ports[0])); k++ ) {
+                addr.a[0] = 0x05000000 | ((u64)j << 16) | ports[k];
+                if ( palmtrie_lookup(&palmtrie0, addr)
+                     != palmtrie_lookup(&palmtrie1, addr) ) {
+                    return -1;
+                }
+            }
+        }
+    }
+    palmtrie_release(&palmtrie0);
+    palmtrie_release(&palmtrie1);
+
+    return 0;
+}
+
+/*
+ * Plain rule of the same key as a group of the range rules, i.e., a rule of
+ * any port and a rule of a port range of the same tuple, added before and
+ * after the range rule, and in the same commit or not; the key is not a
+ * candidate of the exact-match table
+ */
+static int
+test_range_same_key(int stride)
+{
+    struct palmtrie palmtrie;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t range_mask = PALMTRIE_ADDR_ZERO;
+    addr_t plain_mask = PALMTRIE_ADDR_ZERO;
+    struct palmtrie_range range = { 0, 16, 1024, 65535 };
+    static const u64 tests[][2] = {
+        { 0x050a0050, 2 }, { 0x050a05dc, 1 }, { 0x050affff, 1 },
+        { 0x050b05dc, 0 },
+    };
+    int order;
+    int i;
+
+    addr.a[0] = 0x000a0000;
+    range_mask.a[0] = 0xff000000;
+    plain_mask.a[0] = 0xff00ffff;
+    for ( order = 0; order < 4; order++ ) {
+        if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, stride) ) {
+            return -1;
+        }
+        /* The range rule first (0, 1) or the plain rule first (2, 3), and
+           committed in between (1, 3) */
+        for ( i = 0; i < 2; i++ ) {
+            if ( (order < 2) == (0 == i) ) {
+                if ( palmtrie_add_range(&palmtrie, addr, range_mask, &range, 1,
+                                        10, 1) < 0 ) {
+                    return -1;
+                }
+            } else if ( palmtrie_add_data(&palmtrie, addr, plain_mask, 5,
+                                          2) < 0 ) {
+                return -1;
+            }
+            if ( (0 == i && (order & 1)) || 1 == i ) {
+                if ( palmtrie_commit(&palmtrie) < 0 ) {
+                    return -1;
+                }
+            }
+        }
+        for ( i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++ ) {
+            addr.a[0] = tests[i][0];
+            if ( palmtrie_lookup(&palmtrie, addr) != tests[i][1] ) {
+                return -1;
+            }
+        }
+        addr.a[0] = 0x000a0000;
+        palmtrie_release(&palmtrie);
+    }
+
+    return 0;
+}
+
+/*
+ * Test of the lookup on IPv4/TCP headers; the key has the protocol, the source
+ * and destination addresses, and the ports as in the ACL tables, and the
+ * destination port as a number for the range field from the byte 13
+ */
+static int
+test_lookup_pkt(void)
+{
+    struct palmtrie palmtrie;
+    struct palmtrie_fields desc;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    addr_t key;
+    struct palmtrie_range range = { 104, 16, 1024, 65535 };
+    static const struct palmtrie_field fields[] = {
+        { 9, 1, 0, 0 },
+        { 12, 4, 1, 0 },
+        { 16, 4, 5, 0 },
+        { 20, 4, 9, 0 },
+        { 22, 2, 13, PALMTRIE_FIELD_REVERSE },
+    };
+    static const struct palmtrie_field overlapping[] = {
+        { 12, 4, 1, 0 },
+        { 16, 4, 4, 0 },
+    };
+    uint8_t hdr[40];
+    uint8_t *a;
+    uint8_t *m;
+
+    if ( palmtrie_fields_compile(&desc, overlapping, 2) >= 0 ) {
+        return -1;
+    }
+    if ( palmtrie_fields_compile(&desc, fields, 5) < 0 ) {
+        return -1;
+    }
+    if ( 3 != desc.nr || 24 != desc.len ) {
+        /* The addresses and the ports are copied at once */
+        return -1;
+    }
+    if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, 8) ) {
+        return -1;
+    }
+
+    /* TCP to 10.0.0.0/8, and TCP to any */
+    a = (uint8_t *)addr.a;
+    m = (uint8_t *)mask.a;
+    memset(m, 0xff, 16);
+    a[0] = 6;
+    m[0] = 0;
+    a[5] = 10;
+    m[5] = 0;
+    if ( palmtrie_add_range(&palmtrie, addr, mask, &range, 1, 10, 1) < 0 ) {
+        return -1;
+    }
+    a[5] = 0;
+    m[5] = 0xff;
+    if ( palmtrie_add_data(&palmtrie, addr, mask, 1, 2) < 0
+         || palmtrie_commit(&palmtrie) < 0 ) {
+        return -1;
+    }
+
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 0x45;
+    hdr[9] = 6;
+    memcpy(hdr + 12, "\xc0\xa8\x00\x01\x0a\x01\x02\x03", 8);
+    /* 12345 to 8080 */
+    memcpy(hdr + 20, "\x30\x39\x1f\x90", 4);
+    palmtrie_fields_key(&desc, hdr, &key);
+    if ( 6 != ((uint8_t *)key.a)[0] || 0x0a != ((uint8_t *)key.a)[5]
+         || 0x90 != ((uint8_t *)key.a)[12]
+         || 8080 != EXTRACTN(key, 104, 16) ) {
+        return -1;
+    }
+    if ( 1 != palmtrie_lookup_pkt(&palmtrie, &desc, hdr) ) {
+        return -1;
+    }
+    /* To 80 */
+    memcpy(hdr + 22, "\x00\x50", 2);
+    if ( 2 != palmtrie_lookup_pkt(&palmtrie, &desc, hdr) ) {
+        return -1;
+    }
+    /* UDP */
+    hdr[9] = 17;
+    if ( 0 != palmtrie_lookup_pkt(&palmtrie, &desc, hdr) ) {
+        return -1;
+    }
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+/*
+ * Test of the leaves of the keys specified in all the words but the highest
+ * one, which do not fit in the leaves
+ */
+static u64
+_leaf_word(int i, int w, int nw)
+{
+    if ( w == nw - 1 ) {
+        /* To be zero */
         return 0;
     }
+
+    return (0x9e3779b97f4a7c15ULL * (i * nw + w + 1)) & ~0xfffULL;
+}
+
+static int
+test_leaf_words(int stride)
+{
+    struct palmtrie palmtrie;
+    addr_t addr;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    int nw;
+    int i;
+    int w;
+
+    if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    nw = sizeof(addr.a) / sizeof(addr.a[0]);
+    /* Not split into the exact-match table */
+    mask.a[0] = 0xf0f;
+    for ( i = 0; i < 16; i++ ) {
+        for ( w = 0; w < nw; w++ ) {
+            addr.a[w] = _leaf_word(i, w, nw);
+        }
+        if ( palmtrie_add_data(&palmtrie, addr, mask, i, i + 1) < 0 ) {
+            return -1;
+        }
+    }
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < 16; i++ ) {
+        for ( w = 0; w < nw; w++ ) {
+            addr.a[w] = _leaf_word(i, w, nw);
+        }
+        addr.a[0] |= i;
+        if ( palmtrie_lookup(&palmtrie, addr) != (u64)i + 1 ) {
+            return -1;
+        }
+        /* A different bit in any word */
+        for ( w = 0; w < nw; w++ ) {
+            addr.a[w] ^= 1ULL << 40;
+            if ( 0 != palmtrie_lookup(&palmtrie, addr) ) {
+                return -1;
+            }
+            addr.a[w] ^= 1ULL << 40;
+        }
+    }
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+/*
+ * Redundancy elimination test
+ */
+static int
+test_eliminate(int stride)
+{
+    struct palmtrie palmtrie;
+    const struct palmtrie_eliminated *report;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    static const struct {
+        u64 addr;
+        u64 mask;
+        int priority;
+        u64 data;
+    } rules[] = {
+        { 0x10, 0x0f, 50, 1 },
+        { 0x12, 0x01, 40, 2 },  /* Shadowed by #0 */
+        { 0x20, 0x03, 30, 3 },  /* Redundant by #3 */
+        { 0x20, 0x1f, 10, 3 },
+        { 0x40, 0x3f, 20, 4 },
+        { 0x00, 0xff, 1, 5 },
+        { 0x30, 0x07, 25, 6 },
+        { 0x80, 0x0f, 35, 7 },  /* Not redundant due to #8 */
+        { 0x80, 0x1f, 20, 8 },
+        { 0x80, 0x7f, 5, 7 },
+        { 0x22, 0x01, 20, 9 },  /* Added later; #2 is kept and shadows it */
+    };
+    size_t nr;
+    u64 expected;
+    int best;
+    int n;
+    int i;
+    int k;
+
+    if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    if ( palmtrie_set_eliminate(&palmtrie, 1) < 0 ) {
+        return -1;
+    }
+    for ( n = 10; n <= 11; n++ ) {
+        for ( i = n == 10 ? 0 : 10; i < n; i++ ) {
+            addr.a[0] = rules[i].addr;
+            mask.a[0] = rules[i].mask;
+            if ( palmtrie_add_data(&palmtrie, addr, mask, rules[i].priority,
+                                   rules[i].data) < 0 ) {
+                return -1;
+            }
+        }
+        if ( palmtrie_commit(&palmtrie) < 0 ) {
+            return -1;
+        }
+        report = palmtrie_eliminated(&palmtrie, &nr);
+        if ( 2 != nr || 1 != report[0].rule || 0 != report[0].by
+             || PALMTRIE_SHADOWED != report[0].reason ) {
+            return -1;
+        }
+        if ( 10 == n && (2 != report[1].rule || 3 != report[1].by
+                         || PALMTRIE_REDUNDANT != report[1].reason) ) {
+            return -1;
+        }
+        if ( 11 == n && (10 != report[1].rule || 2 != report[1].by
+                         || PALMTRIE_SHADOWED != report[1].reason) ) {
+            return -1;
+        }
+        for ( k = 0; k < 256; k++ ) {
+            addr.a[0] = k;
+            expected = 0;
+            best = -1;
+            for ( i = 0; i < n; i++ ) {
+                if ( (k & ~rules[i].mask) == rules[i].addr
+                     && rules[i].priority > best ) {
+                    best = rules[i].priority;
+                    expected = rules[i].data;
+                }
+            }
+            if ( palmtrie_lookup(&palmtrie, addr) != expected ) {
+                return -1;
+            }
+        }
+    }
+
+    /* Only before adding any entry */
+    if ( palmtrie_set_eliminate(&palmtrie, 0) >= 0 ) {
+        return -1;
+    }
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+/*
+ * Test of the prefix-only compilation of 128-bit keys against the sorted
+ * list, including the wide entry matching the keys set above the width, and
+ * of the fallback to the ternary trie
+ */
+static int
+_prefix_cross(struct palmtrie *sl, struct palmtrie *pl, const u64 *seeds)
+{
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    int i;
+
+    for ( i = 0; i < 20000; i++ ) {
+        addr.a[0] = xor128();
+        addr.a[1] = seeds[i & 3] ^ (xor128() >> (i & 63));
+        addr.a[3] = 0 == i % 16 ? 1 : 0;
+        if ( palmtrie_lookup(sl, addr) != palmtrie_lookup(pl, addr) ) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+test_prefix_only(int stride)
+{
+    struct palmtrie sl;
+    struct palmtrie pl;
+    addr_t addrs[2000];
+    addr_t masks[2000];
+    addr_t mask;
+    addr_t wide;
+    u64 seeds[4];
+    int len;
+    int i;
+    int j;
+    int n;
+
+    if ( NULL == palmtrie_init(&sl, PALMTRIE_SORTED_LIST, 0)
+         || NULL == palmtrie_init(&pl, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    for ( i = 0; i < 4; i++ ) {
+        seeds[i] = xor128();
+    }
+    n = 0;
+    for ( i = 0; i < 2000; i++ ) {
+        /* Nested prefixes of the priorities of the lengths */
+        len = 1 + (int)(xor128() % 128);
+        memset(&mask, 0, sizeof(addr_t));
+        mask.a[0] = len <= 64 ? ~0ULL : (1ULL << (128 - len)) - 1;
+        mask.a[1] = len < 64 ? (1ULL << (64 - len)) - 1 : 0;
+        memset(&addrs[n], 0, sizeof(addr_t));
+        addrs[n].a[0] = xor128() & ~mask.a[0];
+        addrs[n].a[1] = (seeds[i & 3] ^ (xor128() >> (i & 63)))
+            & ~mask.a[1];
+        masks[n] = mask;
+        for ( j = 0; j < n; j++ ) {
+            if ( ADDR_CMP(addrs[j], addrs[n]) && ADDR_CMP(masks[j], mask) ) {
+                break;
+            }
+        }
+        if ( j < n ) {
+            /* Duplicate */
+            continue;
+        }
+        if ( palmtrie_add_data(&sl, addrs[n], mask, len, i + 1) < 0
+             || palmtrie_add_data(&pl, addrs[n], mask, len, i + 1) < 0 ) {
+            return -1;
+        }
+        n++;
+    }
+    memset(&wide, 0xff, sizeof(addr_t));
+    memset(&addrs[0], 0, sizeof(addr_t));
+    if ( palmtrie_add_data(&sl, addrs[0], wide, 0, 0xffff) < 0
+         || palmtrie_add_data(&pl, addrs[0], wide, 0, 0xffff) < 0
+         || palmtrie_commit(&sl) < 0 || palmtrie_commit(&pl) < 0 ) {
+        return -1;
+    }
+    if ( NULL == pl.prefix.direct.ptr
+         || _prefix_cross(&sl, &pl, seeds) < 0 ) {
+        return -1;
+    }
+
+    /* An entry of a ternary mask */
+    memset(&mask, 0, sizeof(addr_t));
+    mask.a[0] = 0xf0f;
+    addrs[0].a[1] = seeds[0];
+    if ( palmtrie_add_data(&sl, addrs[0], mask, 200, 0xfffe) < 0
+         || palmtrie_add_data(&pl, addrs[0], mask, 200, 0xfffe) < 0
+         || palmtrie_commit(&sl) < 0 || palmtrie_commit(&pl) < 0 ) {
+        return -1;
+    }
+    if ( NULL != pl.prefix.direct.ptr || _prefix_cross(&sl, &pl, seeds) < 0
+         || palmtrie_lookup(&pl, addrs[0]) != 0xfffe ) {
+        return -1;
+    }
+    palmtrie_release(&sl);
+    palmtrie_release(&pl);
+
+    return 0;
+}
+
+/*
+ * Shared subtrees of Palmtrie+ for the cross product of the groups of the
+ * sources, the destinations, and the ports, cross-checked with the ternary
+ * PATRICIA trie before and after another group is added
+ */
+static int
+test_share(int stride)
+{
+    struct palmtrie palmtrie0;
+    struct palmtrie palmtrie1;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    static const u64 ports[] = { 22, 80, 443 };
+    u64 src;
+    u64 dst;
+    int nr;
+    int i;
+    int j;
+    int k;
+    int l;
+
+    palmtrie_init(&palmtrie0, PALMTRIE_BASIC, 0);
+    if ( NULL == palmtrie_init(&palmtrie1, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+
+    /* Source in the bits 48-63, destination in the bits 16-31 with the
+       wildcard of the lower 4 or 8 bits, and port in the bits 0-15 */
+    nr = 0;
+    for ( l = 0; l < 2; l++ ) {
+        for ( i = 0; i < 64; i++ ) {
+            src = (u64)(0x0a00 + i * 7 + l * 0x100);
+            for ( j = 0; j < 8; j++ ) {
+                dst = (u64)(0xc000 + j * 0x300);
+                mask.a[0] = (j & 1) ? 0xff0000ULL : 0xf0000ULL;
+                for ( k = 0; k < 3; k++ ) {
+                    addr.a[0] = (src << 48) | (dst << 16) | ports[k];
+                    addr.a[0] &= ~mask.a[0];
+                    if ( palmtrie_add_data(&palmtrie0, addr, mask, 10 + l,
+                                           1 + l) < 0
+                         || palmtrie_add_data(&palmtrie1, addr, mask, 10 + l,
+                                              1 + l) < 0 ) {
+                        return -1;
+                    }
+                    nr++;
+                }
+            }
+        }
+        if ( palmtrie_commit(&palmtrie0) < 0
+             || palmtrie_commit(&palmtrie1) < 0 ) {
+            return -1;
+        }
+        if ( PALMTRIE_PLUS_SHARE
+             && palmtrie1.u.popmtpt.nodes.used >= nr / 4 ) {
+            /* Not shared */
+            return -1;
+        }
+        for ( i = 0; i < 0x10000; i++ ) {
+            tmp.a[0] = ((u64)(0x0a00 + (xor128() & 0x3ff)) << 48)
+                | ((u64)(0xc000 + (xor128() & 0x1fff)) << 16)
+                | ports[xor128() % 3];
+            if ( palmtrie_lookup(&palmtrie0, tmp)
+                 != palmtrie_lookup(&palmtrie1, tmp) ) {
+                return -1;
+            }
+        }
+    }
+    palmtrie_release(&palmtrie0);
+    palmtrie_release(&palmtrie1);
+
+    return 0;
+}
+
+/*
+ * Direct table in front of the root of Palmtrie+, cross-checked with the
+ * ternary PATRICIA trie on the keys of the rules and the random keys
+ */
+static int
+test_direct(int stride)
+{
+    struct palmtrie palmtrie0;
+    struct palmtrie palmtrie1;
+    struct palmtrie_ruleset rs;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    int ret;
+    long long i;
+    size_t r;
+
+    palmtrie_init(&palmtrie0, PALMTRIE_BASIC, 0);
+    if ( NULL == palmtrie_init(&palmtrie1, PALMTRIE_PLUS, stride) ) {
+        return -1;
+    }
+    ret = palmtrie_ruleset_load(&rs, "tests/acl-0001.tcam",
+                                PALMTRIE_TCAM_REVERSE);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    for ( r = 0; r < rs.nr; r++ ) {
+        if ( palmtrie_add_data(&palmtrie0, rs.rules[r].addr,
+                               rs.rules[r].mask, rs.rules[r].priority,
+                               rs.rules[r].data) < 0
+             || palmtrie_add_data(&palmtrie1, rs.rules[r].addr,
+                                  rs.rules[r].mask, rs.rules[r].priority,
+                                  rs.rules[r].data) < 0 ) {
+            return -1;
+        }
+    }
+    if ( palmtrie_commit(&palmtrie0) < 0
+         || palmtrie_commit(&palmtrie1) < 0 ) {
+        return -1;
+    }
+    if ( PALMTRIE_PLUS_DIRECT && NULL == palmtrie1.u.popmtpt.direct.ptr ) {
+        return -1;
+    }
+
+    for ( i = 0; i < 0x40000; i++ ) {
+        if ( i & 1 ) {
+            /* Any value in the wildcard bits of a rule */
+            r = xor128() % rs.nr;
+            tmp = rs.rules[r].addr;
+            tmp.a[0] |= xor128() & rs.rules[r].mask.a[0];
+            tmp.a[1] |= xor128() & rs.rules[r].mask.a[1];
+        } else {
+            tmp.a[0] = xor128();
+            tmp.a[1] = xor128();
+        }
+        if ( palmtrie_lookup(&palmtrie0, tmp)
+             != palmtrie_lookup(&palmtrie1, tmp) ) {
+            return -1;
+        }
+    }
+    palmtrie_ruleset_release(&rs);
+    palmtrie_release(&palmtrie0);
+    palmtrie_release(&palmtrie1);
+
+    return 0;
+}
+
+/*
+ * Direct table of the random ternary rules, whose lists of the candidate
+ * nodes reach the limit of the expansion
+ */
+static int
+test_direct_ternary(void)
+{
+    struct palmtrie palmtrie0;
+    struct palmtrie palmtrie1;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    long long i;
+
+    palmtrie_init(&palmtrie0, PALMTRIE_BASIC, 0);
+    if ( NULL == palmtrie_init(&palmtrie1, PALMTRIE_PLUS, 8) ) {
+        return -1;
+    }
+    for ( i = 0; i < 12000; i++ ) {
+        mask.a[0] = xor128() & xor128() & 0xffffffffULL;
+        addr.a[0] = xor128() & 0xffffffffULL & ~mask.a[0];
+        if ( palmtrie_add_data(&palmtrie0, addr, mask, i, i + 1) < 0
+             || palmtrie_add_data(&palmtrie1, addr, mask, i, i + 1) < 0 ) {
+            return -1;
+        }
+    }
+    if ( palmtrie_commit(&palmtrie0) < 0
+         || palmtrie_commit(&palmtrie1) < 0 ) {
+        return -1;
+    }
+
+    for ( i = 0; i < 0x40000; i++ ) {
+        tmp.a[0] = xor128() & 0xffffffffULL;
+        if ( palmtrie_lookup(&palmtrie0, tmp)
+             != palmtrie_lookup(&palmtrie1, tmp) ) {
+            return -1;
+        }
+    }
+    palmtrie_release(&palmtrie0);
+    palmtrie_release(&palmtrie1);
+
+    return 0;
 }
 
 /*
- * Test
+ * Structure statistics test
  */
 static int
-test_true(enum palmtrie_type type)
+test_stats(enum palmtrie_type type, int stride)
 {
     struct palmtrie palmtrie;
+    struct palmtrie_ruleset rs;
+    struct palmtrie_stats st;
     int ret;
-    addr_t addrs[] = {
-        {0, {0x5, 0, 0, 0, 0, 0, 0, 0}}, {0, {0, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x3, 0, 0, 0, 0, 0, 0, 0}}, {0, {0, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x0, 0, 0, 0, 0, 0, 0, 0}}, {0, {1, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x0, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xffffffffULL, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb20c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb22100ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb22400ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0x3ff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb22c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb24000ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0x3fff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb24e00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb25600ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb25b00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb25c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb27c00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb27f00ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0xff, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb28000ULL, 0, 0, 0, 0, 0, 0, 0}}, {0, {0x7fff, 0, 0, 0, 0, 0, 0, 0}},
-    };
-    addr_t tests[] = {
-        {0, {0xcbb24001ULL, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb26001ULL, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0xcbb28701ULL, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x3, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x5, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x2, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x1, 0, 0, 0, 0, 0, 0, 0}},
-        {0, {0x0, 0, 0, 0, 0, 0, 0, 0}},
-    };
-
-    palmtrie_init(&palmtrie, type);
 
-    ret = palmtrie_add_data(&palmtrie, addrs[0], addrs[1], 2, 5);
-    if ( ret < 0 ) {
-        return -1;
-    }
-    ret = palmtrie_add_data(&palmtrie, addrs[2], addrs[3], 2, 3);
-    if ( ret < 0 ) {
-        return -1;
-    }
-    ret = palmtrie_add_data(&palmtrie, addrs[4], addrs[5], 1, 2);
-    if ( ret < 0 ) {
-        return -1;
-    }
-    ret = palmtrie_add_data(&palmtrie, addrs[6], addrs[7], 0, 9);
-    if ( ret < 0 ) {
+    if ( NULL == palmtrie_init(&palmtrie, type, stride) ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[8], addrs[9], 24, 11);
+    ret = palmtrie_ruleset_load(&rs, "tests/acl-0001.tcam",
+                                PALMTRIE_TCAM_REVERSE);
     if ( ret < 0 ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[10], addrs[11], 24, 12);
-    if ( ret < 0 ) {
+    if ( palmtrie_add_ruleset(&palmtrie, &rs) < 0
+         || palmtrie_commit(&palmtrie) < 0 ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[12], addrs[13], 22, 13);
-    if ( ret < 0 ) {
+
+    palmtrie_get_stats(&palmtrie, &st);
+    if ( st.bytes != palmtrie_memory(&palmtrie)
+         || st.build_bytes + st.inode_bytes + st.leaf_bytes + st.other_bytes
+         != st.bytes ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[14], addrs[15], 24, 14);
-    if ( ret < 0 ) {
+    if ( st.rules != rs.nr || 0 == st.leaves || st.duplicates >= st.leaves ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[16], addrs[17], 18, 15);
-    if ( ret < 0 ) {
+    if ( st.max_depth < 1 || st.avg_depth > st.max_depth ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[18], addrs[19], 24, 16);
-    if ( ret < 0 ) {
+    if ( PALMTRIE_SORTED_LIST != type
+         && (0 == st.inodes || 0 == st.children + st.ternaries) ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[20], addrs[21], 24, 17);
-    if ( ret < 0 ) {
+    palmtrie_ruleset_release(&rs);
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+static int
+test_stats_types(void)
+{
+    if ( test_stats(PALMTRIE_SORTED_LIST, 0) < 0
+         || test_stats(PALMTRIE_BASIC, 0) < 0
+         || test_stats(PALMTRIE_DEFAULT, 8) < 0
+         || test_stats(PALMTRIE_PLUS, 4) < 0
+         || test_stats(PALMTRIE_PLUS, PALMTRIE_STRIDE_VARIABLE) < 0 ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[22], addrs[23], 24, 18);
-    if ( ret < 0 ) {
+
+    return test_stats(PALMTRIE_PLUS, 8);
+}
+
+/*
+ * Flow cache test
+ */
+static int
+test_cache(enum palmtrie_cache_victim victim)
+{
+    struct palmtrie palmtrie;
+    struct palmtrie_cache cache;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    int i;
+
+    if ( NULL == palmtrie_init(&palmtrie, PALMTRIE_PLUS, 8) ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[24], addrs[25], 24, 19);
-    if ( ret < 0 ) {
+    addr.a[0] = 0x1200;
+    mask.a[0] = 0xff;
+    if ( palmtrie_add_data(&palmtrie, addr, mask, 1, 1) < 0 ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[26], addrs[27], 24, 20);
-    if ( ret < 0 ) {
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[28], addrs[29], 24, 21);
-    if ( ret < 0 ) {
+    /* 8 entries of 2 ways to cause the replacement */
+    if ( palmtrie_cache_init(&cache, &palmtrie, 8, 2, victim) < 0 ) {
         return -1;
     }
-    ret = palmtrie_add_data(&palmtrie, addrs[30], addrs[31], 17, 22);
-    if ( ret < 0 ) {
-        return -1;
+    for ( i = 0; i < 512; i++ ) {
+        addr.a[0] = 0x1200 + (i % 32);
+        if ( palmtrie_cache_lookup(&cache, addr)
+             != palmtrie_lookup(&palmtrie, addr) ) {
+            return -1;
+        }
     }
-    ret = palmtrie_commit(&palmtrie);
-    if ( ret < 0 ) {
+    addr.a[0] = 0x1234;
+    palmtrie_cache_lookup(&cache, addr);
+    if ( palmtrie_cache_lookup(&cache, addr) != 1 || 0 == cache.hits
+         || cache.hits + cache.misses != 514 ) {
         return -1;
     }
 
-    if ( 15 != palmtrie_lookup(&palmtrie, tests[0]) ) {
+    /* The cached entries are invalidated by the update */
+    mask.a[0] = 0xf;
+    addr.a[0] = 0x1230;
+    if ( palmtrie_add_data(&palmtrie, addr, mask, 2, 2) < 0 ) {
         return -1;
     }
-    if ( 15 != palmtrie_lookup(&palmtrie, tests[1]) ) {
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
         return -1;
     }
-    if ( 22 != palmtrie_lookup(&palmtrie, tests[2]) ) {
+    addr.a[0] = 0x1234;
+    if ( palmtrie_cache_lookup(&cache, addr) != 2 ) {
         return -1;
     }
-    if ( 3 != palmtrie_lookup(&palmtrie, tests[3]) ) {
+    palmtrie_cache_release(&cache);
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+static int
+test_cache_victims(void)
+{
+    if ( test_cache(PALMTRIE_CACHE_LRU) < 0
+         || test_cache(PALMTRIE_CACHE_FIFO) < 0 ) {
         return -1;
     }
-    if ( 5 != palmtrie_lookup(&palmtrie, tests[4]) ) {
+
+    return test_cache(PALMTRIE_CACHE_RANDOM);
+}
+
+/*
+ * Test of the lookup by the reference and with the context against the
+ * lookup by value
+ */
+static int
+test_lookup_ref(enum palmtrie_type type, int stride)
+{
+    struct palmtrie palmtrie;
+    struct palmtrie_ctx ctx;
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    u64 data;
+    int i;
+
+    if ( NULL == palmtrie_init(&palmtrie, type, stride) ) {
         return -1;
     }
-    if ( 9 != palmtrie_lookup(&palmtrie, tests[5]) ) {
-        return -1;
+    for ( i = 0; i < 64; i++ ) {
+        addr.a[0] = (u64)i << 8;
+        addr.a[1] = i & 3;
+        mask.a[0] = (1ULL << (i & 7)) - 1;
+        if ( palmtrie_add_data_ref(&palmtrie, &addr, &mask, i, i + 1) < 0 ) {
+            return -1;
+        }
     }
-    if ( 2 != palmtrie_lookup(&palmtrie, tests[6]) ) {
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
         return -1;
     }
-    if ( 2 != palmtrie_lookup(&palmtrie, tests[7]) ) {
-        return -1;
+    palmtrie_ctx_init(&ctx, &palmtrie);
+    for ( i = 0; i < 0x4000; i++ ) {
+        addr.a[0] = i;
+        addr.a[1] = (i >> 8) & 3;
+        data = palmtrie_lookup(&palmtrie, addr);
+        if ( palmtrie_lookup_ref(&palmtrie, &addr) != data
+             || palmtrie_ctx_lookup(&ctx, &addr) != data ) {
+            return -1;
+        }
+        if ( PALMTRIE_PLUS == type && 8 == stride
+             && palmtrie_plus_lookup_s8(&ctx, &addr) != data ) {
+            return -1;
+        }
     }
+    palmtrie_release(&palmtrie);
 
     return 0;
 }
+
 static int
-test_true_sl(void)
-{
-    return test_true(PALMTRIE_SORTED_LIST);
-}
-static int
-test_true_tpt(void)
-{
-    return test_true(PALMTRIE_BASIC);
-}
-static int
-test_true_mtpt(void)
-{
-    return test_true(PALMTRIE_DEFAULT);
-}
-static int
-test_true_popmtpt(void)
+test_lookup_ref_types(void)
 {
-    return test_true(PALMTRIE_PLUS);
+    if ( test_lookup_ref(PALMTRIE_DEFAULT, 8) < 0
+         || test_lookup_ref(PALMTRIE_PLUS, 8) < 0
+         || test_lookup_ref(PALMTRIE_PLUS, PALMTRIE_STRIDE_VARIABLE) < 0 ) {
+        return -1;
+    }
+
+    return test_lookup_ref(PALMTRIE_PARTITION, 4);
 }
 
 /*
@@ -266,18 +1323,18 @@ test_microperf(enum palmtrie_type type, long long nr)
     int prefixlen;
     int nexthop[4];
     int ret;
-    addr_t addr1 = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t addr1 = {{0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t mask = {{0, 0, 0, 0, 0, 0, 0, 0}};
     u64 addr2;
     long long i;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t tmp = {{0, 0, 0, 0, 0, 0, 0, 0}};
     double t0;
     double t1;
     double delta;
     u64 x;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
+    palmtrie_init(&palmtrie, type, 0);
 
     /* Load from the linx file */
     fp = fopen("tests/linx-rib.20141217.0000-p46.sorted.txt", "r");
@@ -376,15 +1433,15 @@ test_lookup_linx(enum palmtrie_type type1, enum palmtrie_type type2)
     int prefixlen;
     int nexthop[4];
     int ret;
-    addr_t addr1 = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t addr1 = {{0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t mask = {{0, 0, 0, 0, 0, 0, 0, 0}};
     u64 addr2;
     u64 i;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t tmp = {{0, 0, 0, 0, 0, 0, 0, 0}};
 
     /* Initialize */
-    palmtrie_init(&palmtrie0, type1);
-    palmtrie_init(&palmtrie1, type2);
+    palmtrie_init(&palmtrie0, type1, 0);
+    palmtrie_init(&palmtrie1, type2, 0);
 
     /* Load from the linx file */
     fp = fopen("tests/linx-rib.20141217.0000-p46.sorted.txt", "r");
@@ -467,74 +1524,46 @@ test_cross_tpt_mtpt(void)
  * Cross testing
  */
 static int
-test_acl_cross(enum palmtrie_type type1, enum palmtrie_type type2)
+test_acl_cross(enum palmtrie_type type1, enum palmtrie_type type2, int stride)
 {
     struct palmtrie palmtrie0;
     struct palmtrie palmtrie1;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
+    struct palmtrie_ruleset rs;
     int ret;
-    addr_t addr = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    u64 d;
     long long i;
-    ssize_t k;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t tmp = {{0, 0, 0, 0, 0, 0, 0, 0}};
 
     /* Initialize */
-    palmtrie_init(&palmtrie0, type1);
-    palmtrie_init(&palmtrie1, type2);
-
-    /* Load from the linx file */
-    fp = fopen("tests/acl-0002.tcam", "r");
-    if ( NULL == fp ) {
+    palmtrie_init(&palmtrie0, type1, 0);
+    if ( NULL == palmtrie_init(&palmtrie1, type2, stride) ) {
         return -1;
     }
 
-    /* Load the full route */
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        reverse(data0);
-        reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            d = hex2bin(data1[k]);
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-        }
-
+    /* Load from the TCAM file */
+    ret = palmtrie_ruleset_load(&rs, "tests/acl-0002.tcam",
+                                PALMTRIE_TCAM_REVERSE);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < (long long)rs.nr; i++ ) {
         /* Add an entry */
-        ret = palmtrie_add_data(&palmtrie0, addr, mask, priority, action);
+        ret = palmtrie_add_data(&palmtrie0, rs.rules[i].addr,
+                                rs.rules[i].mask, rs.rules[i].priority,
+                                rs.rules[i].data);
         if ( ret < 0 ) {
             return -1;
         }
-        ret = palmtrie_add_data(&palmtrie1, addr, mask, priority, action);
+        ret = palmtrie_add_data(&palmtrie1, rs.rules[i].addr,
+                                rs.rules[i].mask, rs.rules[i].priority,
+                                rs.rules[i].data);
         if ( ret < 0 ) {
             return -1;
         }
         if ( 0 == i % 10000 ) {
             TEST_PROGRESS();
         }
-        i++;
     }
+    palmtrie_ruleset_release(&rs);
 
     ret = palmtrie_commit(&palmtrie0);
     if ( ret < 0 ) {
@@ -557,20 +1586,50 @@ test_acl_cross(enum palmtrie_type type1, enum palmtrie_type type2)
         }
     }
 
-    /* Close */
-    fclose(fp);
-
     return 0;
 }
 static int
 test_acl_cross_sl_tpt(void)
 {
-    return test_acl_cross(PALMTRIE_SORTED_LIST, PALMTRIE_BASIC);
+    return test_acl_cross(PALMTRIE_SORTED_LIST, PALMTRIE_BASIC, 0);
 }
 static int
 test_acl_cross_tpt_mtpt(void)
 {
-    return test_acl_cross(PALMTRIE_BASIC, PALMTRIE_DEFAULT);
+    return test_acl_cross(PALMTRIE_BASIC, PALMTRIE_DEFAULT, 0);
+}
+static int
+test_acl_cross_tpt_auto(void)
+{
+    return test_acl_cross(PALMTRIE_BASIC, PALMTRIE_AUTO, 0);
+}
+static int
+test_acl_cross_tpt_partition(void)
+{
+    if ( test_acl_cross(PALMTRIE_BASIC, PALMTRIE_PARTITION, 4) < 0 ) {
+        return -1;
+    }
+
+    return test_acl_cross(PALMTRIE_BASIC, PALMTRIE_PARTITION,
+                          PALMTRIE_STRIDE_VARIABLE);
+}
+static int
+test_acl_cross_tpt_popmtpt_strides(void)
+{
+    static const int strides[] = { 4, 6, 7, 8 };
+    int i;
+
+    for ( i = 0; i < (int)(sizeof(strides) / sizeof(strides[0])); i++ ) {
+        if ( test_acl_cross(PALMTRIE_BASIC, PALMTRIE_PLUS, strides[i]) < 0 ) {
+            return -1;
+        }
+    }
+    if ( test_acl_cross(PALMTRIE_BASIC, PALMTRIE_PLUS,
+                        PALMTRIE_STRIDE_VARIABLE) < 0 ) {
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
@@ -581,75 +1640,40 @@ test_acl_cross_ross(enum palmtrie_type type1, enum palmtrie_type type2)
 {
     struct palmtrie palmtrie0;
     struct palmtrie palmtrie1;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
+    struct palmtrie_ruleset rs;
     int ret;
-    addr_t addr = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    u64 d;
     long long i;
-    ssize_t k;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    double t0;
-    double t1;
-    double delta;
-    u64 x;
     addr_t *pattern;
-    int npkt;
-    long long j;
+    size_t npkt;
 
     /* Initialize */
-    palmtrie_init(&palmtrie0, type1);
-    palmtrie_init(&palmtrie1, type2);
+    palmtrie_init(&palmtrie0, type1, 0);
+    palmtrie_init(&palmtrie1, type2, 0);
 
     /* Load TCAM file */
-    fp = fopen("tests/acl-0001.tcam", "r");
-    if ( NULL == fp ) {
+    ret = palmtrie_ruleset_load(&rs, "tests/acl-0001.tcam",
+                                PALMTRIE_TCAM_REVERSE);
+    if ( ret < 0 ) {
         return -1;
     }
-
-    /* Load the full route */
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        reverse(data0);
-        reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            d = hex2bin(data1[k]);
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-        }
-        ret = palmtrie_add_data(&palmtrie0, addr, mask, priority, action);
+    for ( i = 0; i < (long long)rs.nr; i++ ) {
+        ret = palmtrie_add_data(&palmtrie0, rs.rules[i].addr,
+                                rs.rules[i].mask, rs.rules[i].priority,
+                                rs.rules[i].data);
         if ( ret < 0 ) {
             return -1;
         }
-        ret = palmtrie_add_data(&palmtrie1, addr, mask, priority, action);
+        ret = palmtrie_add_data(&palmtrie1, rs.rules[i].addr,
+                                rs.rules[i].mask, rs.rules[i].priority,
+                                rs.rules[i].data);
         if ( ret < 0 ) {
             return -1;
         }
         if ( 0 == i % 100000 ) {
             TEST_PROGRESS();
         }
-        i++;
     }
+    palmtrie_ruleset_release(&rs);
 
     ret = palmtrie_commit(&palmtrie0);
     if ( ret < 0 ) {
@@ -660,69 +1684,25 @@ test_acl_cross_ross(enum palmtrie_type type1, enum palmtrie_type type2)
         return -1;
     }
 
-    /* Close */
-    fclose(fp);
-
     /* Traffic pattern */
-    fp = fopen("./tests/acl-0001.ross", "r");
-    if ( NULL == fp ) {
+    pattern = palmtrie_load_keys("./tests/acl-0001.ross",
+                                 PALMTRIE_TCAM_REVERSE, &npkt);
+    if ( NULL == pattern || 0 == npkt ) {
         return -1;
     }
 
-    /* Load the full route */
-    i = 0;
-    pattern = malloc(sizeof(addr_t) * 65536 * 256);
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s", data0);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        reverse(data0);
-        memset(&tmp, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            tmp.a[k >> 4] |= d << ((k & 0xf) << 2);
-        }
-        (void)memcpy(&pattern[i], &tmp, sizeof(addr_t));
-        if ( 0 == i % 100000 ) {
-            TEST_PROGRESS();
-        }
-        i++;
-        if ( i >= 65536 * 256 ) {
-            break;
-        }
-    }
-    npkt = i;
-
-    /* Close */
-    fclose(fp);
-
-    /* Benchmark */
-    x = 0;
-    t0 = getmicrotime();
-    for ( i = 0, j = 0; i < npkt; i++ ) {
-        if ( 0 == i % (npkt / 8) ) {
+    /* Compare */
+    for ( i = 0; i < (long long)npkt; i++ ) {
+        if ( 0 == i % (npkt / 8 + 1) ) {
             TEST_PROGRESS();
         }
-        if ( palmtrie_lookup(&palmtrie0, pattern[j])
-             != palmtrie_lookup(&palmtrie1, pattern[j]) ) {
+        if ( palmtrie_lookup(&palmtrie0, pattern[i])
+             != palmtrie_lookup(&palmtrie1, pattern[i]) ) {
+            free(pattern);
             return -1;
         }
-        j++;
-        if ( j >= npkt ) {
-            j = 0;
-        }
     }
-    t1 = getmicrotime();
-    (void)x;
-    delta = t1 - t0;
+    free(pattern);
 
     return 0;
 }
@@ -742,6 +1722,78 @@ test_acl_cross_ross_sl_tpt(void)
     return test_acl_cross_ross(PALMTRIE_SORTED_LIST, PALMTRIE_BASIC);
 }
 
+/*
+ * Round trip of a ruleset through the binary format
+ */
+static int
+test_ruleset_binary(int flags)
+{
+    struct palmtrie_ruleset rs0;
+    struct palmtrie_ruleset rs1;
+    char path[] = "/tmp/palmtrie-test-XXXXXX";
+    size_t i;
+    int ret;
+    int fd;
+
+    ret = palmtrie_ruleset_load(&rs0, "tests/acl-0002.tcam", 0);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    fd = mkstemp(path);
+    if ( fd < 0 ) {
+        palmtrie_ruleset_release(&rs0);
+        return -1;
+    }
+    close(fd);
+    TEST_PROGRESS();
+
+    ret = palmtrie_ruleset_save(&rs0, path, flags);
+    if ( 0 == ret ) {
+        TEST_PROGRESS();
+        ret = palmtrie_ruleset_load(&rs1, path, 0);
+    }
+    unlink(path);
+    if ( ret < 0 ) {
+        palmtrie_ruleset_release(&rs0);
+        return -1;
+    }
+    TEST_PROGRESS();
+
+    /* Compare */
+    if ( rs0.nr != rs1.nr || rs0.keybits != rs1.keybits ) {
+        ret = -1;
+    }
+    for ( i = 0; 0 == ret && i < rs0.nr; i++ ) {
+        if ( 0 != memcmp(&rs0.rules[i].addr, &rs1.rules[i].addr,
+                         sizeof(addr_t))
+             || 0 != memcmp(&rs0.rules[i].mask, &rs1.rules[i].mask,
+                            sizeof(addr_t))
+             || rs0.rules[i].priority != rs1.rules[i].priority
+             || rs0.rules[i].data != rs1.rules[i].data ) {
+            ret = -1;
+        }
+    }
+    palmtrie_ruleset_release(&rs0);
+    palmtrie_ruleset_release(&rs1);
+
+    return ret;
+}
+static int
+test_ruleset_binary_fixed(void)
+{
+    return test_ruleset_binary(PALMTRIE_TCAM_BINARY);
+}
+static int
+test_ruleset_binary_compact(void)
+{
+    return test_ruleset_binary(PALMTRIE_TCAM_COMPACT);
+}
+static int
+test_ruleset_text(void)
+{
+    return test_ruleset_binary(0);
+}
+
 /*
  * Main routine for the basic test
  */
@@ -773,6 +1825,8 @@ main(int argc, const char *const argv[])
                 flags |= 1 << 2;
             } else if ( 0 == strcmp("cross-acl", argv[i]) ) {
                 flags |= 1 << 3;
+            } else if ( 0 == strcmp("ruleset", argv[i]) ) {
+                flags |= 1 << 4;
             }
         }
     }
@@ -784,6 +1838,37 @@ main(int argc, const char *const argv[])
         TEST_FUNC("basic test (BASIC)", test_true_tpt, ret);
         TEST_FUNC("basic test (DEFAULT)", test_true_mtpt, ret);
         TEST_FUNC("basic test (PLUS)", test_true_popmtpt, ret);
+        TEST_FUNC("basic test (DEFAULT,PLUS with strides 4/6/7/8/var)",
+                  test_true_strides, ret);
+        TEST_FUNC("basic test (AUTO)", test_true_auto, ret);
+        TEST_FUNC("basic test (PARTITION with strides 8/var)",
+                  test_true_partition, ret);
+        TEST_STRIDES("exact match split (PLUS)", test_exact, strides_4_8_var,
+                     ret);
+        TEST_FUNC("flow cache (LRU/FIFO/RANDOM)", test_cache_victims, ret);
+        TEST_FUNC("range fields (PLUS,SORTED_LIST)", test_range_types, ret);
+        TEST_STRIDES("range rules after commit (PLUS with strides 4/8/var)",
+                     test_range_update, strides_4_8_var, ret);
+        TEST_STRIDES("range and plain rules of the same key (PLUS with "
+                     "strides 4/8/var)", test_range_same_key, strides_4_8_var,
+                     ret);
+        TEST_FUNC("lookup by reference (DEFAULT,PLUS,PARTITION)",
+                  test_lookup_ref_types, ret);
+        TEST_FUNC("lookup on packet headers (PLUS)", test_lookup_pkt, ret);
+        TEST_STRIDES("leaf key words (PLUS with strides 4/8)",
+                     test_leaf_words, strides_4_8, ret);
+        TEST_STRIDES("redundancy elimination (PLUS with strides 8/var)",
+                     test_eliminate, strides_8_var, ret);
+        TEST_STRIDES("prefix-only compilation (PLUS with strides 8/var)",
+                     test_prefix_only, strides_8_var, ret);
+        TEST_STRIDES("subtree sharing (PLUS with strides 4/8)", test_share,
+                     strides_4_8, ret);
+        TEST_STRIDES("direct table (PLUS with strides 4/8)", test_direct,
+                     strides_4_8, ret);
+        TEST_FUNC("direct table of ternary rules (PLUS with stride 8)",
+                  test_direct_ternary, ret);
+        TEST_FUNC("structure statistics (SORTED_LIST,BASIC,DEFAULT,PLUS)",
+                  test_stats_types, ret);
     }
     if ( flags & (1 << 1) ) {
         /* Micro performance measurement */
@@ -805,11 +1890,26 @@ main(int argc, const char *const argv[])
                   test_acl_cross_ross_tpt_mtpt, ret);
         TEST_FUNC("cross check for ACL reverse order scanning (BASIC,PLUS)",
                   test_acl_cross_ross_tpt_popmtpt, ret);
+        TEST_FUNC("cross check for ACL (BASIC,PLUS with strides "
+                  "4/6/7/8/var)",
+                  test_acl_cross_tpt_popmtpt_strides, ret);
+        TEST_FUNC("cross check for ACL (BASIC,AUTO)", test_acl_cross_tpt_auto,
+                  ret);
+        TEST_FUNC("cross check for ACL (BASIC,PARTITION with strides 4/var)",
+                  test_acl_cross_tpt_partition, ret);
         TEST_FUNC("cross check for ACL (SORTED_LIST,BASIC)",
                   test_acl_cross_sl_tpt, ret);
         TEST_FUNC("cross check for ACL reverse order scanning (SORTED_LIST,"
                   "BASIC)", test_acl_cross_ross_sl_tpt, ret);
     }
+    if ( flags & (1 << 4) ) {
+        /* Ruleset file formats */
+        TEST_FUNC("ruleset round trip (text)", test_ruleset_text, ret);
+        TEST_FUNC("ruleset round trip (binary)", test_ruleset_binary_fixed,
+                  ret);
+        TEST_FUNC("ruleset round trip (compact binary)",
+                  test_ruleset_binary_compact, ret);
+    }
 
     return ret;
 }
@@ -0,0 +1,719 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#define MAX_THREADS         256
+#define MAX_ENGINES         16
+#define LOOKUP_BATCH        1024
+#define LATENCY_NR_SAMPLES  (1LL << 22)
+#define ZIPF_NR_KEYS        (1 << 20)
+#define ZIPF_NR_FLOWS       65536
+
+/*
+ * Benchmark configuration
+ */
+struct bench_config {
+    const char *ruleset;
+    const char *traffic;
+    int stride;
+    int threads;
+    double duration;
+    double warmup;
+    int csv;
+    /* Per-thread flow cache (0 entries: disabled) */
+    size_t cache;
+    int ways;
+    enum palmtrie_cache_victim victim;
+    /* Redundancy elimination of popmtpt */
+    int eliminate;
+};
+
+/*
+ * Result of an engine
+ */
+struct bench_result {
+    const char *engine;
+    double load;
+    double build;
+    double commit;
+    long long memory;
+    double mlookups;
+    long long lookups;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+    double hit_ratio;
+};
+
+/*
+ * Per-thread context aligned to a cache line to avoid false sharing of the
+ * lookup counters
+ */
+struct bench_thread {
+    pthread_t th;
+    int cpu;
+    struct palmtrie *palmtrie;
+    const struct bench_config *cfg;
+    struct palmtrie_cache cache;
+    int ret;
+    struct xor128_state rng;
+    const addr_t *pattern;
+    size_t npkt;
+    long long cnt;
+    u64 x;
+} __attribute__ ((aligned (64)));
+
+static volatile int g_start;
+static volatile int g_stop;
+
+/*
+ * Resident set size of the process in bytes
+ */
+static long long
+rss_bytes(void)
+{
+    FILE *fp;
+    long long size;
+    long long resident;
+
+    fp = fopen("/proc/self/statm", "r");
+    if ( NULL == fp ) {
+        return 0;
+    }
+    if ( 2 != fscanf(fp, "%lld %lld", &size, &resident) ) {
+        resident = 0;
+    }
+    fclose(fp);
+
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Lookup loop of a benchmark thread
+ */
+static void *
+bench_thread_main(void *arg)
+{
+    struct bench_thread *bt;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    size_t j;
+    u64 x;
+    int i;
+
+    bt = (struct bench_thread *)arg;
+    pin_thread(bt->cpu);
+    if ( bt->cfg->cache > 0 ) {
+        /* The cache in the memory local to the thread */
+        bt->ret = palmtrie_cache_init(&bt->cache, bt->palmtrie,
+                                      bt->cfg->cache, bt->cfg->ways,
+                                      bt->cfg->victim);
+    }
+
+    while ( !__atomic_load_n(&g_start, __ATOMIC_ACQUIRE) ) {
+        /* Wait for all threads */
+    }
+
+    x = 0;
+    j = 0;
+    while ( !__atomic_load_n(&g_stop, __ATOMIC_RELAXED) ) {
+        if ( bt->cfg->cache > 0 ) {
+            for ( i = 0; i < LOOKUP_BATCH; i++ ) {
+                if ( NULL == bt->pattern ) {
+                    rand_acl_key(&bt->rng, &tmp);
+                } else {
+                    tmp = bt->pattern[j];
+                    j++;
+                    if ( j >= bt->npkt ) {
+                        j = 0;
+                    }
+                }
+                x ^= palmtrie_cache_lookup(&bt->cache, tmp);
+            }
+        } else if ( NULL == bt->pattern ) {
+            for ( i = 0; i < LOOKUP_BATCH; i++ ) {
+                rand_acl_key(&bt->rng, &tmp);
+                x ^= palmtrie_lookup(bt->palmtrie, tmp);
+            }
+        } else {
+            for ( i = 0; i < LOOKUP_BATCH; i++ ) {
+                x ^= palmtrie_lookup(bt->palmtrie, bt->pattern[j]);
+                j++;
+                if ( j >= bt->npkt ) {
+                    j = 0;
+                }
+            }
+        }
+        __atomic_store_n(&bt->cnt, bt->cnt + LOOKUP_BATCH, __ATOMIC_RELAXED);
+    }
+    bt->x = x;
+
+    return NULL;
+}
+
+/*
+ * Sleep for the duration in seconds
+ */
+static void
+bench_sleep(double sec)
+{
+    if ( sec > 0 ) {
+        usleep((useconds_t)(sec * 1000000));
+    }
+}
+
+/*
+ * Throughput with the threads; the lookups in the warmup are excluded
+ */
+static int
+bench_throughput(struct palmtrie *palmtrie, const struct bench_config *cfg,
+                 const addr_t *pattern, size_t npkt,
+                 struct bench_result *res)
+{
+    struct bench_thread *bts;
+    long long c0;
+    long long c1;
+    u64 hits;
+    u64 misses;
+    double t0;
+    double t1;
+    int ncpu;
+    int nth;
+    int i;
+
+    nth = cfg->threads;
+    bts = aligned_alloc(64, sizeof(struct bench_thread) * nth);
+    if ( NULL == bts ) {
+        return -1;
+    }
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( ncpu <= 0 ) {
+        ncpu = 1;
+    }
+
+    g_start = 0;
+    g_stop = 0;
+    for ( i = 0; i < nth; i++ ) {
+        memset(&bts[i], 0, sizeof(struct bench_thread));
+        bts[i].cpu = i % ncpu;
+        bts[i].palmtrie = palmtrie;
+        bts[i].cfg = cfg;
+        bts[i].rng.x = 123456789 + i;
+        bts[i].rng.y = 362436069;
+        bts[i].rng.z = 521288629;
+        bts[i].rng.w = 88675123 ^ (i * 0x9e3779b9U);
+        if ( NULL != pattern ) {
+            /* Slice of the trace for this thread */
+            bts[i].pattern = pattern + npkt * i / nth;
+            bts[i].npkt = npkt * (i + 1) / nth - npkt * i / nth;
+            if ( 0 == bts[i].npkt ) {
+                bts[i].pattern = pattern;
+                bts[i].npkt = npkt;
+            }
+        }
+        if ( 0 != pthread_create(&bts[i].th, NULL, bench_thread_main,
+                                 &bts[i]) ) {
+            /* Stop the threads already created */
+            __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&g_start, 1, __ATOMIC_RELEASE);
+            while ( --i >= 0 ) {
+                pthread_join(bts[i].th, NULL);
+            }
+            free(bts);
+            return -1;
+        }
+    }
+
+    __atomic_store_n(&g_start, 1, __ATOMIC_RELEASE);
+    bench_sleep(cfg->warmup);
+    c0 = 0;
+    for ( i = 0; i < nth; i++ ) {
+        c0 += __atomic_load_n(&bts[i].cnt, __ATOMIC_RELAXED);
+    }
+    t0 = getmicrotime();
+    bench_sleep(cfg->duration);
+    c1 = 0;
+    for ( i = 0; i < nth; i++ ) {
+        c1 += __atomic_load_n(&bts[i].cnt, __ATOMIC_RELAXED);
+    }
+    t1 = getmicrotime();
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+    hits = 0;
+    misses = 0;
+    for ( i = 0; i < nth; i++ ) {
+        pthread_join(bts[i].th, NULL);
+        if ( cfg->cache > 0 ) {
+            hits += bts[i].cache.hits;
+            misses += bts[i].cache.misses;
+            palmtrie_cache_release(&bts[i].cache);
+        }
+    }
+
+    res->lookups = c1 - c0;
+    res->mlookups = (c1 - c0) / (t1 - t0) / 1000 / 1000;
+    res->hit_ratio = hits + misses > 0 ? (double)hits / (hits + misses) : 0;
+    for ( i = 0; i < nth; i++ ) {
+        if ( bts[i].ret < 0 ) {
+            /* Failed to allocate the cache */
+            free(bts);
+            return -1;
+        }
+    }
+    free(bts);
+
+    return 0;
+}
+
+/*
+ * Latency percentiles of the single-key lookup in the calling thread
+ */
+static int
+bench_latency(struct palmtrie *palmtrie, const struct bench_config *cfg,
+              const addr_t *pattern, size_t npkt, struct bench_result *res)
+{
+    struct xor128_state rng = XOR128_INITIALIZER;
+    struct palmtrie_cache cache;
+    struct latency_hist *hist;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    long long i;
+    size_t j;
+    double hz;
+    double t0;
+    u64 overhead;
+    u64 c0;
+    u64 c1;
+    u64 x;
+
+    hist = calloc(1, sizeof(struct latency_hist));
+    if ( NULL == hist ) {
+        return -1;
+    }
+    if ( cfg->cache > 0
+         && palmtrie_cache_init(&cache, palmtrie, cfg->cache, cfg->ways,
+                                cfg->victim) < 0 ) {
+        free(hist);
+        return -1;
+    }
+    hz = tsc_frequency();
+    overhead = tsc_overhead();
+
+    x = 0;
+    j = 0;
+    t0 = getmicrotime();
+    for ( i = 0; i < LATENCY_NR_SAMPLES; i++ ) {
+        if ( NULL == pattern ) {
+            rand_acl_key(&rng, &tmp);
+        } else {
+            tmp = pattern[j];
+            j++;
+            if ( j >= npkt ) {
+                j = 0;
+            }
+        }
+        if ( cfg->cache > 0 ) {
+            c0 = tsc_begin();
+            x ^= palmtrie_cache_lookup(&cache, tmp);
+            c1 = tsc_end();
+        } else {
+            c0 = tsc_begin();
+            x ^= palmtrie_lookup(palmtrie, tmp);
+            c1 = tsc_end();
+        }
+        latency_record(hist, c1 - c0 > overhead ? c1 - c0 - overhead : 0);
+        if ( 0 == (i & 0xffff) && getmicrotime() - t0 > cfg->duration ) {
+            /* Limit the duration for slow engines */
+            break;
+        }
+    }
+    (void)x;
+
+    res->p50 = latency_percentile(hist, 50) * 1e9 / hz;
+    res->p90 = latency_percentile(hist, 90) * 1e9 / hz;
+    res->p99 = latency_percentile(hist, 99) * 1e9 / hz;
+    res->p999 = latency_percentile(hist, 99.9) * 1e9 / hz;
+    res->max = hist->max * 1e9 / hz;
+    free(hist);
+    if ( cfg->cache > 0 ) {
+        palmtrie_cache_release(&cache);
+    }
+
+    return 0;
+}
+
+/*
+ * Run the benchmark of an engine
+ */
+static int
+bench_engine(enum palmtrie_type type, const struct bench_config *cfg,
+             const struct palmtrie_ruleset *rs, const addr_t *pattern,
+             size_t npkt, struct bench_result *res)
+{
+    struct palmtrie palmtrie;
+    long long m0;
+    size_t n;
+    double t0;
+    double t1;
+    double t2;
+
+    m0 = rss_bytes();
+    if ( NULL == palmtrie_init(&palmtrie, type, cfg->stride) ) {
+        return -1;
+    }
+    if ( cfg->eliminate && PALMTRIE_PLUS == type
+         && palmtrie_set_eliminate(&palmtrie, 1) < 0 ) {
+        return -1;
+    }
+    t0 = getmicrotime();
+    if ( palmtrie_add_ruleset(&palmtrie, rs) < 0 ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    if ( palmtrie_commit(&palmtrie) < 0 ) {
+        return -1;
+    }
+    t2 = getmicrotime();
+    if ( PALMTRIE_AUTO == type ) {
+        /* Selection by the auto mode */
+        fprintf(stderr, "%s", palmtrie_auto_report(&palmtrie));
+    }
+    if ( cfg->eliminate && PALMTRIE_PLUS == type ) {
+        (void)palmtrie_eliminated(&palmtrie, &n);
+        fprintf(stderr, "eliminated %zu of %zu rules\n", n, rs->nr);
+    }
+    res->build = t1 - t0;
+    res->commit = t2 - t1;
+    res->memory = rss_bytes() - m0;
+
+    if ( bench_throughput(&palmtrie, cfg, pattern, npkt, res) < 0 ) {
+        return -1;
+    }
+    if ( bench_latency(&palmtrie, cfg, pattern, npkt, res) < 0 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Print the results
+ */
+static void
+print_results(const struct bench_config *cfg, const struct palmtrie_ruleset *rs,
+              const struct bench_result *res, int n)
+{
+    int i;
+
+    if ( cfg->csv ) {
+        printf("engine,stride,ruleset,rules,traffic,threads,duration,warmup,"
+               "load_sec,build_sec,commit_sec,memory_bytes,lookups,"
+               "mlookups_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,"
+               "cache_entries,cache_hit_ratio\n");
+        for ( i = 0; i < n; i++ ) {
+            printf("%s,%d,%s,%zu,%s,%d,%lf,%lf,%lf,%lf,%lf,%lld,%lld,%lf,"
+                   "%.1lf,%.1lf,%.1lf,%.1lf,%.1lf,%zu,%lf\n", res[i].engine,
+                   cfg->stride, cfg->ruleset, rs->nr, cfg->traffic,
+                   cfg->threads, cfg->duration, cfg->warmup, res[i].load,
+                   res[i].build, res[i].commit, res[i].memory, res[i].lookups,
+                   res[i].mlookups, res[i].p50, res[i].p90, res[i].p99,
+                   res[i].p999, res[i].max, cfg->cache, res[i].hit_ratio);
+        }
+        return;
+    }
+
+    printf("[\n");
+    for ( i = 0; i < n; i++ ) {
+        printf("  {\"engine\": \"%s\", \"stride\": %d, \"ruleset\": \"%s\", "
+               "\"rules\": %zu, \"traffic\": \"%s\", \"threads\": %d, "
+               "\"duration\": %lf, \"warmup\": %lf,\n", res[i].engine,
+               cfg->stride, cfg->ruleset, rs->nr, cfg->traffic, cfg->threads,
+               cfg->duration, cfg->warmup);
+        printf("   \"load_sec\": %lf, \"build_sec\": %lf, "
+               "\"commit_sec\": %lf, \"memory_bytes\": %lld,\n", res[i].load,
+               res[i].build, res[i].commit, res[i].memory);
+        printf("   \"lookups\": %lld, \"mlookups_per_sec\": %lf,\n",
+               res[i].lookups, res[i].mlookups);
+        if ( cfg->cache > 0 ) {
+            printf("   \"cache_entries\": %zu, \"cache_hit_ratio\": %lf,\n",
+                   cfg->cache, res[i].hit_ratio);
+        }
+        printf("   \"latency_ns\": {\"p50\": %.1lf, \"p90\": %.1lf, "
+               "\"p99\": %.1lf, \"p999\": %.1lf, \"max\": %.1lf}}%s\n",
+               res[i].p50, res[i].p90, res[i].p99, res[i].p999, res[i].max,
+               i == n - 1 ? "" : ",");
+    }
+    printf("]\n");
+}
+
+/*
+ * Usage
+ */
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] -r <ruleset>\n"
+            "\t-e, --engine=<list>     sl, tpt, mtpt, popmtpt, part, auto, or "
+            "all, separated by\n"
+            "\t                        commas (default: popmtpt)\n"
+            "\t-s, --stride=<bits>     Stride of mtpt, popmtpt, and part, 4, "
+            "6, 7, or 8, or var\n"
+            "\t                        for the variable stride of popmtpt "
+            "and part\n"
+            "\t                        (default: %d)\n"
+            "\t-r, --ruleset=<file>    Ternary matching table in the text "
+            "or binary format\n"
+            "\t-t, --traffic=<source>  rand, ross, sfl, traffic, "
+            "zipf[:<alpha>[:<flows>]], or a\n"
+            "\t                        traffic pattern file (default: rand)\n"
+            "\t-j, --threads=<n>       Number of lookup threads (default: 1)\n"
+            "\t-d, --duration=<sec>    Measurement duration (default: 10)\n"
+            "\t-w, --warmup=<sec>      Warmup excluded from the measurement "
+            "(default: 1)\n"
+            "\t-f, --format=<format>   json or csv (default: json)\n"
+            "\t-c, --cache=<entries>   Per-thread flow cache (default: 0, "
+            "disabled)\n"
+            "\t    --ways=<n>          Associativity of the cache "
+            "(default: 4)\n"
+            "\t    --victim=<policy>   lru, fifo, or random (default: lru)\n"
+            "\t    --eliminate         Leave the redundant rules out of "
+            "popmtpt\n",
+            prog, PALMTRIE_DEFAULT_STRIDE);
+}
+
+/*
+ * Main routine for the unified benchmark
+ */
+int
+main(int argc, char *const argv[])
+{
+    static const struct option longopts[] = {
+        { "engine", required_argument, NULL, 'e' },
+        { "stride", required_argument, NULL, 's' },
+        { "ruleset", required_argument, NULL, 'r' },
+        { "traffic", required_argument, NULL, 't' },
+        { "threads", required_argument, NULL, 'j' },
+        { "duration", required_argument, NULL, 'd' },
+        { "warmup", required_argument, NULL, 'w' },
+        { "format", required_argument, NULL, 'f' },
+        { "cache", required_argument, NULL, 'c' },
+        { "ways", required_argument, NULL, 'W' },
+        { "victim", required_argument, NULL, 'V' },
+        { "eliminate", no_argument, NULL, 'E' },
+        { NULL, 0, NULL, 0 },
+    };
+    /* All the engines but auto for "all" */
+    static const char *all[] = { "sl", "tpt", "mtpt", "popmtpt", "part",
+                                 "auto" };
+    struct bench_config cfg;
+    struct bench_result res[MAX_ENGINES];
+    struct palmtrie_ruleset rs;
+    enum palmtrie_type types[MAX_ENGINES];
+    const char *engines;
+    const char *tfname;
+    const char *p;
+    const char *q;
+    struct xor128_state rng = XOR128_INITIALIZER;
+    addr_t *pattern;
+    size_t npkt;
+    size_t nflows;
+    double alpha;
+    double t0;
+    double load;
+    int n;
+    int i;
+    int ch;
+
+    engines = "popmtpt";
+    cfg.ruleset = NULL;
+    cfg.traffic = "rand";
+    cfg.stride = PALMTRIE_DEFAULT_STRIDE;
+    cfg.threads = 1;
+    cfg.duration = 10;
+    cfg.warmup = 1;
+    cfg.csv = 0;
+    cfg.cache = 0;
+    cfg.ways = 4;
+    cfg.victim = PALMTRIE_CACHE_LRU;
+    cfg.eliminate = 0;
+    while ( -1 != (ch = getopt_long(argc, argv, "e:s:r:t:j:d:w:f:c:", longopts,
+                                    NULL)) ) {
+        switch ( ch ) {
+        case 'e':
+            engines = optarg;
+            break;
+        case 's':
+            if ( 0 == strcmp(optarg, "var") ) {
+                cfg.stride = PALMTRIE_STRIDE_VARIABLE;
+            } else {
+                cfg.stride = atoi(optarg);
+            }
+            break;
+        case 'r':
+            cfg.ruleset = optarg;
+            break;
+        case 't':
+            cfg.traffic = optarg;
+            break;
+        case 'j':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration = atof(optarg);
+            break;
+        case 'w':
+            cfg.warmup = atof(optarg);
+            break;
+        case 'f':
+            if ( 0 == strcmp(optarg, "csv") ) {
+                cfg.csv = 1;
+            } else if ( 0 == strcmp(optarg, "json") ) {
+                cfg.csv = 0;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            cfg.cache = strtoull(optarg, NULL, 10);
+            break;
+        case 'W':
+            cfg.ways = atoi(optarg);
+            break;
+        case 'V':
+            if ( 0 == strcmp(optarg, "lru") ) {
+                cfg.victim = PALMTRIE_CACHE_LRU;
+            } else if ( 0 == strcmp(optarg, "fifo") ) {
+                cfg.victim = PALMTRIE_CACHE_FIFO;
+            } else if ( 0 == strcmp(optarg, "random") ) {
+                cfg.victim = PALMTRIE_CACHE_RANDOM;
+            } else {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'E':
+            cfg.eliminate = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( NULL == cfg.ruleset || optind != argc || cfg.threads <= 0
+         || cfg.threads > MAX_THREADS || cfg.duration <= 0
+         || cfg.warmup < 0 || cfg.ways <= 0 || cfg.ways > 16 ) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ( !PALMTRIE_STRIDE_SUPPORTED(cfg.stride)
+         && PALMTRIE_STRIDE_VARIABLE != cfg.stride ) {
+        fprintf(stderr, "Unsupported stride: %d\n", cfg.stride);
+        return EXIT_FAILURE;
+    }
+
+    /* Engines */
+    n = 0;
+    for ( p = engines; '\0' != *p; p = '\0' == *q ? q : q + 1 ) {
+        q = strchr(p, ',');
+        if ( NULL == q ) {
+            q = p + strlen(p);
+        }
+        if ( 3 == q - p && 0 == strncmp(p, "all", 3) ) {
+            for ( i = 0; i < 5 && n < MAX_ENGINES; i++ ) {
+                parse_engine(all[i], strlen(all[i]), &types[n]);
+                res[n++].engine = all[i];
+            }
+            continue;
+        }
+        if ( n >= MAX_ENGINES || parse_engine(p, q - p, &types[n]) < 0 ) {
+            fprintf(stderr, "Invalid engine: %s\n", engines);
+            return EXIT_FAILURE;
+        }
+        for ( i = 0; i < 6; i++ ) {
+            if ( strlen(all[i]) == (size_t)(q - p)
+                 && 0 == strncmp(p, all[i], q - p) ) {
+                res[n].engine = all[i];
+            }
+        }
+        n++;
+    }
+
+    /* Ruleset */
+    t0 = getmicrotime();
+    if ( palmtrie_ruleset_load(&rs, cfg.ruleset, PALMTRIE_TCAM_THREADS) < 0 ) {
+        fprintf(stderr, "Failed to load %s\n", cfg.ruleset);
+        return EXIT_FAILURE;
+    }
+    load = getmicrotime() - t0;
+
+    /* Traffic */
+    pattern = NULL;
+    npkt = 0;
+    tfname = NULL;
+    if ( 0 == strncmp(cfg.traffic, "zipf", 4)
+         && ('\0' == cfg.traffic[4] || ':' == cfg.traffic[4]) ) {
+        /* Zipf traffic over the flows matching the rules */
+        alpha = 1.0;
+        nflows = ZIPF_NR_FLOWS;
+        if ( ':' == cfg.traffic[4] ) {
+            alpha = strtod(cfg.traffic + 5, (char **)&p);
+            if ( ':' == *p ) {
+                nflows = strtoull(p + 1, NULL, 10);
+            }
+        }
+        npkt = ZIPF_NR_KEYS;
+        pattern = zipf_keys(&rs, npkt, nflows, alpha, &rng);
+        if ( NULL == pattern ) {
+            fprintf(stderr, "Failed to generate the Zipf traffic\n");
+            palmtrie_ruleset_release(&rs);
+            return EXIT_FAILURE;
+        }
+    } else if ( parse_traffic(cfg.traffic, &tfname) < 0 ) {
+        /* A traffic pattern file */
+        tfname = cfg.traffic;
+    }
+    if ( NULL != tfname ) {
+        pattern = palmtrie_load_keys(tfname, PALMTRIE_TCAM_THREADS, &npkt);
+        if ( NULL == pattern || 0 == npkt ) {
+            fprintf(stderr, "Failed to load %s\n", tfname);
+            palmtrie_ruleset_release(&rs);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Run */
+    for ( i = 0; i < n; i++ ) {
+        res[i].load = load;
+        if ( bench_engine(types[i], &cfg, &rs, pattern, npkt, &res[i]) < 0 ) {
+            fprintf(stderr, "Failed to run the benchmark of %s\n",
+                    res[i].engine);
+            free(pattern);
+            palmtrie_ruleset_release(&rs);
+            return EXIT_FAILURE;
+        }
+    }
+    print_results(&cfg, &rs, res, n);
+
+    free(pattern);
+    palmtrie_ruleset_release(&rs);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
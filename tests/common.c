@@ -0,0 +1,282 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+struct xor128_state xor128_default = XOR128_INITIALIZER;
+
+/*
+ * Get current time at the microsecond granularity
+ */
+double
+getmicrotime(void)
+{
+    struct timeval tv;
+    double microsec;
+
+    if ( 0 != gettimeofday(&tv, NULL) ) {
+        return 0.0;
+    }
+
+    microsec = (double)tv.tv_sec + (1.0 * tv.tv_usec / 1000000);
+
+    return microsec;
+}
+
+/*
+ * Pin the calling thread to the specified CPU
+ */
+void
+pin_thread(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    (void)pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+#else
+    (void)cpu;
+#endif
+}
+
+/*
+ * Upper bound of the value in the bucket
+ */
+static __inline__ u64
+_latency_bucket_value(int b)
+{
+    int e;
+
+    if ( b < LATENCY_SUB_BUCKETS ) {
+        return b;
+    }
+    e = (b >> LATENCY_SUB_BITS) - 1;
+
+    return ((u64)(LATENCY_SUB_BUCKETS + (b & (LATENCY_SUB_BUCKETS - 1)) + 1)
+            << e) - 1;
+}
+
+/*
+ * Percentile p of the recorded values
+ */
+u64
+latency_percentile(struct latency_hist *h, double p)
+{
+    u64 target;
+    u64 acc;
+    int i;
+
+    target = (u64)(h->cnt * p / 100.0);
+    if ( target >= h->cnt ) {
+        return h->max;
+    }
+    acc = 0;
+    for ( i = 0; i < LATENCY_NR_BUCKETS; i++ ) {
+        acc += h->buckets[i];
+        if ( acc > target ) {
+            return _latency_bucket_value(i) < h->max
+                ? _latency_bucket_value(i) : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+/*
+ * Estimate the frequency of the timestamp counter in Hz
+ */
+double
+tsc_frequency(void)
+{
+    double t0;
+    double t1;
+    u64 c0;
+    u64 c1;
+
+    t0 = getmicrotime();
+    c0 = tsc_begin();
+    do {
+        t1 = getmicrotime();
+    } while ( t1 - t0 < 0.1 );
+    c1 = tsc_end();
+
+    return (c1 - c0) / (t1 - t0);
+}
+
+/*
+ * Estimate the overhead of the timestamp counter reads in cycles
+ */
+u64
+tsc_overhead(void)
+{
+    u64 c0;
+    u64 c1;
+    u64 min;
+    int i;
+
+    min = (u64)-1;
+    for ( i = 0; i < 100000; i++ ) {
+        c0 = tsc_begin();
+        c1 = tsc_end();
+        if ( c1 - c0 < min ) {
+            min = c1 - c0;
+        }
+    }
+
+    return min;
+}
+
+/*
+ * Zipf traffic of n keys over the flows ranked by the exponent alpha, each of
+ * which matches a random rule of the ruleset with the wildcard bits filled at
+ * random
+ */
+addr_t *
+zipf_keys(const struct palmtrie_ruleset *rs, size_t n, size_t nflows,
+          double alpha, struct xor128_state *s)
+{
+    const struct palmtrie_rule *r;
+    addr_t *flows;
+    addr_t *keys;
+    double *cdf;
+    double sum;
+    double x;
+    size_t lo;
+    size_t hi;
+    size_t i;
+    size_t j;
+
+    if ( 0 == rs->nr || 0 == nflows ) {
+        return NULL;
+    }
+    flows = malloc(sizeof(addr_t) * nflows);
+    cdf = malloc(sizeof(double) * nflows);
+    /* Aligned to the cache line */
+    keys = aligned_alloc(64, (sizeof(addr_t) * n + 63) & ~(size_t)63);
+    if ( NULL == flows || NULL == cdf || NULL == keys ) {
+        free(flows);
+        free(cdf);
+        free(keys);
+        return NULL;
+    }
+    sum = 0;
+    for ( i = 0; i < nflows; i++ ) {
+        r = &rs->rules[xor128_r(s) % rs->nr];
+        flows[i] = r->addr;
+        for ( j = 0; j < sizeof(r->addr.a) / sizeof(u64); j++ ) {
+            flows[i].a[j] = (r->addr.a[j] & ~r->mask.a[j])
+                | ((((u64)xor128_r(s) << 32) | xor128_r(s)) & r->mask.a[j]);
+        }
+        sum += 1.0 / pow(i + 1, alpha);
+        cdf[i] = sum;
+    }
+    for ( i = 0; i < n; i++ ) {
+        /* Binary search of the rank */
+        x = sum * xor128_r(s) / 4294967296.0;
+        lo = 0;
+        hi = nflows - 1;
+        while ( lo < hi ) {
+            if ( cdf[(lo + hi) / 2] < x ) {
+                lo = (lo + hi) / 2 + 1;
+            } else {
+                hi = (lo + hi) / 2;
+            }
+        }
+        keys[i] = flows[lo];
+    }
+    free(flows);
+    free(cdf);
+
+    return keys;
+}
+
+/*
+ * Parse the engine name of len characters
+ */
+int
+parse_engine(const char *name, size_t len, enum palmtrie_type *type)
+{
+    if ( 2 == len && 0 == strncmp(name, "sl", len) ) {
+        *type = PALMTRIE_SORTED_LIST;
+    } else if ( 3 == len && 0 == strncmp(name, "tpt", len) ) {
+        *type = PALMTRIE_BASIC;
+    } else if ( 4 == len && 0 == strncmp(name, "mtpt", len) ) {
+        *type = PALMTRIE_DEFAULT;
+    } else if ( 7 == len && 0 == strncmp(name, "popmtpt", len) ) {
+        *type = PALMTRIE_PLUS;
+    } else if ( 4 == len && 0 == strncmp(name, "auto", len) ) {
+        *type = PALMTRIE_AUTO;
+    } else if ( 4 == len && 0 == strncmp(name, "part", len) ) {
+        *type = PALMTRIE_PARTITION;
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse the name of the traffic pattern; the file name is NULL for the random
+ * traffic
+ */
+int
+parse_traffic(const char *name, const char **tfname)
+{
+    if ( 0 == strcmp(name, "rand") ) {
+        *tfname = NULL;
+    } else if ( 0 == strcmp(name, "ross") ) {
+        *tfname = "tests/acl-1000.ross";
+    } else if ( 0 == strcmp(name, "sfl") ) {
+        *tfname = "tests/traffic.sfl2";
+    } else if ( 0 == strcmp(name, "traffic") ) {
+        *tfname = "tests/traffic.tmp";
+    } else {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Initialize a palmtrie of the type and build it from the TCAM file; the
+ * palmtrie is released on failure
+ */
+int
+build_acl(struct palmtrie *palmtrie, enum palmtrie_type type,
+          const char *fname)
+{
+    if ( NULL == palmtrie_init(palmtrie, type, 0) ) {
+        return -1;
+    }
+    if ( palmtrie_load_tcam(palmtrie, fname, 0) < 0
+         || palmtrie_commit(palmtrie) < 0 ) {
+        palmtrie_release(palmtrie);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
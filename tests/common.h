@@ -0,0 +1,143 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#ifndef _PALMTRIE_TESTS_COMMON_H
+#define _PALMTRIE_TESTS_COMMON_H
+
+#include "../palmtrie.h"
+#include <x86intrin.h>
+
+/*
+ * Xorshift with an explicit state
+ */
+struct xor128_state {
+    u32 x;
+    u32 y;
+    u32 z;
+    u32 w;
+};
+#define XOR128_INITIALIZER  { 123456789, 362436069, 521288629, 88675123 }
+
+static __inline__ u32
+xor128_r(struct xor128_state *s)
+{
+    u32 t;
+
+    t = s->x ^ (s->x << 11);
+    s->x = s->y;
+    s->y = s->z;
+    s->z = s->w;
+    return s->w = (s->w ^ (s->w >> 19)) ^ (t ^ (t >> 8));
+}
+
+/* Xorshift with the state of the program */
+extern struct xor128_state xor128_default;
+static __inline__ u32
+xor128(void)
+{
+    return xor128_r(&xor128_default);
+}
+
+/*
+ * Random ACL key: ICMP from a random source to a random destination in
+ * x.x.x.10 with the byte 14 set
+ */
+static __inline__ void
+rand_acl_key(struct xor128_state *s, addr_t *key)
+{
+    uint32_t *a;
+    uint32_t rv;
+
+    rv = xor128_r(s);
+    key->a[0] = 0x01;
+    a = (void *)key->a + 1;
+    *(a + 0) = xor128_r(s);
+    *(a + 1) = (rv & 0xffffff00) | 0x0a;
+    *(a + 2) = xor128_r(s);
+    *((uint8_t *)key->a + 14) = 0x02;
+}
+
+/*
+ * Latency histogram with log-scaled buckets; each power of two is split into
+ * 2^LATENCY_SUB_BITS linear sub-buckets, so that the relative error of each
+ * bucket is bounded by 2^-LATENCY_SUB_BITS.
+ */
+#define LATENCY_SUB_BITS        4
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BITS)
+#define LATENCY_NR_BUCKETS      (64 * LATENCY_SUB_BUCKETS)
+struct latency_hist {
+    u64 buckets[LATENCY_NR_BUCKETS];
+    u64 cnt;
+    u64 max;
+};
+
+static __inline__ int
+latency_bucket(u64 v)
+{
+    int msb;
+
+    if ( v < LATENCY_SUB_BUCKETS ) {
+        return v;
+    }
+    msb = 63 - __builtin_clzll(v);
+
+    return ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+        + ((v >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+static __inline__ void
+latency_record(struct latency_hist *h, u64 v)
+{
+    h->buckets[latency_bucket(v)]++;
+    h->cnt++;
+    if ( v > h->max ) {
+        h->max = v;
+    }
+}
+
+/*
+ * Serialized timestamp counter reads for the beginning and the end of the
+ * measured region
+ */
+static __inline__ u64
+tsc_begin(void)
+{
+    _mm_lfence();
+    return __rdtsc();
+}
+static __inline__ u64
+tsc_end(void)
+{
+    unsigned int aux;
+    u64 t;
+
+    t = __rdtscp(&aux);
+    _mm_lfence();
+
+    return t;
+}
+
+/* Prototype declarations */
+double getmicrotime(void);
+void pin_thread(int);
+u64 latency_percentile(struct latency_hist *, double);
+double tsc_frequency(void);
+u64 tsc_overhead(void);
+int parse_engine(const char *, size_t, enum palmtrie_type *);
+int parse_traffic(const char *, const char **);
+int build_acl(struct palmtrie *, enum palmtrie_type, const char *);
+addr_t * zipf_keys(const struct palmtrie_ruleset *, size_t, size_t, double,
+                   struct xor128_state *);
+
+#endif /* _PALMTRIE_TESTS_COMMON_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
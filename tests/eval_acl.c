@@ -3,81 +3,13 @@
  * All rights reserved.
  */
 
-#include "../palmtrie.h"
+#include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <time.h>
-#include <alloca.h>
-
-void
-reverse(char *s)
-{
-    char *t;
-    int l;
-    int i;
-    l = strlen(s);
-    t = alloca(l + 1);
-    for ( i = 0; i < l; i++ ) {
-        t[i] = s[l - i - 1];
-    }
-    t[l] = 0;
-
-    strcpy(s, t);
-}
-
-/*
- * Get current time at the microsecond granularity
- */
-double
-getmicrotime(void)
-{
-    struct timeval tv;
-    double microsec;
-
-    if ( 0 != gettimeofday(&tv, NULL) ) {
-        return 0.0;
-    }
-
-    microsec = (double)tv.tv_sec + (1.0 * tv.tv_usec / 1000000);
-
-    return microsec;
-}
-
-/*
- * Xorshift
- */
-static __inline__ u32
-xor128(void)
-{
-    static u32 x = 123456789;
-    static u32 y = 362436069;
-    static u32 z = 521288629;
-    static u32 w = 88675123;
-    u32 t;
-
-    t = x ^ (x<<11);
-    x = y;
-    y = z;
-    z = w;
-    return w = (w ^ (w>>19)) ^ (t ^ (t >> 8));
-}
-
-static __inline__ int
-hex2bin(char c)
-{
-    if ( c >= '0' && c <= '9' ) {
-        return c - '0';
-    } else if ( c >= 'a' && c <= 'f' ) {
-        return c - 'a' + 10;
-    } else if ( c >= 'A' && c <= 'F' ) {
-        return c - 'A' + 10;
-    } else {
-        return 0;
-    }
-}
 
 #define NRTRIALS    30
 double g_t0;
@@ -106,64 +38,21 @@ static int
 test_acl_perf(enum palmtrie_type type, const char *fname)
 {
     struct palmtrie palmtrie;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
     int ret;
-    addr_t addr = PALMTRIE_ADDR_ZERO;
-    addr_t mask = PALMTRIE_ADDR_ZERO;
-    u64 d;
     long long i;
-    ssize_t k;
     addr_t tmp = PALMTRIE_ADDR_ZERO;
     double delta;
     u64 x;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
-
-    /* Load from the linx file */
-    fp = fopen(fname, "r");
-    if ( NULL == fp ) {
-        return -1;
-    }
+    palmtrie_init(&palmtrie, type, 0);
 
+    /* Load from the TCAM file */
     double t0, t1, t2;
     t0 = getmicrotime();
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        //reverse(data0);
-        //reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            k ^= 1;
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-            d = hex2bin(data1[k]);
-            k ^= 1;
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-        }
-        ret = palmtrie_add_data(&palmtrie, addr, mask, priority, action);
-        if ( ret < 0 ) {
-            return -1;
-        }
+    ret = palmtrie_load_tcam(&palmtrie, fname, 0);
+    if ( ret < 0 ) {
+        return -1;
     }
     t1 = getmicrotime();
     ret = palmtrie_commit(&palmtrie);
@@ -173,9 +62,6 @@ test_acl_perf(enum palmtrie_type type, const char *fname)
     t2 = getmicrotime();
     printf("#build %lf %lf\n", t1 - t0, t2 - t1);
 
-    /* Close */
-    fclose(fp);
-
     struct sigaction act;
     struct sigaction oldact;
     struct itimerval itval;
@@ -197,17 +83,7 @@ test_acl_perf(enum palmtrie_type type, const char *fname)
     x = 0;
     g_t0 = getmicrotime();
     for ( g_cnt = 0; g_nrsigs < NRTRIALS; g_cnt++ ) {
-        uint32_t *a;
-        uint32_t rv;
-        rv = xor128();
-        tmp.a[0] = 0x01;
-        a = (void *)tmp.a + 1;
-        *(a + 0) = xor128();
-        *(a + 1) = (rv & 0xffffff00) | 0x0a;
-        *(a + 2) = xor128();
-        *((uint8_t *)tmp.a + 14) = 0x02;
-        //tmp.a[0] = xor128();
-        //tmp.a[1] = xor128();
+        rand_acl_key(&xor128_default, &tmp);
         x ^= palmtrie_lookup(&palmtrie, tmp);
     }
     g_t1 = getmicrotime();
@@ -239,69 +115,23 @@ static int
 test_acl_ross(enum palmtrie_type type, const char *fname, const char *tfname)
 {
     struct palmtrie palmtrie;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
     int ret;
-    addr_t addr = PALMTRIE_ADDR_ZERO;
-    addr_t mask = PALMTRIE_ADDR_ZERO;
-    u64 d;
     long long i;
-    ssize_t k;
-    addr_t tmp = PALMTRIE_ADDR_ZERO;
     double delta;
     u64 x;
     addr_t *pattern;
-    int npkt;
-    long long j;
+    size_t npkt;
+    size_t j;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
+    palmtrie_init(&palmtrie, type, 0);
 
     /* Load TCAM file */
-    fp = fopen(fname, "r");
-    if ( NULL == fp ) {
-        return -1;
-    }
-
-    /* Load the full route */
     double t0, t1, t2;
     t0 = getmicrotime();
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        //reverse(data0);
-        //reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            k ^= 1;
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-            d = hex2bin(data1[k]);
-            k ^= 1;
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-        }
-        ret = palmtrie_add_data(&palmtrie, addr, mask, priority, action);
-        if ( ret < 0 ) {
-            return -1;
-        }
+    ret = palmtrie_load_tcam(&palmtrie, fname, 0);
+    if ( ret < 0 ) {
+        return -1;
     }
     t1 = getmicrotime();
     ret = palmtrie_commit(&palmtrie);
@@ -315,50 +145,16 @@ test_acl_ross(enum palmtrie_type type, const char *fname, const char *tfname)
         printf("#nodes = %d\n", palmtrie.u.popmtpt.nodes.used);
     }
 #endif
-
-    /* Close */
-    fclose(fp);
+    (void)t0;
+    (void)t1;
+    (void)t2;
 
     /* Traffic pattern */
-    fp = fopen(tfname, "r");
-    if ( NULL == fp ) {
+    pattern = palmtrie_load_keys(tfname, 0, &npkt);
+    if ( NULL == pattern || 0 == npkt ) {
         return -1;
     }
 
-    /* Load the full route */
-    i = 0;
-    pattern = malloc(sizeof(addr_t) * 65536 * 256);
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s", data0);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        //reverse(data0);
-        memset(&tmp, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            k ^= 1;
-            tmp.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-        }
-        (void)memcpy(&pattern[i], &tmp, sizeof(addr_t));
-        i++;
-        if ( i >= 65536 * 256 ) {
-            break;
-        }
-    }
-    npkt = i;
-
-    /* Close */
-    fclose(fp);
-
     struct sigaction act;
     struct sigaction oldact;
     struct itimerval itval;
@@ -413,86 +209,28 @@ test_acl_ross(enum palmtrie_type type, const char *fname, const char *tfname)
 /*
  * Performance test
  */
-struct tmpent {
-    addr_t addr;
-    addr_t mask;
-    int priority;
-    int action;
-};
 static int
 test_acl_build(enum palmtrie_type type, const char *fname)
 {
     struct palmtrie palmtrie;
-    FILE *fp;
-    char buf[4096];
-    char data0[1024];
-    char data1[1024];
-    int priority;
-    int action;
+    struct palmtrie_ruleset rs;
+    struct palmtrie_stats st;
     int ret;
-    addr_t addr = PALMTRIE_ADDR_ZERO;
-    addr_t mask = PALMTRIE_ADDR_ZERO;
-    u64 d;
-    long long i;
-    long long n;
-    ssize_t k;
-    struct tmpent *ents = malloc(sizeof(struct tmpent) * 1024 * 1024 * 128);
+    double t0, t1, t2;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
+    palmtrie_init(&palmtrie, type, 0);
 
     /* Load TCAM file */
-    fp = fopen(fname, "r");
-    if ( NULL == fp ) {
+    ret = palmtrie_ruleset_load(&rs, fname, 0);
+    if ( ret < 0 ) {
         return -1;
     }
 
-    /* Load the full route */
-    double t0, t1, t2;
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%1000s %1000s %d %d", data0, data1, &priority,
-                     &action);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        if ( strlen(data0) != 32 || strlen(data1) != 32 ) {
-            /* Length mismatch */
-            return -1;
-        }
-        //reverse(data0);
-        //reverse(data1);
-        memset(&addr, 0, sizeof(addr_t));
-        memset(&mask, 0, sizeof(addr_t));
-        for ( k = 0; k < (ssize_t)strlen(data0); k++ ) {
-            d = hex2bin(data0[k]);
-            k ^= 1;
-            addr.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-            d = hex2bin(data1[k]);
-            k ^= 1;
-            mask.a[k >> 4] |= d << ((k & 0xf) << 2);
-            k ^= 1;
-        }
-
-        memcpy(&ents[i].addr, &addr, sizeof(addr_t));
-        memcpy(&ents[i].mask, &mask, sizeof(addr_t));
-        ents[i].priority = priority;
-        ents[i].action = action;
-        i++;
-    }
-
     t0 = getmicrotime();
-    n = i;
-    for ( i = 0; i < n; i++ ) {
-        ret = palmtrie_add_data(&palmtrie, ents[i].addr, ents[i].mask,
-                             ents[i].priority, ents[i].action);
-        if ( ret < 0 ) {
-            return -1;
-        }
+    ret = palmtrie_add_ruleset(&palmtrie, &rs);
+    if ( ret < 0 ) {
+        return -1;
     }
     t1 = getmicrotime();
     ret = palmtrie_commit(&palmtrie);
@@ -502,8 +240,115 @@ test_acl_build(enum palmtrie_type type, const char *fname)
     t2 = getmicrotime();
     printf("#build %lf %lf\n", t1 - t0, t2 - t1);
 
-    /* Close */
-    fclose(fp);
+    /* Structure statistics */
+    palmtrie_get_stats(&palmtrie, &st);
+    printf("#bytes %zu build %zu inode %zu leaf %zu other %zu\n", st.bytes,
+           st.build_bytes, st.inode_bytes, st.leaf_bytes, st.other_bytes);
+    printf("#nodes rules %zu inodes %zu leaves %zu children %zu ternaries %zu"
+           " duplicates %zu compressible %zu\n", st.rules, st.inodes,
+           st.leaves, st.children, st.ternaries, st.duplicates,
+           st.compressible);
+    printf("#depth max %d avg %lf\n", st.max_depth, st.avg_depth);
+
+    palmtrie_ruleset_release(&rs);
+
+    return 0;
+}
+
+#define LATENCY_NR_SAMPLES      (1LL << 24)
+#define LATENCY_DURATION        10.0
+
+/*
+ * Latency test; the traffic pattern is random if tfname is NULL
+ */
+static int
+test_acl_latency(enum palmtrie_type type, const char *fname,
+                 const char *tfname)
+{
+    struct palmtrie palmtrie;
+    struct latency_hist *hist;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    addr_t *pattern;
+    size_t npkt;
+    size_t j;
+    long long i;
+    double hz;
+    double t0;
+    u64 overhead;
+    u64 c0;
+    u64 c1;
+    u64 x;
+
+    /* Initialize */
+    if ( build_acl(&palmtrie, type, fname) < 0 ) {
+        return -1;
+    }
+
+    /* Traffic pattern */
+    pattern = NULL;
+    npkt = 0;
+    if ( NULL != tfname ) {
+        pattern = palmtrie_load_keys(tfname, 0, &npkt);
+        if ( NULL == pattern || 0 == npkt ) {
+            free(pattern);
+            palmtrie_release(&palmtrie);
+            return -1;
+        }
+    }
+
+    hist = calloc(1, sizeof(struct latency_hist));
+    if ( NULL == hist ) {
+        free(pattern);
+        palmtrie_release(&palmtrie);
+        return -1;
+    }
+    hz = tsc_frequency();
+    overhead = tsc_overhead();
+
+    /* Benchmark */
+    x = 0;
+    j = 0;
+    t0 = getmicrotime();
+    for ( i = 0; i < LATENCY_NR_SAMPLES; i++ ) {
+        if ( NULL == pattern ) {
+            rand_acl_key(&xor128_default, &tmp);
+        } else {
+            tmp = pattern[j];
+            j++;
+            if ( j >= npkt ) {
+                j = 0;
+            }
+        }
+        c0 = tsc_begin();
+        x ^= palmtrie_lookup(&palmtrie, tmp);
+        c1 = tsc_end();
+        latency_record(hist, c1 - c0 > overhead ? c1 - c0 - overhead : 0);
+        if ( 0 == (i & 0xffff) && getmicrotime() - t0 > LATENCY_DURATION ) {
+            /* Limit the duration for slow types */
+            break;
+        }
+    }
+    (void)x;
+
+    printf("#latency %p %llu samples, %.3lf GHz, %llu cycles of overhead\n",
+           (void *)x, (unsigned long long)hist->cnt, hz / 1000 / 1000 / 1000,
+           (unsigned long long)overhead);
+    printf("#p50 p90 p99 p99.9 max [cycles] p50 p90 p99 p99.9 max [nsec]\n");
+    printf("%llu %llu %llu %llu %llu %.1lf %.1lf %.1lf %.1lf %.1lf\n",
+           (unsigned long long)latency_percentile(hist, 50),
+           (unsigned long long)latency_percentile(hist, 90),
+           (unsigned long long)latency_percentile(hist, 99),
+           (unsigned long long)latency_percentile(hist, 99.9),
+           (unsigned long long)hist->max,
+           latency_percentile(hist, 50) * 1e9 / hz,
+           latency_percentile(hist, 90) * 1e9 / hz,
+           latency_percentile(hist, 99) * 1e9 / hz,
+           latency_percentile(hist, 99.9) * 1e9 / hz,
+           hist->max * 1e9 / hz);
+
+    free(hist);
+    free(pattern);
+    palmtrie_release(&palmtrie);
 
     return 0;
 }
@@ -516,57 +361,44 @@ main(int argc, const char *const argv[])
 {
     const char *fname;
     const char *type;
+    const char *traffic;
+    const char *tfname;
+    enum palmtrie_type t;
+    int latency;
+    int ret;
 
-    if ( argc != 3 ) {
-        fprintf(stderr, "Usage: %s <tcam-file> <type>\n", argv[0]);
+    if ( argc != 3 && !(argc == 4 && 0 == strcmp(argv[3], "latency")) ) {
+        fprintf(stderr, "Usage: %s <tcam-file> <type> [latency]\n", argv[0]);
         return EXIT_FAILURE;
     }
     fname = argv[1];
     type = argv[2];
-    if ( 0 == strcmp(type, "sl-rand") ) {
-        test_acl_perf(PALMTRIE_SORTED_LIST, fname);
-    } else if ( 0 == strcmp(type, "tpt-rand") ) {
-        test_acl_perf(PALMTRIE_BASIC, fname);
-    } else if ( 0 == strcmp(type, "mtpt-rand") ) {
-        test_acl_perf(PALMTRIE_DEFAULT, fname);
-    } else if ( 0 == strcmp(type, "popmtpt-rand") ) {
-        test_acl_perf(PALMTRIE_PLUS, fname);
-    } else if ( 0 == strcmp(type, "sl-ross") ) {
-        test_acl_ross(PALMTRIE_SORTED_LIST, fname, "tests/acl-1000.ross");
-    } else if ( 0 == strcmp(type, "tpt-ross") ) {
-        test_acl_ross(PALMTRIE_BASIC, fname, "tests/acl-1000.ross");
-    } else if ( 0 == strcmp(type, "mtpt-ross") ) {
-        test_acl_ross(PALMTRIE_DEFAULT, fname,
-                      "tests/acl-1000.ross");
-    } else if ( 0 == strcmp(type, "popmtpt-ross") ) {
-        test_acl_ross(PALMTRIE_PLUS, fname,
-                      "tests/acl-1000.ross");
-    } else if ( 0 == strcmp(type, "sl-sfl") ) {
-        test_acl_ross(PALMTRIE_SORTED_LIST, fname, "tests/traffic.sfl2");
-    } else if ( 0 == strcmp(type, "tpt-sfl") ) {
-        test_acl_ross(PALMTRIE_BASIC, fname, "tests/traffic.sfl2");
-    } else if ( 0 == strcmp(type, "mtpt-sfl") ) {
-        test_acl_ross(PALMTRIE_DEFAULT, fname,
-                      "tests/traffic.sfl2");
-    } else if ( 0 == strcmp(type, "popmtpt-sfl") ) {
-        test_acl_ross(PALMTRIE_PLUS, fname,
-                      "tests/traffic.sfl2");
-    } else if ( 0 == strcmp(type, "sl-traffic") ) {
-        test_acl_ross(PALMTRIE_SORTED_LIST, fname, "tests/traffic.tmp");
-    } else if ( 0 == strcmp(type, "tpt-traffic") ) {
-        test_acl_ross(PALMTRIE_BASIC, fname, "tests/traffic.tmp");
-    } else if ( 0 == strcmp(type, "mtpt-traffic") ) {
-        test_acl_ross(PALMTRIE_DEFAULT, fname,
-                      "tests/traffic.tmp");
-    } else if ( 0 == strcmp(type, "popmtpt-traffic") ) {
-        test_acl_ross(PALMTRIE_PLUS, fname,
-                      "tests/traffic.tmp");
-    } else if ( 0 == strcmp(type, "tpt-build") ) {
-        test_acl_build(PALMTRIE_BASIC, fname);
-    } else if ( 0 == strcmp(type, "mtpt-build") ) {
-        test_acl_build(PALMTRIE_DEFAULT, fname);
-    } else if ( 0 == strcmp(type, "popmtpt-build") ) {
-        test_acl_build(PALMTRIE_PLUS, fname);
+    latency = (4 == argc);
+
+    /* Split the type into the engine and the traffic pattern */
+    traffic = strchr(type, '-');
+    if ( NULL == traffic || parse_engine(type, traffic - type, &t) < 0 ) {
+        fprintf(stderr, "Invalid type: %s\n", type);
+        return EXIT_FAILURE;
+    }
+    traffic++;
+
+    if ( !latency && 0 == strcmp(traffic, "build") ) {
+        ret = test_acl_build(t, fname);
+    } else if ( parse_traffic(traffic, &tfname) < 0 ) {
+        fprintf(stderr, "Invalid traffic pattern: %s\n", traffic);
+        return EXIT_FAILURE;
+    } else if ( latency ) {
+        /* Latency mode */
+        ret = test_acl_latency(t, fname, tfname);
+    } else if ( NULL == tfname ) {
+        ret = test_acl_perf(t, fname);
+    } else {
+        ret = test_acl_ross(t, fname, tfname);
+    }
+    if ( ret < 0 ) {
+        fprintf(stderr, "Failed to run the test\n");
+        return EXIT_FAILURE;
     }
 
     return 0;
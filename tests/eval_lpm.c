@@ -3,52 +3,17 @@
  * All rights reserved.
  */
 
-#include "../palmtrie.h"
+#include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <time.h>
-
-/*
- * Get current time at the microsecond granularity
- */
-double
-getmicrotime(void)
-{
-    struct timeval tv;
-    double microsec;
-
-    if ( 0 != gettimeofday(&tv, NULL) ) {
-        return 0.0;
-    }
-
-    microsec = (double)tv.tv_sec + (1.0 * tv.tv_usec / 1000000);
-
-    return microsec;
-}
-
-/*
- * Xorshift
- */
-static __inline__ u32
-xor128(void)
-{
-    static u32 x = 123456789;
-    static u32 y = 362436069;
-    static u32 z = 521288629;
-    static u32 w = 88675123;
-    u32 t;
-
-    t = x ^ (x<<11);
-    x = y;
-    y = z;
-    z = w;
-    return w = (w ^ (w>>19)) ^ (t ^ (t >> 8));
-}
+#include <arpa/inet.h>
 
 #define NRTRIALS    30
+#define NRKEYS6     65536       /* IPv6 keys generated from the routes */
 double g_t0;
 double g_t1;
 int g_nrsigs;
@@ -69,11 +34,140 @@ sig_handler(int signum)
 }
 
 /*
- * Performance test
+ * IPv6 route; the address is a 128-bit number of the high and the low words
+ */
+struct route6 {
+    u64 hi;
+    u64 lo;
+    int prefixlen;
+};
+struct routes6 {
+    struct route6 *routes;
+    size_t nr;
+    size_t size;
+};
+
+/*
+ * Parse an IPv6 address to the high and the low 64-bit words
  */
 static int
-test_lpm_perf(enum palmtrie_type type, const char *fname)
+parse_ipv6(const char *s, u64 *hi, u64 *lo)
 {
+    uint8_t b[16];
+    int i;
+
+    if ( 1 != inet_pton(AF_INET6, s, b) ) {
+        return -1;
+    }
+    *hi = 0;
+    *lo = 0;
+    for ( i = 0; i < 8; i++ ) {
+        *hi = (*hi << 8) | b[i];
+        *lo = (*lo << 8) | b[i + 8];
+    }
+
+    return 0;
+}
+
+/*
+ * Add an IPv6 route of a line of "prefix/len nexthop" to the trie as a
+ * 128-bit key in a[0] (low) and a[1] (high); the data is the low 64 bits of
+ * the next hop
+ */
+static int
+add_route6(struct palmtrie *palmtrie, struct routes6 *rt, const char *buf)
+{
+    char prefix[INET6_ADDRSTRLEN];
+    char nexthop[INET6_ADDRSTRLEN];
+    addr_t addr = PALMTRIE_ADDR_ZERO;
+    addr_t mask = PALMTRIE_ADDR_ZERO;
+    struct route6 *routes;
+    int prefixlen;
+    u64 nhi;
+    u64 nlo;
+    size_t nsize;
+
+    if ( 3 != sscanf(buf, "%45[^/]/%d %45s", prefix, &prefixlen, nexthop)
+         || prefixlen < 0 || prefixlen > 128
+         || parse_ipv6(prefix, &addr.a[1], &addr.a[0]) < 0
+         || parse_ipv6(nexthop, &nhi, &nlo) < 0 ) {
+        return -1;
+    }
+    if ( prefixlen <= 64 ) {
+        mask.a[1] = 64 == prefixlen ? 0 : ~0ULL >> prefixlen;
+        mask.a[0] = ~0ULL;
+    } else {
+        mask.a[0] = 128 == prefixlen ? 0 : ~0ULL >> (prefixlen - 64);
+    }
+    addr.a[1] &= ~mask.a[1];
+    addr.a[0] &= ~mask.a[0];
+    if ( palmtrie_add_data(palmtrie, addr, mask, prefixlen, nlo) < 0 ) {
+        return -1;
+    }
+
+    /* For the traffic */
+    if ( rt->nr >= rt->size ) {
+        nsize = rt->size ? rt->size * 2 : 65536;
+        routes = realloc(rt->routes, sizeof(struct route6) * nsize);
+        if ( NULL == routes ) {
+            return -1;
+        }
+        rt->routes = routes;
+        rt->size = nsize;
+    }
+    rt->routes[rt->nr].hi = addr.a[1];
+    rt->routes[rt->nr].lo = addr.a[0];
+    rt->routes[rt->nr].prefixlen = prefixlen;
+    rt->nr++;
+
+    return 0;
+}
+
+/*
+ * Generate the IPv6 keys in the routes with random interface identifiers,
+ * since uniformly random 128-bit keys hardly match any route
+ */
+static u64 *
+gen_keys6(const struct routes6 *rt)
+{
+    const struct route6 *r;
+    u64 *keys;
+    u64 hi;
+    u64 lo;
+    int i;
+
+    keys = malloc(sizeof(u64) * 2 * NRKEYS6);
+    if ( NULL == keys ) {
+        return NULL;
+    }
+    for ( i = 0; i < NRKEYS6; i++ ) {
+        r = &rt->routes[xor128() % rt->nr];
+        hi = ((u64)xor128() << 32) | xor128();
+        lo = ((u64)xor128() << 32) | xor128();
+        if ( r->prefixlen <= 64 ) {
+            keys[2 * i] = lo;
+            keys[2 * i + 1] = r->hi
+                | (64 == r->prefixlen ? 0 : hi & (~0ULL >> r->prefixlen));
+        } else {
+            keys[2 * i] = r->lo
+                | (128 == r->prefixlen ? 0 : lo & (~0ULL >> (r->prefixlen
+                                                            - 64)));
+            keys[2 * i + 1] = r->hi;
+        }
+    }
+
+    return keys;
+}
+
+/*
+ * Performance test; IPv4 routes of "a.b.c.d/len nexthop" are looked up by
+ * random keys, and IPv6 routes by the keys generated from the routes
+ */
+static int
+test_lpm_perf(enum palmtrie_type type, const char *fname, int duration)
+{
+    struct routes6 rt = { NULL, 0, 0 };
+    u64 *keys6;
     struct palmtrie palmtrie;
     FILE *fp;
     char buf[4096];
@@ -81,16 +175,16 @@ test_lpm_perf(enum palmtrie_type type, const char *fname)
     int prefixlen;
     int nexthop[4];
     int ret;
-    addr_t addr1 = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
-    addr_t mask = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t addr1 = {{0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t mask = {{0, 0, 0, 0, 0, 0, 0, 0}};
     u64 addr2;
     long long i;
-    addr_t tmp = {0, {0, 0, 0, 0, 0, 0, 0, 0}};
+    addr_t tmp = {{0, 0, 0, 0, 0, 0, 0, 0}};
     double delta;
     u64 x;
 
     /* Initialize */
-    palmtrie_init(&palmtrie, type);
+    palmtrie_init(&palmtrie, type, 0);
 
     /* Load from the linx file */
     fp = fopen(fname, "r");
@@ -103,6 +197,13 @@ test_lpm_perf(enum palmtrie_type type, const char *fname)
         if ( !fgets(buf, sizeof(buf), fp) ) {
             continue;
         }
+        if ( NULL != strchr(buf, ':') ) {
+            /* IPv6 */
+            if ( add_route6(&palmtrie, &rt, buf) < 0 ) {
+                return -1;
+            }
+            continue;
+        }
         ret = sscanf(buf, "%d.%d.%d.%d/%d %d.%d.%d.%d", &prefix[0], &prefix[1],
                      &prefix[2], &prefix[3], &prefixlen, &nexthop[0],
                      &nexthop[1], &nexthop[2], &nexthop[3]);
@@ -132,6 +233,14 @@ test_lpm_perf(enum palmtrie_type type, const char *fname)
     /* Close */
     fclose(fp);
 
+    keys6 = NULL;
+    if ( rt.nr ) {
+        keys6 = gen_keys6(&rt);
+        if ( NULL == keys6 ) {
+            return -1;
+        }
+    }
+
     struct sigaction act;
     struct sigaction oldact;
     struct itimerval itval;
@@ -141,9 +250,9 @@ test_lpm_perf(enum palmtrie_type type, const char *fname)
     if ( 0 != sigaction(SIGVTALRM, &act, &oldact) ) {
         return -1;
     }
-    itval.it_value.tv_sec = 10;
+    itval.it_value.tv_sec = duration;
     itval.it_value.tv_usec = 0;
-    itval.it_interval.tv_sec = 10;
+    itval.it_interval.tv_sec = duration;
     itval.it_interval.tv_usec = 0;
     if ( 0 != setitimer(ITIMER_VIRTUAL, &itval, NULL) ) {
         return -1;
@@ -153,9 +262,17 @@ test_lpm_perf(enum palmtrie_type type, const char *fname)
     x = 0;
     g_t0 = getmicrotime();
     g_nrsigs = 0;
-    for ( g_cnt = 0; g_nrsigs < NRTRIALS; g_cnt++ ) {
-        tmp.a[0] = xor128();
-        x ^= palmtrie_lookup(&palmtrie, tmp);
+    if ( NULL != keys6 ) {
+        for ( g_cnt = 0; g_nrsigs < NRTRIALS; g_cnt++ ) {
+            tmp.a[0] = keys6[2 * (g_cnt & (NRKEYS6 - 1))];
+            tmp.a[1] = keys6[2 * (g_cnt & (NRKEYS6 - 1)) + 1];
+            x ^= palmtrie_lookup_ref(&palmtrie, &tmp);
+        }
+    } else {
+        for ( g_cnt = 0; g_nrsigs < NRTRIALS; g_cnt++ ) {
+            tmp.a[0] = xor128();
+            x ^= palmtrie_lookup(&palmtrie, tmp);
+        }
     }
     g_t1 = getmicrotime();
     sigaction(SIGVTALRM, &oldact, NULL);
@@ -175,6 +292,9 @@ test_lpm_perf(enum palmtrie_type type, const char *fname)
         t = g_data_timer[i];
         cnt = g_data_cnt[i];
     }
+    free(keys6);
+    free(rt.routes);
+    palmtrie_release(&palmtrie);
 
     return 0;
 }
@@ -187,25 +307,32 @@ main(int argc, const char *const argv[])
 {
     const char *fname;
     const char *type;
+    int duration;
 
-    if ( argc != 3 ) {
-        fprintf(stderr, "Usage: %s <tcam-file> <type>\n", argv[0]);
+    if ( argc != 3 && argc != 4 ) {
+        fprintf(stderr, "Usage: %s <routing-table> <type> [duration]\n",
+                argv[0]);
         return EXIT_FAILURE;
     }
     fname = argv[1];
     type = argv[2];
+    duration = argc > 3 ? atoi(argv[3]) : 10;
+    if ( duration <= 0 ) {
+        fprintf(stderr, "Invalid duration\n");
+        return EXIT_FAILURE;
+    }
     if ( 0 == strcmp(type, "sl") ) {
         printf("#SL:\n");
-        test_lpm_perf(PALMTRIE_SORTED_LIST, fname);
+        test_lpm_perf(PALMTRIE_SORTED_LIST, fname, duration);
     } else if ( 0 == strcmp(type, "tpt") ) {
         printf("#TPT(%d):\n", PALMTRIE_PRIORITY_SKIP);
-        test_lpm_perf(PALMTRIE_BASIC, fname);
+        test_lpm_perf(PALMTRIE_BASIC, fname, duration);
     } else if ( 0 == strcmp(type, "mtpt") ) {
-        printf("#MTPT(%d/%d):\n", PALMTRIE_PRIORITY_SKIP, PALMTRIE_MTPT_STRIDE);
-        test_lpm_perf(PALMTRIE_DEFAULT, fname);
+        printf("#MTPT(%d/%d):\n", PALMTRIE_PRIORITY_SKIP, PALMTRIE_DEFAULT_STRIDE);
+        test_lpm_perf(PALMTRIE_DEFAULT, fname, duration);
     } else if ( 0 == strcmp(type, "popmtpt") ) {
-        printf("#POPMTPT(%d/%d):\n", PALMTRIE_PRIORITY_SKIP, PALMTRIE_MTPT_STRIDE);
-        test_lpm_perf(PALMTRIE_PLUS, fname);
+        printf("#POPMTPT(%d/%d):\n", PALMTRIE_PRIORITY_SKIP, PALMTRIE_DEFAULT_STRIDE);
+        test_lpm_perf(PALMTRIE_PLUS, fname, duration);
     }
 
     return 0;
@@ -0,0 +1,293 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define MAX_THREADS     256
+#define LOOKUP_BATCH    1024
+
+/*
+ * Per-thread benchmark context.  Each context is aligned to a cache line to
+ * avoid false sharing of the lookup counters.
+ */
+struct bench_thread {
+    pthread_t th;
+    int id;
+    int cpu;
+    struct palmtrie *palmtrie;
+    /* Traffic: xor128 keys if pattern is NULL, otherwise a trace slice */
+    struct xor128_state rng;
+    addr_t *pattern;
+    size_t npkt;
+    /* Result */
+    long long cnt;
+    double t0;
+    double t1;
+    u64 x;
+} __attribute__ ((aligned (64)));
+
+static volatile int g_start;
+static volatile int g_stop;
+
+/*
+ * Lookup loop of a benchmark thread
+ */
+static void *
+bench_thread_main(void *arg)
+{
+    struct bench_thread *bt;
+    addr_t tmp = PALMTRIE_ADDR_ZERO;
+    long long cnt;
+    size_t j;
+    u64 x;
+    int i;
+
+    bt = (struct bench_thread *)arg;
+    pin_thread(bt->cpu);
+
+    while ( !__atomic_load_n(&g_start, __ATOMIC_ACQUIRE) ) {
+        /* Wait for all threads */
+    }
+
+    x = 0;
+    cnt = 0;
+    j = 0;
+    bt->t0 = getmicrotime();
+    while ( !__atomic_load_n(&g_stop, __ATOMIC_RELAXED) ) {
+        if ( NULL == bt->pattern ) {
+            for ( i = 0; i < LOOKUP_BATCH; i++ ) {
+                rand_acl_key(&bt->rng, &tmp);
+                x ^= palmtrie_lookup(bt->palmtrie, tmp);
+            }
+        } else {
+            for ( i = 0; i < LOOKUP_BATCH; i++ ) {
+                x ^= palmtrie_lookup(bt->palmtrie, bt->pattern[j]);
+                j++;
+                if ( j >= bt->npkt ) {
+                    j = 0;
+                }
+            }
+        }
+        cnt += LOOKUP_BATCH;
+    }
+    bt->t1 = getmicrotime();
+    bt->cnt = cnt;
+    bt->x = x;
+
+    return NULL;
+}
+
+/*
+ * Run the benchmark with nth threads for the duration
+ */
+static int
+run_threads(struct palmtrie *palmtrie, int nth, int duration, addr_t *pattern,
+            size_t npkt)
+{
+    struct bench_thread *bts;
+    double total;
+    double rate;
+    int ncpu;
+    int i;
+    int ret;
+
+    bts = aligned_alloc(64, sizeof(struct bench_thread) * nth);
+    if ( NULL == bts ) {
+        return -1;
+    }
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( ncpu <= 0 ) {
+        ncpu = 1;
+    }
+
+    g_start = 0;
+    g_stop = 0;
+    for ( i = 0; i < nth; i++ ) {
+        memset(&bts[i], 0, sizeof(struct bench_thread));
+        bts[i].id = i;
+        bts[i].cpu = i % ncpu;
+        bts[i].palmtrie = palmtrie;
+        /* Distinct xor128 seeds for each thread */
+        bts[i].rng.x = 123456789 + i;
+        bts[i].rng.y = 362436069;
+        bts[i].rng.z = 521288629;
+        bts[i].rng.w = 88675123 ^ (i * 0x9e3779b9U);
+        if ( NULL != pattern ) {
+            /* Slice of the trace for this thread */
+            bts[i].pattern = pattern + npkt * i / nth;
+            bts[i].npkt = npkt * (i + 1) / nth - npkt * i / nth;
+            if ( 0 == bts[i].npkt ) {
+                bts[i].pattern = pattern;
+                bts[i].npkt = npkt;
+            }
+        }
+        ret = pthread_create(&bts[i].th, NULL, bench_thread_main, &bts[i]);
+        if ( 0 != ret ) {
+            /* Release and stop the threads already started */
+            __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&g_start, 1, __ATOMIC_RELEASE);
+            while ( i > 0 ) {
+                pthread_join(bts[--i].th, NULL);
+            }
+            free(bts);
+            return -1;
+        }
+    }
+
+    __atomic_store_n(&g_start, 1, __ATOMIC_RELEASE);
+    sleep(duration);
+    __atomic_store_n(&g_stop, 1, __ATOMIC_RELAXED);
+
+    total = 0;
+    for ( i = 0; i < nth; i++ ) {
+        pthread_join(bts[i].th, NULL);
+        total += bts[i].cnt / (bts[i].t1 - bts[i].t0);
+    }
+
+    /* Aggregate and per-thread lookup rates */
+    printf("%d %lf", nth, total / 1000 / 1000);
+    for ( i = 0; i < nth; i++ ) {
+        rate = bts[i].cnt / (bts[i].t1 - bts[i].t0);
+        printf(" %lf", rate / 1000 / 1000);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    free(bts);
+
+    return 0;
+}
+
+/*
+ * Scaling test of an engine from 1 to maxth threads
+ */
+static int
+test_scaling(enum palmtrie_type type, const char *name, const char *fname,
+             addr_t *pattern, size_t npkt, int maxth, int duration)
+{
+    struct palmtrie palmtrie;
+    double t0;
+    double t1;
+    int nth;
+    int ret;
+
+    t0 = getmicrotime();
+    if ( build_acl(&palmtrie, type, fname) < 0 ) {
+        fprintf(stderr, "Failed to load %s\n", fname);
+        return -1;
+    }
+    t1 = getmicrotime();
+
+    printf("#%s: build %lf\n", name, t1 - t0);
+    printf("#threads aggregate[Mlookup/sec] thread0[Mlookup/sec] ...\n");
+    for ( nth = 1; nth <= maxth; nth++ ) {
+        ret = run_threads(&palmtrie, nth, duration, pattern, npkt);
+        if ( ret < 0 ) {
+            palmtrie_release(&palmtrie);
+            return -1;
+        }
+    }
+    palmtrie_release(&palmtrie);
+
+    return 0;
+}
+
+/*
+ * Main routine for the multi-threaded scaling evaluation
+ */
+int
+main(int argc, const char *const argv[])
+{
+    const char *fname;
+    const char *type;
+    const char *traffic;
+    const char *tfname;
+    static const char *const engines[] = { "sl", "tpt", "mtpt", "popmtpt" };
+    enum palmtrie_type t;
+    char engine[64];
+    addr_t *pattern;
+    size_t npkt;
+    size_t i;
+    int maxth;
+    int duration;
+    int all;
+
+    if ( argc < 3 || argc > 5 ) {
+        fprintf(stderr, "Usage: %s <tcam-file> <type> [<threads> "
+                "[<seconds>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    fname = argv[1];
+    type = argv[2];
+    maxth = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    duration = argc > 4 ? atoi(argv[4]) : 10;
+    if ( maxth <= 0 || maxth > MAX_THREADS || duration <= 0 ) {
+        fprintf(stderr, "Invalid number of threads or duration\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Split the type into the engine and the traffic pattern */
+    traffic = strchr(type, '-');
+    if ( NULL == traffic || (size_t)(traffic - type) >= sizeof(engine) ) {
+        fprintf(stderr, "Invalid type: %s\n", type);
+        return EXIT_FAILURE;
+    }
+    memcpy(engine, type, traffic - type);
+    engine[traffic - type] = '\0';
+    traffic++;
+    all = (0 == strcmp(engine, "all"));
+    if ( !all && parse_engine(engine, strlen(engine), &t) < 0 ) {
+        fprintf(stderr, "Invalid type: %s\n", type);
+        return EXIT_FAILURE;
+    }
+
+    /* Traffic pattern */
+    pattern = NULL;
+    npkt = 0;
+    tfname = NULL;
+    if ( parse_traffic(traffic, &tfname) < 0 ) {
+        fprintf(stderr, "Invalid traffic pattern: %s\n", traffic);
+        return EXIT_FAILURE;
+    }
+    if ( NULL != tfname ) {
+        pattern = palmtrie_load_keys(tfname, 0, &npkt);
+        if ( NULL == pattern || 0 == npkt ) {
+            fprintf(stderr, "Failed to load %s\n", tfname);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( all ) {
+        for ( i = 0; i < sizeof(engines) / sizeof(engines[0]); i++ ) {
+            parse_engine(engines[i], strlen(engines[i]), &t);
+            test_scaling(t, engines[i], fname, pattern, npkt, maxth,
+                         duration);
+        }
+    } else {
+        test_scaling(t, engine, fname, pattern, npkt, maxth, duration);
+    }
+
+    free(pattern);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,824 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#define KEY_BYTES           16
+#define MAX_WEIGHTS         33
+#define NR_NETWORKS         256
+#define DEFAULT_RULES       1000
+#define DEFAULT_PACKETS     1000000
+#define DEFAULT_ALPHA       1.0
+
+/* Port classes of ClassBench */
+enum port_class {
+    PORT_WC = 0,        /* Wildcard */
+    PORT_HI,            /* 1024-65535 */
+    PORT_LO,            /* 0-1023 */
+    PORT_EM,            /* Exact match */
+    PORT_AR,            /* Arbitrary range */
+    PORT_NR_CLASSES,
+};
+
+/* Traffic locality */
+enum locality {
+    LOCALITY_UNIFORM,
+    LOCALITY_ZIPF,
+    LOCALITY_RULES,
+};
+
+/*
+ * Weighted distribution of small integers
+ */
+struct dist {
+    int nr;
+    int values[MAX_WEIGHTS];
+    double weights[MAX_WEIGHTS];
+};
+
+/*
+ * Seed profile of the ruleset
+ */
+struct profile {
+    const char *name;
+    const char *proto;
+    const char *src_plen;
+    const char *dst_plen;
+    const char *sport;
+    const char *dport;
+};
+
+/*
+ * Ternary entry of the ternary matching table
+ */
+struct entry {
+    uint8_t key[KEY_BYTES];
+    uint8_t mask[KEY_BYTES];
+};
+
+/*
+ * Generated ruleset; the entries of the i-th rule are from first[i] to
+ * first[i + 1] - 1
+ */
+struct ruleset {
+    struct entry *ents;
+    size_t nr;
+    size_t size;
+    size_t *first;
+    size_t nrules;
+    /* Hash table of the entries to drop the duplicates */
+    size_t *ht;
+    size_t htsize;
+};
+
+/*
+ * ClassBench-like seed profiles.  The distributions are
+ * "<value>:<weight>,..."; protocol 0 is the wildcard and the port classes
+ * are wc, hi, lo, em, and ar in this order.
+ */
+static const struct profile profiles[] = {
+    { "acl", "6:70,17:20,1:5,0:5",
+      "0:5,8:2,16:8,24:25,28:10,32:50",
+      "0:2,16:8,24:30,28:10,32:50",
+      "0:97,1:1,3:1,4:1", "0:10,1:5,2:5,3:75,4:5" },
+    { "fw", "6:50,17:20,0:30",
+      "0:30,8:10,16:20,24:20,32:20",
+      "0:15,16:15,24:30,32:40",
+      "0:85,1:5,3:5,4:5", "0:30,1:10,2:5,3:50,4:5" },
+    { "ipc", "6:50,17:30,1:10,0:10",
+      "0:10,16:15,24:35,32:40",
+      "0:10,16:15,24:35,32:40",
+      "0:75,1:5,2:5,3:10,4:5", "0:30,1:10,2:5,3:50,4:5" },
+};
+
+/* Well-known ports for the exact matches */
+static const u16 well_known_ports[] = {
+    20, 21, 22, 23, 25, 53, 67, 68, 69, 80, 110, 123, 137, 138, 139, 143,
+    161, 162, 179, 389, 443, 445, 514, 636, 993, 995, 1433, 1521, 3306, 3389,
+    5060, 8080,
+};
+
+static struct xor128_state rng = XOR128_INITIALIZER;
+
+/* Write the keys from the most significant byte of the header */
+static int reverse;
+
+/*
+ * Random number in [0, 1)
+ */
+static __inline__ double
+rand_double(void)
+{
+    return xor128_r(&rng) / 4294967296.0;
+}
+
+/*
+ * Parse a distribution "<value>:<weight>,..."
+ */
+static int
+parse_dist(struct dist *d, const char *s)
+{
+    char *end;
+    double sum;
+    int i;
+
+    d->nr = 0;
+    sum = 0;
+    while ( '\0' != *s ) {
+        if ( d->nr >= MAX_WEIGHTS ) {
+            return -1;
+        }
+        d->values[d->nr] = strtol(s, &end, 10);
+        if ( ':' != *end ) {
+            return -1;
+        }
+        s = end + 1;
+        d->weights[d->nr] = strtod(s, &end);
+        if ( end == s || d->weights[d->nr] < 0 ) {
+            return -1;
+        }
+        sum += d->weights[d->nr];
+        d->nr++;
+        s = end;
+        if ( ',' == *s ) {
+            s++;
+        } else if ( '\0' != *s ) {
+            return -1;
+        }
+    }
+    if ( 0 == d->nr || sum <= 0 ) {
+        return -1;
+    }
+    /* Normalize to the cumulative distribution */
+    for ( i = 0; i < d->nr; i++ ) {
+        d->weights[i] = d->weights[i] / sum + (i > 0 ? d->weights[i - 1] : 0);
+    }
+
+    return 0;
+}
+
+/*
+ * Draw a value from the distribution
+ */
+static int
+draw(const struct dist *d)
+{
+    double r;
+    int i;
+
+    r = rand_double();
+    for ( i = 0; i < d->nr - 1; i++ ) {
+        if ( r < d->weights[i] ) {
+            break;
+        }
+    }
+
+    return d->values[i];
+}
+
+/*
+ * Append an entry to the ruleset
+ */
+static struct entry *
+append_entry(struct ruleset *rs)
+{
+    struct entry *ents;
+    size_t nsize;
+
+    if ( rs->nr >= rs->size ) {
+        nsize = rs->size ? rs->size * 2 : 1024;
+        ents = realloc(rs->ents, sizeof(struct entry) * nsize);
+        if ( NULL == ents ) {
+            return NULL;
+        }
+        rs->ents = ents;
+        rs->size = nsize;
+    }
+
+    return &rs->ents[rs->nr++];
+}
+
+/*
+ * Hash of an entry
+ */
+static __inline__ size_t
+entry_hash(const struct entry *e)
+{
+    const uint8_t *b;
+    u64 h;
+    size_t i;
+
+    /* FNV-1a */
+    b = (const uint8_t *)e;
+    h = 0xcbf29ce484222325ULL;
+    for ( i = 0; i < sizeof(struct entry); i++ ) {
+        h = (h ^ b[i]) * 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+/*
+ * Commit the last entry unless the same entry exists; a duplicate entry is
+ * shadowed by the earlier one and the trie rejects it
+ */
+static int
+commit_entry(struct ruleset *rs)
+{
+    struct entry *e;
+    size_t *ht;
+    size_t nsize;
+    size_t i;
+    size_t j;
+    size_t h;
+
+    if ( 2 * rs->nr > rs->htsize ) {
+        /* Rehash; the slots hold the entry index plus one */
+        nsize = rs->htsize ? rs->htsize * 2 : 4096;
+        ht = calloc(nsize, sizeof(size_t));
+        if ( NULL == ht ) {
+            return -1;
+        }
+        for ( i = 0; i < rs->htsize; i++ ) {
+            if ( rs->ht[i] ) {
+                h = entry_hash(&rs->ents[rs->ht[i] - 1]) & (nsize - 1);
+                while ( ht[h] ) {
+                    h = (h + 1) & (nsize - 1);
+                }
+                ht[h] = rs->ht[i];
+            }
+        }
+        free(rs->ht);
+        rs->ht = ht;
+        rs->htsize = nsize;
+    }
+
+    e = &rs->ents[rs->nr - 1];
+    h = entry_hash(e) & (rs->htsize - 1);
+    while ( (j = rs->ht[h]) ) {
+        if ( 0 == memcmp(&rs->ents[j - 1], e, sizeof(struct entry)) ) {
+            /* Duplicate */
+            rs->nr--;
+            return 0;
+        }
+        h = (h + 1) & (rs->htsize - 1);
+    }
+    rs->ht[h] = rs->nr;
+
+    return 0;
+}
+
+/*
+ * Set a big-endian field of the entry; the bits set in the wildcard argument
+ * are wildcard
+ */
+static void
+set_field(struct entry *e, int off, int len, u32 value, u32 wildcard)
+{
+    int i;
+
+    for ( i = 0; i < len; i++ ) {
+        e->key[off + i] = (value & ~wildcard) >> (8 * (len - i - 1));
+        e->mask[off + i] = wildcard >> (8 * (len - i - 1));
+    }
+}
+
+/*
+ * Expand a port range to the prefixes; each prefix is stored as the value and
+ * the wildcard bits
+ */
+static int
+range_prefixes(u32 lo, u32 hi, u32 *values, u32 *wildcards)
+{
+    u32 size;
+    int n;
+
+    n = 0;
+    while ( lo <= hi ) {
+        /* Largest aligned block from lo within the range */
+        size = lo ? (lo & -lo) : 0x10000;
+        while ( lo + size - 1 > hi ) {
+            size >>= 1;
+        }
+        values[n] = lo;
+        wildcards[n] = size - 1;
+        n++;
+        lo += size;
+    }
+
+    return n;
+}
+
+/*
+ * Generate a port range of the class
+ */
+static void
+port_range(int class, u32 *lo, u32 *hi)
+{
+    u32 a;
+    u32 b;
+
+    switch ( class ) {
+    case PORT_HI:
+        *lo = 1024;
+        *hi = 65535;
+        break;
+    case PORT_LO:
+        *lo = 0;
+        *hi = 1023;
+        break;
+    case PORT_EM:
+        if ( rand_double() < 0.7 ) {
+            *lo = well_known_ports[xor128_r(&rng)
+                                   % (sizeof(well_known_ports)
+                                      / sizeof(well_known_ports[0]))];
+        } else {
+            *lo = xor128_r(&rng) & 0xffff;
+        }
+        *hi = *lo;
+        break;
+    case PORT_AR:
+        a = xor128_r(&rng) & 0xffff;
+        b = xor128_r(&rng) & 0xffff;
+        *lo = a < b ? a : b;
+        *hi = a < b ? b : a;
+        break;
+    default:
+        *lo = 0;
+        *hi = 65535;
+    }
+}
+
+/*
+ * Generate an address prefix; the prefixes longer than /16 are in one of the
+ * networks to mimic the address structure of the real rulesets
+ */
+static void
+prefix(const u32 *networks, int plen, u32 *value, u32 *wildcard)
+{
+    u32 a;
+
+    a = xor128_r(&rng);
+    if ( plen > 16 ) {
+        a = networks[xor128_r(&rng) % NR_NETWORKS] | (a & 0xffff);
+    }
+    *wildcard = plen >= 32 ? 0 : (0xffffffffU >> plen);
+    *value = a & ~*wildcard;
+}
+
+/*
+ * Generate a ruleset
+ */
+static int
+generate_rules(struct ruleset *rs, size_t nrules, const struct dist *proto,
+               const struct dist *src_plen, const struct dist *dst_plen,
+               const struct dist *sport, const struct dist *dport)
+{
+    u32 networks[NR_NETWORKS];
+    u32 sv[32];
+    u32 sw[32];
+    u32 dv[32];
+    u32 dw[32];
+    u32 src;
+    u32 srcw;
+    u32 dst;
+    u32 dstw;
+    u32 lo;
+    u32 hi;
+    struct entry *e;
+    size_t i;
+    int p;
+    int ns;
+    int nd;
+    int j;
+    int k;
+
+    for ( j = 0; j < NR_NETWORKS; j++ ) {
+        networks[j] = xor128_r(&rng) & 0xffff0000U;
+    }
+    memset(rs, 0, sizeof(struct ruleset));
+    rs->first = malloc(sizeof(size_t) * (nrules + 1));
+    if ( NULL == rs->first ) {
+        return -1;
+    }
+    rs->nrules = nrules;
+
+    for ( i = 0; i < nrules; i++ ) {
+        rs->first[i] = rs->nr;
+    retry:
+        p = draw(proto);
+        prefix(networks, draw(src_plen), &src, &srcw);
+        prefix(networks, draw(dst_plen), &dst, &dstw);
+        if ( 6 == p || 17 == p ) {
+            port_range(draw(sport), &lo, &hi);
+            ns = range_prefixes(lo, hi, sv, sw);
+            port_range(draw(dport), &lo, &hi);
+            nd = range_prefixes(lo, hi, dv, dw);
+        } else {
+            ns = range_prefixes(0, 65535, sv, sw);
+            nd = range_prefixes(0, 65535, dv, dw);
+        }
+        /* Cross product of the port prefixes */
+        for ( j = 0; j < ns; j++ ) {
+            for ( k = 0; k < nd; k++ ) {
+                e = append_entry(rs);
+                if ( NULL == e ) {
+                    return -1;
+                }
+                memset(e, 0, sizeof(struct entry));
+                set_field(e, 0, 1, p, 0 == p ? 0xff : 0);
+                set_field(e, 1, 4, src, srcw);
+                set_field(e, 5, 4, dst, dstw);
+                set_field(e, 9, 2, sv[j], sw[j]);
+                set_field(e, 11, 2, dv[k], dw[k]);
+                /* TCP flags and the padding */
+                set_field(e, 13, 1, 0, 0xff);
+                set_field(e, 14, 2, 0, 0xffff);
+                if ( commit_entry(rs) < 0 ) {
+                    return -1;
+                }
+            }
+        }
+        if ( rs->first[i] == rs->nr ) {
+            /* All the entries are duplicates */
+            goto retry;
+        }
+    }
+    rs->first[nrules] = rs->nr;
+
+    return 0;
+}
+
+/*
+ * Write a hexadecimal string of the bytes; the string is in the memory order
+ * of the key, or reversed so that the protocol is the most significant byte
+ * of the key, which is the first byte scanned by the tries
+ */
+static void
+write_hex(FILE *fp, const uint8_t *b, int len)
+{
+    int i;
+
+    for ( i = 0; i < len; i++ ) {
+        fprintf(fp, "%02x", b[reverse ? len - i - 1 : i]);
+    }
+}
+
+/*
+ * Write the ruleset as a ternary matching table; the first rule has the
+ * highest priority and the data of each entry is the rule number from 1
+ */
+static int
+write_rules(const struct ruleset *rs, const char *path)
+{
+    FILE *fp;
+    size_t i;
+    size_t j;
+
+    fp = fopen(path, "w");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    for ( i = 0; i < rs->nrules; i++ ) {
+        for ( j = rs->first[i]; j < rs->first[i + 1]; j++ ) {
+            write_hex(fp, rs->ents[j].key, KEY_BYTES);
+            fprintf(fp, " ");
+            write_hex(fp, rs->ents[j].mask, KEY_BYTES);
+            fprintf(fp, " %zu %zu\n", rs->nrules - i, i + 1);
+        }
+    }
+
+    return fclose(fp);
+}
+
+/*
+ * Generate a header matching the rule
+ */
+static void
+rule_header(const struct ruleset *rs, size_t r, uint8_t *h)
+{
+    const struct entry *e;
+    size_t n;
+    int i;
+
+    n = rs->first[r + 1] - rs->first[r];
+    e = &rs->ents[rs->first[r] + xor128_r(&rng) % n];
+    for ( i = 0; i < KEY_BYTES; i++ ) {
+        h[i] = (e->key[i] & ~e->mask[i]) | (xor128_r(&rng) & e->mask[i]);
+    }
+    /* Clear the padding */
+    h[14] = 0;
+    h[15] = 0;
+}
+
+/*
+ * Generate a uniformly random header
+ */
+static void
+uniform_header(uint8_t *h)
+{
+    static const uint8_t protos[] = { 6, 17, 1 };
+    int i;
+
+    for ( i = 0; i < KEY_BYTES; i++ ) {
+        h[i] = xor128_r(&rng);
+    }
+    h[0] = protos[xor128_r(&rng) % 3];
+    h[14] = 0;
+    h[15] = 0;
+}
+
+/*
+ * Generate a header trace
+ */
+static int
+write_trace(const struct ruleset *rs, const char *path, size_t npkt,
+            enum locality loc, double alpha, size_t nflows)
+{
+    uint8_t *flows;
+    double *cdf;
+    uint8_t h[KEY_BYTES];
+    FILE *fp;
+    double sum;
+    double r;
+    size_t lo;
+    size_t hi;
+    size_t i;
+
+    flows = NULL;
+    cdf = NULL;
+    if ( LOCALITY_ZIPF == loc ) {
+        /* Pool of rule-targeted flows ranked by the Zipf distribution */
+        flows = malloc(KEY_BYTES * nflows);
+        cdf = malloc(sizeof(double) * nflows);
+        if ( NULL == flows || NULL == cdf ) {
+            free(flows);
+            free(cdf);
+            return -1;
+        }
+        sum = 0;
+        for ( i = 0; i < nflows; i++ ) {
+            rule_header(rs, xor128_r(&rng) % rs->nrules, flows + KEY_BYTES * i);
+            sum += 1.0 / pow(i + 1, alpha);
+            cdf[i] = sum;
+        }
+        for ( i = 0; i < nflows; i++ ) {
+            cdf[i] /= sum;
+        }
+    }
+
+    fp = fopen(path, "w");
+    if ( NULL == fp ) {
+        free(flows);
+        free(cdf);
+        return -1;
+    }
+    for ( i = 0; i < npkt; i++ ) {
+        switch ( loc ) {
+        case LOCALITY_UNIFORM:
+            uniform_header(h);
+            break;
+        case LOCALITY_RULES:
+            rule_header(rs, xor128_r(&rng) % rs->nrules, h);
+            break;
+        case LOCALITY_ZIPF:
+            /* Binary search of the rank */
+            r = rand_double();
+            lo = 0;
+            hi = nflows - 1;
+            while ( lo < hi ) {
+                if ( cdf[(lo + hi) / 2] < r ) {
+                    lo = (lo + hi) / 2 + 1;
+                } else {
+                    hi = (lo + hi) / 2;
+                }
+            }
+            memcpy(h, flows + KEY_BYTES * lo, KEY_BYTES);
+            break;
+        }
+        write_hex(fp, h, KEY_BYTES);
+        fprintf(fp, "\n");
+    }
+    free(flows);
+    free(cdf);
+
+    return fclose(fp);
+}
+
+/*
+ * Usage
+ */
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] <tcam-file> [<trace-file>]\n"
+            "\t-t, --type=<seed>        acl, fw, or ipc (default: acl)\n"
+            "\t-n, --rules=<n>          Number of rules (default: %d)\n"
+            "\t-S, --seed=<n>           Random seed (default: 0)\n"
+            "\t-r, --reverse            Place the protocol at the most "
+            "significant byte\n"
+            "\t--proto=<dist>           Protocols, 0 for the wildcard\n"
+            "\t--src-plen=<dist>        Source prefix lengths\n"
+            "\t--dst-plen=<dist>        Destination prefix lengths\n"
+            "\t--sport=<dist>           Source port classes\n"
+            "\t--dport=<dist>           Destination port classes\n"
+            "\t                         (0: wildcard, 1: 1024-65535, "
+            "2: 0-1023, 3: exact,\n"
+            "\t                          4: arbitrary range)\n"
+            "\t-m, --packets=<n>        Number of headers in the trace "
+            "(default: %d)\n"
+            "\t-l, --locality=<type>    uniform, zipf, or rules "
+            "(default: rules)\n"
+            "\t-a, --alpha=<alpha>      Zipf exponent (default: %.1lf)\n"
+            "\t-F, --flows=<n>          Number of flows for Zipf "
+            "(default: number of rules)\n"
+            "A distribution is \"<value>:<weight>,...\".\n",
+            prog, DEFAULT_RULES, DEFAULT_PACKETS, DEFAULT_ALPHA);
+}
+
+/*
+ * Main routine of the ruleset and trace generator
+ */
+int
+main(int argc, char *const argv[])
+{
+    static const struct option longopts[] = {
+        { "type", required_argument, NULL, 't' },
+        { "rules", required_argument, NULL, 'n' },
+        { "seed", required_argument, NULL, 'S' },
+        { "reverse", no_argument, NULL, 'r' },
+        { "proto", required_argument, NULL, 'P' },
+        { "src-plen", required_argument, NULL, 's' },
+        { "dst-plen", required_argument, NULL, 'd' },
+        { "sport", required_argument, NULL, 'x' },
+        { "dport", required_argument, NULL, 'y' },
+        { "packets", required_argument, NULL, 'm' },
+        { "locality", required_argument, NULL, 'l' },
+        { "alpha", required_argument, NULL, 'a' },
+        { "flows", required_argument, NULL, 'F' },
+        { NULL, 0, NULL, 0 },
+    };
+    const struct profile *prof;
+    const char *specs[5];
+    struct dist dists[5];
+    struct ruleset rs;
+    enum locality loc;
+    size_t nrules;
+    size_t npkt;
+    size_t nflows;
+    double alpha;
+    unsigned long seed;
+    int ch;
+    int i;
+
+    prof = &profiles[0];
+    memset(specs, 0, sizeof(specs));
+    nrules = DEFAULT_RULES;
+    npkt = DEFAULT_PACKETS;
+    nflows = 0;
+    alpha = DEFAULT_ALPHA;
+    loc = LOCALITY_RULES;
+    seed = 0;
+    while ( -1 != (ch = getopt_long(argc, argv, "t:n:S:rm:l:a:F:", longopts,
+                                    NULL)) ) {
+        switch ( ch ) {
+        case 't':
+            prof = NULL;
+            for ( i = 0; i < (int)(sizeof(profiles) / sizeof(profiles[0]));
+                  i++ ) {
+                if ( 0 == strcmp(optarg, profiles[i].name) ) {
+                    prof = &profiles[i];
+                }
+            }
+            if ( NULL == prof ) {
+                fprintf(stderr, "Invalid type: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'n':
+            nrules = strtoull(optarg, NULL, 10);
+            break;
+        case 'S':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            reverse = 1;
+            break;
+        case 'P':
+            specs[0] = optarg;
+            break;
+        case 's':
+            specs[1] = optarg;
+            break;
+        case 'd':
+            specs[2] = optarg;
+            break;
+        case 'x':
+            specs[3] = optarg;
+            break;
+        case 'y':
+            specs[4] = optarg;
+            break;
+        case 'm':
+            npkt = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            if ( 0 == strcmp(optarg, "uniform") ) {
+                loc = LOCALITY_UNIFORM;
+            } else if ( 0 == strcmp(optarg, "zipf") ) {
+                loc = LOCALITY_ZIPF;
+            } else if ( 0 == strcmp(optarg, "rules") ) {
+                loc = LOCALITY_RULES;
+            } else {
+                fprintf(stderr, "Invalid locality: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'a':
+            alpha = atof(optarg);
+            break;
+        case 'F':
+            nflows = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( argc - optind < 1 || argc - optind > 2 || 0 == nrules ) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ( 0 == nflows ) {
+        nflows = nrules;
+    }
+
+    /* Distributions */
+    if ( NULL == specs[0] ) {
+        specs[0] = prof->proto;
+    }
+    if ( NULL == specs[1] ) {
+        specs[1] = prof->src_plen;
+    }
+    if ( NULL == specs[2] ) {
+        specs[2] = prof->dst_plen;
+    }
+    if ( NULL == specs[3] ) {
+        specs[3] = prof->sport;
+    }
+    if ( NULL == specs[4] ) {
+        specs[4] = prof->dport;
+    }
+    for ( i = 0; i < 5; i++ ) {
+        if ( parse_dist(&dists[i], specs[i]) < 0 ) {
+            fprintf(stderr, "Invalid distribution: %s\n", specs[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Seed */
+    rng.x ^= seed;
+    rng.y ^= seed * 0x9e3779b9UL;
+    for ( i = 0; i < 64; i++ ) {
+        (void)xor128_r(&rng);
+    }
+
+    if ( generate_rules(&rs, nrules, &dists[0], &dists[1], &dists[2],
+                        &dists[3], &dists[4]) < 0 ) {
+        fprintf(stderr, "Failed to generate the rules\n");
+        return EXIT_FAILURE;
+    }
+    if ( write_rules(&rs, argv[optind]) < 0 ) {
+        fprintf(stderr, "Failed to write %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%zu rules (%zu entries)\n", rs.nrules, rs.nr);
+    if ( argc - optind > 1 ) {
+        if ( write_trace(&rs, argv[optind + 1], npkt, loc, alpha,
+                         nflows) < 0 ) {
+            fprintf(stderr, "Failed to write %s\n", argv[optind + 1]);
+            return EXIT_FAILURE;
+        }
+    }
+    free(rs.ents);
+    free(rs.first);
+    free(rs.ht);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
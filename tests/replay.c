@@ -0,0 +1,736 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DEFAULT_DURATION    10
+#define DEFAULT_BATCH       32
+#define CHECK_INTERVAL      65536   /* Lookups between the time checks */
+
+/* pcap and pcapng */
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAPNG_SHB          0x0a0d0d0a
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_SPB          0x00000003
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BOM          0x1a2b3c4d
+#define PCAPNG_MAX_IF       256
+
+/* Link-layer header types */
+#define LINKTYPE_NULL       0
+#define LINKTYPE_EN10MB     1
+#define LINKTYPE_RAW_OLD    12
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LOOP       108
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_IPV6       229
+#define LINKTYPE_LINUX_SLL2 276
+
+/* Ethertypes */
+#define ETHERTYPE_IPV4      0x0800
+#define ETHERTYPE_IPV6      0x86dd
+#define ETHERTYPE_VLAN      0x8100
+#define ETHERTYPE_QINQ      0x88a8
+
+/* IP protocol numbers */
+#define IPPROTO_HOPOPTS_    0
+#define IPPROTO_TCP_        6
+#define IPPROTO_UDP_        17
+#define IPPROTO_ROUTING_    43
+#define IPPROTO_FRAGMENT_   44
+#define IPPROTO_AH_         51
+#define IPPROTO_DSTOPTS_    60
+#define IPPROTO_SCTP_       132
+
+/*
+ * Keys extracted from a capture file
+ */
+struct replay_keys {
+    addr_t *keys;
+    size_t nr;
+    size_t size;
+    /* Statistics */
+    size_t npkt;
+    size_t nipv4;
+    size_t nipv6;
+    size_t nskip;
+};
+
+/*
+ * Read 16/32-bit values in the network byte order or the file byte order
+ */
+static __inline__ u16
+rd16be(const uint8_t *p)
+{
+    return ((u16)p[0] << 8) | p[1];
+}
+static __inline__ u32
+rd32(const uint8_t *p, int swap)
+{
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return swap ? __builtin_bswap32(v) : v;
+}
+static __inline__ u16
+rd16(const uint8_t *p, int swap)
+{
+    u16 v;
+
+    memcpy(&v, p, sizeof(v));
+
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+/*
+ * Append a key
+ */
+static addr_t *
+append_key(struct replay_keys *rk)
+{
+    addr_t *keys;
+    size_t nsize;
+
+    if ( rk->nr >= rk->size ) {
+        nsize = rk->size ? rk->size * 2 : 65536;
+        keys = realloc(rk->keys, sizeof(addr_t) * nsize);
+        if ( NULL == keys ) {
+            return NULL;
+        }
+        rk->keys = keys;
+        rk->size = nsize;
+    }
+
+    return &rk->keys[rk->nr++];
+}
+
+/*
+ * Set the transport-layer fields of the key: the source and destination ports
+ * in the network byte order followed by the TCP flags
+ */
+static void
+key_l4(uint8_t *k, int proto, const uint8_t *l4, size_t len)
+{
+    if ( IPPROTO_TCP_ == proto || IPPROTO_UDP_ == proto
+         || IPPROTO_SCTP_ == proto ) {
+        if ( len >= 4 ) {
+            memcpy(k, l4, 4);
+        }
+        if ( IPPROTO_TCP_ == proto && len >= 14 ) {
+            k[4] = l4[13];
+        }
+    }
+}
+
+/*
+ * Build a key from an IPv4 packet.  The layout is the same as the .tcam
+ * files: protocol, source address, destination address, source port,
+ * destination port, and TCP flags from the first byte.
+ */
+static int
+key_ipv4(struct replay_keys *rk, const uint8_t *p, size_t len)
+{
+    addr_t *key;
+    uint8_t *k;
+    size_t hlen;
+    u16 frag;
+
+    if ( len < 20 || 4 != (p[0] >> 4) ) {
+        return -1;
+    }
+    hlen = (p[0] & 0xf) * 4;
+    if ( hlen < 20 || hlen > len ) {
+        return -1;
+    }
+    key = append_key(rk);
+    if ( NULL == key ) {
+        return -1;
+    }
+    memset(key, 0, sizeof(addr_t));
+    k = (uint8_t *)key->a;
+    k[0] = p[9];
+    memcpy(k + 1, p + 12, 4);
+    memcpy(k + 5, p + 16, 4);
+    frag = rd16be(p + 6) & 0x1fff;
+    if ( 0 == frag ) {
+        /* No transport header in the non-first fragments */
+        key_l4(k + 9, p[9], p + hlen, len - hlen);
+    }
+    rk->nipv4++;
+
+    return 0;
+}
+
+/*
+ * Build a key from an IPv6 packet.  The addresses are 128 bits, so the key is
+ * the protocol, source address, destination address, source port,
+ * destination port, and TCP flags in 38 bytes.
+ */
+static int
+key_ipv6(struct replay_keys *rk, const uint8_t *p, size_t len)
+{
+    addr_t *key;
+    uint8_t *k;
+    size_t off;
+    int nh;
+    int l4;
+
+    if ( sizeof(((addr_t *)0)->a) < 38 ) {
+        /* Not enough key width */
+        return -1;
+    }
+    if ( len < 40 || 6 != (p[0] >> 4) ) {
+        return -1;
+    }
+
+    /* Skip the extension headers */
+    nh = p[6];
+    off = 40;
+    l4 = 1;
+    for ( ;; ) {
+        if ( IPPROTO_HOPOPTS_ == nh || IPPROTO_ROUTING_ == nh
+             || IPPROTO_DSTOPTS_ == nh ) {
+            if ( off + 8 > len ) {
+                return -1;
+            }
+            nh = p[off];
+            off += (p[off + 1] + 1) * 8;
+        } else if ( IPPROTO_FRAGMENT_ == nh ) {
+            if ( off + 8 > len ) {
+                return -1;
+            }
+            if ( rd16be(p + off + 2) & 0xfff8 ) {
+                /* Non-first fragment */
+                l4 = 0;
+            }
+            nh = p[off];
+            off += 8;
+        } else if ( IPPROTO_AH_ == nh ) {
+            if ( off + 8 > len ) {
+                return -1;
+            }
+            nh = p[off];
+            off += (p[off + 1] + 2) * 4;
+        } else {
+            break;
+        }
+    }
+    if ( off > len ) {
+        return -1;
+    }
+
+    key = append_key(rk);
+    if ( NULL == key ) {
+        return -1;
+    }
+    memset(key, 0, sizeof(addr_t));
+    k = (uint8_t *)key->a;
+    k[0] = nh;
+    memcpy(k + 1, p + 8, 16);
+    memcpy(k + 17, p + 24, 16);
+    if ( l4 ) {
+        key_l4(k + 33, nh, p + off, len - off);
+    }
+    rk->nipv6++;
+
+    return 0;
+}
+
+/*
+ * Build a key from an IP packet by the ethertype
+ */
+static int
+key_ip(struct replay_keys *rk, u16 type, const uint8_t *p, size_t len)
+{
+    switch ( type ) {
+    case ETHERTYPE_IPV4:
+        return key_ipv4(rk, p, len);
+    case ETHERTYPE_IPV6:
+        return key_ipv6(rk, p, len);
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Parse a packet of the link-layer header type
+ */
+static void
+parse_packet(struct replay_keys *rk, u32 linktype, const uint8_t *p,
+             size_t len)
+{
+    u32 af;
+    u16 type;
+    int ret;
+
+    rk->npkt++;
+    ret = -1;
+    switch ( linktype ) {
+    case LINKTYPE_NULL:
+    case LINKTYPE_LOOP:
+        if ( len < 4 ) {
+            break;
+        }
+        /* The address family in the host byte order of the capturing host,
+           or in the network byte order for LINKTYPE_LOOP */
+        af = rd32(p, 0);
+        if ( af > 0xffff ) {
+            af = __builtin_bswap32(af);
+        }
+        if ( 2 == af ) {
+            ret = key_ipv4(rk, p + 4, len - 4);
+        } else if ( 24 == af || 28 == af || 30 == af ) {
+            ret = key_ipv6(rk, p + 4, len - 4);
+        }
+        break;
+    case LINKTYPE_EN10MB:
+        if ( len < 14 ) {
+            break;
+        }
+        type = rd16be(p + 12);
+        p += 14;
+        len -= 14;
+        while ( (ETHERTYPE_VLAN == type || ETHERTYPE_QINQ == type)
+                && len >= 4 ) {
+            type = rd16be(p + 2);
+            p += 4;
+            len -= 4;
+        }
+        ret = key_ip(rk, type, p, len);
+        break;
+    case LINKTYPE_RAW_OLD:
+    case LINKTYPE_RAW:
+        if ( len < 1 ) {
+            break;
+        }
+        ret = key_ip(rk, 4 == (p[0] >> 4) ? ETHERTYPE_IPV4 : ETHERTYPE_IPV6,
+                     p, len);
+        break;
+    case LINKTYPE_IPV4:
+        ret = key_ipv4(rk, p, len);
+        break;
+    case LINKTYPE_IPV6:
+        ret = key_ipv6(rk, p, len);
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if ( len < 16 ) {
+            break;
+        }
+        ret = key_ip(rk, rd16be(p + 14), p + 16, len - 16);
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if ( len < 20 ) {
+            break;
+        }
+        ret = key_ip(rk, rd16be(p), p + 20, len - 20);
+        break;
+    default:
+        break;
+    }
+    if ( ret < 0 ) {
+        rk->nskip++;
+    }
+}
+
+/*
+ * Parse a pcap file
+ */
+static int
+parse_pcap(struct replay_keys *rk, const uint8_t *buf, size_t size)
+{
+    size_t off;
+    u32 magic;
+    u32 linktype;
+    u32 caplen;
+    int swap;
+
+    if ( size < 24 ) {
+        return -1;
+    }
+    magic = rd32(buf, 0);
+    if ( PCAP_MAGIC == magic || PCAP_MAGIC_NSEC == magic ) {
+        swap = 0;
+    } else if ( PCAP_MAGIC == __builtin_bswap32(magic)
+                || PCAP_MAGIC_NSEC == __builtin_bswap32(magic) ) {
+        swap = 1;
+    } else {
+        return -1;
+    }
+    /* The upper 16 bits may carry the FCS length */
+    linktype = rd32(buf + 20, swap) & 0x0fffffff;
+
+    for ( off = 24; off + 16 <= size; ) {
+        caplen = rd32(buf + off + 8, swap);
+        off += 16;
+        if ( caplen > size - off ) {
+            /* Truncated */
+            break;
+        }
+        parse_packet(rk, linktype, buf + off, caplen);
+        off += caplen;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse a pcapng file
+ */
+static int
+parse_pcapng(struct replay_keys *rk, const uint8_t *buf, size_t size)
+{
+    u32 linktypes[PCAPNG_MAX_IF];
+    size_t off;
+    u32 type;
+    u32 blen;
+    u32 ifid;
+    u32 caplen;
+    int nif;
+    int swap;
+
+    swap = 0;
+    nif = 0;
+    for ( off = 0; off + 12 <= size; off += blen ) {
+        type = rd32(buf + off, swap);
+        if ( PCAPNG_SHB == type ) {
+            /* New section: detect the byte order */
+            if ( PCAPNG_BOM == rd32(buf + off + 8, 0) ) {
+                swap = 0;
+            } else if ( PCAPNG_BOM == __builtin_bswap32(rd32(buf + off + 8,
+                                                             0)) ) {
+                swap = 1;
+            } else {
+                return -1;
+            }
+            nif = 0;
+        }
+        blen = rd32(buf + off + 4, swap);
+        if ( blen < 12 || (blen & 3) || blen > size - off ) {
+            /* Invalid or truncated block */
+            break;
+        }
+        switch ( type ) {
+        case PCAPNG_IDB:
+            if ( blen >= 20 && nif < PCAPNG_MAX_IF ) {
+                linktypes[nif++] = rd16(buf + off + 8, swap);
+            }
+            break;
+        case PCAPNG_EPB:
+            if ( blen < 32 ) {
+                break;
+            }
+            ifid = rd32(buf + off + 8, swap);
+            caplen = rd32(buf + off + 20, swap);
+            if ( ifid >= (u32)nif || caplen > blen - 32 ) {
+                break;
+            }
+            parse_packet(rk, linktypes[ifid], buf + off + 28, caplen);
+            break;
+        case PCAPNG_SPB:
+            if ( blen < 16 || nif < 1 ) {
+                break;
+            }
+            caplen = rd32(buf + off + 8, swap);
+            if ( caplen > blen - 16 ) {
+                caplen = blen - 16;
+            }
+            parse_packet(rk, linktypes[0], buf + off + 12, caplen);
+            break;
+        default:
+            /* Skip the other blocks */
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Load the keys from a pcap or pcapng file into a contiguous array
+ */
+static int
+load_capture(struct replay_keys *rk, const char *path)
+{
+    struct stat st;
+    uint8_t *buf;
+    int fd;
+    int ret;
+
+    memset(rk, 0, sizeof(struct replay_keys));
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        return -1;
+    }
+    if ( fstat(fd, &st) < 0 || st.st_size < 4 ) {
+        close(fd);
+        return -1;
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( MAP_FAILED == buf ) {
+        return -1;
+    }
+    (void)madvise(buf, st.st_size, MADV_SEQUENTIAL);
+
+    if ( PCAPNG_SHB == rd32(buf, 0) ) {
+        ret = parse_pcapng(rk, buf, st.st_size);
+    } else {
+        ret = parse_pcap(rk, buf, st.st_size);
+    }
+    munmap(buf, st.st_size);
+
+    return ret;
+}
+
+/*
+ * Write the keys as a traffic pattern file
+ */
+static int
+dump_keys(const struct replay_keys *rk, const char *path, int nbytes)
+{
+    const uint8_t *b;
+    FILE *fp;
+    size_t i;
+    int j;
+
+    fp = fopen(path, "w");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    for ( i = 0; i < rk->nr; i++ ) {
+        b = (const uint8_t *)rk->keys[i].a;
+        for ( j = 0; j < nbytes; j++ ) {
+            fprintf(fp, "%02x", b[j]);
+        }
+        fprintf(fp, "\n");
+    }
+
+    return fclose(fp);
+}
+
+/*
+ * Replay the keys through the single-key lookup for the duration
+ */
+static void
+replay_single(struct palmtrie *palmtrie, const struct replay_keys *rk,
+              int duration)
+{
+    double t0;
+    double t1;
+    long long cnt;
+    size_t passes;
+    size_t i;
+    size_t k;
+    u64 x;
+
+    x = 0;
+    cnt = 0;
+    passes = CHECK_INTERVAL / rk->nr + 1;
+    t0 = getmicrotime();
+    do {
+        for ( k = 0; k < passes; k++ ) {
+            for ( i = 0; i < rk->nr; i++ ) {
+                x ^= palmtrie_lookup(palmtrie, rk->keys[i]);
+            }
+        }
+        cnt += rk->nr * passes;
+        t1 = getmicrotime();
+    } while ( t1 - t0 < duration );
+    (void)x;
+
+    printf("single %lld %lf %lf\n", cnt, t1 - t0,
+           cnt / (t1 - t0) / 1000 / 1000);
+}
+
+/*
+ * Replay the keys through the batched lookup for the duration
+ */
+static int
+replay_batch(struct palmtrie *palmtrie, const struct replay_keys *rk,
+             int duration, size_t batch)
+{
+    u64 *results;
+    double t0;
+    double t1;
+    long long cnt;
+    size_t passes;
+    size_t i;
+    size_t k;
+    size_t n;
+    u64 x;
+
+    results = malloc(sizeof(u64) * batch);
+    if ( NULL == results ) {
+        return -1;
+    }
+
+    x = 0;
+    cnt = 0;
+    passes = CHECK_INTERVAL / rk->nr + 1;
+    t0 = getmicrotime();
+    do {
+        for ( k = 0; k < passes; k++ ) {
+            for ( i = 0; i < rk->nr; i += n ) {
+                n = rk->nr - i < batch ? rk->nr - i : batch;
+                palmtrie_lookup_batch(palmtrie, rk->keys + i, results, n);
+                x ^= results[n - 1];
+            }
+        }
+        cnt += rk->nr * passes;
+        t1 = getmicrotime();
+    } while ( t1 - t0 < duration );
+    (void)x;
+
+    printf("batch%zu %lld %lf %lf\n", batch, cnt, t1 - t0,
+           cnt / (t1 - t0) / 1000 / 1000);
+    free(results);
+
+    return 0;
+}
+
+/*
+ * Usage
+ */
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-e <engine>] [-d <seconds>] [-b <batch>] "
+            "[-w <keys-file>] <tcam-file> <capture-file>\n"
+            "\t-e: sl, tpt, mtpt, popmtpt, or auto (default: popmtpt)\n"
+            "\t-d: Duration of each replay (default: %d)\n"
+            "\t-b: Number of keys per batched lookup (default: %d)\n"
+            "\t-w: Write the extracted keys as a traffic pattern file\n",
+            prog, DEFAULT_DURATION, DEFAULT_BATCH);
+}
+
+/*
+ * Main routine for the pcap replay
+ */
+int
+main(int argc, char *const argv[])
+{
+    struct replay_keys rk;
+    struct palmtrie palmtrie;
+    enum palmtrie_type type;
+    const char *engine;
+    const char *wfname;
+    double t0;
+    double t1;
+    int duration;
+    int batch;
+    int ch;
+
+    engine = "popmtpt";
+    wfname = NULL;
+    duration = DEFAULT_DURATION;
+    batch = DEFAULT_BATCH;
+    while ( -1 != (ch = getopt(argc, argv, "e:d:b:w:")) ) {
+        switch ( ch ) {
+        case 'e':
+            engine = optarg;
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'b':
+            batch = atoi(optarg);
+            break;
+        case 'w':
+            wfname = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( argc - optind != 2 || duration <= 0 || batch <= 0 ) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ( 0 == strcmp(engine, "sl") ) {
+        type = PALMTRIE_SORTED_LIST;
+    } else if ( 0 == strcmp(engine, "tpt") ) {
+        type = PALMTRIE_BASIC;
+    } else if ( 0 == strcmp(engine, "mtpt") ) {
+        type = PALMTRIE_DEFAULT;
+    } else if ( 0 == strcmp(engine, "popmtpt") ) {
+        type = PALMTRIE_PLUS;
+    } else if ( 0 == strcmp(engine, "auto") ) {
+        type = PALMTRIE_AUTO;
+    } else if ( 0 == strcmp(engine, "part") ) {
+        type = PALMTRIE_PARTITION;
+    } else {
+        fprintf(stderr, "Invalid engine: %s\n", engine);
+        return EXIT_FAILURE;
+    }
+
+    /* Preload the keys */
+    t0 = getmicrotime();
+    if ( load_capture(&rk, argv[optind + 1]) < 0 ) {
+        fprintf(stderr, "Failed to load %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+    t1 = getmicrotime();
+    printf("#capture %lf packets %zu ipv4 %zu ipv6 %zu skipped %zu\n",
+           t1 - t0, rk.npkt, rk.nipv4, rk.nipv6, rk.nskip);
+    if ( NULL != wfname ) {
+        if ( dump_keys(&rk, wfname, rk.nipv6 ? 38 : 16) < 0 ) {
+            fprintf(stderr, "Failed to write %s\n", wfname);
+            free(rk.keys);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( 0 == rk.nr ) {
+        fprintf(stderr, "No IPv4/IPv6 packets in %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    /* Build */
+    if ( NULL == palmtrie_init(&palmtrie, type, 0) ) {
+        free(rk.keys);
+        return EXIT_FAILURE;
+    }
+    t0 = getmicrotime();
+    if ( palmtrie_load_tcam(&palmtrie, argv[optind], 0) < 0
+         || palmtrie_commit(&palmtrie) < 0 ) {
+        fprintf(stderr, "Failed to load %s\n", argv[optind]);
+        free(rk.keys);
+        return EXIT_FAILURE;
+    }
+    t1 = getmicrotime();
+    printf("#build %lf\n", t1 - t0);
+
+    /* Replay */
+    printf("#mode lookups seconds Mlookup/sec\n");
+    replay_single(&palmtrie, &rk, duration);
+    if ( replay_batch(&palmtrie, &rk, duration, batch) < 0 ) {
+        free(rk.keys);
+        return EXIT_FAILURE;
+    }
+
+    free(rk.keys);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
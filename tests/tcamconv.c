@@ -0,0 +1,86 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "../palmtrie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Usage
+ */
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t] [-c] [-r] <input> <output>\n"
+            "\t-t: Write the text format instead of the binary format\n"
+            "\t-c: Omit the wildcard words in the binary format\n"
+            "\t-r: Keys in the text format are from the most significant "
+            "nibble\n", prog);
+}
+
+/*
+ * Convert a ternary matching table file between the text and binary formats
+ */
+int
+main(int argc, char *const argv[])
+{
+    struct palmtrie_ruleset rs;
+    int flags;
+    int text;
+    int ch;
+
+    text = 0;
+    flags = PALMTRIE_TCAM_BINARY;
+    while ( -1 != (ch = getopt(argc, argv, "tcr")) ) {
+        switch ( ch ) {
+        case 't':
+            text = 1;
+            break;
+        case 'c':
+            flags |= PALMTRIE_TCAM_COMPACT;
+            break;
+        case 'r':
+            flags |= PALMTRIE_TCAM_REVERSE;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( argc - optind != 2 ) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ( text ) {
+        flags &= ~(PALMTRIE_TCAM_BINARY | PALMTRIE_TCAM_COMPACT);
+    }
+
+    /* The input format is detected from the file */
+    if ( palmtrie_ruleset_load(&rs, argv[optind],
+                               flags & PALMTRIE_TCAM_REVERSE) < 0 ) {
+        fprintf(stderr, "Failed to load %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if ( palmtrie_ruleset_save(&rs, argv[optind + 1], flags) < 0 ) {
+        fprintf(stderr, "Failed to save %s\n", argv[optind + 1]);
+        palmtrie_ruleset_release(&rs);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "%zu rules (%d-bit keys)\n", rs.nr, rs.keybits);
+    palmtrie_ruleset_release(&rs);
+
+    return 0;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -56,6 +56,106 @@ palmtrie_tpt_release(struct palmtrie *palmtrie)
     return 0;
 }
 
+/*
+ * Recursively count the memory size of the node in a tree
+ */
+static size_t
+_node_memory(struct palmtrie_tpt_node *n)
+{
+    size_t sz;
+
+    if ( NULL == n ) {
+        return 0;
+    }
+
+    sz = sizeof(struct palmtrie_tpt_node);
+    if ( NULL != n->left && n->bit > n->left->bit ) {
+        sz += _node_memory(n->left);
+    }
+    if ( NULL != n->center && n->bit > n->center->bit ) {
+        sz += _node_memory(n->center);
+    }
+    if ( NULL != n->right && n->bit > n->right->bit ) {
+        sz += _node_memory(n->right);
+    }
+
+    return sz;
+}
+
+/*
+ * Memory size of the instance in bytes
+ */
+size_t
+palmtrie_tpt_memory(struct palmtrie *palmtrie)
+{
+    return _node_memory(palmtrie->u.tpt.root);
+}
+
+/*
+ * Recursively collect the statistics of the node at the depth; a child of a
+ * higher bit than the node is a reference to a leaf
+ */
+static void
+_node_stats(struct palmtrie_tpt_node *n, int depth,
+            struct palmtrie_stats *stats)
+{
+    struct palmtrie_tpt_node *slots[3];
+    int nodes;
+    int leaves;
+    int i;
+
+    stats->rules++;
+    stats->inodes++;
+    slots[0] = n->left;
+    slots[1] = n->right;
+    slots[2] = n->center;
+    nodes = 0;
+    leaves = 0;
+    for ( i = 0; i < 3; i++ ) {
+        if ( NULL == slots[i] ) {
+            continue;
+        }
+        if ( 2 == i ) {
+            stats->ternaries++;
+        } else {
+            stats->children++;
+        }
+        if ( n->bit > slots[i]->bit ) {
+            nodes++;
+            _node_stats(slots[i], depth + 1, stats);
+        } else {
+            leaves++;
+            stats->leaves++;
+            stats->avg_depth += depth;
+            if ( depth > stats->max_depth ) {
+                stats->max_depth = depth;
+            }
+        }
+    }
+    if ( 0 == nodes && 1 == leaves ) {
+        stats->compressible++;
+    }
+}
+
+/*
+ * Statistics of the instance
+ */
+void
+palmtrie_tpt_stats(struct palmtrie *palmtrie, struct palmtrie_stats *stats)
+{
+    if ( NULL == palmtrie->u.tpt.root ) {
+        return;
+    }
+    _node_stats(palmtrie->u.tpt.root, 1, stats);
+    stats->inode_bytes = palmtrie_tpt_memory(palmtrie);
+    if ( stats->leaves > stats->rules ) {
+        stats->duplicates = stats->leaves - stats->rules;
+    }
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
 /*
  * Add a leaf to the trie
  */
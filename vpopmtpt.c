@@ -0,0 +1,648 @@
+/*_
+ * Copyright (c) 2019-2020 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ */
+
+#include "palmtrie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* 64-bit popcnt intrinsic.  To use popcnt instruction in x86-64, the "-mpopcnt"
+   option must be specified in CFLAGS. */
+#define popcnt(v)               __builtin_popcountll(v)
+
+#define _STACK_DEPTH    PALMTRIE_STACK_DEPTH
+
+#define _NWORDS         (int)(sizeof(((addr_t *)0)->a) / sizeof(u64))
+#define _BITMAP_WORDS(s)    ((s) <= 6 ? 1 : 1 << ((s) - 6))
+
+/* Cost model of the stride selection: the cost of a node visit in bit probes,
+   and the cost of a cache line of the bitmaps amortized by the rules */
+#define _COST_NODE      8.0
+#define _COST_LINE      1.0
+
+/*
+ * Allocate nodes
+ */
+static int64_t
+_alloc_nodes(struct palmtrie_vpopmtpt *t, uint32_t n)
+{
+    struct palmtrie_vpopmtpt_node *ptr;
+    uint32_t nr;
+    uint32_t idx;
+
+    if ( t->nodes.used + n > t->nodes.nr ) {
+        nr = t->nodes.nr ? t->nodes.nr : 1024;
+        while ( t->nodes.used + n > nr ) {
+            nr *= 2;
+        }
+        ptr = realloc(t->nodes.ptr,
+                      sizeof(struct palmtrie_vpopmtpt_node) * nr);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->nodes.ptr = ptr;
+        t->nodes.nr = nr;
+    }
+    idx = t->nodes.used;
+    t->nodes.used += n;
+
+    return idx;
+}
+
+/*
+ * Allocate bitmap words
+ */
+static int64_t
+_alloc_words(struct palmtrie_vpopmtpt *t, uint32_t n)
+{
+    struct palmtrie_vpopmtpt_word *ptr;
+    uint32_t nr;
+    uint32_t idx;
+
+    if ( t->words.used + n > t->words.nr ) {
+        nr = t->words.nr ? t->words.nr : 1024;
+        while ( t->words.used + n > nr ) {
+            nr *= 2;
+        }
+        ptr = realloc(t->words.ptr,
+                      sizeof(struct palmtrie_vpopmtpt_word) * nr);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->words.ptr = ptr;
+        t->words.nr = nr;
+    }
+    idx = t->words.used;
+    memset(&t->words.ptr[idx], 0, sizeof(struct palmtrie_vpopmtpt_word) * n);
+    t->words.used += n;
+
+    return idx;
+}
+
+/*
+ * Slot of a rule in the node of the stride s at the bit nb, and the next bit
+ * to inspect for the rule.  The ternary slots come first, followed by the
+ * children slots.
+ */
+static __inline__ int
+_slot(struct palmtrie_rule *r, int nb, int s, int *next)
+{
+    int a;
+    int m;
+    int i;
+
+    a = EXTRACTN(r->addr, nb, s);
+    m = EXTRACTN(r->mask, nb, s);
+    if ( 0 == m ) {
+        /* Child */
+        *next = nb - 1;
+        return (1 << s) - 1 + a;
+    }
+    /* Ternary with the first dc bit at the i-th bit from the top */
+    i = s - (31 - __builtin_clz(m));
+    *next = nb + s - 1 - i;
+
+    return ((a >> (s - i + 1)) | (1 << (i - 1))) - 1;
+}
+
+/*
+ * The most significant bit at or below cbit where the rules differ, or -1 if
+ * all the rules are the same.  A bit that is don't care in all the rules is
+ * the same, hence the runs of the wildcard bits are skipped as well.
+ */
+static int
+_diff_bit(struct palmtrie_rule **rules, size_t n, int cbit)
+{
+    u64 diff[_NWORDS];
+    size_t i;
+    int j;
+    int b;
+
+    memset(diff, 0, sizeof(diff));
+    for ( i = 0; i < n; i++ ) {
+        for ( j = 0; j < _NWORDS; j++ ) {
+            diff[j] |= (rules[i]->mask.a[j] ^ rules[0]->mask.a[j])
+                | ((rules[i]->addr.a[j] ^ rules[0]->addr.a[j])
+                   & ~rules[i]->mask.a[j] & ~rules[0]->mask.a[j]);
+        }
+    }
+    for ( b = cbit; b >= 0; b-- ) {
+        if ( (diff[b >> 6] >> (b & 0x3f)) & 1 ) {
+            return b;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Choose the stride of the node at cbit by the expected number of bit probes
+ * per inspected bit.  Wide strides pay off when the rules are specified
+ * through the window, whereas the ternary-heavy rules consume a few bits
+ * whatever the stride is.
+ */
+static int
+_choose_stride(struct palmtrie_rule **rules, size_t n, int cbit)
+{
+    double cost;
+    double best;
+    double consumed;
+    size_t i;
+    int smin;
+    int smax;
+    int next;
+    int bs;
+    int s;
+
+    smax = cbit + 1 < PALMTRIE_VSTRIDE_MAX ? cbit + 1 : PALMTRIE_VSTRIDE_MAX;
+    smin = smax < PALMTRIE_VSTRIDE_MIN ? smax : PALMTRIE_VSTRIDE_MIN;
+    best = -1;
+    bs = smax;
+    for ( s = smin; s <= smax; s++ ) {
+        consumed = 0;
+        for ( i = 0; i < n; i++ ) {
+            (void)_slot(rules[i], cbit - s + 1, s, &next);
+            consumed += cbit - next;
+        }
+        cost = (_COST_NODE + s + 1) / (consumed / n)
+            + _COST_LINE * (_BITMAP_WORDS(s) * 2
+                            * sizeof(struct palmtrie_vpopmtpt_word) / 64.0) / n;
+        if ( best < 0 || cost < best ) {
+            best = cost;
+            bs = s;
+        }
+    }
+
+    return bs;
+}
+
+/*
+ * Make a leaf of the rule with the highest priority; the others are the
+ * duplicates of the same addr/mask
+ */
+static void
+_leaf(struct palmtrie_vpopmtpt *t, uint32_t ni, struct palmtrie_rule **rules,
+      size_t n)
+{
+    struct palmtrie_vpopmtpt_node *node;
+    struct palmtrie_rule *r;
+    size_t i;
+    int j;
+
+    r = rules[0];
+    for ( i = 1; i < n; i++ ) {
+        if ( rules[i]->priority > r->priority ) {
+            r = rules[i];
+        }
+    }
+    node = &t->nodes.ptr[ni];
+    node->bit = -1;
+    node->stride = 0;
+    node->u.leaf.priority = r->priority;
+    node->u.leaf.addr = r->addr;
+    node->u.leaf.mask = r->mask;
+    for ( j = 0; j < _NWORDS; j++ ) {
+        /* Clear the dc bits for the comparison in the lookup */
+        node->u.leaf.addr.a[j] &= ~r->mask.a[j];
+    }
+    node->u.leaf.data = (void *)r->data;
+}
+
+/*
+ * Build the node ni for the rules from the bit cbit
+ */
+static int
+_build(struct palmtrie_vpopmtpt *t, uint32_t ni, struct palmtrie_rule **rules,
+       struct palmtrie_rule **tmp, size_t n, int cbit)
+{
+    struct palmtrie_vpopmtpt_node *node;
+    struct palmtrie_vpopmtpt_word *w;
+    uint32_t *cnt;
+    int64_t words;
+    int64_t cbase;
+    int64_t tbase;
+    uint32_t nc;
+    uint32_t nt;
+    int32_t maxp;
+    size_t i;
+    size_t off;
+    int nslots;
+    int nw;
+    int nb;
+    int next;
+    int slot;
+    int s;
+
+    if ( n > 1 ) {
+        /* Skip the bits that are the same in all the rules */
+        cbit = _diff_bit(rules, n, cbit);
+    }
+    if ( n <= 1 || cbit < 0 ) {
+        _leaf(t, ni, rules, n);
+        return 0;
+    }
+
+    s = _choose_stride(rules, n, cbit);
+    nb = cbit - s + 1;
+    nw = _BITMAP_WORDS(s);
+    nslots = (1 << (s + 1)) - 1;
+
+    /* Sort the rules by the slot */
+    cnt = calloc(nslots + 1, sizeof(uint32_t));
+    if ( NULL == cnt ) {
+        return -1;
+    }
+    maxp = rules[0]->priority;
+    for ( i = 0; i < n; i++ ) {
+        cnt[_slot(rules[i], nb, s, &next) + 1]++;
+        if ( rules[i]->priority > maxp ) {
+            maxp = rules[i]->priority;
+        }
+    }
+    nt = 0;
+    nc = 0;
+    for ( slot = 0; slot < nslots; slot++ ) {
+        if ( cnt[slot + 1] ) {
+            if ( slot < (1 << s) - 1 ) {
+                nt++;
+            } else {
+                nc++;
+            }
+        }
+        cnt[slot + 1] += cnt[slot];
+    }
+    for ( i = 0; i < n; i++ ) {
+        tmp[cnt[_slot(rules[i], nb, s, &next)]++] = rules[i];
+    }
+    memcpy(rules, tmp, sizeof(struct palmtrie_rule *) * n);
+
+    /* Allocate the bitmaps and the descendant nodes */
+    words = _alloc_words(t, 2 * nw);
+    cbase = _alloc_nodes(t, nc);
+    tbase = _alloc_nodes(t, nt);
+    if ( words < 0 || cbase < 0 || tbase < 0 ) {
+        free(cnt);
+        return -1;
+    }
+    node = &t->nodes.ptr[ni];
+    node->bit = nb;
+    node->stride = s;
+    node->u.inode.max_priority = maxp;
+    node->u.inode.words = words;
+    t->strides[s]++;
+
+    /* Bitmaps: cnt[slot] is the end of the rules of the slot after sort */
+    w = &t->words.ptr[words];
+    off = 0;
+    nc = 0;
+    nt = 0;
+    for ( slot = 0; slot < nslots; slot++ ) {
+        if ( cnt[slot] == off ) {
+            continue;
+        }
+        off = cnt[slot];
+        if ( slot < (1 << s) - 1 ) {
+            if ( 0 == w[nw + (slot >> 6)].bitmap ) {
+                w[nw + (slot >> 6)].base = tbase + nt;
+            }
+            w[nw + (slot >> 6)].bitmap |= 1ULL << (slot & 0x3f);
+            nt++;
+        } else {
+            i = slot - ((1 << s) - 1);
+            if ( 0 == w[i >> 6].bitmap ) {
+                w[i >> 6].base = cbase + nc;
+            }
+            w[i >> 6].bitmap |= 1ULL << (i & 0x3f);
+            nc++;
+        }
+    }
+
+    /* Build the descendant nodes */
+    off = 0;
+    nc = 0;
+    nt = 0;
+    for ( slot = 0; slot < nslots; slot++ ) {
+        if ( cnt[slot] == off ) {
+            continue;
+        }
+        (void)_slot(rules[off], nb, s, &next);
+        if ( slot < (1 << s) - 1 ) {
+            ni = tbase + nt++;
+        } else {
+            ni = cbase + nc++;
+        }
+        if ( _build(t, ni, rules + off, tmp + off, cnt[slot] - off,
+                    next) < 0 ) {
+            free(cnt);
+            return -1;
+        }
+        off = cnt[slot];
+    }
+    free(cnt);
+
+    return 0;
+}
+
+/*
+ * Release the compiled trie
+ */
+static void
+_release_nodes(struct palmtrie_vpopmtpt *t)
+{
+    free(t->nodes.ptr);
+    t->nodes.ptr = NULL;
+    t->nodes.nr = 0;
+    t->nodes.used = 0;
+    free(t->words.ptr);
+    t->words.ptr = NULL;
+    t->words.nr = 0;
+    t->words.used = 0;
+    memset(t->strides, 0, sizeof(t->strides));
+}
+
+/*
+ * Push the descendant node of the slot if any
+ */
+#define _PUSH(t, w, slot, ptrs, nr) do {                                \
+        if ( (w)[(slot) >> 6].bitmap & (1ULL << ((slot) & 0x3f)) ) {   \
+            (ptrs)[(nr)] = &(t)->nodes.ptr[(w)[(slot) >> 6].base        \
+                + popcnt((w)[(slot) >> 6].bitmap                        \
+                         & ((1ULL << ((slot) & 0x3f)) - 1))];           \
+            __builtin_prefetch((ptrs)[(nr)], 0, 3);                     \
+            (nr)++;                                                     \
+        }                                                               \
+    } while ( 0 )
+
+/*
+ * Lookup an entry corresponding to the specified address
+ */
+void *
+palmtrie_vpopmtpt_lookup(struct palmtrie_vpopmtpt *t, addr_t addr)
+{
+    int priority;
+
+    priority = -1;
+    return palmtrie_vpopmtpt_lookup_above(t, addr, &priority, NULL);
+}
+
+/*
+ * Lookup an entry of a higher priority than the specified priority, and
+ * return the specified data if there is no such entry.  The priority is
+ * updated to the one of the returned data.
+ */
+void *
+palmtrie_vpopmtpt_lookup_above(struct palmtrie_vpopmtpt *t, addr_t addr,
+                               int *priority, void *data)
+{
+    return palmtrie_vpopmtpt_lookup_above_ref(t, &addr, priority, data, NULL);
+}
+
+/*
+ * Lookup an entry of a higher priority than the specified priority by the
+ * reference to the address, with the traversal stack of PALMTRIE_STACK_DEPTH
+ * entries preallocated by the caller, or on the stack if it is NULL
+ */
+void *
+palmtrie_vpopmtpt_lookup_above_ref(struct palmtrie_vpopmtpt *t,
+                                   const addr_t *addr, int *priority,
+                                   void *data, void **stack)
+{
+    void *local[_STACK_DEPTH];
+    void **ptrs;
+    struct palmtrie_vpopmtpt_node *node;
+    struct palmtrie_vpopmtpt_word *w;
+    int sidx;
+    int idx;
+    int tmp;
+    int nr;
+    int best;
+    int s;
+    int i;
+
+    if ( __builtin_expect(!!(0 == t->nodes.used), 0) ) {
+        return data;
+    }
+
+    ptrs = NULL != stack ? stack : local;
+    best = *priority;
+    nr = 0;
+    ptrs[nr++] = &t->nodes.ptr[0];
+    while ( nr > 0 ) {
+        node = ptrs[--nr];
+
+        if ( 0 == node->stride ) {
+            /* Leaf */
+            if ( node->u.leaf.priority > best
+                 && ADDR_MASK_CMP2(*addr, node->u.leaf.mask,
+                                   node->u.leaf.addr) ) {
+                best = node->u.leaf.priority;
+                data = node->u.leaf.data;
+            }
+            continue;
+        }
+
+#if PALMTRIE_PRIORITY_SKIP
+        if ( best >= node->u.inode.max_priority ) {
+            continue;
+        }
+#endif
+        if ( __builtin_expect(!!(nr + PALMTRIE_VSTRIDE_MAX + 1 > _STACK_DEPTH),
+                              0) ) {
+            fprintf(stderr, "Fatal error: Stack overflow\n");
+            break;
+        }
+
+        s = node->stride;
+        w = &t->words.ptr[node->u.inode.words];
+        sidx = EXTRACTN(*addr, node->bit, s);
+
+        /* Ternaries from the shortest prefix, then the child on top of the
+           stack */
+        idx = (sidx >> 1) | (1 << (s - 1));
+        for ( i = s - 1; i >= 0; i-- ) {
+            tmp = (idx >> i) - 1;
+            _PUSH(t, w + _BITMAP_WORDS(s), tmp, ptrs, nr);
+        }
+        _PUSH(t, w, sidx, ptrs, nr);
+    }
+    *priority = best;
+
+    return data;
+}
+
+/*
+ * Add an entry; the trie is compiled at commit
+ */
+int
+palmtrie_vpopmtpt_add(struct palmtrie_vpopmtpt *t, addr_t addr, addr_t mask,
+                      int priority, void *data)
+{
+    struct palmtrie_rule *ptr;
+    size_t size;
+
+    if ( t->rules.nr >= t->rules.size ) {
+        size = t->rules.size ? t->rules.size * 2 : 1024;
+        ptr = realloc(t->rules.ptr, sizeof(struct palmtrie_rule) * size);
+        if ( NULL == ptr ) {
+            return -1;
+        }
+        t->rules.ptr = ptr;
+        t->rules.size = size;
+    }
+    t->rules.ptr[t->rules.nr].addr = addr;
+    t->rules.ptr[t->rules.nr].mask = mask;
+    t->rules.ptr[t->rules.nr].priority = priority;
+    t->rules.ptr[t->rules.nr].data = (u64)data;
+    t->rules.nr++;
+
+    return 0;
+}
+
+/*
+ * Compile the trie choosing the stride of each node
+ */
+int
+palmtrie_vpopmtpt_commit(struct palmtrie_vpopmtpt *t)
+{
+    struct palmtrie_rule **rules;
+    struct palmtrie_rule **tmp;
+    size_t i;
+    int ret;
+
+    _release_nodes(t);
+    if ( 0 == t->rules.nr ) {
+        return 0;
+    }
+
+    rules = malloc(sizeof(struct palmtrie_rule *) * t->rules.nr * 2);
+    if ( NULL == rules ) {
+        return -1;
+    }
+    tmp = rules + t->rules.nr;
+    for ( i = 0; i < t->rules.nr; i++ ) {
+        rules[i] = &t->rules.ptr[i];
+    }
+    ret = -1;
+    if ( _alloc_nodes(t, 1) >= 0 ) {
+        ret = _build(t, 0, rules, tmp, t->rules.nr, _NWORDS * 64 - 1);
+    }
+    free(rules);
+    if ( ret < 0 ) {
+        _release_nodes(t);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Release the instance
+ */
+int
+palmtrie_vpopmtpt_release(struct palmtrie_vpopmtpt *t)
+{
+    _release_nodes(t);
+    free(t->rules.ptr);
+    t->rules.ptr = NULL;
+    t->rules.nr = 0;
+    t->rules.size = 0;
+
+    return 0;
+}
+
+/*
+ * Memory size of the instance in bytes
+ */
+size_t
+palmtrie_vpopmtpt_memory(struct palmtrie_vpopmtpt *t)
+{
+    return sizeof(struct palmtrie_vpopmtpt_node) * t->nodes.used
+        + sizeof(struct palmtrie_vpopmtpt_word) * t->words.used
+        + sizeof(struct palmtrie_rule) * t->rules.nr;
+}
+
+/*
+ * Statistics of the instance; the rules are kept for the rebuild at commit,
+ * and the descendants of a node follow the node in the node array
+ */
+void
+palmtrie_vpopmtpt_stats(struct palmtrie_vpopmtpt *t,
+                        struct palmtrie_stats *stats)
+{
+    struct palmtrie_vpopmtpt_node *node;
+    struct palmtrie_vpopmtpt_word *w;
+    int *depth;
+    uint32_t i;
+    int nw;
+    int slots;
+    int leaves;
+    int j;
+    int k;
+
+    stats->rules = t->rules.nr;
+    stats->build_bytes = sizeof(struct palmtrie_rule) * t->rules.nr;
+    if ( 0 == t->nodes.used ) {
+        return;
+    }
+    depth = calloc(t->nodes.used, sizeof(int));
+    if ( NULL == depth ) {
+        return;
+    }
+    depth[0] = 1;
+    for ( i = 0; i < t->nodes.used; i++ ) {
+        node = &t->nodes.ptr[i];
+        if ( 0 == node->stride ) {
+            /* The depth of a leaf is of its parent */
+            stats->leaves++;
+            stats->avg_depth += depth[i] - 1;
+            if ( depth[i] - 1 > stats->max_depth ) {
+                stats->max_depth = depth[i] - 1;
+            }
+            continue;
+        }
+        stats->inodes++;
+        nw = _BITMAP_WORDS(node->stride);
+        w = &t->words.ptr[node->u.inode.words];
+        slots = 0;
+        leaves = 0;
+        for ( j = 0; j < 2 * nw; j++ ) {
+            for ( k = 0; k < popcnt(w[j].bitmap); k++ ) {
+                depth[w[j].base + k] = depth[i] + 1;
+                if ( 0 == t->nodes.ptr[w[j].base + k].stride ) {
+                    leaves++;
+                }
+                slots++;
+            }
+            if ( j < nw ) {
+                stats->children += popcnt(w[j].bitmap);
+            } else {
+                stats->ternaries += popcnt(w[j].bitmap);
+            }
+        }
+        if ( 1 == slots && 1 == leaves ) {
+            stats->compressible++;
+        }
+    }
+    free(depth);
+
+    stats->inode_bytes = sizeof(struct palmtrie_vpopmtpt_node) * stats->inodes
+        + sizeof(struct palmtrie_vpopmtpt_word) * t->words.used;
+    stats->leaf_bytes = sizeof(struct palmtrie_vpopmtpt_node) * stats->leaves;
+    if ( stats->leaves > stats->rules ) {
+        stats->duplicates = stats->leaves - stats->rules;
+    }
+    if ( stats->leaves ) {
+        stats->avg_depth /= stats->leaves;
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */